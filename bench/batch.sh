@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+# Scripts per second for many small scripts, run once per process the way a
+# pipeline would and then all at once with --batch on 1 thread and on one
+# per core. The gap is what process startup and setup costs per script.
+# Usage: bench/batch.sh [path/to/pepper] [scripts]
+PEPPER=${1:-./bin/pepper}
+SCRIPTS=${2:-500}
+CORES=$(getconf _NPROCESSORS_ONLN 2> /dev/null || echo 1)
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+for i in $(seq 1 "$SCRIPTS"); do
+    cat > "$DIR/$(printf '%05d' "$i").pepr" << EOF
+fn fib(n) {
+    if (n < 2) { return n. }
+    return fib(n - 1) + fib(n - 2).
+}
+total := 0.
+for (i := 0; i < $((i % 50))) |i++| {
+    total = total + i.
+}
+print fib($((i % 15))) + total.
+EOF
+done
+
+now() {
+    date +%s.%N
+}
+
+report() {
+    echo "$1 $SCRIPTS $2 $3" | awk '{ printf "%-20s %8.1f scripts/s\n", $1, $2 / ($4 - $3) }'
+}
+
+start=$(now)
+for script in "$DIR"/*.pepr; do
+    "$PEPPER" "$script" > /dev/null
+done
+report "process-per-script" "$start" "$(now)"
+
+start=$(now)
+"$PEPPER" --batch "$DIR" --threads 1 > /dev/null 2>&1
+report "batch-1-thread" "$start" "$(now)"
+
+start=$(now)
+"$PEPPER" --batch "$DIR" --threads "$CORES" > /dev/null 2>&1
+report "batch-$CORES-threads" "$start" "$(now)"
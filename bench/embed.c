@@ -0,0 +1,153 @@
+// Evaluations per second through the embedding API. An evaluation runs a
+// small script's top level and then calls one of its functions, the way a
+// service would evaluate a rule. Each mode shares more than the last:
+//
+//   compile   compiles, instantiates and frees everything every time
+//   vm        compiles once, but creates and frees a VM every time
+//   pool      compiles once and reuses VMs from a pool
+//
+// A counting allocator is installed through pepper_set_allocator, so the
+// allocations each evaluation makes are reported as well.
+// Usage: make bench-embed [ARGS="<evaluations> <threads>"]
+#define _DEFAULT_SOURCE 1
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pepper.h"
+
+static const char* source =
+    "limit := 10.\n"
+    "fn score(x: Int, y: Int) Int {\n"
+    "    total := 0.\n"
+    "    for (i := 0; i < limit) |i++| {\n"
+    "        total = total + x * i - y.\n"
+    "    }\n"
+    "    return total.\n"
+    "}\n";
+
+typedef enum {
+    MODE_COMPILE,
+    MODE_VM,
+    MODE_POOL,
+} Mode;
+
+typedef struct {
+    Mode mode;
+    PepperScript* script;
+    PepperPool* pool;
+    uint64_t evaluations;
+    int64_t seed;
+} Worker;
+
+static uint64_t allocations = 0;
+
+static void* counting_reallocate(void* pointer, size_t old_size, size_t new_size, void* user_data) {
+    (void)old_size;
+    (void)user_data;
+    if (new_size == 0) {
+        free(pointer);
+        return NULL;
+    }
+    if (pointer == NULL) __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return realloc(pointer, new_size);
+}
+
+static void fail(const char* what, const char* message) {
+    fprintf(stderr, "%s failed: %s\n", what, message);
+    exit(1);
+}
+
+static void evaluate(PepperVM* vm, int64_t x) {
+    if (pepper_run(vm) != PEPPER_OK) fail("run", pepper_error(vm));
+    PepperValue arguments[2] = {
+        {.type = PEPPER_INT, .as.integer = x},
+        {.type = PEPPER_INT, .as.integer = 3},
+    };
+    PepperValue result;
+    if (pepper_call(vm, "score", arguments, 2, &result) != PEPPER_OK) fail("call", pepper_error(vm));
+    if (result.type != PEPPER_INT || result.as.integer != 45 * x - 30) fail("call", "wrong result");
+}
+
+static void* run_worker(void* argument) {
+    Worker* worker = (Worker*)argument;
+    for (uint64_t i = 0; i < worker->evaluations; i++) {
+        int64_t x = worker->seed + (int64_t)i;
+        switch (worker->mode) {
+            case MODE_COMPILE: {
+                PepperScript* script;
+                char error[256];
+                if (pepper_compile(source, &script, error, sizeof(error)) != PEPPER_OK) fail("compile", error);
+                PepperVM* vm = pepper_instantiate(script);
+                evaluate(vm, x);
+                pepper_free_vm(vm);
+                pepper_free_script(script);
+                break;
+            }
+            case MODE_VM: {
+                PepperVM* vm = pepper_instantiate(worker->script);
+                evaluate(vm, x);
+                pepper_free_vm(vm);
+                break;
+            }
+            case MODE_POOL: {
+                PepperVM* vm = pepper_acquire(worker->pool);
+                evaluate(vm, x);
+                pepper_release(worker->pool, vm);
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static double seconds_since(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void measure(const char* name, Mode mode, PepperScript* script, uint64_t evaluations, uint32_t threads) {
+    PepperPool* pool = mode == MODE_POOL ? pepper_create_pool(script, threads) : NULL;
+    pthread_t* handles = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    Worker* workers = (Worker*)malloc(sizeof(Worker) * threads);
+    uint64_t allocations_before = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < threads; i++) {
+        workers[i] = (Worker){mode, script, pool, evaluations / threads + (i < evaluations % threads ? 1 : 0),
+                              (int64_t)i * 1000};
+        if (pthread_create(&handles[i], NULL, run_worker, &workers[i]) != 0) fail("pthread_create", "no thread");
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    double elapsed = seconds_since(&start);
+    uint64_t allocated = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - allocations_before;
+    printf("%-8s %10.0f evals/s %8.2f allocations/eval\n", name, (double)evaluations / elapsed,
+           (double)allocated / (double)evaluations);
+    free(workers);
+    free(handles);
+    if (pool != NULL) pepper_free_pool(pool);
+}
+
+int main(int argc, const char* argv[]) {
+    long evaluations = argc > 1 ? strtol(argv[1], NULL, 10) : 20000;
+    long threads = argc > 2 ? strtol(argv[2], NULL, 10) : 1;
+    if (evaluations <= 0 || threads <= 0 || threads > 1024) {
+        fprintf(stderr, "Usage: embed-bench [evaluations] [threads]\n");
+        return 64;
+    }
+    pepper_set_allocator(counting_reallocate, NULL);
+
+    PepperScript* script;
+    char error[256];
+    if (pepper_compile(source, &script, error, sizeof(error)) != PEPPER_OK) fail("compile", error);
+    printf("%ld evaluations on %ld threads\n", evaluations, threads);
+    measure("compile", MODE_COMPILE, script, (uint64_t)evaluations, (uint32_t)threads);
+    measure("vm", MODE_VM, script, (uint64_t)evaluations, (uint32_t)threads);
+    measure("pool", MODE_POOL, script, (uint64_t)evaluations, (uint32_t)threads);
+    pepper_free_script(script);
+    return 0;
+}
@@ -0,0 +1,117 @@
+// Objects marked per second by the collector on a big synthetic heap, with
+// 1 marker thread and then 2, 4 and so on up to the number of cores. The
+// heap is a balanced tree of ropes, 2^depth - 1 of them over one shared
+// string, built the way concatenation builds them and kept alive from the
+// VM's stack. One marker marks incrementally, a slice at a time, as a VM
+// does by default; more mark in parallel, which should scale with the cores
+// until memory bandwidth runs out.
+// Usage: make bench-mark [ARGS="<depth> <runs> <most threads>"]
+#define _DEFAULT_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "bytecode_generator.h"
+#include "vm.h"
+
+static f64 now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (f64)time.tv_sec * 1e9 + (f64)time.tv_nsec;
+}
+
+static void fail(const char* message) {
+    fprintf(stderr, "mark-bench: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+static ByteCode* compile_source(const char* source) {
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    Parser* parser = init_parser(lexer);
+    parser->error_output = NULL;
+    Program* program = parse_program(parser);
+    if (parser->has_error || parser->panic_mode) fail(parser->error);
+    ByteCode* byte_code = generate_bytecode(program);
+    if (byte_code->has_error) fail(byte_code->error);
+    de_init_program(program);
+    de_init_parser(parser);
+    return byte_code;
+}
+
+// Leaves the tree on top of the stack. The string every leaf rope points at
+// is in the bottom slot, since collecting moves it.
+static void build_tree(VM* vm, u32 depth) {
+    if (depth == 0) {
+        *vm->stack_top++ = vm->stack[0];
+        return;
+    }
+    build_tree(vm, depth - 1);
+    build_tree(vm, depth - 1);
+    ObjRope* rope = (ObjRope*)allocate_heap_object(vm, sizeof(ObjRope), OBJ_ROPE);
+    // Read after allocating, which may have moved both halves
+    rope->left = vm->stack_top[-2];
+    rope->right = vm->stack_top[-1];
+    rope->length = string_length(&rope->left) + string_length(&rope->right);
+    rope->flat = NULL;
+    vm->stack_top[-2] = OBJ_VAL(rope);
+    vm->stack_top--;
+}
+
+// Runs one old generation cycle, timing only its marking
+static f64 time_mark(VM* vm) {
+    Heap* heap = &vm->heap;
+    u64 freed = heap->stats.bytes_freed;
+    f64 start = now();
+    do {
+        gc_step(vm);
+    } while (heap->phase == GC_MARKING);
+    f64 elapsed = now() - start;
+    while (heap->phase != GC_IDLE) gc_step(vm);
+    if (heap->stats.bytes_freed != freed) fail("Swept a live object.");
+    return elapsed;
+}
+
+int main(int argc, const char* argv[]) {
+    u32 depth = argc > 1 ? (u32)strtoul(argv[1], NULL, 10) : 21;
+    u32 runs = argc > 2 ? (u32)strtoul(argv[2], NULL, 10) : 5;
+    long cores = argc > 3 ? strtol(argv[3], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (depth == 0 || depth > 30 || runs == 0) fail("Usage: mark-bench [depth] [runs] [most threads]");
+    if (cores < 1) cores = 1;
+    if (cores > GC_MAX_MARKER_THREADS) cores = GC_MAX_MARKER_THREADS;
+
+    ByteCode* byte_code = compile_source("x := 1.\n");
+    VM* vm = init_vm(byte_code);
+    ObjString* leaf = allocate_string(vm, ROPE_MIN_LENGTH);
+    memset(leaf->chars, 'x', ROPE_MIN_LENGTH);
+    vm->stack_top = vm->stack;
+    *vm->stack_top++ = OBJ_VAL(leaf);
+    f64 start = now();
+    build_tree(vm, depth);
+    // Everything in the old generation and no cycle under way
+    collect_garbage(vm);
+    u64 objects = ((u64)1 << depth) - 1 + 1;
+    printf("%lu objects in %.1fMB, built in %.1fms\n", objects, (f64)vm->heap.size / 1e6, (now() - start) / 1e6);
+
+    f64 single = 0;
+    for (u32 threads = 1; threads <= (u32)cores; threads *= 2) {
+        // Heaps read it when they're created, so it's set on this one directly
+        vm->heap.marker_threads = threads;
+        f64 best = 0;
+        for (u32 i = 0; i < runs; i++) {
+            f64 elapsed = time_mark(vm);
+            if (i == 0 || elapsed < best) best = elapsed;
+        }
+        if (threads == 1) single = best;
+        printf("%3u threads: %8.2fms %8.1fM objects/s %6.2fx\n", threads, best / 1e6, (f64)objects * 1e3 / best,
+               single / best);
+    }
+
+    free_vm(vm);
+    free_byte_code(byte_code);
+    return 0;
+}
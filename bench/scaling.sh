@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# Runs one compiled script over and over on 1, 2, 4, ... worker threads, up
+# to the number of cores, with the same number of runs per thread each time.
+# Every thread has its own VM over the shared byte code, so runs per second
+# should grow with the thread count until the cores run out.
+# Usage: bench/scaling.sh [path/to/pepper] [script.pepr] [runs per thread]
+PEPPER=${1:-./bin/pepper}
+SCRIPT=${2:-"$(dirname "$0")/fib.pepr"}
+RUNS=${3:-20}
+CORES=$(getconf _NPROCESSORS_ONLN 2> /dev/null || echo 1)
+
+threads=1
+while [ "$threads" -le "$CORES" ]; do
+    "$PEPPER" --runs $((threads * RUNS)) --threads "$threads" "$SCRIPT" > /dev/null
+    threads=$((threads * 2))
+done
@@ -0,0 +1,56 @@
+#!/usr/bin/env bash
+# Time from starting pepper to the first byte of output, for a script run
+# cold, the way run_file does it, and through a --serve daemon with
+# --connect. The script is two hundred functions that are compiled but
+# barely run, so the times are startup and compiling. The first request to
+# the server compiles; the rest find the byte code cached and a VM waiting.
+# Usage: bench/serve.sh [path/to/pepper] [runs]
+PEPPER=${1:-./bin/pepper}
+RUNS=${2:-50}
+DIR=$(mktemp -d)
+SOCKET="$DIR/pepper.sock"
+SCRIPT="$DIR/script.pepr"
+
+for i in $(seq 1 200); do
+    cat >> "$SCRIPT" << EOF
+fn f$i(n) {
+    total := 0.
+    for (i := 0; i < n) |i++| {
+        if (i < $i) { total = total + i * 2. } else { total = total - 1. }
+    }
+    return total.
+}
+EOF
+done
+echo 'print f200(10).' >> "$SCRIPT"
+
+"$PEPPER" --serve "$SOCKET" 2> /dev/null &
+SERVER=$!
+trap 'kill $SERVER; rm -rf "$DIR"' EXIT
+while [ ! -S "$SOCKET" ]; do sleep 0.01; done
+
+# Microseconds until the command's first byte of output, after which the
+# rest is read so runs don't overlap
+first_output() {
+    local start=$EPOCHREALTIME
+    local end
+    {
+        read -r -n 1 _
+        end=$EPOCHREALTIME
+        cat > /dev/null
+    } < <("$@")
+    echo "$start $end" | awk '{ printf "%d\n", ($2 - $1) * 1e6 }'
+}
+
+measure() {
+    local name=$1
+    shift
+    for _ in $(seq 1 "$RUNS"); do
+        first_output "$@"
+    done | sort -n | awk -v name="$name" '
+        { times[NR] = $1; total += $1 }
+        END { printf "%-8s median %6d us  mean %6d us  min %6d us\n", name, times[int((NR + 1) / 2)], total / NR, times[1] }'
+}
+
+measure "cold" "$PEPPER" "$SCRIPT"
+measure "server" "$PEPPER" --connect "$SOCKET" "$SCRIPT"
@@ -0,0 +1,565 @@
+// The benchmark suite behind make bench. Each benchmark runs a few times to
+// warm up and then a number of times more, and the median and the median
+// absolute deviation of those are reported:
+//
+//   lexer/*    tokenizing each generated corpus
+//   parser/*   parsing it, from tokens already made
+//   codegen/*  generating byte code for it, from the AST
+//   table/*    interning strings, the way the VM and byte code do
+//   vm/*       the interpreter's dispatch loop on its own, without the JIT
+//   macro/*    whole programs with every tier on: calls, floating point
+//              arithmetic and building strings
+//
+// The corpora are large synthetic programs: deep expressions, many globals,
+// long loops and big tables of literals. --dump writes them out, to try
+// on bin/pepper with --time-phases.
+//
+// Results go to a JSON file, one benchmark a line, and can be compared
+// against an earlier file, in which case the exit status is 1 if anything
+// got slower by more than the threshold, 15% unless given, and by more
+// than its noise.
+// Usage: make bench [ARGS="[--runs <n>] [--warmup <n>] [--filter <text>]
+//                          [--json <path>] [--baseline <path>]
+//                          [--threshold <percent>] [--dump <directory>]"]
+#define _DEFAULT_SOURCE 1
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "bytecode_generator.h"
+#include "table.h"
+#include "vm.h"
+#include "jit.h"
+#include "output.h"
+#include "memory.h"
+#include "vector.h"
+
+#define NAME_MAX_LENGTH 64
+#define BENCHMARKS_MAX 32
+#define INTERNED_STRINGS 100000
+
+DEFINE_VECTOR(Text, text, char, 0, MEMORY_OTHER)
+DEFINE_VECTOR(Samples, samples, u64, 0, MEMORY_OTHER)
+
+typedef struct {
+    const char* name;
+    char* source;
+    u64 length;
+    u64 capacity;
+} Corpus;
+
+typedef enum {
+    BENCH_LEXER,
+    BENCH_PARSER,
+    BENCH_CODEGEN,
+    BENCH_TABLE,
+    BENCH_SCRIPT,
+} BenchKind;
+
+typedef struct {
+    char name[NAME_MAX_LENGTH];
+    BenchKind kind;
+    const Corpus* corpus;
+    // For BENCH_SCRIPT
+    const char* source;
+    bool jit;
+    u64 median_ns;
+    u64 mad_ns;
+    u64 min_ns;
+    // The median and its noise from the baseline, or 0 if it has none
+    u64 baseline_ns;
+    u64 baseline_mad_ns;
+} Benchmark;
+
+static const char* fib_source =
+    "fn fib(n: Int) Int {\n"
+    "    if (n < 2) {\n"
+    "        return n.\n"
+    "    }\n"
+    "    return fib(n - 1) + fib(n - 2).\n"
+    "}\n"
+    "print fib(25).\n";
+
+// Three bodies in a plane, with square roots by Newton's method
+static const char* nbody_source =
+    "x1 := 0.0. y1 := 0.0. vx1 := 0.0. vy1 := 0.0. m1 := 10.0.\n"
+    "x2 := 1.0. y2 := 0.0. vx2 := 0.0. vy2 := 3.0. m2 := 0.1.\n"
+    "x3 := 0.0. y3 := 2.0. vx3 := 2.0. vy3 := 0.0. m3 := 0.01.\n"
+    "fn root(v: Float) Float {\n"
+    "    g := v.\n"
+    "    for (i := 0; i < 8) |i++| {\n"
+    "        g = (g + v / g) / 2.0.\n"
+    "    }\n"
+    "    return g.\n"
+    "}\n"
+    "fn pull(dx: Float, dy: Float) Float {\n"
+    "    d2 := dx * dx + dy * dy + 0.01.\n"
+    "    return 1.0 / (d2 * root(d2)).\n"
+    "}\n"
+    "fn advance(steps: Int, dt: Float) Float {\n"
+    "    for (i := 0; i < steps) |i++| {\n"
+    "        dx := x1 - x2. dy := y1 - y2. f := pull(dx, dy) * dt.\n"
+    "        vx1 = vx1 - dx * m2 * f. vy1 = vy1 - dy * m2 * f.\n"
+    "        vx2 = vx2 + dx * m1 * f. vy2 = vy2 + dy * m1 * f.\n"
+    "        dx = x1 - x3. dy = y1 - y3. f = pull(dx, dy) * dt.\n"
+    "        vx1 = vx1 - dx * m3 * f. vy1 = vy1 - dy * m3 * f.\n"
+    "        vx3 = vx3 + dx * m1 * f. vy3 = vy3 + dy * m1 * f.\n"
+    "        dx = x2 - x3. dy = y2 - y3. f = pull(dx, dy) * dt.\n"
+    "        vx2 = vx2 - dx * m3 * f. vy2 = vy2 - dy * m3 * f.\n"
+    "        vx3 = vx3 + dx * m2 * f. vy3 = vy3 + dy * m2 * f.\n"
+    "        x1 = x1 + dt * vx1. y1 = y1 + dt * vy1.\n"
+    "        x2 = x2 + dt * vx2. y2 = y2 + dt * vy2.\n"
+    "        x3 = x3 + dt * vx3. y3 = y3 + dt * vy3.\n"
+    "    }\n"
+    "    return m1 * (vx1 * vx1 + vy1 * vy1) + m2 * (vx2 * vx2 + vy2 * vy2) + m3 * (vx3 * vx3 + vy3 * vy3).\n"
+    "}\n"
+    "print advance(50000, 0.001).\n";
+
+// Appending builds ropes, which are flattened by the comparison
+static const char* strings_source =
+    "fn build(n: Int) Int {\n"
+    "    text := \"\".\n"
+    "    for (i := 0; i < n) |i++| {\n"
+    "        text = text + \"a piece of text \".\n"
+    "    }\n"
+    "    again := \"\".\n"
+    "    for (i := 0; i < n / 2) |i++| {\n"
+    "        again = again + \"a piece of text \" + \"a piece of text \".\n"
+    "    }\n"
+    "    if (text == again) {\n"
+    "        return n.\n"
+    "    }\n"
+    "    return 0.\n"
+    "}\n"
+    "print build(100000).\n";
+
+static const char* dispatch_source =
+    "fn spin(n: Int) Int {\n"
+    "    total := 0.\n"
+    "    for (i := 0; i < n) |i++| {\n"
+    "        total = total + i * 3 - 1.\n"
+    "        if (total > 1000000) {\n"
+    "            total = total - 1000000.\n"
+    "        }\n"
+    "    }\n"
+    "    return total.\n"
+    "}\n"
+    "print spin(2000000).\n";
+
+static void append(Text* text, const char* format, ...) {
+    char buffer[256];
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+    reserve_text(text, text->count + (u64)length + 1);
+    memcpy(text->items + text->count, buffer, (u64)length);
+    text->count += (u64)length;
+    text->items[text->count] = '\0';
+}
+
+// Functions returning expressions nested 150 deep, so the parser and the
+// generator recurse as far as real code ever makes them
+static void generate_deep(Text* text) {
+    for (u32 function = 0; function < 200; function++) {
+        append(text, "fn deep%u(a: Int, b: Int) Int {\n    return ", function);
+        for (u32 depth = 0; depth < 150; depth++) append(text, "(");
+        append(text, "a");
+        for (u32 depth = 0; depth < 150; depth++) {
+            if (depth % 3 == 0) {
+                append(text, " + b)");
+            } else if (depth % 3 == 1) {
+                append(text, " - %u)", depth % 7 + 1);
+            } else {
+                append(text, " + a)");
+            }
+        }
+        append(text, ".\n}\n");
+    }
+}
+
+// As many globals as a program can have, read and written from functions
+static void generate_globals(Text* text) {
+    const u32 globals = 230;
+    append(text, "g0 := 1.\n");
+    for (u32 global = 1; global < globals; global++) append(text, "g%u := g%u.\n", global, global - 1);
+    for (u32 function = 0; function < 20; function++) {
+        append(text, "fn touch%u() Int {\n", function);
+        for (u32 statement = 0; statement < 200; statement++) {
+            u32 a = (function * 31 + statement * 7) % globals;
+            u32 b = (function * 17 + statement * 13) % globals;
+            u32 c = (function * 7 + statement * 29) % globals;
+            append(text, "    g%u = g%u + g%u - g%u.\n", a, b, c, a);
+        }
+        append(text, "    return g0.\n}\n");
+    }
+}
+
+// Nested loops with long bodies
+static void generate_loops(Text* text) {
+    for (u32 function = 0; function < 200; function++) {
+        append(text, "fn loop%u(n: Int) Int {\n    total := 0.\n", function);
+        append(text, "    for (i := 0; i < n) |i++| {\n        for (j := 0; j < n) |j++| {\n");
+        for (u32 statement = 0; statement < 40; statement++) {
+            if (statement % 4 == 3) {
+                append(text, "            if (total > %u) { total = total - i. } else { total = total + j. }\n",
+                       statement * 100);
+            } else {
+                append(text, "            total = total + i * j - %u.\n", statement);
+            }
+        }
+        append(text, "        }\n    }\n    return total.\n}\n");
+    }
+}
+
+// Functions with two hundred string literals each, long enough that they
+// aren't held in the value, so each is interned
+static void generate_literals(Text* text) {
+    for (u32 function = 0; function < 200; function++) {
+        append(text, "fn table%u() Int {\n    s := \"\".\n", function);
+        for (u32 literal = 0; literal < 200; literal++) {
+            append(text, "    s = \"entry %u of table %u, with some text after it\".\n", literal, function);
+        }
+        append(text, "    return 0.\n}\n");
+    }
+}
+
+static void generate_corpus(Corpus* corpus, const char* name, void (*generate)(Text*)) {
+    Text text;
+    init_text(&text);
+    generate(&text);
+    corpus->name = name;
+    corpus->source = text.items;
+    corpus->length = text.count;
+    corpus->capacity = text.capacity;
+}
+
+static void free_corpus(Corpus* corpus) {
+    FREE_ARRAY(char, corpus->source, corpus->capacity);
+}
+
+static u64 now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000 + (u64)now.tv_nsec;
+}
+
+static void fail(const char* name, const char* message) {
+    fprintf(stderr, "%s: %s\n", name, message);
+    exit(EXIT_FAILURE);
+}
+
+static Parser* parse_corpus(const Benchmark* benchmark, const char* source, Program** program) {
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    Parser* parser = init_parser(lexer);
+    parser->error_output = NULL;
+    *program = parse_program(parser);
+    if (parser->has_error || parser->panic_mode) fail(benchmark->name, parser->error);
+    return parser;
+}
+
+static ByteCode* compile_source(const Benchmark* benchmark, const char* source) {
+    Program* program;
+    Parser* parser = parse_corpus(benchmark, source, &program);
+    ByteCode* byte_code = generate_bytecode(program);
+    if (byte_code->has_error) fail(benchmark->name, byte_code->error);
+    de_init_program(program);
+    de_init_parser(parser);
+    return byte_code;
+}
+
+// Interns strings that are all different, then looks each one up again
+static u64 time_table(void) {
+    char chars[32];
+    Obj* objects = NULL;
+    Table table;
+    init_table(&table, MEMORY_OTHER);
+    u64 start = now_ns();
+    for (u32 i = 0; i < INTERNED_STRINGS; i++) {
+        u64 length = (u64)snprintf(chars, sizeof(chars), "interned-%u", i);
+        u32 hash = hash_chars(HASH_SEED, chars, length);
+        if (table_find_string(&table, chars, length, "", 0, hash) == NULL) {
+            table_add(&table, new_string(&objects, chars, length));
+        }
+    }
+    u64 found = 0;
+    for (u32 i = 0; i < INTERNED_STRINGS; i++) {
+        u64 length = (u64)snprintf(chars, sizeof(chars), "interned-%u", i);
+        u32 hash = hash_chars(HASH_SEED, chars, length);
+        if (table_find_string(&table, chars, length, "", 0, hash) != NULL) found++;
+    }
+    u64 elapsed = now_ns() - start;
+    if (found != INTERNED_STRINGS) fail("table/intern", "Lost a string.");
+    free_table(&table);
+    free_objects(objects, MEMORY_CHUNK);
+    return elapsed;
+}
+
+// A fresh VM each time, so the JIT has to find and compile its traces again
+// just as a run of bin/pepper would. Output goes to /dev/null.
+static u64 time_script(const Benchmark* benchmark, const ByteCode* byte_code, int null_fd) {
+    jit_set_enabled(benchmark->jit);
+    u64 start = now_ns();
+    VM* vm = init_vm(byte_code);
+    redirect_output(&vm->output, null_fd);
+    if (run(vm) != OK) fail(benchmark->name, vm->error);
+    u64 elapsed = now_ns() - start;
+    free_vm(vm);
+    jit_set_enabled(true);
+    return elapsed;
+}
+
+// One run of the benchmark, timing only its own stage
+static u64 time_once(const Benchmark* benchmark, const ByteCode* byte_code, int null_fd) {
+    const char* source = benchmark->corpus != NULL ? benchmark->corpus->source : NULL;
+    switch (benchmark->kind) {
+        case BENCH_LEXER: {
+            u64 start = now_ns();
+            Lexer* lexer = init_lexer(source);
+            tokenize(lexer);
+            u64 elapsed = now_ns() - start;
+            de_init_lexer(lexer);
+            return elapsed;
+        }
+        case BENCH_PARSER: {
+            Lexer* lexer = init_lexer(source);
+            tokenize(lexer);
+            Parser* parser = init_parser(lexer);
+            parser->error_output = NULL;
+            u64 start = now_ns();
+            Program* program = parse_program(parser);
+            u64 elapsed = now_ns() - start;
+            if (parser->has_error || parser->panic_mode) fail(benchmark->name, parser->error);
+            de_init_program(program);
+            de_init_parser(parser);
+            return elapsed;
+        }
+        case BENCH_CODEGEN: {
+            Program* program;
+            Parser* parser = parse_corpus(benchmark, source, &program);
+            u64 start = now_ns();
+            ByteCode* generated = generate_bytecode(program);
+            u64 elapsed = now_ns() - start;
+            if (generated->has_error) fail(benchmark->name, generated->error);
+            free_byte_code(generated);
+            de_init_program(program);
+            de_init_parser(parser);
+            return elapsed;
+        }
+        case BENCH_TABLE: return time_table();
+        case BENCH_SCRIPT: return time_script(benchmark, byte_code, null_fd);
+    }
+    return 0;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    u64 left = *(const u64*)a;
+    u64 right = *(const u64*)b;
+    return left < right ? -1 : left > right;
+}
+
+static u64 median(u64* values, u64 count) {
+    qsort(values, count, sizeof(u64), compare_u64);
+    return count % 2 == 1 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+static void measure(Benchmark* benchmark, u32 warmup, u32 runs, int null_fd) {
+    ByteCode* byte_code = benchmark->kind == BENCH_SCRIPT ? compile_source(benchmark, benchmark->source) : NULL;
+    for (u32 i = 0; i < warmup; i++) time_once(benchmark, byte_code, null_fd);
+    Samples samples;
+    init_samples(&samples);
+    for (u32 i = 0; i < runs; i++) write_samples(&samples, time_once(benchmark, byte_code, null_fd));
+    benchmark->median_ns = median(samples.items, samples.count);
+    // Which median left sorted
+    benchmark->min_ns = samples.items[0];
+    for (u64 i = 0; i < samples.count; i++) {
+        u64 time = samples.items[i];
+        samples.items[i] = time > benchmark->median_ns ? time - benchmark->median_ns : benchmark->median_ns - time;
+    }
+    benchmark->mad_ns = median(samples.items, samples.count);
+    free_samples(&samples);
+    if (byte_code != NULL) free_byte_code(byte_code);
+}
+
+// Reads the medians and deviations back from a file write_json wrote
+static void read_baseline(const char* path, Benchmark* benchmarks, u32 count) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open \"%s\".\n", path);
+        exit(74);
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char name[NAME_MAX_LENGTH];
+        u64 median_ns;
+        u64 mad_ns;
+        if (sscanf(line, " {\"name\": \"%63[^\"]\", \"median_ns\": %lu, \"mad_ns\": %lu", name, &median_ns,
+                   &mad_ns) != 3) {
+            continue;
+        }
+        for (u32 i = 0; i < count; i++) {
+            if (strcmp(benchmarks[i].name, name) != 0) continue;
+            benchmarks[i].baseline_ns = median_ns;
+            benchmarks[i].baseline_mad_ns = mad_ns;
+        }
+    }
+    fclose(file);
+}
+
+static void write_json(const char* path, const Benchmark* benchmarks, u32 count, u32 warmup, u32 runs) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write \"%s\".\n", path);
+        exit(74);
+    }
+    fprintf(file, "{\"warmup\": %u, \"runs\": %u, \"benchmarks\": [\n", warmup, runs);
+    for (u32 i = 0; i < count; i++) {
+        const Benchmark* benchmark = &benchmarks[i];
+        fprintf(file, "  {\"name\": \"%s\", \"median_ns\": %lu, \"mad_ns\": %lu, \"min_ns\": %lu}%s\n",
+                benchmark->name, benchmark->median_ns, benchmark->mad_ns, benchmark->min_ns,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+}
+
+// Slower than the baseline by more than the threshold, and by more than
+// three times the noise in both runs, so a noisy benchmark doesn't fail on
+// its own
+static bool is_regression(const Benchmark* benchmark, f64 threshold) {
+    if (benchmark->baseline_ns == 0 || benchmark->median_ns <= benchmark->baseline_ns) return false;
+    u64 slower = benchmark->median_ns - benchmark->baseline_ns;
+    return (f64)slower > (f64)benchmark->baseline_ns * threshold && slower > 3 * (benchmark->mad_ns + benchmark->baseline_mad_ns);
+}
+
+static void add_benchmark(Benchmark* benchmarks, u32* count, const char* filter, BenchKind kind,
+                          const char* prefix, const char* name, const Corpus* corpus, const char* source,
+                          bool jit) {
+    Benchmark* benchmark = &benchmarks[*count];
+    snprintf(benchmark->name, sizeof(benchmark->name), "%s/%s", prefix, name);
+    if (filter != NULL && strstr(benchmark->name, filter) == NULL) return;
+    benchmark->kind = kind;
+    benchmark->corpus = corpus;
+    benchmark->source = source;
+    benchmark->jit = jit;
+    benchmark->baseline_ns = 0;
+    benchmark->baseline_mad_ns = 0;
+    (*count)++;
+}
+
+static void dump_corpora(const char* directory, const Corpus* corpora, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s.pepr", directory, corpora[i].name);
+        FILE* file = fopen(path, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Could not write \"%s\".\n", path);
+            exit(74);
+        }
+        fwrite(corpora[i].source, sizeof(char), corpora[i].length, file);
+        fclose(file);
+        printf("%s: %lu bytes\n", path, corpora[i].length);
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: bench-suite [--runs <n>] [--warmup <n>] [--filter <text>] [--json <path>] "
+                    "[--baseline <path>] [--threshold <percent>] [--dump <directory>]\n");
+    exit(64);
+}
+
+int main(int argc, char* argv[]) {
+    long runs = 11;
+    long warmup = 2;
+    f64 threshold = 15.0;
+    const char* filter = NULL;
+    const char* json_path = NULL;
+    const char* baseline_path = NULL;
+    const char* dump_directory = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) usage();
+        if (strcmp(argv[i], "--runs") == 0) {
+            runs = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            warmup = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threshold") == 0) {
+            threshold = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--dump") == 0) {
+            dump_directory = argv[++i];
+        } else {
+            usage();
+        }
+    }
+    if (runs < 1 || warmup < 0 || threshold <= 0.0) usage();
+
+    Corpus corpora[4];
+    generate_corpus(&corpora[0], "deep", generate_deep);
+    generate_corpus(&corpora[1], "globals", generate_globals);
+    generate_corpus(&corpora[2], "loops", generate_loops);
+    generate_corpus(&corpora[3], "literals", generate_literals);
+    u32 corpus_count = sizeof(corpora) / sizeof(corpora[0]);
+    if (dump_directory != NULL) {
+        dump_corpora(dump_directory, corpora, corpus_count);
+        for (u32 i = 0; i < corpus_count; i++) free_corpus(&corpora[i]);
+        return 0;
+    }
+
+    Benchmark benchmarks[BENCHMARKS_MAX];
+    u32 count = 0;
+    static const struct {
+        BenchKind kind;
+        const char* prefix;
+    } stages[] = {{BENCH_LEXER, "lexer"}, {BENCH_PARSER, "parser"}, {BENCH_CODEGEN, "codegen"}};
+    for (u32 stage = 0; stage < sizeof(stages) / sizeof(stages[0]); stage++) {
+        for (u32 i = 0; i < corpus_count; i++) {
+            add_benchmark(benchmarks, &count, filter, stages[stage].kind, stages[stage].prefix, corpora[i].name,
+                          &corpora[i], NULL, true);
+        }
+    }
+    add_benchmark(benchmarks, &count, filter, BENCH_TABLE, "table", "intern", NULL, NULL, true);
+    add_benchmark(benchmarks, &count, filter, BENCH_SCRIPT, "vm", "dispatch", NULL, dispatch_source, false);
+    add_benchmark(benchmarks, &count, filter, BENCH_SCRIPT, "macro", "fib", NULL, fib_source, true);
+    add_benchmark(benchmarks, &count, filter, BENCH_SCRIPT, "macro", "nbody", NULL, nbody_source, true);
+    add_benchmark(benchmarks, &count, filter, BENCH_SCRIPT, "macro", "strings", NULL, strings_source, true);
+    if (baseline_path != NULL) read_baseline(baseline_path, benchmarks, count);
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0) fail("bench-suite", "Could not open /dev/null.");
+    printf("%-20s %12s %12s %12s", "benchmark", "median ms", "mad ms", "min ms");
+    if (baseline_path != NULL) printf(" %12s %9s", "baseline ms", "change");
+    printf("\n");
+    u32 regressions = 0;
+    for (u32 i = 0; i < count; i++) {
+        Benchmark* benchmark = &benchmarks[i];
+        measure(benchmark, (u32)warmup, (u32)runs, null_fd);
+        printf("%-20s %12.3f %12.3f %12.3f", benchmark->name, (f64)benchmark->median_ns / 1e6,
+               (f64)benchmark->mad_ns / 1e6, (f64)benchmark->min_ns / 1e6);
+        if (benchmark->baseline_ns > 0) {
+            f64 change = ((f64)benchmark->median_ns / (f64)benchmark->baseline_ns - 1.0) * 100.0;
+            bool regressed = is_regression(benchmark, threshold / 100.0);
+            printf(" %12.3f %+8.1f%%%s", (f64)benchmark->baseline_ns / 1e6, change, regressed ? " slower" : "");
+            if (regressed) regressions++;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    close(null_fd);
+    if (json_path != NULL) write_json(json_path, benchmarks, count, (u32)warmup, (u32)runs);
+    if (regressions > 0) printf("%u benchmarks slower than the baseline by more than %.0f%%\n", regressions, threshold);
+
+    for (u32 i = 0; i < corpus_count; i++) free_corpus(&corpora[i]);
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# Times every benchmark under each execution tier:
+#   interpreter  the switch dispatch loop on its own
+#   baseline     whole functions compiled to native code on first call
+#   trace        the interpreter with the tracing JIT for hot loops
+#   native       an executable from 'pepper build', not counting the build
+#   c            the same through 'pepper build --target c'
+# Usage: bench/tiers.sh [path/to/pepper]
+PEPPER=${1:-./bin/pepper}
+TIMEFORMAT=%R
+BUILD_DIR=$(mktemp -d)
+trap 'rm -rf "$BUILD_DIR"' EXIT
+
+printf "%-20s %12s %12s %12s %12s %12s\n" benchmark interpreter baseline trace native c
+for file in "$(dirname "$0")"/*.pepr; do
+    interpreter=$( { time "$PEPPER" --no-jit "$file" > /dev/null; } 2>&1 )
+    baseline=$( { time "$PEPPER" --baseline "$file" > /dev/null; } 2>&1 )
+    trace=$( { time "$PEPPER" "$file" > /dev/null; } 2>&1 )
+    native=-
+    if "$PEPPER" build "$file" -o "$BUILD_DIR/program" 2> /dev/null; then
+        native=$( { time "$BUILD_DIR/program" > /dev/null; } 2>&1 )s
+    fi
+    c=-
+    if "$PEPPER" build "$file" -o "$BUILD_DIR/program" --target c 2> /dev/null; then
+        c=$( { time "$BUILD_DIR/program" > /dev/null; } 2>&1 )s
+    fi
+    printf "%-20s %11ss %11ss %11ss %12s %12s\n" "$(basename "$file")" "$interpreter" "$baseline" "$trace" "$native" "$c"
+done
@@ -0,0 +1,151 @@
+// Nanoseconds per element to push onto and then iterate over arrays three
+// ways:
+//
+//   vector    DEFINE_VECTOR, with a few elements stored inline
+//   grown     the hand-rolled GROW_ARRAY pattern vectors replaced
+//   boxed     the old ArrayList: an array of pointers to separately
+//             allocated copies of each element
+//
+// Each is measured building one long array, then building, summing and
+// freeing many short ones, which is where storing elements inline pays off.
+// Usage: make bench-vector [ARGS="<elements>"]
+#define _DEFAULT_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "memory.h"
+#include "vector.h"
+
+#define SHORT_LENGTH 6
+
+DEFINE_VECTOR(NumberVector, number_vector, u64, 8, MEMORY_OTHER)
+
+typedef struct {
+    u64 count;
+    u64 capacity;
+    u64* items;
+} GrownArray;
+
+typedef struct {
+    u64 count;
+    u64 capacity;
+    void** items;
+} BoxedArray;
+
+typedef struct {
+    f64 push;
+    f64 iterate;
+} Timing;
+
+// Each build function pushes length elements, sums them and frees the
+// array. With timing, the push and the sum are timed separately; timing
+// every short array would mostly measure the clock, so they're timed as a
+// whole by run_short instead.
+typedef u64 (*BuildFunction)(u64 length, Timing* timing);
+
+// Stops the sums being optimized away
+static volatile u64 sink;
+
+static f64 now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (f64)time.tv_sec * 1e9 + (f64)time.tv_nsec;
+}
+
+static u64 build_vector(u64 length, Timing* timing) {
+    f64 start = timing != NULL ? now() : 0;
+    NumberVector vector;
+    init_number_vector(&vector);
+    for (u64 i = 0; i < length; i++) write_number_vector(&vector, i);
+    f64 middle = timing != NULL ? now() : 0;
+    u64 sum = 0;
+    for (u64 i = 0; i < vector.count; i++) sum += vector.items[i];
+    if (timing != NULL) {
+        timing->push = middle - start;
+        timing->iterate = now() - middle;
+    }
+    free_number_vector(&vector);
+    return sum;
+}
+
+static u64 build_grown(u64 length, Timing* timing) {
+    f64 start = timing != NULL ? now() : 0;
+    GrownArray array = {0, 0, NULL};
+    for (u64 i = 0; i < length; i++) {
+        if (array.count == array.capacity) {
+            u64 old_capacity = array.capacity;
+            array.capacity = GROW_CAPACITY(old_capacity);
+            array.items = GROW_ARRAY(u64, array.items, old_capacity, array.capacity);
+        }
+        array.items[array.count++] = i;
+    }
+    f64 middle = timing != NULL ? now() : 0;
+    u64 sum = 0;
+    for (u64 i = 0; i < array.count; i++) sum += array.items[i];
+    if (timing != NULL) {
+        timing->push = middle - start;
+        timing->iterate = now() - middle;
+    }
+    FREE_ARRAY(u64, array.items, array.capacity);
+    return sum;
+}
+
+static u64 build_boxed(u64 length, Timing* timing) {
+    f64 start = timing != NULL ? now() : 0;
+    BoxedArray array = {0, 16, NULL};
+    array.items = ALLOCATE(void*, array.capacity);
+    for (u64 i = 0; i < length; i++) {
+        if (array.count == array.capacity) {
+            u64 old_capacity = array.capacity;
+            array.capacity *= 2;
+            array.items = GROW_ARRAY(void*, array.items, old_capacity, array.capacity);
+        }
+        u64* copy = ALLOCATE(u64, 1);
+        *copy = i;
+        array.items[array.count++] = copy;
+    }
+    f64 middle = timing != NULL ? now() : 0;
+    u64 sum = 0;
+    for (u64 i = 0; i < array.count; i++) sum += *(u64*)array.items[i];
+    if (timing != NULL) {
+        timing->push = middle - start;
+        timing->iterate = now() - middle;
+    }
+    for (u64 i = 0; i < array.count; i++) FREE(u64, array.items[i]);
+    FREE_ARRAY(void*, array.items, array.capacity);
+    return sum;
+}
+
+static void run_long(const char* name, BuildFunction build, u64 elements) {
+    Timing timing;
+    sink = build(elements, &timing);
+    printf("%-8s %10.2f %10.2f\n", name, timing.push / (f64)elements, timing.iterate / (f64)elements);
+}
+
+static void run_short(const char* name, BuildFunction build, u64 repeats) {
+    f64 start = now();
+    u64 sum = 0;
+    for (u64 r = 0; r < repeats; r++) sum += build(SHORT_LENGTH, NULL);
+    sink = sum;
+    printf("%-8s %10.2f\n", name, (now() - start) / (f64)(repeats * SHORT_LENGTH));
+}
+
+int main(int argc, const char* argv[]) {
+    u64 elements = argc > 1 ? (u64)strtoull(argv[1], NULL, 10) : 10000000;
+    if (elements < SHORT_LENGTH) elements = SHORT_LENGTH;
+
+    printf("one array of %lu elements, ns per element\n", elements);
+    printf("%-8s %10s %10s\n", "", "push", "iterate");
+    run_long("vector", build_vector, elements);
+    run_long("grown", build_grown, elements);
+    run_long("boxed", build_boxed, elements);
+
+    u64 repeats = elements / SHORT_LENGTH;
+    printf("\n%lu arrays of %d elements, ns per element\n", repeats, SHORT_LENGTH);
+    printf("%-8s %10s\n", "", "all");
+    run_short("vector", build_vector, repeats);
+    run_short("grown", build_grown, repeats);
+    run_short("boxed", build_boxed, repeats);
+    return 0;
+}
@@ -0,0 +1,596 @@
+#include <stdarg.h>
+#include <string.h>
+
+#include "codegen.h"
+#include "regalloc.h"
+
+// Registers are numbered as in the instruction encoding
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+static const char* register_names[] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+};
+
+// rax, rcx, rdx and r11 are scratch for the code generator, and rdx also
+// takes the high half of idiv. Arguments go through the stack into their
+// registers, so values can live in argument registers between calls.
+#define ARGUMENT_REGISTERS 6
+static const i32 argument_registers[ARGUMENT_REGISTERS] = {RDI, RSI, RDX, RCX, R8, R9};
+
+static const i32 caller_saved[] = {RSI, RDI, R8, R9, R10};
+static const i32 callee_saved[] = {RBX, R12, R13, R14, R15};
+static const RegisterPool register_pool = {caller_saved, 5, callee_saved, 5, argument_registers, ARGUMENT_REGISTERS};
+
+#ifdef __APPLE__
+#define SYMBOL_PREFIX "_"
+#define LABEL_PREFIX "L"
+#else
+#define SYMBOL_PREFIX ""
+#define LABEL_PREFIX ".L"
+#endif
+
+typedef struct {
+    char text[48];
+} Operand;
+
+typedef struct {
+    FILE* out;
+    IrProgram* ir;
+    u32 function_index;
+    IrFunction* function;
+    Allocation* allocation;
+    i32 saved[5];
+    u32 saved_count;
+} Emitter;
+
+static void emit_line(Emitter* emitter, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    fputs("    ", emitter->out);
+    vfprintf(emitter->out, format, args);
+    fputc('\n', emitter->out);
+    va_end(args);
+}
+
+static Location location_of(Emitter* emitter, i32 vreg) {
+    if (vreg == IR_NONE) return (Location){LOCATION_NONE, 0};
+    return emitter->allocation->locations[vreg];
+}
+
+static i32 spill_offset(Emitter* emitter, i32 slot) {
+    return -8 * ((i32)emitter->saved_count + 1 + slot);
+}
+
+static Operand operand(Emitter* emitter, i32 vreg) {
+    Operand result;
+    Location location = location_of(emitter, vreg);
+    switch (location.kind) {
+        case LOCATION_REGISTER:
+            snprintf(result.text, sizeof(result.text), "%s", register_names[location.index]);
+            break;
+        case LOCATION_STACK:
+            snprintf(result.text, sizeof(result.text), "%d(%%rbp)", spill_offset(emitter, location.index));
+            break;
+        default:
+            // Never live, so any value will do
+            snprintf(result.text, sizeof(result.text), "$0");
+            break;
+    }
+    return result;
+}
+
+static bool in_register(Emitter* emitter, i32 vreg) {
+    return location_of(emitter, vreg).kind == LOCATION_REGISTER;
+}
+
+static bool same_location(Emitter* emitter, i32 a, i32 b) {
+    Location left = location_of(emitter, a);
+    Location right = location_of(emitter, b);
+    return left.kind == right.kind && left.index == right.index && left.kind != LOCATION_NONE;
+}
+
+static void load(Emitter* emitter, i32 vreg, i32 reg) {
+    if (in_register(emitter, vreg) && location_of(emitter, vreg).index == reg) return;
+    emit_line(emitter, "movq %s, %s", operand(emitter, vreg).text, register_names[reg]);
+}
+
+static void store(Emitter* emitter, i32 reg, i32 vreg) {
+    Location location = location_of(emitter, vreg);
+    if (location.kind == LOCATION_NONE) return;
+    if (location.kind == LOCATION_REGISTER && location.index == reg) return;
+    emit_line(emitter, "movq %s, %s", register_names[reg], operand(emitter, vreg).text);
+}
+
+static void load_xmm(Emitter* emitter, i32 vreg, const char* xmm) {
+    if (location_of(emitter, vreg).kind == LOCATION_NONE) {
+        emit_line(emitter, "xorpd %s, %s", xmm, xmm);
+        return;
+    }
+    emit_line(emitter, "movq %s, %s", operand(emitter, vreg).text, xmm);
+}
+
+static void print_symbol(char* buffer, u64 size, const char* prefix, const char* name) {
+    snprintf(buffer, size, SYMBOL_PREFIX "%s%s", prefix, name);
+}
+
+static void function_symbol(Emitter* emitter, u32 index, char* buffer, u64 size) {
+    const char* name = emitter->ir->functions[index].name;
+    if (name == NULL) {
+        print_symbol(buffer, size, "pepper_main", "");
+        return;
+    }
+    print_symbol(buffer, size, "pepper_fn_", name);
+}
+
+static void global_symbol(Emitter* emitter, i64 index, char* buffer, u64 size) {
+    print_symbol(buffer, size, "pepper_g_", emitter->ir->checked->globals[index].name);
+}
+
+// The byte that says whether a guarded global has been defined yet, and its
+// name for the error if it hasn't
+static void defined_symbol(Emitter* emitter, i64 index, char* buffer, u64 size) {
+    print_symbol(buffer, size, "pepper_d_", emitter->ir->checked->globals[index].name);
+}
+
+static void name_symbol(Emitter* emitter, i64 index, char* buffer, u64 size) {
+    print_symbol(buffer, size, "pepper_n_", emitter->ir->checked->globals[index].name);
+}
+
+// Stops with the VM's error if the global hasn't been defined. The store
+// defining it is in the script, and marks it defined instead.
+static void emit_guard(Emitter* emitter, IrInstruction* instruction) {
+    char symbol[MAX_TOKEN_LENGTH + 32];
+    defined_symbol(emitter, instruction->immediate, symbol, sizeof(symbol));
+    if (instruction->op == IR_STORE_GLOBAL && emitter->ir->functions[emitter->function_index].name == NULL) {
+        emit_line(emitter, "movb $1, %s(%%rip)", symbol);
+        return;
+    }
+    emit_line(emitter, "cmpb $0, %s(%%rip)", symbol);
+    emit_line(emitter, "jne 1f");
+    name_symbol(emitter, instruction->immediate, symbol, sizeof(symbol));
+    emit_line(emitter, "leaq %s(%%rip), %%rdi", symbol);
+    emit_line(emitter, "call " SYMBOL_PREFIX "pepper_undefined_variable");
+    fprintf(emitter->out, "1:\n");
+}
+
+static const char* condition_suffix(IrCondition condition) {
+    switch (condition) {
+        case IR_EQ: return "e";
+        case IR_NE: return "ne";
+        case IR_LT: return "l";
+        case IR_GE: return "ge";
+        case IR_GT: return "g";
+        default: return "le";
+    }
+}
+
+// The register an instruction computes into: dst itself when it's in a
+// register that doesn't hold the right operand, so nothing needs copying
+static i32 target_register(Emitter* emitter, IrInstruction* instruction) {
+    if (!in_register(emitter, instruction->dst)) return RAX;
+    if (!instruction->has_immediate && instruction->b != IR_NONE &&
+        same_location(emitter, instruction->dst, instruction->b) &&
+        !same_location(emitter, instruction->dst, instruction->a)) {
+        return RAX;
+    }
+    return location_of(emitter, instruction->dst).index;
+}
+
+static void right_operand(Emitter* emitter, IrInstruction* instruction, Operand* result) {
+    if (instruction->has_immediate) {
+        snprintf(result->text, sizeof(result->text), "$%ld", instruction->immediate);
+        return;
+    }
+    *result = operand(emitter, instruction->b);
+}
+
+static void emit_arithmetic(Emitter* emitter, IrInstruction* instruction, const char* mnemonic) {
+    i32 target = target_register(emitter, instruction);
+    Operand right;
+    right_operand(emitter, instruction, &right);
+    load(emitter, instruction->a, target);
+    emit_line(emitter, "%s %s, %s", mnemonic, right.text, register_names[target]);
+    store(emitter, target, instruction->dst);
+}
+
+static void emit_divide(Emitter* emitter, IrInstruction* instruction) {
+    load(emitter, instruction->b, RCX);
+    emit_line(emitter, "testq %%rcx, %%rcx");
+    emit_line(emitter, "jnz 1f");
+    emit_line(emitter, "call " SYMBOL_PREFIX "pepper_division_by_zero");
+    fprintf(emitter->out, "1:\n");
+    load(emitter, instruction->a, RAX);
+    // INT64_MIN / -1 traps in idiv, so dividing by -1 negates, wrapping as
+    // the VM does
+    emit_line(emitter, "cmpq $-1, %%rcx");
+    emit_line(emitter, "jne 2f");
+    emit_line(emitter, "negq %%rax");
+    emit_line(emitter, "jmp 3f");
+    fprintf(emitter->out, "2:\n");
+    emit_line(emitter, "cqto");
+    emit_line(emitter, "idivq %%rcx");
+    fprintf(emitter->out, "3:\n");
+    store(emitter, RAX, instruction->dst);
+}
+
+static void emit_float_arithmetic(Emitter* emitter, IrInstruction* instruction, const char* mnemonic) {
+    load_xmm(emitter, instruction->a, "%xmm0");
+    load_xmm(emitter, instruction->b, "%xmm1");
+    emit_line(emitter, "%s %%xmm1, %%xmm0", mnemonic);
+    if (location_of(emitter, instruction->dst).kind != LOCATION_NONE) {
+        emit_line(emitter, "movq %%xmm0, %s", operand(emitter, instruction->dst).text);
+    }
+}
+
+static void emit_unary(Emitter* emitter, IrInstruction* instruction, const char* format) {
+    i32 target = target_register(emitter, instruction);
+    load(emitter, instruction->a, target);
+    emit_line(emitter, format, register_names[target]);
+    store(emitter, target, instruction->dst);
+}
+
+// Sets the flags for a <condition> b on two ints
+static void emit_int_compare(Emitter* emitter, IrInstruction* instruction) {
+    Operand right;
+    right_operand(emitter, instruction, &right);
+    Operand left = operand(emitter, instruction->a);
+    if (!in_register(emitter, instruction->a)) {
+        load(emitter, instruction->a, RAX);
+        snprintf(left.text, sizeof(left.text), "%%rax");
+    }
+    emit_line(emitter, "cmpq %s, %s", right.text, left.text);
+}
+
+// Leaves the flags so that 'a' (above) or 'be' (below or equal) decide the
+// ordered comparisons, and 'e'/'p' decide equality
+static void emit_float_compare(Emitter* emitter, IrInstruction* instruction) {
+    load_xmm(emitter, instruction->a, "%xmm0");
+    load_xmm(emitter, instruction->b, "%xmm1");
+    if (instruction->condition == IR_LT || instruction->condition == IR_GE) {
+        emit_line(emitter, "ucomisd %%xmm0, %%xmm1");
+    } else {
+        emit_line(emitter, "ucomisd %%xmm1, %%xmm0");
+    }
+}
+
+static void store_flag(Emitter* emitter, i32 dst) {
+    if (in_register(emitter, dst)) {
+        emit_line(emitter, "movzbq %%al, %s", operand(emitter, dst).text);
+        return;
+    }
+    emit_line(emitter, "movzbl %%al, %%eax");
+    store(emitter, RAX, dst);
+}
+
+static void emit_compare(Emitter* emitter, IrInstruction* instruction) {
+    emit_int_compare(emitter, instruction);
+    emit_line(emitter, "set%s %%al", condition_suffix(instruction->condition));
+    store_flag(emitter, instruction->dst);
+}
+
+static void emit_float_compare_value(Emitter* emitter, IrInstruction* instruction) {
+    emit_float_compare(emitter, instruction);
+    switch (instruction->condition) {
+        case IR_EQ:
+            emit_line(emitter, "sete %%al");
+            emit_line(emitter, "setnp %%cl");
+            emit_line(emitter, "andb %%cl, %%al");
+            break;
+        case IR_NE:
+            emit_line(emitter, "setne %%al");
+            emit_line(emitter, "setp %%cl");
+            emit_line(emitter, "orb %%cl, %%al");
+            break;
+        case IR_LT:
+        case IR_GT:
+            emit_line(emitter, "seta %%al");
+            break;
+        default:
+            emit_line(emitter, "setbe %%al");
+            break;
+    }
+    store_flag(emitter, instruction->dst);
+}
+
+static void emit_label_reference(Emitter* emitter, const char* mnemonic, i32 label) {
+    emit_line(emitter, "%s " LABEL_PREFIX "%u_%d", mnemonic, emitter->function_index, label);
+}
+
+static void emit_float_branch(Emitter* emitter, IrInstruction* instruction) {
+    emit_float_compare(emitter, instruction);
+    switch (instruction->condition) {
+        case IR_EQ:
+            emit_line(emitter, "jp 1f");
+            emit_label_reference(emitter, "je", instruction->label);
+            fprintf(emitter->out, "1:\n");
+            break;
+        case IR_NE:
+            emit_label_reference(emitter, "jp", instruction->label);
+            emit_label_reference(emitter, "jne", instruction->label);
+            break;
+        case IR_LT:
+        case IR_GT:
+            emit_label_reference(emitter, "ja", instruction->label);
+            break;
+        default:
+            emit_label_reference(emitter, "jbe", instruction->label);
+            break;
+    }
+}
+
+// Whether writing the argument registers in order would overwrite an
+// argument that hasn't been read yet
+static bool arguments_conflict(Emitter* emitter, i32* args, u32 count) {
+    for (u32 k = 1; k < count; k++) {
+        if (!in_register(emitter, args[k])) continue;
+        i32 source = location_of(emitter, args[k]).index;
+        for (u32 i = 0; i < k; i++) {
+            if (source == argument_registers[i]) return true;
+        }
+    }
+    return false;
+}
+
+// Moves the first six arguments into their registers and pushes the rest
+// where the callee expects them. When the registers would be shuffled into
+// each other, every argument goes through the stack instead, which works
+// for any order. Returns the bytes to drop after the call.
+static u32 emit_arguments(Emitter* emitter, i32* args, u32 count) {
+    u32 stack_args = count > ARGUMENT_REGISTERS ? count - ARGUMENT_REGISTERS : 0;
+    u32 in_registers = count - stack_args;
+    u32 padding = stack_args % 2 == 1 ? 8 : 0;
+    if (padding > 0) emit_line(emitter, "subq $%u, %%rsp", padding);
+    for (u32 i = count; i-- > in_registers;) {
+        emit_line(emitter, "pushq %s", operand(emitter, args[i]).text);
+    }
+    if (!arguments_conflict(emitter, args, in_registers)) {
+        for (u32 i = 0; i < in_registers; i++) load(emitter, args[i], argument_registers[i]);
+        return stack_args * 8 + padding;
+    }
+    for (u32 i = in_registers; i-- > 0;) {
+        emit_line(emitter, "pushq %s", operand(emitter, args[i]).text);
+    }
+    for (u32 i = 0; i < in_registers; i++) {
+        emit_line(emitter, "popq %s", register_names[argument_registers[i]]);
+    }
+    return stack_args * 8 + padding;
+}
+
+static void emit_call(Emitter* emitter, const char* symbol, i32* args, u32 count) {
+    u32 stack_bytes = emit_arguments(emitter, args, count);
+    emit_line(emitter, "call %s", symbol);
+    if (stack_bytes > 0) emit_line(emitter, "addq $%u, %%rsp", stack_bytes);
+}
+
+static void emit_epilogue(Emitter* emitter) {
+    if (emitter->saved_count == 0) {
+        emit_line(emitter, "movq %%rbp, %%rsp");
+    } else {
+        emit_line(emitter, "leaq %d(%%rbp), %%rsp", -8 * (i32)emitter->saved_count);
+        for (u32 i = emitter->saved_count; i-- > 0;) {
+            emit_line(emitter, "popq %s", register_names[emitter->saved[i]]);
+        }
+    }
+    emit_line(emitter, "popq %%rbp");
+}
+
+static void emit_return(Emitter* emitter, IrInstruction* instruction) {
+    if (instruction->a == IR_NONE) {
+        emit_line(emitter, "xorl %%eax, %%eax");
+    } else {
+        load(emitter, instruction->a, RAX);
+    }
+    emit_epilogue(emitter);
+    emit_line(emitter, "ret");
+}
+
+static void emit_tail_call(Emitter* emitter, IrInstruction* instruction) {
+    char symbol[MAX_TOKEN_LENGTH + 32];
+    function_symbol(emitter, (u32)instruction->immediate, symbol, sizeof(symbol));
+    if (instruction->arg_count > ARGUMENT_REGISTERS) {
+        // Stack arguments would overwrite our own frame's caller's, so make a normal call
+        emit_call(emitter, symbol, instruction->args, instruction->arg_count);
+        emit_epilogue(emitter);
+        emit_line(emitter, "ret");
+        return;
+    }
+    emit_arguments(emitter, instruction->args, instruction->arg_count);
+    emit_epilogue(emitter);
+    emit_line(emitter, "jmp %s", symbol);
+}
+
+static void emit_print(Emitter* emitter, IrInstruction* instruction) {
+    const char* symbol;
+    switch ((StaticType)instruction->immediate) {
+        case TYPE_INT: symbol = SYMBOL_PREFIX "pepper_print_int"; break;
+        case TYPE_FLOAT: symbol = SYMBOL_PREFIX "pepper_print_float"; break;
+        case TYPE_BOOL: symbol = SYMBOL_PREFIX "pepper_print_bool"; break;
+        default: symbol = SYMBOL_PREFIX "pepper_print_nil"; break;
+    }
+    emit_call(emitter, symbol, &instruction->a, instruction->a == IR_NONE ? 0 : 1);
+}
+
+static void emit_const(Emitter* emitter, IrInstruction* instruction) {
+    Location location = location_of(emitter, instruction->dst);
+    if (location.kind == LOCATION_NONE) return;
+    i64 value = instruction->immediate;
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        emit_line(emitter, "movq $%ld, %s", value, operand(emitter, instruction->dst).text);
+        return;
+    }
+    i32 target = location.kind == LOCATION_REGISTER ? location.index : RAX;
+    emit_line(emitter, "movabsq $%ld, %s", value, register_names[target]);
+    store(emitter, target, instruction->dst);
+}
+
+static void emit_move(Emitter* emitter, IrInstruction* instruction) {
+    if (same_location(emitter, instruction->dst, instruction->a)) return;
+    if (location_of(emitter, instruction->dst).kind == LOCATION_NONE) return;
+    if (in_register(emitter, instruction->dst)) {
+        load(emitter, instruction->a, location_of(emitter, instruction->dst).index);
+        return;
+    }
+    if (in_register(emitter, instruction->a)) {
+        store(emitter, location_of(emitter, instruction->a).index, instruction->dst);
+        return;
+    }
+    load(emitter, instruction->a, RAX);
+    store(emitter, RAX, instruction->dst);
+}
+
+static void emit_instruction(Emitter* emitter, IrInstruction* instruction) {
+    char symbol[MAX_TOKEN_LENGTH + 32];
+    switch (instruction->op) {
+        case IR_CONST: emit_const(emitter, instruction); break;
+        case IR_MOVE: emit_move(emitter, instruction); break;
+        case IR_LOAD_GLOBAL: {
+            if (instruction->guarded) emit_guard(emitter, instruction);
+            global_symbol(emitter, instruction->immediate, symbol, sizeof(symbol));
+            i32 target = in_register(emitter, instruction->dst) ? location_of(emitter, instruction->dst).index : RAX;
+            emit_line(emitter, "movq %s(%%rip), %s", symbol, register_names[target]);
+            store(emitter, target, instruction->dst);
+            break;
+        }
+        case IR_STORE_GLOBAL: {
+            global_symbol(emitter, instruction->immediate, symbol, sizeof(symbol));
+            i32 source = in_register(emitter, instruction->a) ? location_of(emitter, instruction->a).index : RAX;
+            load(emitter, instruction->a, source);
+            if (instruction->guarded) emit_guard(emitter, instruction);
+            emit_line(emitter, "movq %s, %s(%%rip)", register_names[source], symbol);
+            break;
+        }
+        case IR_ADD: emit_arithmetic(emitter, instruction, "addq"); break;
+        case IR_SUB: emit_arithmetic(emitter, instruction, "subq"); break;
+        case IR_MUL: emit_arithmetic(emitter, instruction, "imulq"); break;
+        case IR_DIV: emit_divide(emitter, instruction); break;
+        case IR_NEG: emit_unary(emitter, instruction, "negq %s"); break;
+        case IR_NOT: emit_unary(emitter, instruction, "xorq $1, %s"); break;
+        case IR_FADD: emit_float_arithmetic(emitter, instruction, "addsd"); break;
+        case IR_FSUB: emit_float_arithmetic(emitter, instruction, "subsd"); break;
+        case IR_FMUL: emit_float_arithmetic(emitter, instruction, "mulsd"); break;
+        case IR_FDIV: emit_float_arithmetic(emitter, instruction, "divsd"); break;
+        // Flips the sign bit
+        case IR_FNEG: emit_unary(emitter, instruction, "btcq $63, %s"); break;
+        case IR_COMPARE: emit_compare(emitter, instruction); break;
+        case IR_FCOMPARE: emit_float_compare_value(emitter, instruction); break;
+        case IR_LABEL:
+            fprintf(emitter->out, LABEL_PREFIX "%u_%d:\n", emitter->function_index, instruction->label);
+            break;
+        case IR_JUMP: emit_label_reference(emitter, "jmp", instruction->label); break;
+        case IR_BRANCH:
+            emit_line(emitter, "cmpq $0, %s", operand(emitter, instruction->a).text);
+            emit_label_reference(emitter, instruction->condition == IR_EQ ? "je" : "jne", instruction->label);
+            break;
+        case IR_BRANCH_COMPARE: {
+            char mnemonic[8];
+            emit_int_compare(emitter, instruction);
+            snprintf(mnemonic, sizeof(mnemonic), "j%s", condition_suffix(instruction->condition));
+            emit_label_reference(emitter, mnemonic, instruction->label);
+            break;
+        }
+        case IR_FBRANCH_COMPARE: emit_float_branch(emitter, instruction); break;
+        case IR_CALL:
+            function_symbol(emitter, (u32)instruction->immediate, symbol, sizeof(symbol));
+            emit_call(emitter, symbol, instruction->args, instruction->arg_count);
+            store(emitter, RAX, instruction->dst);
+            break;
+        case IR_TAIL_CALL: emit_tail_call(emitter, instruction); break;
+        case IR_PRINT: emit_print(emitter, instruction); break;
+        case IR_RETURN: emit_return(emitter, instruction); break;
+    }
+}
+
+// Saves the callee-saved registers the allocator used and makes room for
+// spills, keeping the stack 16 byte aligned for calls
+static void emit_prologue(Emitter* emitter) {
+    IrFunction* function = emitter->function;
+    emit_line(emitter, "pushq %%rbp");
+    emit_line(emitter, "movq %%rsp, %%rbp");
+    emitter->saved_count = 0;
+    for (u32 i = 0; i < register_pool.callee_saved_count; i++) {
+        i32 reg = register_pool.callee_saved[i];
+        if (emitter->allocation->used_registers & (1U << reg)) {
+            emitter->saved[emitter->saved_count++] = reg;
+            emit_line(emitter, "pushq %s", register_names[reg]);
+        }
+    }
+    u32 slots = emitter->allocation->spill_count;
+    if ((slots + emitter->saved_count) % 2 == 1) slots++;
+    if (slots > 0) emit_line(emitter, "subq $%u, %%rsp", slots * 8);
+
+    // Parameters move from the argument registers to wherever they live,
+    // through the stack if they would overwrite each other
+    u32 in_registers = function->parameter_count < ARGUMENT_REGISTERS ? function->parameter_count
+                                                                     : ARGUMENT_REGISTERS;
+    bool conflict = false;
+    for (u32 i = 0; i < in_registers; i++) {
+        if (!in_register(emitter, (i32)i)) continue;
+        for (u32 k = i + 1; k < in_registers; k++) {
+            if (location_of(emitter, (i32)i).index == argument_registers[k]) conflict = true;
+        }
+    }
+    for (u32 i = 0; i < in_registers && !conflict; i++) {
+        store(emitter, argument_registers[i], (i32)i);
+    }
+    for (u32 i = 0; i < in_registers && conflict; i++) {
+        emit_line(emitter, "pushq %s", register_names[argument_registers[i]]);
+    }
+    for (u32 i = in_registers; i-- > 0 && conflict;) {
+        if (location_of(emitter, (i32)i).kind == LOCATION_NONE) {
+            emit_line(emitter, "addq $8, %%rsp");
+        } else {
+            emit_line(emitter, "popq %s", operand(emitter, (i32)i).text);
+        }
+    }
+    for (u32 i = ARGUMENT_REGISTERS; i < function->parameter_count; i++) {
+        if (location_of(emitter, (i32)i).kind == LOCATION_NONE) continue;
+        emit_line(emitter, "movq %u(%%rbp), %%rax", 16 + 8 * (i - ARGUMENT_REGISTERS));
+        store(emitter, RAX, (i32)i);
+    }
+}
+
+static void emit_function(Emitter* emitter, u32 index) {
+    char symbol[MAX_TOKEN_LENGTH + 32];
+    emitter->function_index = index;
+    emitter->function = &emitter->ir->functions[index];
+    emitter->allocation = allocate_registers(emitter->function, &register_pool);
+    function_symbol(emitter, index, symbol, sizeof(symbol));
+
+    fprintf(emitter->out, "\n    .p2align 4\n");
+    if (index == 0) fprintf(emitter->out, "    .globl %s\n", symbol);
+    fprintf(emitter->out, "%s:\n", symbol);
+    emit_prologue(emitter);
+    for (u64 i = 0; i < emitter->function->count; i++) {
+        emit_instruction(emitter, &emitter->function->code[i]);
+    }
+    free_allocation(emitter->allocation);
+}
+
+void emit_assembly(IrProgram* ir, FILE* out) {
+    Emitter emitter = {.out = out, .ir = ir};
+    fprintf(out, "# Generated by pepper\n    .text\n");
+    for (u32 i = 0; i < ir->function_count; i++) {
+        emit_function(&emitter, i);
+    }
+
+    char symbol[MAX_TOKEN_LENGTH + 32];
+    fprintf(out, "\n    .data\n    .p2align 3\n");
+    for (u32 i = 0; i < ir->checked->global_count; i++) {
+        global_symbol(&emitter, i, symbol, sizeof(symbol));
+        fprintf(out, "%s:\n    .quad 0\n", symbol);
+    }
+    for (u32 i = 0; i < ir->checked->global_count; i++) {
+        if (!ir->checked->globals[i].maybe_undefined) continue;
+        defined_symbol(&emitter, i, symbol, sizeof(symbol));
+        fprintf(out, "%s:\n    .byte 0\n", symbol);
+        name_symbol(&emitter, i, symbol, sizeof(symbol));
+        fprintf(out, "%s:\n    .asciz \"%s\"\n", symbol, ir->checked->globals[i].name);
+    }
+#ifdef __linux__
+    fprintf(out, "\n    .section .note.GNU-stack,\"\",@progbits\n");
+#endif
+}
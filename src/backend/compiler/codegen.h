@@ -0,0 +1,13 @@
+#ifndef pepper_codegen_h
+#define pepper_codegen_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "ir.h"
+
+// Writes the program as x86-64 assembly in AT&T syntax for the system
+// assembler. The script becomes pepper_main, which the runtime's main calls.
+void emit_assembly(IrProgram* ir, FILE* out);
+
+#endif
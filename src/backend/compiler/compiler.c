@@ -1,2 +1,190 @@
+#define _DEFAULT_SOURCE 1
+#define MEMORY_TAG MEMORY_COMPILER
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "compiler.h"
+#include "checker.h"
+#include "memory.h"
+#include "transpiler.h"
+
+Compiler* init_compiler(const char* output_path, CompileTarget target) {
+    Compiler* compiler = ALLOCATE(Compiler, 1);
+    compiler->output_path = output_path;
+    compiler->target = target;
+    const char* cc = getenv("CC");
+    compiler->cc = cc != NULL && cc[0] != '\0' ? cc : "cc";
+    return compiler;
+}
+
+void free_compiler(Compiler* compiler) {
+    FREE(Compiler, compiler);
+}
+
+static bool ends_with(const char* string, const char* suffix) {
+    u64 length = strlen(string);
+    u64 suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(string + length - suffix_length, suffix) == 0;
+}
+
+static FILE* open_output(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) fprintf(stderr, "Could not write \"%s\".\n", path);
+    return file;
+}
+
+static bool make_build_directory(char* directory, size_t size) {
+    const char* tmp = getenv("TMPDIR");
+    snprintf(directory, size, "%s/pepper-XXXXXX", tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp");
+    if (mkdtemp(directory) == NULL) {
+        fprintf(stderr, "Could not create a temporary directory.\n");
+        return false;
+    }
+    return true;
+}
+
+// Runs the C compiler directly rather than through the shell, so paths
+// don't need quoting. The second source may be NULL.
+static bool link_executable(Compiler* compiler, const char* source, const char* other_source) {
+    const char* argv[] = {compiler->cc, "-O2", "-o", compiler->output_path, source, other_source, NULL};
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "Could not start %s.\n", compiler->cc);
+        return false;
+    }
+    if (pid == 0) {
+        execvp(argv[0], (char* const*)argv);
+        fprintf(stderr, "Could not run %s.\n", compiler->cc);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) == -1) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool write_c(CheckedProgram* checked, const char* path) {
+    FILE* file = open_output(path);
+    if (file == NULL) return false;
+    emit_c(checked, file);
+    return fclose(file) == 0;
+}
+
+static bool build_c(Compiler* compiler, CheckedProgram* checked) {
+    if (ends_with(compiler->output_path, ".c")) return write_c(checked, compiler->output_path);
+
+    char directory[4096];
+    if (!make_build_directory(directory, sizeof(directory))) return false;
+    char source[4200];
+    snprintf(source, sizeof(source), "%s/program.c", directory);
+    bool ok = write_c(checked, source) && link_executable(compiler, source, NULL);
+    unlink(source);
+    rmdir(directory);
+    return ok;
+}
+
+#ifdef NATIVE_SUPPORTED
+
+#include "ir.h"
+#include "codegen.h"
+
+// Linked into every executable. Output matches the VM's print_value.
+static const char* runtime_source =
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "void pepper_main(void);\n"
+    "\n"
+    "void pepper_print_int(int64_t value) { printf(\"%ld\\n\", (long)value); }\n"
+    "\n"
+    "void pepper_print_float(int64_t bits) {\n"
+    "    double value;\n"
+    "    memcpy(&value, &bits, sizeof(value));\n"
+    "    printf(\"%f\\n\", value);\n"
+    "}\n"
+    "\n"
+    "void pepper_print_bool(int64_t value) { puts(value ? \"true\" : \"false\"); }\n"
+    "\n"
+    "void pepper_print_nil(void) { puts(\"nil\"); }\n"
+    "\n"
+    "void pepper_division_by_zero(void) {\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"[ERROR]: Division by zero.\\n\\n\");\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "void pepper_undefined_variable(const char* name) {\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"[ERROR]: Undefined variable '%s'.\\n\\n\", name);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "int main(void) {\n"
+    "    pepper_main();\n"
+    "    return 0;\n"
+    "}\n";
+
+static bool write_assembly(IrProgram* ir, const char* path) {
+    FILE* file = open_output(path);
+    if (file == NULL) return false;
+    emit_assembly(ir, file);
+    return fclose(file) == 0;
+}
+
+static bool write_runtime(const char* path) {
+    FILE* file = open_output(path);
+    if (file == NULL) return false;
+    fputs(runtime_source, file);
+    return fclose(file) == 0;
+}
+
+static bool assemble(Compiler* compiler, IrProgram* ir) {
+    if (ends_with(compiler->output_path, ".s")) return write_assembly(ir, compiler->output_path);
+
+    char directory[4096];
+    if (!make_build_directory(directory, sizeof(directory))) return false;
+    char assembly[4200];
+    char runtime[4200];
+    snprintf(assembly, sizeof(assembly), "%s/program.s", directory);
+    snprintf(runtime, sizeof(runtime), "%s/runtime.c", directory);
+    bool ok = write_assembly(ir, assembly) && write_runtime(runtime) && link_executable(compiler, assembly, runtime);
+    unlink(assembly);
+    unlink(runtime);
+    rmdir(directory);
+    return ok;
+}
+
+static bool build_assembly(Compiler* compiler, CheckedProgram* checked) {
+    IrProgram* ir = lower_program(checked);
+#ifdef DEBUG_MODE_COMPILER
+    for (u32 i = 0; i < ir->function_count; i++) {
+        print_ir_function(&ir->functions[i]);
+    }
+#endif
+    bool ok = assemble(compiler, ir);
+    free_ir_program(ir);
+    return ok;
+}
+
+#else
+
+static bool build_assembly(Compiler* compiler, CheckedProgram* checked) {
+    (void)compiler;
+    (void)checked;
+    fprintf(stderr, "Native compilation needs an x86-64 Linux or macOS host; use --target c instead.\n");
+    return false;
+}
+
+#endif
 
+bool compile(Compiler* compiler, Program* program) {
+    CheckedProgram* checked = check_program(program);
+    bool ok = false;
+    if (!checked->has_error) {
+        ok = compiler->target == TARGET_C ? build_c(compiler, checked) : build_assembly(compiler, checked);
+    }
+    free_checked_program(checked);
+    return ok;
+}
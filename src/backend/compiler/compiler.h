@@ -1,14 +1,40 @@
 #ifndef pepper_compiler_h
 #define pepper_compiler_h
 
-#include "vm.h"
+#include "common.h"
+#include "parser.h"
+
+// Ahead-of-time compilation to a standalone executable. The program is
+// checked and then written out for the system C compiler to build, either as
+// x86-64 assembly linked against a small runtime that does the printing, or
+// as a single C file.
+//
+// Compiled programs print and fail as the VM does, with these differences:
+// - Strings can't be compiled yet.
+// - Top-level code using a global before its definition is a compile error,
+//   where the VM stops with "Undefined variable" once it gets there.
+//   Functions the script calls before a global's definition check it at
+//   runtime, with the VM's error.
+typedef enum {
+    // Lowered to IR, register allocated and emitted as assembly
+    TARGET_ASSEMBLY,
+    // Transpiled to C, which works on any host with a C compiler
+    TARGET_C,
+} CompileTarget;
 
 typedef struct {
-    void* constants;
+    const char* output_path;
+    CompileTarget target;
+    // $CC, or cc
+    const char* cc;
 } Compiler;
 
-Compiler* init_compiler();
+Compiler* init_compiler(const char* output_path, CompileTarget target);
+void free_compiler(Compiler* compiler);
 
-void compile(const char* source);
+// Writes just the assembly or the C when the output path ends in .s or .c
+// respectively. Reports errors to stderr and returns false if the program
+// can't be compiled.
+bool compile(Compiler* compiler, Program* program);
 
 #endif
@@ -0,0 +1,545 @@
+#define MEMORY_TAG MEMORY_COMPILER
+#include <string.h>
+
+#include "ir.h"
+#include "memory.h"
+
+typedef struct {
+    CheckedProgram* checked;
+    CheckedFunction* source;
+    IrFunction* function;
+} Lowerer;
+
+static void lower_statement(Lowerer* lowerer, Statement* statement);
+static i32 lower_expression(Lowerer* lowerer, Expression* expression);
+
+IrCondition negate_condition(IrCondition condition) {
+    // Conditions are laid out in pairs
+    return (IrCondition)(condition ^ 1);
+}
+
+static IrInstruction* emit(Lowerer* lowerer, IrOp op) {
+    IrFunction* function = lowerer->function;
+    if (function->capacity < function->count + 1) {
+        u64 old_capacity = function->capacity;
+        function->capacity = GROW_CAPACITY(old_capacity);
+        function->code = GROW_ARRAY(IrInstruction, function->code, old_capacity, function->capacity);
+    }
+    IrInstruction* instruction = &function->code[function->count++];
+    *instruction = (IrInstruction){
+        .op = op,
+        .condition = IR_EQ,
+        .dst = IR_NONE,
+        .a = IR_NONE,
+        .b = IR_NONE,
+        .has_immediate = false,
+        .immediate = 0,
+        .guarded = false,
+        .label = 0,
+        .args = NULL,
+        .arg_count = 0,
+    };
+    return instruction;
+}
+
+static i32 new_temp(Lowerer* lowerer) {
+    return (i32)lowerer->function->vreg_count++;
+}
+
+static i32 new_label(Lowerer* lowerer) {
+    return (i32)lowerer->function->label_count++;
+}
+
+static void emit_label(Lowerer* lowerer, i32 label) {
+    emit(lowerer, IR_LABEL)->label = label;
+}
+
+static void emit_jump(Lowerer* lowerer, i32 label) {
+    emit(lowerer, IR_JUMP)->label = label;
+}
+
+static i32 emit_const(Lowerer* lowerer, i64 value) {
+    IrInstruction* instruction = emit(lowerer, IR_CONST);
+    instruction->dst = new_temp(lowerer);
+    instruction->immediate = value;
+    return instruction->dst;
+}
+
+static bool is_temp(Lowerer* lowerer, i32 vreg) {
+    return vreg >= (i32)lowerer->source->local_count;
+}
+
+// A temporary that was just computed is written straight into the local
+// instead of being copied
+static void assign_local(Lowerer* lowerer, i32 local, i32 value) {
+    IrFunction* function = lowerer->function;
+    if (is_temp(lowerer, value) && function->count > 0 && function->code[function->count - 1].dst == value) {
+        function->code[function->count - 1].dst = local;
+        return;
+    }
+    if (value == local) return;
+    IrInstruction* instruction = emit(lowerer, IR_MOVE);
+    instruction->dst = local;
+    instruction->a = value;
+}
+
+// Whether an access to the global needs a guard. Outside functions, the
+// checker already made sure globals are only used after their definitions.
+static bool is_guarded(Lowerer* lowerer, i64 global) {
+    return lowerer->source->name != NULL && lowerer->checked->globals[global].maybe_undefined;
+}
+
+static void assign_variable(Lowerer* lowerer, i32 variable, i32 value, bool defines) {
+    if (variable >= 0) {
+        assign_local(lowerer, variable, value);
+        return;
+    }
+    IrInstruction* instruction = emit(lowerer, IR_STORE_GLOBAL);
+    instruction->a = value;
+    instruction->immediate = -(variable + 1);
+    instruction->guarded = defines ? lowerer->checked->globals[instruction->immediate].maybe_undefined
+                                   : is_guarded(lowerer, instruction->immediate);
+}
+
+static bool is_comparison(OperatorType operator) {
+    switch (operator) {
+        case PARSE_OP_EQUALITY:
+        case PARSE_OP_NOT_EQUAL:
+        case PARSE_OP_GREATER:
+        case PARSE_OP_EQUAL_GREATER:
+        case PARSE_OP_LESS:
+        case PARSE_OP_EQUAL_LESS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static IrCondition comparison_condition(OperatorType operator) {
+    switch (operator) {
+        case PARSE_OP_EQUALITY: return IR_EQ;
+        case PARSE_OP_NOT_EQUAL: return IR_NE;
+        case PARSE_OP_GREATER: return IR_GT;
+        case PARSE_OP_EQUAL_GREATER: return IR_GE;
+        case PARSE_OP_LESS: return IR_LT;
+        default: return IR_LE;
+    }
+}
+
+// An int literal that fits in an instruction's 32 bit immediate
+static bool is_small_int(Expression* expression) {
+    return expression->type == EXPR_INT && expression->integer >= INT32_MIN && expression->integer <= INT32_MAX;
+}
+
+// Sets the right operand of a two-operand instruction, folding small literals
+static void lower_right_operand(Lowerer* lowerer, Expression* right, i32* b, bool* has_immediate, i64* immediate) {
+    if (is_small_int(right)) {
+        *has_immediate = true;
+        *immediate = right->integer;
+        return;
+    }
+    *has_immediate = false;
+    *b = lower_expression(lowerer, right);
+}
+
+// Emits code that jumps to label when the expression's truthiness is
+// jump_if, and falls through otherwise
+static void lower_branch(Lowerer* lowerer, Expression* expression, bool jump_if, i32 label) {
+    if (expression->type == EXPR_BOOL) {
+        if (expression->boolean == jump_if) emit_jump(lowerer, label);
+        return;
+    }
+    if (expression->type == EXPR_PREFIX && expression->prefix.operator == PARSE_OP_NOT &&
+        ((Expression*)expression->prefix.right)->static_type == TYPE_BOOL) {
+        lower_branch(lowerer, (Expression*)expression->prefix.right, !jump_if, label);
+        return;
+    }
+    if (expression->type == EXPR_INFIX) {
+        OperatorType operator = expression->infix.operator;
+        Expression* left = (Expression*)expression->infix.left;
+        Expression* right = (Expression*)expression->infix.right;
+        if (operator == PARSE_OP_AND || operator == PARSE_OP_OR) {
+            bool is_and = operator == PARSE_OP_AND;
+            if (is_and != jump_if) {
+                // Either operand alone decides the outcome
+                lower_branch(lowerer, left, jump_if, label);
+                lower_branch(lowerer, right, jump_if, label);
+                return;
+            }
+            i32 skip = new_label(lowerer);
+            lower_branch(lowerer, left, !jump_if, skip);
+            lower_branch(lowerer, right, jump_if, label);
+            emit_label(lowerer, skip);
+            return;
+        }
+        if (is_comparison(operator) && left->static_type == right->static_type && left->static_type != TYPE_NIL) {
+            IrCondition condition = comparison_condition(operator);
+            bool is_float = left->static_type == TYPE_FLOAT;
+            i32 a = lower_expression(lowerer, left);
+            i32 b = IR_NONE;
+            bool has_immediate = false;
+            i64 immediate = 0;
+            if (is_float) {
+                b = lower_expression(lowerer, right);
+            } else {
+                lower_right_operand(lowerer, right, &b, &has_immediate, &immediate);
+            }
+            IrInstruction* instruction = emit(lowerer, is_float ? IR_FBRANCH_COMPARE : IR_BRANCH_COMPARE);
+            instruction->condition = jump_if ? condition : negate_condition(condition);
+            instruction->a = a;
+            instruction->b = b;
+            instruction->has_immediate = has_immediate;
+            instruction->immediate = immediate;
+            instruction->label = label;
+            return;
+        }
+    }
+    i32 value = lower_expression(lowerer, expression);
+    if (expression->static_type != TYPE_BOOL) {
+        // Numbers are always truthy and nil never is
+        bool truthy = expression->static_type != TYPE_NIL;
+        if (truthy == jump_if) emit_jump(lowerer, label);
+        return;
+    }
+    IrInstruction* instruction = emit(lowerer, IR_BRANCH);
+    instruction->condition = jump_if ? IR_NE : IR_EQ;
+    instruction->a = value;
+    instruction->label = label;
+}
+
+static i32 lower_materialized_condition(Lowerer* lowerer, Expression* expression) {
+    i32 result = new_temp(lowerer);
+    i32 false_label = new_label(lowerer);
+    i32 end_label = new_label(lowerer);
+    lower_branch(lowerer, expression, false, false_label);
+    IrInstruction* instruction = emit(lowerer, IR_CONST);
+    instruction->dst = result;
+    instruction->immediate = 1;
+    emit_jump(lowerer, end_label);
+    emit_label(lowerer, false_label);
+    instruction = emit(lowerer, IR_CONST);
+    instruction->dst = result;
+    instruction->immediate = 0;
+    emit_label(lowerer, end_label);
+    return result;
+}
+
+static i32 lower_comparison(Lowerer* lowerer, Expression* expression) {
+    Expression* left = (Expression*)expression->infix.left;
+    Expression* right = (Expression*)expression->infix.right;
+    OperatorType operator = expression->infix.operator;
+    if (left->static_type != right->static_type || left->static_type == TYPE_NIL) {
+        // Only == and != get here. Values of different types are never equal,
+        // and nor is nil to nil, as in values_equal.
+        lower_expression(lowerer, left);
+        lower_expression(lowerer, right);
+        return emit_const(lowerer, operator == PARSE_OP_NOT_EQUAL);
+    }
+    bool is_float = left->static_type == TYPE_FLOAT;
+    i32 a = lower_expression(lowerer, left);
+    i32 b = IR_NONE;
+    bool has_immediate = false;
+    i64 immediate = 0;
+    if (is_float) {
+        b = lower_expression(lowerer, right);
+    } else {
+        lower_right_operand(lowerer, right, &b, &has_immediate, &immediate);
+    }
+    IrInstruction* instruction = emit(lowerer, is_float ? IR_FCOMPARE : IR_COMPARE);
+    instruction->condition = comparison_condition(operator);
+    instruction->dst = new_temp(lowerer);
+    instruction->a = a;
+    instruction->b = b;
+    instruction->has_immediate = has_immediate;
+    instruction->immediate = immediate;
+    return instruction->dst;
+}
+
+static i32 lower_infix(Lowerer* lowerer, Expression* expression) {
+    OperatorType operator = expression->infix.operator;
+    if (operator == PARSE_OP_AND || operator == PARSE_OP_OR) {
+        return lower_materialized_condition(lowerer, expression);
+    }
+    if (is_comparison(operator)) return lower_comparison(lowerer, expression);
+
+    bool is_float = expression->static_type == TYPE_FLOAT;
+    IrOp op;
+    switch (operator) {
+        case PARSE_OP_ADD: op = is_float ? IR_FADD : IR_ADD; break;
+        case PARSE_OP_MINUS: op = is_float ? IR_FSUB : IR_SUB; break;
+        case PARSE_OP_MULTIPLY: op = is_float ? IR_FMUL : IR_MUL; break;
+        default: op = is_float ? IR_FDIV : IR_DIV; break;
+    }
+    i32 a = lower_expression(lowerer, (Expression*)expression->infix.left);
+    i32 b = IR_NONE;
+    bool has_immediate = false;
+    i64 immediate = 0;
+    if (op == IR_ADD || op == IR_SUB || op == IR_MUL) {
+        lower_right_operand(lowerer, (Expression*)expression->infix.right, &b, &has_immediate, &immediate);
+    } else {
+        b = lower_expression(lowerer, (Expression*)expression->infix.right);
+    }
+    IrInstruction* instruction = emit(lowerer, op);
+    instruction->dst = new_temp(lowerer);
+    instruction->a = a;
+    instruction->b = b;
+    instruction->has_immediate = has_immediate;
+    instruction->immediate = immediate;
+    return instruction->dst;
+}
+
+static i32 lower_prefix(Lowerer* lowerer, Expression* expression) {
+    Expression* right = (Expression*)expression->prefix.right;
+    i32 value = lower_expression(lowerer, right);
+    if (expression->prefix.operator == PARSE_OP_NOT && right->static_type != TYPE_BOOL) {
+        // Only nil is falsey among the other types
+        return emit_const(lowerer, right->static_type == TYPE_NIL);
+    }
+    IrOp op = IR_NOT;
+    if (expression->prefix.operator == PARSE_OP_MINUS) {
+        op = right->static_type == TYPE_FLOAT ? IR_FNEG : IR_NEG;
+    }
+    IrInstruction* instruction = emit(lowerer, op);
+    instruction->dst = new_temp(lowerer);
+    instruction->a = value;
+    return instruction->dst;
+}
+
+static void lower_arguments(Lowerer* lowerer, Expression* expression, i32** args, u32* arg_count) {
+    *arg_count = (u32)expression->call.argument_count;
+    *args = *arg_count == 0 ? NULL : ALLOCATE(i32, *arg_count);
+    for (u32 i = 0; i < *arg_count; i++) {
+        (*args)[i] = lower_expression(lowerer, (Expression*)expression->call.arguments[i]);
+    }
+}
+
+static i32 lower_call(Lowerer* lowerer, Expression* expression) {
+    i32* args;
+    u32 arg_count;
+    lower_arguments(lowerer, expression, &args, &arg_count);
+    IrInstruction* instruction = emit(lowerer, IR_CALL);
+    instruction->dst = new_temp(lowerer);
+    instruction->immediate = ((Expression*)expression->call.callee)->variable;
+    instruction->args = args;
+    instruction->arg_count = arg_count;
+    return instruction->dst;
+}
+
+static i32 lower_expression(Lowerer* lowerer, Expression* expression) {
+    switch (expression->type) {
+        case EXPR_INT: return emit_const(lowerer, expression->integer);
+        case EXPR_FLOAT: {
+            i64 bits;
+            memcpy(&bits, &expression->floating_point, sizeof(bits));
+            return emit_const(lowerer, bits);
+        }
+        case EXPR_BOOL: return emit_const(lowerer, expression->boolean);
+        case EXPR_IDENT: {
+            if (expression->variable >= 0) return expression->variable;
+            IrInstruction* instruction = emit(lowerer, IR_LOAD_GLOBAL);
+            instruction->dst = new_temp(lowerer);
+            instruction->immediate = -(expression->variable + 1);
+            instruction->guarded = is_guarded(lowerer, instruction->immediate);
+            return instruction->dst;
+        }
+        case EXPR_INFIX: return lower_infix(lowerer, expression);
+        case EXPR_PREFIX: return lower_prefix(lowerer, expression);
+        case EXPR_CALL: return lower_call(lowerer, expression);
+        default: return emit_const(lowerer, 0);
+    }
+}
+
+static void lower_if(Lowerer* lowerer, Expression* expression) {
+    i32 else_label = new_label(lowerer);
+    lower_branch(lowerer, (Expression*)expression->if_expr.condition, false, else_label);
+    lower_statement(lowerer, (Statement*)expression->if_expr.consequence);
+    if (expression->if_expr.alternative == NULL) {
+        emit_label(lowerer, else_label);
+        return;
+    }
+    i32 end_label = new_label(lowerer);
+    emit_jump(lowerer, end_label);
+    emit_label(lowerer, else_label);
+    lower_statement(lowerer, (Statement*)expression->if_expr.alternative);
+    emit_label(lowerer, end_label);
+}
+
+static bool is_always_true(Expression* condition) {
+    return condition == NULL || (condition->type == EXPR_BOOL && condition->boolean);
+}
+
+// Rotated like the bytecode: the condition sits at the bottom and branches
+// back to the body
+static void lower_loop(Lowerer* lowerer, Statement* statement) {
+    Expression* condition = (Expression*)statement->loop.condition;
+    if (statement->loop.initializer != NULL) lower_statement(lowerer, statement->loop.initializer);
+    i32 body_label = new_label(lowerer);
+    i32 condition_label = new_label(lowerer);
+    if (!is_always_true(condition)) emit_jump(lowerer, condition_label);
+    emit_label(lowerer, body_label);
+    lower_statement(lowerer, statement->loop.body);
+    if (statement->loop.increment != NULL) lower_statement(lowerer, statement->loop.increment);
+    emit_label(lowerer, condition_label);
+    if (is_always_true(condition)) {
+        emit_jump(lowerer, body_label);
+        return;
+    }
+    lower_branch(lowerer, condition, true, body_label);
+}
+
+static void lower_return(Lowerer* lowerer, Statement* statement) {
+    if (statement->value != NULL && statement->value->type == EXPR_CALL) {
+        Expression* call = statement->value;
+        i32* args;
+        u32 arg_count;
+        lower_arguments(lowerer, call, &args, &arg_count);
+        IrInstruction* instruction = emit(lowerer, IR_TAIL_CALL);
+        instruction->immediate = ((Expression*)call->call.callee)->variable;
+        instruction->args = args;
+        instruction->arg_count = arg_count;
+        return;
+    }
+    if (statement->value == NULL) {
+        emit(lowerer, IR_RETURN);
+        return;
+    }
+    i32 value = lower_expression(lowerer, statement->value);
+    emit(lowerer, IR_RETURN)->a = value;
+}
+
+static void lower_statement(Lowerer* lowerer, Statement* statement) {
+    switch (statement->type) {
+        case STMT_EXPRESSION:
+            if (statement->value->type == EXPR_IF) {
+                lower_if(lowerer, statement->value);
+                break;
+            }
+            lower_expression(lowerer, statement->value);
+            break;
+        case STMT_PRINT: {
+            i32 value = lower_expression(lowerer, statement->value);
+            IrInstruction* instruction = emit(lowerer, IR_PRINT);
+            instruction->a = statement->value->static_type == TYPE_NIL ? IR_NONE : value;
+            instruction->immediate = statement->value->static_type;
+            break;
+        }
+        case STMT_INSTANTIATE:
+        case STMT_ASSIGN:
+            assign_variable(lowerer, statement->variable, lower_expression(lowerer, statement->value),
+                            statement->type == STMT_INSTANTIATE);
+            break;
+        case STMT_RETURN: lower_return(lowerer, statement); break;
+        case STMT_BLOCK:
+            for (u64 i = 0; i < statement->block.statement_count; i++) {
+                lower_statement(lowerer, &statement->block.statements[i]);
+            }
+            break;
+        case STMT_WHILE:
+        case STMT_FOR: lower_loop(lowerer, statement); break;
+        // Functions are lowered separately
+        case STMT_FUNCTION:
+        default: break;
+    }
+}
+
+static void lower_function(CheckedProgram* checked, CheckedFunction* source, IrFunction* function) {
+    function->name = source->name;
+    function->parameter_count = source->parameter_count;
+    function->vreg_count = source->local_count;
+    function->label_count = 0;
+    function->code = NULL;
+    function->count = 0;
+    function->capacity = 0;
+
+    Lowerer lowerer = {.checked = checked, .source = source, .function = function};
+    if (source->declaration == NULL) {
+        Program* program = checked->program;
+        for (u64 i = 0; i < program->statements.count; i++) {
+            lower_statement(&lowerer, &program->statements.items[i]);
+        }
+    } else {
+        lower_statement(&lowerer, source->declaration->function.body);
+    }
+    emit(&lowerer, IR_RETURN);
+}
+
+IrProgram* lower_program(CheckedProgram* checked) {
+    IrProgram* ir = ALLOCATE(IrProgram, 1);
+    ir->checked = checked;
+    ir->function_count = checked->function_count;
+    ir->functions = ALLOCATE(IrFunction, ir->function_count);
+    for (u32 i = 0; i < ir->function_count; i++) {
+        lower_function(checked, &checked->functions[i], &ir->functions[i]);
+    }
+    return ir;
+}
+
+void free_ir_program(IrProgram* ir) {
+    for (u32 i = 0; i < ir->function_count; i++) {
+        IrFunction* function = &ir->functions[i];
+        for (u64 j = 0; j < function->count; j++) {
+            FREE_ARRAY(i32, function->code[j].args, function->code[j].arg_count);
+        }
+        FREE_ARRAY(IrInstruction, function->code, function->capacity);
+    }
+    FREE_ARRAY(IrFunction, ir->functions, ir->function_count);
+    FREE(IrProgram, ir);
+}
+
+#ifdef DEBUG_MODE_COMPILER
+static const char* op_names[] = {
+    "const", "move", "load_global", "store_global", "add", "sub", "mul", "div", "neg",
+    "fadd", "fsub", "fmul", "fdiv", "fneg", "compare", "fcompare", "not", "label", "jump",
+    "branch", "branch_compare", "fbranch_compare", "call", "tail_call", "print", "return",
+};
+
+static const char* condition_names[] = {"eq", "ne", "lt", "ge", "gt", "le"};
+
+void print_ir_function(IrFunction* function) {
+    printf("== %s ==\n", function->name != NULL ? function->name : "<script>");
+    for (u64 i = 0; i < function->count; i++) {
+        IrInstruction* instruction = &function->code[i];
+        if (instruction->op == IR_LABEL) {
+            printf("L%d:\n", instruction->label);
+            continue;
+        }
+        printf("%04lu    %-16s", i, op_names[instruction->op]);
+        if (instruction->op == IR_COMPARE || instruction->op == IR_FCOMPARE || instruction->op == IR_BRANCH ||
+            instruction->op == IR_BRANCH_COMPARE || instruction->op == IR_FBRANCH_COMPARE) {
+            printf(" %s", condition_names[instruction->condition]);
+        }
+        if (instruction->dst != IR_NONE) printf(" v%d =", instruction->dst);
+        if (instruction->a != IR_NONE) printf(" v%d", instruction->a);
+        if (instruction->has_immediate) {
+            printf(" #%ld", instruction->immediate);
+        } else if (instruction->b != IR_NONE) {
+            printf(" v%d", instruction->b);
+        }
+        switch (instruction->op) {
+            case IR_CONST:
+            case IR_LOAD_GLOBAL:
+            case IR_STORE_GLOBAL:
+            case IR_PRINT:
+                printf(" #%ld%s", instruction->immediate, instruction->guarded ? " guarded" : "");
+                break;
+            case IR_CALL:
+            case IR_TAIL_CALL:
+                printf(" f%ld(", instruction->immediate);
+                for (u32 a = 0; a < instruction->arg_count; a++) {
+                    printf(a == 0 ? "v%d" : ", v%d", instruction->args[a]);
+                }
+                printf(")");
+                break;
+            case IR_JUMP:
+            case IR_BRANCH:
+            case IR_BRANCH_COMPARE:
+            case IR_FBRANCH_COMPARE:
+                printf(" -> L%d", instruction->label);
+                break;
+            default:
+                break;
+        }
+        printf("\n");
+    }
+}
+#endif
@@ -0,0 +1,107 @@
+#ifndef pepper_ir_h
+#define pepper_ir_h
+
+#include "common.h"
+#include "checker.h"
+
+// A three-address code for the native backend. Each function works on an
+// unlimited supply of virtual registers: locals own the first ones, in the
+// checker's order, and temporaries come after. Every value is 64 bits wide;
+// bools are 0 or 1 and floats travel as their bit pattern.
+
+typedef enum {
+    IR_CONST,
+    IR_MOVE,
+    IR_LOAD_GLOBAL,
+    IR_STORE_GLOBAL,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_NEG,
+    IR_FADD,
+    IR_FSUB,
+    IR_FMUL,
+    IR_FDIV,
+    IR_FNEG,
+    // dst = a <condition> b, as a bool
+    IR_COMPARE,
+    IR_FCOMPARE,
+    // dst = !a for a bool
+    IR_NOT,
+    IR_LABEL,
+    IR_JUMP,
+    // Jumps when a != 0 with IR_NE, or when a == 0 with IR_EQ
+    IR_BRANCH,
+    // Jumps when a <condition> b
+    IR_BRANCH_COMPARE,
+    IR_FBRANCH_COMPARE,
+    IR_CALL,
+    IR_TAIL_CALL,
+    IR_PRINT,
+    IR_RETURN,
+} IrOp;
+
+// Every condition's negation is also a condition, which is what lets a branch
+// be flipped. For floats GE and LE mean !(a < b) and !(a > b), which is how
+// the VM evaluates them, so they're true when either side is NaN.
+typedef enum {
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_GE,
+    IR_GT,
+    IR_LE,
+} IrCondition;
+
+#define IR_NONE -1
+
+typedef struct {
+    IrOp op;
+    IrCondition condition;
+    // Virtual registers, or IR_NONE
+    i32 dst;
+    i32 a;
+    i32 b;
+    // When set, b is unused and immediate is the right operand
+    bool has_immediate;
+    // The constant for IR_CONST, the global for loads and stores, the callee
+    // for calls and the type for IR_PRINT
+    i64 immediate;
+    // For a global that might not be defined yet: loads and stores in
+    // functions check that it is, and the store defining it marks it
+    bool guarded;
+    // For labels, jumps and branches
+    i32 label;
+    i32* args;
+    u32 arg_count;
+} IrInstruction;
+
+typedef struct {
+    // NULL for the script
+    const char* name;
+    u32 parameter_count;
+    u32 vreg_count;
+    u32 label_count;
+    IrInstruction* code;
+    u64 count;
+    u64 capacity;
+} IrFunction;
+
+typedef struct {
+    CheckedProgram* checked;
+    IrFunction* functions;
+    u32 function_count;
+} IrProgram;
+
+IrCondition negate_condition(IrCondition condition);
+
+// Lowers a program that passed the checker
+IrProgram* lower_program(CheckedProgram* checked);
+void free_ir_program(IrProgram* ir);
+
+#ifdef DEBUG_MODE_COMPILER
+void print_ir_function(IrFunction* function);
+#endif
+
+#endif
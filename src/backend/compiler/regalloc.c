@@ -0,0 +1,341 @@
+#define MEMORY_TAG MEMORY_COMPILER
+#include <string.h>
+
+#include "regalloc.h"
+#include "memory.h"
+
+// Instruction i sits at position i + 1. Position zero is the function entry,
+// where the parameters arrive.
+#define POSITION(index) ((i32)(index) + 1)
+
+typedef struct {
+    u64 first;
+    // One past the last instruction
+    u64 end;
+    u32 successors[2];
+    u32 successor_count;
+} Block;
+
+typedef struct {
+    i32 vreg;
+    i32 start;
+    i32 end;
+    bool crosses_call;
+} Interval;
+
+typedef struct {
+    IrFunction* function;
+    Block* blocks;
+    u32 block_count;
+    u32 words;
+    // Bitsets over virtual registers, words per block
+    u64* use;
+    u64* def;
+    u64* live_in;
+    u64* live_out;
+} Liveness;
+
+static bool is_terminator(IrOp op) {
+    switch (op) {
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_BRANCH_COMPARE:
+        case IR_FBRANCH_COMPARE:
+        case IR_RETURN:
+        case IR_TAIL_CALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_call(IrOp op) {
+    return op == IR_CALL || op == IR_PRINT;
+}
+
+// Fills uses with the virtual registers the instruction reads
+static u32 get_uses(IrInstruction* instruction, i32* uses) {
+    if (instruction->op == IR_CALL || instruction->op == IR_TAIL_CALL) {
+        for (u32 i = 0; i < instruction->arg_count; i++) uses[i] = instruction->args[i];
+        return instruction->arg_count;
+    }
+    u32 count = 0;
+    if (instruction->a != IR_NONE) uses[count++] = instruction->a;
+    if (instruction->b != IR_NONE && !instruction->has_immediate) uses[count++] = instruction->b;
+    return count;
+}
+
+static void set_bit(u64* set, i32 bit) {
+    set[bit / 64] |= 1UL << (bit % 64);
+}
+
+static bool has_bit(u64* set, i32 bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1UL;
+}
+
+static void build_blocks(Liveness* liveness) {
+    IrFunction* function = liveness->function;
+    liveness->blocks = ALLOCATE(Block, function->count);
+    u32* label_blocks = ALLOCATE(u32, function->label_count + 1);
+    u32 count = 0;
+    for (u64 i = 0; i < function->count; i++) {
+        bool leader = i == 0 || function->code[i].op == IR_LABEL || is_terminator(function->code[i - 1].op);
+        if (leader) {
+            if (count > 0) liveness->blocks[count - 1].end = i;
+            liveness->blocks[count++] = (Block){.first = i, .end = function->count, .successor_count = 0};
+        }
+        if (function->code[i].op == IR_LABEL) label_blocks[function->code[i].label] = count - 1;
+    }
+    for (u32 b = 0; b < count; b++) {
+        Block* block = &liveness->blocks[b];
+        IrInstruction* last = &function->code[block->end - 1];
+        switch (last->op) {
+            case IR_RETURN:
+            case IR_TAIL_CALL:
+                break;
+            case IR_JUMP:
+                block->successors[block->successor_count++] = label_blocks[last->label];
+                break;
+            case IR_BRANCH:
+            case IR_BRANCH_COMPARE:
+            case IR_FBRANCH_COMPARE:
+                block->successors[block->successor_count++] = label_blocks[last->label];
+                // fallthrough
+            default:
+                if (b + 1 < count) block->successors[block->successor_count++] = b + 1;
+                break;
+        }
+    }
+    liveness->block_count = count;
+    FREE_ARRAY(u32, label_blocks, function->label_count + 1);
+}
+
+static void compute_liveness(Liveness* liveness) {
+    IrFunction* function = liveness->function;
+    u32 words = liveness->words;
+    u64 size = (u64)liveness->block_count * words;
+    liveness->use = ALLOCATE(u64, size);
+    liveness->def = ALLOCATE(u64, size);
+    liveness->live_in = ALLOCATE(u64, size);
+    liveness->live_out = ALLOCATE(u64, size);
+    memset(liveness->use, 0, sizeof(u64) * size);
+    memset(liveness->def, 0, sizeof(u64) * size);
+    memset(liveness->live_in, 0, sizeof(u64) * size);
+    memset(liveness->live_out, 0, sizeof(u64) * size);
+
+    i32 uses[UINT8_COUNT];
+    for (u32 b = 0; b < liveness->block_count; b++) {
+        u64* use = &liveness->use[b * words];
+        u64* def = &liveness->def[b * words];
+        for (u64 i = liveness->blocks[b].first; i < liveness->blocks[b].end; i++) {
+            IrInstruction* instruction = &function->code[i];
+            u32 count = get_uses(instruction, uses);
+            for (u32 u = 0; u < count; u++) {
+                if (!has_bit(def, uses[u])) set_bit(use, uses[u]);
+            }
+            if (instruction->dst != IR_NONE) set_bit(def, instruction->dst);
+        }
+    }
+
+    // Backwards dataflow until nothing changes
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (u32 b = liveness->block_count; b-- > 0;) {
+            Block* block = &liveness->blocks[b];
+            u64* out = &liveness->live_out[b * words];
+            u64* in = &liveness->live_in[b * words];
+            for (u32 s = 0; s < block->successor_count; s++) {
+                u64* successor_in = &liveness->live_in[block->successors[s] * words];
+                for (u32 w = 0; w < words; w++) out[w] |= successor_in[w];
+            }
+            for (u32 w = 0; w < words; w++) {
+                u64 updated = liveness->use[b * words + w] | (out[w] & ~liveness->def[b * words + w]);
+                if (updated != in[w]) {
+                    in[w] = updated;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+static void extend(Interval* interval, i32 position) {
+    if (interval->start == -1 || position < interval->start) interval->start = position;
+    if (position > interval->end) interval->end = position;
+}
+
+// One conservative range per virtual register, from the first to the last
+// position where it is live in the linear order
+static Interval* build_intervals(Liveness* liveness) {
+    IrFunction* function = liveness->function;
+    Interval* intervals = ALLOCATE(Interval, function->vreg_count);
+    for (u32 v = 0; v < function->vreg_count; v++) {
+        intervals[v] = (Interval){.vreg = (i32)v, .start = -1, .end = -1, .crosses_call = false};
+    }
+    i32 uses[UINT8_COUNT];
+    for (u32 b = 0; b < liveness->block_count; b++) {
+        Block* block = &liveness->blocks[b];
+        i32 first = b == 0 ? 0 : POSITION(block->first);
+        i32 last = POSITION(block->end - 1);
+        for (u32 v = 0; v < function->vreg_count; v++) {
+            if (has_bit(&liveness->live_in[b * liveness->words], (i32)v)) extend(&intervals[v], first);
+            if (has_bit(&liveness->live_out[b * liveness->words], (i32)v)) extend(&intervals[v], last);
+        }
+        for (u64 i = block->first; i < block->end; i++) {
+            IrInstruction* instruction = &function->code[i];
+            u32 count = get_uses(instruction, uses);
+            for (u32 u = 0; u < count; u++) extend(&intervals[uses[u]], POSITION(i));
+            if (instruction->dst != IR_NONE) extend(&intervals[instruction->dst], POSITION(i));
+        }
+    }
+    // Parameters are written at the entry even when their first use is later
+    for (u32 p = 0; p < function->parameter_count; p++) {
+        if (intervals[p].start != -1) intervals[p].start = 0;
+    }
+
+    // calls[p] counts the calls at or before position p
+    u64 positions = function->count + 1;
+    u32* calls = ALLOCATE(u32, positions);
+    calls[0] = 0;
+    for (u64 i = 0; i < function->count; i++) {
+        calls[POSITION(i)] = calls[POSITION(i) - 1] + (is_call(function->code[i].op) ? 1 : 0);
+    }
+    for (u32 v = 0; v < function->vreg_count; v++) {
+        Interval* interval = &intervals[v];
+        if (interval->start == -1 || interval->end <= interval->start + 1) continue;
+        interval->crosses_call = calls[interval->end - 1] > calls[interval->start];
+    }
+    FREE_ARRAY(u32, calls, positions);
+    return intervals;
+}
+
+static int compare_starts(const void* a, const void* b) {
+    const Interval* left = *(const Interval* const*)a;
+    const Interval* right = *(const Interval* const*)b;
+    if (left->start != right->start) return left->start < right->start ? -1 : 1;
+    return left->vreg < right->vreg ? -1 : (left->vreg > right->vreg);
+}
+
+static bool is_callee_saved(const RegisterPool* pool, i32 reg) {
+    for (u32 i = 0; i < pool->callee_saved_count; i++) {
+        if (pool->callee_saved[i] == reg) return true;
+    }
+    return false;
+}
+
+static i32 take_register(const RegisterPool* pool, u32* available, Interval* interval, u32 parameter_count) {
+    bool crosses_call = interval->crosses_call;
+    if (interval->vreg < (i32)parameter_count && interval->vreg < (i32)pool->parameter_register_count) {
+        i32 hint = pool->parameter_registers[interval->vreg];
+        bool allowed = !crosses_call || is_callee_saved(pool, hint);
+        if (allowed && (*available & (1U << hint))) {
+            *available &= ~(1U << hint);
+            return hint;
+        }
+    }
+    if (!crosses_call) {
+        for (u32 i = 0; i < pool->caller_saved_count; i++) {
+            if (*available & (1U << pool->caller_saved[i])) {
+                *available &= ~(1U << pool->caller_saved[i]);
+                return pool->caller_saved[i];
+            }
+        }
+    }
+    for (u32 i = 0; i < pool->callee_saved_count; i++) {
+        if (*available & (1U << pool->callee_saved[i])) {
+            *available &= ~(1U << pool->callee_saved[i]);
+            return pool->callee_saved[i];
+        }
+    }
+    return -1;
+}
+
+static void spill(Allocation* allocation, i32 vreg) {
+    allocation->locations[vreg] = (Location){LOCATION_STACK, (i32)allocation->spill_count++};
+}
+
+static void linear_scan(Allocation* allocation, Interval* intervals, u32 count, u32 parameter_count,
+                        const RegisterPool* pool) {
+    Interval** sorted = ALLOCATE(Interval*, count);
+    u32 live = 0;
+    for (u32 v = 0; v < count; v++) {
+        if (intervals[v].start != -1) sorted[live++] = &intervals[v];
+    }
+    qsort(sorted, live, sizeof(Interval*), compare_starts);
+
+    u32 available = 0;
+    for (u32 i = 0; i < pool->caller_saved_count; i++) available |= 1U << pool->caller_saved[i];
+    for (u32 i = 0; i < pool->callee_saved_count; i++) available |= 1U << pool->callee_saved[i];
+
+    // Intervals holding a register, in no particular order
+    Interval** active = ALLOCATE(Interval*, live + 1);
+    u32 active_count = 0;
+    for (u32 i = 0; i < live; i++) {
+        Interval* current = sorted[i];
+        // An interval ending where this one starts keeps its register, so an
+        // instruction never writes a register it is still reading
+        for (u32 a = 0; a < active_count;) {
+            if (active[a]->end < current->start) {
+                available |= 1U << allocation->locations[active[a]->vreg].index;
+                active[a] = active[--active_count];
+            } else {
+                a++;
+            }
+        }
+        i32 reg = take_register(pool, &available, current, parameter_count);
+        if (reg != -1) {
+            allocation->locations[current->vreg] = (Location){LOCATION_REGISTER, reg};
+            allocation->used_registers |= 1U << reg;
+            active[active_count++] = current;
+            continue;
+        }
+        // Spill whichever interval ends last, if the current one can use its register
+        i32 victim = -1;
+        for (u32 a = 0; a < active_count; a++) {
+            i32 candidate = allocation->locations[active[a]->vreg].index;
+            if (current->crosses_call && !is_callee_saved(pool, candidate)) continue;
+            if (victim == -1 || active[a]->end > active[victim]->end) victim = (i32)a;
+        }
+        if (victim == -1 || active[victim]->end <= current->end) {
+            spill(allocation, current->vreg);
+            continue;
+        }
+        allocation->locations[current->vreg] = allocation->locations[active[victim]->vreg];
+        spill(allocation, active[victim]->vreg);
+        active[victim] = current;
+    }
+    FREE_ARRAY(Interval*, active, live + 1);
+    FREE_ARRAY(Interval*, sorted, count);
+}
+
+Allocation* allocate_registers(IrFunction* function, const RegisterPool* pool) {
+    Liveness liveness = {.function = function, .words = (function->vreg_count + 63) / 64};
+    build_blocks(&liveness);
+    compute_liveness(&liveness);
+    Interval* intervals = build_intervals(&liveness);
+
+    Allocation* allocation = ALLOCATE(Allocation, 1);
+    allocation->vreg_count = function->vreg_count;
+    allocation->locations = ALLOCATE(Location, function->vreg_count);
+    for (u32 v = 0; v < function->vreg_count; v++) {
+        allocation->locations[v] = (Location){LOCATION_NONE, 0};
+    }
+    allocation->spill_count = 0;
+    allocation->used_registers = 0;
+    linear_scan(allocation, intervals, function->vreg_count, function->parameter_count, pool);
+
+    u64 size = (u64)liveness.block_count * liveness.words;
+    FREE_ARRAY(u64, liveness.use, size);
+    FREE_ARRAY(u64, liveness.def, size);
+    FREE_ARRAY(u64, liveness.live_in, size);
+    FREE_ARRAY(u64, liveness.live_out, size);
+    FREE_ARRAY(Block, liveness.blocks, function->count);
+    FREE_ARRAY(Interval, intervals, function->vreg_count);
+    return allocation;
+}
+
+void free_allocation(Allocation* allocation) {
+    FREE_ARRAY(Location, allocation->locations, allocation->vreg_count);
+    FREE(Allocation, allocation);
+}
@@ -0,0 +1,46 @@
+#ifndef pepper_regalloc_h
+#define pepper_regalloc_h
+
+#include "common.h"
+#include "ir.h"
+
+// Linear-scan register allocation over an IrFunction. Registers are plain
+// numbers here; the code generator decides what they mean.
+
+typedef enum {
+    // The virtual register is never live
+    LOCATION_NONE,
+    LOCATION_REGISTER,
+    LOCATION_STACK,
+} LocationKind;
+
+typedef struct {
+    LocationKind kind;
+    // A register number, or a spill slot
+    i32 index;
+} Location;
+
+typedef struct {
+    // Only hold values that aren't live across a call
+    const i32* caller_saved;
+    u32 caller_saved_count;
+    const i32* callee_saved;
+    u32 callee_saved_count;
+    // Where parameters arrive, tried first so they needn't be moved
+    const i32* parameter_registers;
+    u32 parameter_register_count;
+} RegisterPool;
+
+typedef struct {
+    // One per virtual register
+    Location* locations;
+    u32 vreg_count;
+    u32 spill_count;
+    // Bit n is set when register n is handed out
+    u32 used_registers;
+} Allocation;
+
+Allocation* allocate_registers(IrFunction* function, const RegisterPool* pool);
+void free_allocation(Allocation* allocation);
+
+#endif
@@ -0,0 +1,680 @@
+#define MEMORY_TAG MEMORY_COMPILER
+#include <stdarg.h>
+#include <string.h>
+
+#include "transpiler.h"
+#include "memory.h"
+
+// Ints wrap and divide like the VM's, and printing matches print_value
+static const char* prelude =
+    "#include <inttypes.h>\n"
+    "#include <stdbool.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "\n"
+    "typedef uint8_t pepper_nil;\n"
+    "\n"
+    "static inline int64_t pepper_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }\n"
+    "static inline int64_t pepper_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }\n"
+    "static inline int64_t pepper_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }\n"
+    "static inline int64_t pepper_neg(int64_t a) { return (int64_t)(0 - (uint64_t)a); }\n"
+    "\n"
+    "static inline int64_t pepper_div(int64_t a, int64_t b) {\n"
+    "    if (b == 0) {\n"
+    "        fflush(stdout);\n"
+    "        fprintf(stderr, \"[ERROR]: Division by zero.\\n\\n\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return b == -1 ? pepper_neg(a) : a / b;\n"
+    "}\n"
+    "\n"
+    "static inline void pepper_check_defined(bool defined, const char* name) {\n"
+    "    if (defined) return;\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"[ERROR]: Undefined variable '%s'.\\n\\n\", name);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "static inline void pepper_print_int(int64_t value) { printf(\"%\" PRId64 \"\\n\", value); }\n"
+    "static inline void pepper_print_float(double value) { printf(\"%f\\n\", value); }\n"
+    "static inline void pepper_print_bool(bool value) { puts(value ? \"true\" : \"false\"); }\n"
+    "static inline void pepper_print_nil(pepper_nil value) { (void)value; puts(\"nil\"); }\n";
+
+// Names get a prefix that no other kind of name starts with, so they can't
+// clash with each other or with C:
+//   l<index>_name  locals       g_name  globals
+//   f_name         functions    t<n>    temporaries
+//   d_name         whether a global that might be used before its
+//                  definition has been defined yet
+
+typedef struct {
+    Expression* expression;
+    u32 temp;
+} Hoisted;
+
+typedef struct {
+    FILE* out;
+    CheckedProgram* checked;
+    i32 function_index;
+    CheckedFunction* function;
+    u32 depth;
+    u32 temp_count;
+    // Subexpressions the current statement already evaluated into temporaries
+    Hoisted* hoisted;
+    u32 hoisted_count;
+    u32 hoisted_capacity;
+} Transpiler;
+
+static void transpile_statement(Transpiler* transpiler, Statement* statement);
+static void write_expression(Transpiler* transpiler, Expression* expression);
+
+static void indent(Transpiler* transpiler) {
+    for (u32 i = 0; i < transpiler->depth; i++) {
+        fputs("    ", transpiler->out);
+    }
+}
+
+static void line(Transpiler* transpiler, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    indent(transpiler);
+    vfprintf(transpiler->out, format, args);
+    fputc('\n', transpiler->out);
+    va_end(args);
+}
+
+static const char* c_type(StaticType type) {
+    switch (type) {
+        case TYPE_FLOAT: return "double";
+        case TYPE_BOOL: return "bool";
+        case TYPE_NIL: return "pepper_nil";
+        default: return "int64_t";
+    }
+}
+
+static const char* print_suffix(StaticType type) {
+    switch (type) {
+        case TYPE_FLOAT: return "float";
+        case TYPE_BOOL: return "bool";
+        case TYPE_NIL: return "nil";
+        default: return "int";
+    }
+}
+
+static void write_variable(Transpiler* transpiler, i32 variable) {
+    if (variable >= 0) {
+        fprintf(transpiler->out, "l%d_%s", variable, transpiler->function->locals[variable].name);
+    } else {
+        fprintf(transpiler->out, "g_%s", transpiler->checked->globals[-(variable + 1)].name);
+    }
+}
+
+// Whether the variable is a global that the current function has to check
+// is defined before using it. Outside functions, the checker already made
+// sure globals are only used after their definitions.
+static bool is_guarded(Transpiler* transpiler, i32 variable) {
+    return variable < 0 && transpiler->function_index > 0 &&
+           transpiler->checked->globals[-(variable + 1)].maybe_undefined;
+}
+
+static void write_read(Transpiler* transpiler, i32 variable) {
+    if (!is_guarded(transpiler, variable)) {
+        write_variable(transpiler, variable);
+        return;
+    }
+    const char* name = transpiler->checked->globals[-(variable + 1)].name;
+    fprintf(transpiler->out, "(pepper_check_defined(d_%s, \"%s\"), g_%s)", name, name, name);
+}
+
+static bool is_logical(OperatorType operator) {
+    return operator == PARSE_OP_AND || operator == PARSE_OP_OR;
+}
+
+static bool has_call(Expression* expression) {
+    switch (expression->type) {
+        case EXPR_CALL: return true;
+        case EXPR_INFIX:
+            return has_call((Expression*)expression->infix.left) || has_call((Expression*)expression->infix.right);
+        case EXPR_PREFIX: return has_call((Expression*)expression->prefix.right);
+        default: return false;
+    }
+}
+
+static bool reads_global(Expression* expression) {
+    switch (expression->type) {
+        case EXPR_IDENT: return expression->variable < 0;
+        case EXPR_INFIX:
+            return reads_global((Expression*)expression->infix.left) ||
+                   reads_global((Expression*)expression->infix.right);
+        case EXPR_PREFIX: return reads_global((Expression*)expression->prefix.right);
+        case EXPR_CALL:
+            for (u64 i = 0; i < expression->call.argument_count; i++) {
+                if (reads_global((Expression*)expression->call.arguments[i])) return true;
+            }
+            return false;
+        default: return false;
+    }
+}
+
+// C leaves the order of operands and arguments unspecified, but the VM goes
+// left to right. Calls can only change globals, so an operand is evaluated
+// into a temporary first when a later operand could observe or change it.
+static bool must_hoist(Expression** operands, u32 count, u32 index) {
+    bool call = has_call(operands[index]);
+    bool global = reads_global(operands[index]);
+    if (!call && !global) return false;
+    for (u32 i = index + 1; i < count; i++) {
+        if (has_call(operands[i]) || (call && reads_global(operands[i]))) return true;
+    }
+    return false;
+}
+
+// Whether the expression needs statements before it to keep that order
+static bool needs_statements(Expression* expression) {
+    switch (expression->type) {
+        case EXPR_INFIX: {
+            Expression* operands[2] = {(Expression*)expression->infix.left, (Expression*)expression->infix.right};
+            if (!is_logical(expression->infix.operator) && must_hoist(operands, 2, 0)) return true;
+            return needs_statements(operands[0]) || needs_statements(operands[1]);
+        }
+        case EXPR_PREFIX: return needs_statements((Expression*)expression->prefix.right);
+        case EXPR_CALL: {
+            Expression** arguments = (Expression**)expression->call.arguments;
+            u32 count = (u32)expression->call.argument_count;
+            for (u32 i = 0; i < count; i++) {
+                if (must_hoist(arguments, count, i) || needs_statements(arguments[i])) return true;
+            }
+            return false;
+        }
+        default: return false;
+    }
+}
+
+static void add_hoisted(Transpiler* transpiler, Expression* expression, u32 temp) {
+    if (transpiler->hoisted_capacity < transpiler->hoisted_count + 1) {
+        u32 old_capacity = transpiler->hoisted_capacity;
+        transpiler->hoisted_capacity = GROW_CAPACITY(old_capacity);
+        transpiler->hoisted = GROW_ARRAY(Hoisted, transpiler->hoisted, old_capacity, transpiler->hoisted_capacity);
+    }
+    transpiler->hoisted[transpiler->hoisted_count++] = (Hoisted){expression, temp};
+}
+
+static bool find_hoisted(Transpiler* transpiler, Expression* expression, u32* temp) {
+    for (u32 i = 0; i < transpiler->hoisted_count; i++) {
+        if (transpiler->hoisted[i].expression == expression) {
+            *temp = transpiler->hoisted[i].temp;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void begin_statement(Transpiler* transpiler) {
+    transpiler->hoisted_count = 0;
+}
+
+static u32 evaluate_into_temp(Transpiler* transpiler, Expression* expression) {
+    u32 temp = transpiler->temp_count++;
+    indent(transpiler);
+    fprintf(transpiler->out, "%s t%u = ", c_type(expression->static_type), temp);
+    write_expression(transpiler, expression);
+    fputs(";\n", transpiler->out);
+    return temp;
+}
+
+static void hoist(Transpiler* transpiler, Expression* expression);
+
+static void hoist_operands(Transpiler* transpiler, Expression** operands, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        hoist(transpiler, operands[i]);
+        if (must_hoist(operands, count, i)) {
+            add_hoisted(transpiler, operands[i], evaluate_into_temp(transpiler, operands[i]));
+        }
+    }
+}
+
+// Writes the statements an expression needs before it, see must_hoist
+static void hoist(Transpiler* transpiler, Expression* expression) {
+    switch (expression->type) {
+        case EXPR_INFIX: {
+            Expression* left = (Expression*)expression->infix.left;
+            Expression* right = (Expression*)expression->infix.right;
+            if (!is_logical(expression->infix.operator)) {
+                Expression* operands[2] = {left, right};
+                hoist_operands(transpiler, operands, 2);
+                break;
+            }
+            hoist(transpiler, left);
+            if (!needs_statements(right)) break;
+            // The right operand's statements only run when it's evaluated
+            u32 temp = evaluate_into_temp(transpiler, left);
+            line(transpiler, expression->infix.operator == PARSE_OP_AND ? "if (t%u) {" : "if (!t%u) {", temp);
+            transpiler->depth++;
+            hoist(transpiler, right);
+            indent(transpiler);
+            fprintf(transpiler->out, "t%u = ", temp);
+            write_expression(transpiler, right);
+            fputs(";\n", transpiler->out);
+            transpiler->depth--;
+            line(transpiler, "}");
+            add_hoisted(transpiler, expression, temp);
+            break;
+        }
+        case EXPR_PREFIX: hoist(transpiler, (Expression*)expression->prefix.right); break;
+        case EXPR_CALL:
+            hoist_operands(transpiler, (Expression**)expression->call.arguments, (u32)expression->call.argument_count);
+            break;
+        default: break;
+    }
+}
+
+static void write_float(Transpiler* transpiler, f64 value) {
+    char buffer[32];
+    // Enough digits to read back the same double
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+    fputs(buffer, transpiler->out);
+    if (strpbrk(buffer, ".e") == NULL) fputs(".0", transpiler->out);
+}
+
+// Evaluates both operands for their effects and gives a known bool
+static void write_discarded(Transpiler* transpiler, Expression* left, Expression* right, bool result) {
+    fputs("((void)", transpiler->out);
+    write_expression(transpiler, left);
+    if (right != NULL) {
+        fputs(", (void)", transpiler->out);
+        write_expression(transpiler, right);
+    }
+    fprintf(transpiler->out, ", %s)", result ? "true" : "false");
+}
+
+static void write_comparison(Transpiler* transpiler, Expression* expression) {
+    Expression* left = (Expression*)expression->infix.left;
+    Expression* right = (Expression*)expression->infix.right;
+    OperatorType operator = expression->infix.operator;
+    // Values of different types are never equal, and nor is nil to nil
+    if (left->static_type != right->static_type || left->static_type == TYPE_NIL) {
+        write_discarded(transpiler, left, right, operator == PARSE_OP_NOT_EQUAL);
+        return;
+    }
+    // >= and <= are the negated opposite, as in the bytecode, which matters for NaN
+    if (operator == PARSE_OP_EQUAL_GREATER || operator == PARSE_OP_EQUAL_LESS) {
+        fputs("!(", transpiler->out);
+        write_expression(transpiler, left);
+        fputs(operator == PARSE_OP_EQUAL_GREATER ? " < " : " > ", transpiler->out);
+        write_expression(transpiler, right);
+        fputs(")", transpiler->out);
+        return;
+    }
+    const char* symbol;
+    switch (operator) {
+        case PARSE_OP_EQUALITY: symbol = "=="; break;
+        case PARSE_OP_NOT_EQUAL: symbol = "!="; break;
+        case PARSE_OP_GREATER: symbol = ">"; break;
+        default: symbol = "<"; break;
+    }
+    fputs("(", transpiler->out);
+    write_expression(transpiler, left);
+    fprintf(transpiler->out, " %s ", symbol);
+    write_expression(transpiler, right);
+    fputs(")", transpiler->out);
+}
+
+static void write_infix(Transpiler* transpiler, Expression* expression) {
+    Expression* left = (Expression*)expression->infix.left;
+    Expression* right = (Expression*)expression->infix.right;
+    const char* symbol;
+    const char* function;
+    switch (expression->infix.operator) {
+        case PARSE_OP_AND: symbol = "&&"; function = NULL; break;
+        case PARSE_OP_OR: symbol = "||"; function = NULL; break;
+        case PARSE_OP_ADD: symbol = "+"; function = "pepper_add"; break;
+        case PARSE_OP_MINUS: symbol = "-"; function = "pepper_sub"; break;
+        case PARSE_OP_MULTIPLY: symbol = "*"; function = "pepper_mul"; break;
+        case PARSE_OP_DIVIDE: symbol = "/"; function = "pepper_div"; break;
+        default: write_comparison(transpiler, expression); return;
+    }
+    if (function != NULL && expression->static_type == TYPE_INT) {
+        fprintf(transpiler->out, "%s(", function);
+        write_expression(transpiler, left);
+        fputs(", ", transpiler->out);
+        write_expression(transpiler, right);
+        fputs(")", transpiler->out);
+        return;
+    }
+    fputs("(", transpiler->out);
+    write_expression(transpiler, left);
+    fprintf(transpiler->out, " %s ", symbol);
+    write_expression(transpiler, right);
+    fputs(")", transpiler->out);
+}
+
+static void write_prefix(Transpiler* transpiler, Expression* expression) {
+    Expression* right = (Expression*)expression->prefix.right;
+    if (expression->prefix.operator == PARSE_OP_NOT && right->static_type != TYPE_BOOL) {
+        // Only nil is falsey among the other types
+        write_discarded(transpiler, right, NULL, right->static_type == TYPE_NIL);
+        return;
+    }
+    if (expression->prefix.operator == PARSE_OP_NOT) {
+        fputs("(!", transpiler->out);
+    } else {
+        fputs(right->static_type == TYPE_INT ? "pepper_neg(" : "(-", transpiler->out);
+    }
+    write_expression(transpiler, right);
+    fputs(")", transpiler->out);
+}
+
+static void write_call(Transpiler* transpiler, Expression* expression) {
+    CheckedFunction* callee = &transpiler->checked->functions[((Expression*)expression->call.callee)->variable];
+    fprintf(transpiler->out, "f_%s(", callee->name);
+    for (u64 i = 0; i < expression->call.argument_count; i++) {
+        if (i > 0) fputs(", ", transpiler->out);
+        write_expression(transpiler, (Expression*)expression->call.arguments[i]);
+    }
+    fputs(")", transpiler->out);
+}
+
+static void write_expression(Transpiler* transpiler, Expression* expression) {
+    u32 temp;
+    if (find_hoisted(transpiler, expression, &temp)) {
+        fprintf(transpiler->out, "t%u", temp);
+        return;
+    }
+    switch (expression->type) {
+        case EXPR_INT:
+            // The smallest int has no literal of its own in C
+            if (expression->integer == INT64_MIN) {
+                fputs("INT64_MIN", transpiler->out);
+            } else {
+                fprintf(transpiler->out, "%ld", expression->integer);
+            }
+            break;
+        case EXPR_FLOAT: write_float(transpiler, expression->floating_point); break;
+        case EXPR_BOOL: fputs(expression->boolean ? "true" : "false", transpiler->out); break;
+        case EXPR_IDENT: write_read(transpiler, expression->variable); break;
+        case EXPR_INFIX: write_infix(transpiler, expression); break;
+        case EXPR_PREFIX: write_prefix(transpiler, expression); break;
+        case EXPR_CALL: write_call(transpiler, expression); break;
+        default: fputs("0", transpiler->out); break;
+    }
+}
+
+// Writes the expression's truthiness as a C condition
+static void write_condition(Transpiler* transpiler, Expression* condition) {
+    if (condition->static_type == TYPE_BOOL) {
+        write_expression(transpiler, condition);
+        return;
+    }
+    // Numbers are always truthy and nil never is
+    write_discarded(transpiler, condition, NULL, condition->static_type != TYPE_NIL);
+}
+
+// Block bodies are written without their own braces
+static void transpile_body(Transpiler* transpiler, Statement* body) {
+    transpiler->depth++;
+    if (body->type == STMT_BLOCK) {
+        for (u64 i = 0; i < body->block.statement_count; i++) {
+            transpile_statement(transpiler, &body->block.statements[i]);
+        }
+    } else {
+        transpile_statement(transpiler, body);
+    }
+    transpiler->depth--;
+}
+
+static void transpile_if(Transpiler* transpiler, Expression* expression) {
+    Expression* condition = (Expression*)expression->if_expr.condition;
+    begin_statement(transpiler);
+    hoist(transpiler, condition);
+    indent(transpiler);
+    fputs("if (", transpiler->out);
+    write_condition(transpiler, condition);
+    fputs(") {\n", transpiler->out);
+    transpile_body(transpiler, (Statement*)expression->if_expr.consequence);
+    if (expression->if_expr.alternative != NULL) {
+        line(transpiler, "} else {");
+        transpile_body(transpiler, (Statement*)expression->if_expr.alternative);
+    }
+    line(transpiler, "}");
+}
+
+static void transpile_loop(Transpiler* transpiler, Statement* statement) {
+    Expression* condition = (Expression*)statement->loop.condition;
+    if (statement->loop.initializer != NULL) transpile_statement(transpiler, statement->loop.initializer);
+    begin_statement(transpiler);
+    if (condition == NULL) {
+        line(transpiler, "for (;;) {");
+    } else if (!needs_statements(condition)) {
+        indent(transpiler);
+        fputs("while (", transpiler->out);
+        write_condition(transpiler, condition);
+        fputs(") {\n", transpiler->out);
+    } else {
+        // The condition's statements have to run on every iteration
+        line(transpiler, "for (;;) {");
+        transpiler->depth++;
+        hoist(transpiler, condition);
+        indent(transpiler);
+        fputs("if (!", transpiler->out);
+        write_condition(transpiler, condition);
+        fputs(") break;\n", transpiler->out);
+        transpiler->depth--;
+    }
+    transpile_body(transpiler, statement->loop.body);
+    if (statement->loop.increment != NULL) {
+        transpiler->depth++;
+        transpile_statement(transpiler, statement->loop.increment);
+        transpiler->depth--;
+    }
+    line(transpiler, "}");
+}
+
+static bool is_self_call(Transpiler* transpiler, Expression* expression) {
+    return expression->type == EXPR_CALL &&
+           ((Expression*)expression->call.callee)->variable == transpiler->function_index;
+}
+
+// A call to the function itself in tail position becomes a jump back to the
+// top, so tail recursion runs in constant stack like it does in the VM. The C
+// compiler is left to turn other tail calls into jumps.
+static void transpile_tail_call(Transpiler* transpiler, Expression* call) {
+    Expression** arguments = (Expression**)call->call.arguments;
+    u32 count = (u32)call->call.argument_count;
+    hoist_operands(transpiler, arguments, count);
+    u32 first = transpiler->temp_count;
+    for (u32 i = 0; i < count; i++) {
+        evaluate_into_temp(transpiler, arguments[i]);
+    }
+    for (u32 i = 0; i < count; i++) {
+        indent(transpiler);
+        write_variable(transpiler, (i32)i);
+        fprintf(transpiler->out, " = t%u;\n", first + i);
+    }
+    line(transpiler, "goto tail;");
+}
+
+static void transpile_return(Transpiler* transpiler, Statement* statement) {
+    if (statement->value == NULL) {
+        line(transpiler, "return 0;");
+        return;
+    }
+    begin_statement(transpiler);
+    if (is_self_call(transpiler, statement->value)) {
+        transpile_tail_call(transpiler, statement->value);
+        return;
+    }
+    hoist(transpiler, statement->value);
+    indent(transpiler);
+    fputs("return ", transpiler->out);
+    write_expression(transpiler, statement->value);
+    fputs(";\n", transpiler->out);
+}
+
+static void transpile_statement(Transpiler* transpiler, Statement* statement) {
+    switch (statement->type) {
+        case STMT_EXPRESSION:
+            if (statement->value->type == EXPR_IF) {
+                transpile_if(transpiler, statement->value);
+                break;
+            }
+            begin_statement(transpiler);
+            hoist(transpiler, statement->value);
+            indent(transpiler);
+            if (statement->value->type != EXPR_CALL) fputs("(void)", transpiler->out);
+            write_expression(transpiler, statement->value);
+            fputs(";\n", transpiler->out);
+            break;
+        case STMT_PRINT:
+            begin_statement(transpiler);
+            hoist(transpiler, statement->value);
+            indent(transpiler);
+            fprintf(transpiler->out, "pepper_print_%s(", print_suffix(statement->value->static_type));
+            write_expression(transpiler, statement->value);
+            fputs(");\n", transpiler->out);
+            break;
+        case STMT_INSTANTIATE:
+        case STMT_ASSIGN:
+            begin_statement(transpiler);
+            hoist(transpiler, statement->value);
+            indent(transpiler);
+            if (is_guarded(transpiler, statement->variable)) {
+                // The value comes first, as in the VM, so whatever it prints
+                // is printed before the error
+                const Variable* global = &transpiler->checked->globals[-(statement->variable + 1)];
+                fprintf(transpiler->out, "{ %s value = ", c_type(global->type));
+                write_expression(transpiler, statement->value);
+                fprintf(transpiler->out, "; pepper_check_defined(d_%s, \"%s\"); g_%s = value; }\n", global->name,
+                        global->name, global->name);
+                break;
+            }
+            write_variable(transpiler, statement->variable);
+            fputs(" = ", transpiler->out);
+            write_expression(transpiler, statement->value);
+            fputs(";\n", transpiler->out);
+            if (statement->type == STMT_INSTANTIATE && statement->variable < 0 &&
+                transpiler->checked->globals[-(statement->variable + 1)].maybe_undefined) {
+                indent(transpiler);
+                fprintf(transpiler->out, "d_%s = true;\n", transpiler->checked->globals[-(statement->variable + 1)].name);
+            }
+            break;
+        case STMT_RETURN: transpile_return(transpiler, statement); break;
+        case STMT_BLOCK:
+            line(transpiler, "{");
+            transpile_body(transpiler, statement);
+            line(transpiler, "}");
+            break;
+        case STMT_WHILE:
+        case STMT_FOR: transpile_loop(transpiler, statement); break;
+        // Functions are written separately
+        case STMT_FUNCTION:
+        default: break;
+    }
+}
+
+static bool has_self_tail_call(Statement* statement, i32 function_index) {
+    switch (statement->type) {
+        case STMT_RETURN:
+            return statement->value != NULL && statement->value->type == EXPR_CALL &&
+                   ((Expression*)statement->value->call.callee)->variable == function_index;
+        case STMT_BLOCK:
+            for (u64 i = 0; i < statement->block.statement_count; i++) {
+                if (has_self_tail_call(&statement->block.statements[i], function_index)) return true;
+            }
+            return false;
+        case STMT_EXPRESSION: {
+            Expression* expression = statement->value;
+            if (expression->type != EXPR_IF) return false;
+            if (has_self_tail_call((Statement*)expression->if_expr.consequence, function_index)) return true;
+            return expression->if_expr.alternative != NULL &&
+                   has_self_tail_call((Statement*)expression->if_expr.alternative, function_index);
+        }
+        case STMT_WHILE:
+        case STMT_FOR: return has_self_tail_call(statement->loop.body, function_index);
+        default: return false;
+    }
+}
+
+static void write_signature(Transpiler* transpiler, CheckedFunction* function) {
+    fprintf(transpiler->out, "static %s f_%s(", c_type(function->return_type), function->name);
+    if (function->parameter_count == 0) fputs("void", transpiler->out);
+    for (u32 i = 0; i < function->parameter_count; i++) {
+        Variable* parameter = &function->locals[i];
+        fprintf(transpiler->out, "%s%s l%u_%s", i == 0 ? "" : ", ", c_type(parameter->type), i, parameter->name);
+    }
+    fputs(")", transpiler->out);
+}
+
+// Every local gets its own C variable at the top of the function
+static void declare_locals(Transpiler* transpiler) {
+    CheckedFunction* function = transpiler->function;
+    for (u32 i = function->parameter_count; i < function->local_count; i++) {
+        Variable* local = &function->locals[i];
+        line(transpiler, "%s l%u_%s = 0;", c_type(local->type), i, local->name);
+    }
+}
+
+static void begin_function(Transpiler* transpiler, u32 index) {
+    transpiler->function_index = (i32)index;
+    transpiler->function = &transpiler->checked->functions[index];
+    transpiler->temp_count = 0;
+    transpiler->depth = 1;
+}
+
+static void transpile_function(Transpiler* transpiler, u32 index) {
+    begin_function(transpiler, index);
+    CheckedFunction* function = transpiler->function;
+    Statement* body = function->declaration->function.body;
+    write_signature(transpiler, function);
+    fputs(" {\n", transpiler->out);
+    declare_locals(transpiler);
+    if (has_self_tail_call(body, transpiler->function_index)) fputs("tail:;\n", transpiler->out);
+    for (u64 i = 0; i < body->block.statement_count; i++) {
+        transpile_statement(transpiler, &body->block.statements[i]);
+    }
+    if (function->return_type == TYPE_NIL) line(transpiler, "return 0;");
+    fputs("}\n\n", transpiler->out);
+}
+
+static void transpile_script(Transpiler* transpiler) {
+    begin_function(transpiler, 0);
+    Program* program = transpiler->checked->program;
+    fputs("int main(void) {\n", transpiler->out);
+    declare_locals(transpiler);
+    for (u64 i = 0; i < program->statements.count; i++) {
+        transpile_statement(transpiler, &program->statements.items[i]);
+    }
+    line(transpiler, "return 0;");
+    fputs("}\n", transpiler->out);
+}
+
+void emit_c(CheckedProgram* checked, FILE* out) {
+    Transpiler transpiler = {
+        .out = out,
+        .checked = checked,
+        .function_index = 0,
+        .function = NULL,
+        .depth = 0,
+        .temp_count = 0,
+        .hoisted = NULL,
+        .hoisted_count = 0,
+        .hoisted_capacity = 0,
+    };
+    fputs(prelude, out);
+    fputs("\n", out);
+    for (u32 i = 0; i < checked->global_count; i++) {
+        fprintf(out, "static %s g_%s;\n", c_type(checked->globals[i].type), checked->globals[i].name);
+        if (checked->globals[i].maybe_undefined) fprintf(out, "static bool d_%s;\n", checked->globals[i].name);
+    }
+    if (checked->global_count > 0) fputs("\n", out);
+    for (u32 i = 1; i < checked->function_count; i++) {
+        write_signature(&transpiler, &checked->functions[i]);
+        fputs(";\n", out);
+    }
+    if (checked->function_count > 1) fputs("\n", out);
+    for (u32 i = 1; i < checked->function_count; i++) {
+        transpile_function(&transpiler, i);
+    }
+    transpile_script(&transpiler);
+    FREE_ARRAY(Hoisted, transpiler.hoisted, transpiler.hoisted_capacity);
+}
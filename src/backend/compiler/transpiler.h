@@ -0,0 +1,14 @@
+#ifndef pepper_transpiler_h
+#define pepper_transpiler_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "checker.h"
+
+// Writes the program as a single self-contained C99 file. Locals and globals
+// become typed C variables, functions become static C functions and the
+// script becomes main, so the host C compiler does the optimizing.
+void emit_c(CheckedProgram* checked, FILE* out);
+
+#endif
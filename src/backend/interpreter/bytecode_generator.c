@@ -1,13 +1,52 @@
+#define MEMORY_TAG MEMORY_CHUNK
 #include "bytecode_generator.h"
 #include "lexer.h"
 #include "memory.h"
-#include "logger.h"
 #include "parser.h"
 #include "debug.h"
+#include <stdarg.h>
 #include <stdint.h>
+#include <string.h>
 
-static void generate_expression(ByteCode* byte_code, Expression* expression);
-static void generate_statement(ByteCode* byte_code, Statement* statement);
+typedef struct {
+    // Points into the AST, which outlives code generation
+    const char* name;
+    i32 depth;
+} Local;
+
+// Code generation state for the function currently being compiled. Slot zero of
+// every frame holds the function being called, so locals start at slot one.
+typedef struct FunctionScope {
+    struct FunctionScope* enclosing;
+    ObjFunction* function;
+    Local locals[UINT8_COUNT];
+    i32 local_count;
+    i32 scope_depth;
+} FunctionScope;
+
+typedef struct {
+    ByteCode* byte_code;
+    FunctionScope* scope;
+} Generator;
+
+static void generate_expression(Generator* generator, Expression* expression);
+static void generate_statement(Generator* generator, Statement* statement);
+
+static Chunk* current_chunk(Generator* generator) {
+    return &generator->scope->function->chunk;
+}
+
+// Only the first error is kept. Generation carries on regardless, but the
+// byte code is never run.
+static void error(Generator* generator, const char* format, ...) {
+    ByteCode* byte_code = generator->byte_code;
+    if (byte_code->has_error) return;
+    byte_code->has_error = true;
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(byte_code->error, sizeof(byte_code->error), format, arguments);
+    va_end(arguments);
+}
 
 static void emit_byte(Chunk* chunk, uint8_t byte, u64 line) {
     write_chunk(chunk, byte, line);
@@ -18,98 +57,479 @@ static void emit_bytes(Chunk* chunk, uint8_t byte1, uint8_t byte2, u64 line) {
     emit_byte(chunk, byte2, line);
 }
 
-static uint8_t create_constant(Chunk* chunk, Value value) {
-    const int constant = add_constant(chunk, value);
+static uint8_t create_constant(Generator* generator, Value value) {
+    const int constant = add_constant(current_chunk(generator), value);
     if (constant > UINT8_MAX) {
-        ERROR("Too many constants in one chunk");
+        error(generator, "Too many constants in one chunk");
         return 0;
     }
     return (uint8_t)constant;
 }
 
-static void emit_constant(Chunk* chunk, Value value, u64 line) {
-    emit_bytes(chunk, OP_CONSTANT, create_constant(chunk, value), line);
+static void emit_constant(Generator* generator, Value value, u64 line) {
+    emit_bytes(current_chunk(generator), OP_CONSTANT, create_constant(generator, value), line);
+}
+
+// Emits a jump with a placeholder operand and returns the operand's offset for patch_jump
+static u64 emit_jump(Chunk* chunk, uint8_t instruction, u64 line) {
+    emit_byte(chunk, instruction, line);
+    emit_byte(chunk, 0xff, line);
+    emit_byte(chunk, 0xff, line);
+    return chunk->code.count - 2;
+}
+
+static void patch_jump(Generator* generator, u64 offset) {
+    Chunk* chunk = current_chunk(generator);
+    // -2 to skip over the jump's own operand
+    u64 jump = chunk->code.count - offset - 2;
+    if (jump > UINT16_MAX) {
+        error(generator, "Too much code to jump over.");
+    }
+    chunk->code.items[offset] = (uint8_t)((jump >> 8) & 0xff);
+    chunk->code.items[offset + 1] = (uint8_t)(jump & 0xff);
+}
+
+static void emit_loop(Generator* generator, uint8_t instruction, u64 loop_start, u64 line) {
+    Chunk* chunk = current_chunk(generator);
+    emit_byte(chunk, instruction, line);
+    // +2 to also jump back over the operand being emitted
+    u64 offset = chunk->code.count - loop_start + 2;
+    if (offset > UINT16_MAX) {
+        error(generator, "Loop body too large.");
+    }
+    emit_byte(chunk, (uint8_t)((offset >> 8) & 0xff), line);
+    emit_byte(chunk, (uint8_t)(offset & 0xff), line);
+}
+
+static void emit_return(Generator* generator, u64 line) {
+    emit_constant(generator, NIL_VAL, line);
+    emit_byte(current_chunk(generator), OP_RETURN, line);
+}
+
+// Copies the name into the byte code, so it doesn't depend on the AST
+static const char* copy_name(ByteCode* byte_code, const char* name) {
+    u64 length = strlen(name) + 1;
+    NameBlock* block = byte_code->names;
+    if (block == NULL || block->size - block->used < length) {
+        // Each block is twice the last, so there are few of them and at most
+        // half the space is unused
+        u64 size = block == NULL ? NAME_BLOCK_SIZE : block->size * 2;
+        if (size < length) size = length;
+        block = (NameBlock*)reallocate(NULL, 0, sizeof(NameBlock) + size, MEMORY_TAG);
+        block->next = byte_code->names;
+        block->used = 0;
+        block->size = size;
+        byte_code->names = block;
+    }
+    char* copy = block->chars + block->used;
+    memcpy(copy, name, length);
+    block->used += length;
+    return copy;
+}
+
+static void begin_function_scope(Generator* generator, FunctionScope* scope, const char* name) {
+    scope->enclosing = generator->scope;
+    const char* copy = name != NULL ? copy_name(generator->byte_code, name) : NULL;
+    scope->function = new_function(&generator->byte_code->objects, copy);
+    scope->function->index = generator->byte_code->function_count++;
+    scope->local_count = 0;
+    scope->scope_depth = 0;
+    generator->scope = scope;
+
+    // Reserve slot zero for the callee
+    Local* local = &scope->locals[scope->local_count++];
+    local->name = "";
+    local->depth = 0;
+}
+
+static ObjFunction* end_function_scope(Generator* generator, u64 line) {
+    emit_return(generator, line);
+    ObjFunction* function = generator->scope->function;
+#ifdef DEBUG_MODE_INTERPRETER
+    printf("== %s ==\n", function->name != NULL ? function->name : "<script>");
+    debug_chunk(&function->chunk);
+#endif
+    generator->scope = generator->scope->enclosing;
+    return function;
+}
+
+static void begin_scope(Generator* generator) {
+    generator->scope->scope_depth++;
+}
+
+static void end_scope(Generator* generator, u64 line) {
+    FunctionScope* scope = generator->scope;
+    scope->scope_depth--;
+    while (scope->local_count > 0 && scope->locals[scope->local_count - 1].depth > scope->scope_depth) {
+        emit_byte(current_chunk(generator), OP_POP, line);
+        scope->local_count--;
+    }
+}
+
+static void add_local(Generator* generator, const char* name) {
+    FunctionScope* scope = generator->scope;
+    if (scope->local_count == UINT8_COUNT) {
+        error(generator, "Too many local variables in function.");
+        return;
+    }
+    Local* local = &scope->locals[scope->local_count++];
+    local->name = name;
+    local->depth = scope->scope_depth;
+}
+
+static i32 resolve_local(FunctionScope* scope, const char* name) {
+    for (i32 i = scope->local_count - 1; i >= 0; i--) {
+        if (strcmp(scope->locals[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Globals get an index the first time any code mentions them, which can be
+// before the definition runs
+static uint8_t resolve_global(Generator* generator, const char* name) {
+    ByteCode* byte_code = generator->byte_code;
+    for (u32 i = 0; i < byte_code->global_count; i++) {
+        if (strcmp(byte_code->global_names[i], name) == 0) return (uint8_t)i;
+    }
+    if (byte_code->global_count == UINT8_COUNT) {
+        error(generator, "Too many global variables.");
+        return 0;
+    }
+    if (byte_code->global_capacity < byte_code->global_count + 1) {
+        u32 old_capacity = byte_code->global_capacity;
+        byte_code->global_capacity = GROW_CAPACITY(old_capacity);
+        byte_code->global_names = GROW_ARRAY(const char*, byte_code->global_names, old_capacity,
+                                             byte_code->global_capacity);
+    }
+    byte_code->global_names[byte_code->global_count] = copy_name(byte_code, name);
+    return (uint8_t)byte_code->global_count++;
+}
+
+// 'and' and 'or' only evaluate their right operand when it can change the result
+static void generate_logical_expression(Generator* generator, Expression* expression) {
+    Chunk* chunk = current_chunk(generator);
+    const u64 line = expression->token.line;
+    const bool is_and = expression->infix.operator == PARSE_OP_AND;
+
+    generate_expression(generator, (Expression*)expression->infix.left);
+    u64 short_circuit_jump = emit_jump(chunk, OP_JUMP_IF_FALSE, line);
+    if (is_and) {
+        generate_expression(generator, (Expression*)expression->infix.right);
+    } else {
+        emit_constant(generator, BOOL_VAL(true), line);
+    }
+    u64 end_jump = emit_jump(chunk, OP_JUMP, line);
+    patch_jump(generator, short_circuit_jump);
+    if (is_and) {
+        emit_constant(generator, BOOL_VAL(false), line);
+    } else {
+        generate_expression(generator, (Expression*)expression->infix.right);
+    }
+    patch_jump(generator, end_jump);
 }
 
-static void generate_infix_expression(ByteCode* byte_code, Expression* expression) {
-    generate_expression(byte_code, (Expression*)expression->infix.left);
-    generate_expression(byte_code, (Expression*)expression->infix.right);
+static void generate_infix_expression(Generator* generator, Expression* expression) {
     const OperatorType operator = expression->infix.operator;
+    if (operator == PARSE_OP_AND || operator == PARSE_OP_OR) {
+        generate_logical_expression(generator, expression);
+        return;
+    }
+    generate_expression(generator, (Expression*)expression->infix.left);
+    generate_expression(generator, (Expression*)expression->infix.right);
+    Chunk* chunk = current_chunk(generator);
     switch (operator) {
-        case PARSE_OP_ADD: emit_byte(byte_code->chunk, OP_ADD, expression->token.line); break;
-        case PARSE_OP_MINUS: emit_byte(byte_code->chunk, OP_SUBTRACT, expression->token.line); break;
-        case PARSE_OP_MULTIPLY: emit_byte(byte_code->chunk, OP_MULTIPLY, expression->token.line); break;
-        case PARSE_OP_DIVIDE: emit_byte(byte_code->chunk, OP_DIVIDE, expression->token.line); break;
-        case PARSE_OP_GREATER: emit_byte(byte_code->chunk, OP_GREATER, expression->token.line); break;
-        default: emit_byte(byte_code->chunk, OP_UNKNOWN, expression->token.line); break;
+        case PARSE_OP_ADD: emit_byte(chunk, OP_ADD, expression->token.line); break;
+        case PARSE_OP_MINUS: emit_byte(chunk, OP_SUBTRACT, expression->token.line); break;
+        case PARSE_OP_MULTIPLY: emit_byte(chunk, OP_MULTIPLY, expression->token.line); break;
+        case PARSE_OP_DIVIDE: emit_byte(chunk, OP_DIVIDE, expression->token.line); break;
+        case PARSE_OP_GREATER: emit_byte(chunk, OP_GREATER, expression->token.line); break;
+        case PARSE_OP_LESS: emit_byte(chunk, OP_LESS, expression->token.line); break;
+        case PARSE_OP_EQUALITY: emit_byte(chunk, OP_EQUAL, expression->token.line); break;
+        case PARSE_OP_NOT_EQUAL: emit_bytes(chunk, OP_EQUAL, OP_NOT, expression->token.line); break;
+        case PARSE_OP_EQUAL_GREATER: emit_bytes(chunk, OP_LESS, OP_NOT, expression->token.line); break;
+        case PARSE_OP_EQUAL_LESS: emit_bytes(chunk, OP_GREATER, OP_NOT, expression->token.line); break;
+        default: emit_byte(chunk, OP_UNKNOWN, expression->token.line); break;
     }
     //emit_byte(chunk, OP_POP, expression->token.line);
 }
 
-static void generate_int_expression(ByteCode* byte_code, Expression* expression) {
-    emit_constant(byte_code->chunk, INT_VAL(expression->integer), expression->token.line);
+static void generate_prefix_expression(Generator* generator, Expression* expression) {
+    generate_expression(generator, (Expression*)expression->prefix.right);
+    switch (expression->prefix.operator) {
+        case PARSE_OP_MINUS: emit_byte(current_chunk(generator), OP_NEGATE, expression->token.line); break;
+        case PARSE_OP_NOT: emit_byte(current_chunk(generator), OP_NOT, expression->token.line); break;
+        default: emit_byte(current_chunk(generator), OP_UNKNOWN, expression->token.line); break;
+    }
+}
+
+static void generate_int_expression(Generator* generator, Expression* expression) {
+    emit_constant(generator, INT_VAL(expression->integer), expression->token.line);
 }
 
-static void generate_float_expression(ByteCode* byte_code, Expression* expression) {
-    emit_constant(byte_code->chunk, FLOATING_VAL(expression->floating_point), expression->token.line);
+static void generate_float_expression(Generator* generator, Expression* expression) {
+    emit_constant(generator, FLOATING_VAL(expression->floating_point), expression->token.line);
+}
+
+static void generate_bool_expression(Generator* generator, Expression* expression) {
+    emit_constant(generator, BOOL_VAL(expression->boolean), expression->token.line);
+}
+
+// Leaves nothing on the stack; callers that need a value push their own
+static void generate_if_expression(Generator* generator, Expression* expression) {
+    Chunk* chunk = current_chunk(generator);
+    const u64 line = expression->token.line;
+    generate_expression(generator, (Expression*)expression->if_expr.condition);
+    u64 else_jump = emit_jump(chunk, OP_JUMP_IF_FALSE, line);
+    generate_statement(generator, (Statement*)expression->if_expr.consequence);
+    if (expression->if_expr.alternative == NULL) {
+        patch_jump(generator, else_jump);
+        return;
+    }
+    u64 end_jump = emit_jump(chunk, OP_JUMP, line);
+    patch_jump(generator, else_jump);
+    generate_statement(generator, (Statement*)expression->if_expr.alternative);
+    patch_jump(generator, end_jump);
+}
+
+static void generate_ident_expression(Generator* generator, Expression* expression) {
+    const i32 slot = resolve_local(generator->scope, expression->ident.value);
+    if (slot != -1) {
+        emit_bytes(current_chunk(generator), OP_GET_LOCAL, (uint8_t)slot, expression->token.line);
+        return;
+    }
+    const uint8_t global = resolve_global(generator, expression->ident.value);
+    emit_bytes(current_chunk(generator), OP_GET_GLOBAL, global, expression->token.line);
 }
 
-static void generate_bool_expression(ByteCode* byte_code, Expression* expression) {
-    emit_constant(byte_code->chunk, BOOL_VAL(expression->boolean), expression->token.line);
+// Literals belong to the byte code, like functions, so VMs never collect them
+static void generate_string_expression(Generator* generator, Expression* expression) {
+    Token* token = &expression->token;
+    const char* chars = token->start + 1;
+    u64 length = token->length - 2;
+    if (length <= SHORT_STRING_MAX) {
+        Value value = EMPTY_SHORT_STRING_VAL;
+        memcpy(AS_SHORT_STRING(value), chars, length);
+        SHORT_STRING_LENGTH(value) = (char)length;
+        emit_constant(generator, value, token->line);
+        return;
+    }
+    ByteCode* byte_code = generator->byte_code;
+    u32 hash = hash_chars(HASH_SEED, chars, length);
+    ObjString* string = table_find_string(&byte_code->strings, chars, length, "", 0, hash);
+    if (string == NULL) {
+        string = new_string(&byte_code->objects, chars, length);
+        table_add(&byte_code->strings, string);
+    }
+    emit_constant(generator, OBJ_VAL(string), token->line);
 }
 
-static void generate_if_expression(ByteCode* byte_code, Expression* expression) {
-    generate_expression(byte_code, (Expression*)expression->if_expr.condition);
-    generate_statement(byte_code, (Statement*)expression->if_expr.consequence);
-    generate_statement(byte_code, (Statement*)expression->if_expr.alternative);
+static void generate_call_arguments(Generator* generator, Expression* expression) {
+    generate_expression(generator, (Expression*)expression->call.callee);
+    for (u64 i = 0; i < expression->call.argument_count; i++) {
+        generate_expression(generator, (Expression*)expression->call.arguments[i]);
+    }
 }
 
-static void generate_ident_expression(ByteCode* byte_code, Expression* expression) {
-    const uint8_t const_val = create_constant(byte_code->chunk, STRING_VAL(expression->ident.value));
-    emit_bytes(byte_code->chunk, OP_GET_GLOBAL, const_val, expression->token.line);
+static void generate_call_expression(Generator* generator, Expression* expression) {
+    generate_call_arguments(generator, expression);
+    emit_bytes(current_chunk(generator), OP_CALL, (uint8_t)expression->call.argument_count, expression->token.line);
 }
 
-static void generate_expression(ByteCode* byte_code, Expression* expression) {
+static void generate_expression(Generator* generator, Expression* expression) {
     switch (expression->type) {
-        case EXPR_INFIX: generate_infix_expression(byte_code, expression); break;
-        case EXPR_INT: generate_int_expression(byte_code, expression); break;
-        case EXPR_FLOAT: generate_float_expression(byte_code, expression); break;
-        case EXPR_BOOL: generate_bool_expression(byte_code, expression); break;
-        case EXPR_IF: generate_if_expression(byte_code, expression); break;
-        case EXPR_IDENT: generate_ident_expression(byte_code, expression); break;
+        case EXPR_INFIX: generate_infix_expression(generator, expression); break;
+        case EXPR_INT: generate_int_expression(generator, expression); break;
+        case EXPR_FLOAT: generate_float_expression(generator, expression); break;
+        case EXPR_BOOL: generate_bool_expression(generator, expression); break;
+        case EXPR_STRING: generate_string_expression(generator, expression); break;
+        case EXPR_PREFIX: generate_prefix_expression(generator, expression); break;
+        case EXPR_IF: {
+            generate_if_expression(generator, expression);
+            emit_constant(generator, NIL_VAL, expression->token.line);
+            break;
+        }
+        case EXPR_IDENT: generate_ident_expression(generator, expression); break;
+        case EXPR_CALL: generate_call_expression(generator, expression); break;
         default: break;
     }
 }
 
-static void generate_instantiate_statement(ByteCode* byte_code, Statement* statement) {
-    generate_expression(byte_code, statement->value);
-    const uint8_t const_val = create_constant(byte_code->chunk, STRING_VAL(statement->name.value));
-    emit_bytes(byte_code->chunk, OP_DEFINE_GLOBAL, const_val, statement->token.line);
+static void generate_instantiate_statement(Generator* generator, Statement* statement) {
+    generate_expression(generator, statement->value);
+    if (generator->scope->scope_depth > 0) {
+        // The value is left on the stack and becomes the local's slot
+        add_local(generator, statement->name.value);
+        return;
+    }
+    const uint8_t global = resolve_global(generator, statement->name.value);
+    emit_bytes(current_chunk(generator), OP_DEFINE_GLOBAL, global, statement->token.line);
+}
+
+static void generate_assign_statement(Generator* generator, Statement* statement) {
+    generate_expression(generator, statement->value);
+    const i32 slot = resolve_local(generator->scope, statement->name.value);
+    if (slot != -1) {
+        emit_bytes(current_chunk(generator), OP_SET_LOCAL, (uint8_t)slot, statement->token.line);
+        return;
+    }
+    const uint8_t global = resolve_global(generator, statement->name.value);
+    emit_bytes(current_chunk(generator), OP_SET_GLOBAL, global, statement->token.line);
+}
+
+static void generate_block_statement(Generator* generator, Statement* statement) {
+    begin_scope(generator);
+    for (u64 i = 0; i < statement->block.statement_count; i++) {
+        generate_statement(generator, &statement->block.statements[i]);
+    }
+    end_scope(generator, statement->token.line);
+}
+
+static bool is_always_true(Expression* condition) {
+    return condition == NULL || (condition->type == EXPR_BOOL && condition->boolean);
+}
+
+// Emits a loop's back-edge with the condition test fused into it, so each
+// iteration costs a single conditional branch. A '<' comparison, the usual
+// counted loop, fuses into one compare-and-branch instruction.
+static void generate_loop_condition(Generator* generator, Expression* condition, u64 loop_start, u64 line) {
+    if (is_always_true(condition)) {
+        emit_loop(generator, OP_LOOP, loop_start, line);
+        return;
+    }
+    if (condition->type == EXPR_INFIX && condition->infix.operator == PARSE_OP_LESS) {
+        generate_expression(generator, (Expression*)condition->infix.left);
+        generate_expression(generator, (Expression*)condition->infix.right);
+        emit_loop(generator, OP_LOOP_IF_LESS, loop_start, line);
+        return;
+    }
+    generate_expression(generator, condition);
+    emit_loop(generator, OP_LOOP_IF_TRUE, loop_start, line);
+}
+
+// Loops are rotated: entry jumps straight to the condition at the bottom, so
+// the condition is only evaluated at the back-edge.
+static void generate_loop(Generator* generator, Statement* statement) {
+    Chunk* chunk = current_chunk(generator);
+    const u64 line = statement->token.line;
+    Expression* condition = (Expression*)statement->loop.condition;
+
+    u64 entry_jump = 0;
+    if (!is_always_true(condition)) {
+        entry_jump = emit_jump(chunk, OP_JUMP, line);
+    }
+    u64 loop_start = chunk->code.count;
+    generate_statement(generator, statement->loop.body);
+    if (statement->loop.increment != NULL) {
+        generate_statement(generator, statement->loop.increment);
+    }
+    if (!is_always_true(condition)) {
+        patch_jump(generator, entry_jump);
+    }
+    generate_loop_condition(generator, condition, loop_start, line);
+}
+
+static void generate_for_statement(Generator* generator, Statement* statement) {
+    // The loop variable is scoped to the loop
+    begin_scope(generator);
+    if (statement->loop.initializer != NULL) {
+        generate_statement(generator, statement->loop.initializer);
+    }
+    generate_loop(generator, statement);
+    end_scope(generator, statement->token.line);
+}
+
+static void generate_function_statement(Generator* generator, Statement* statement) {
+    FunctionScope scope;
+    begin_function_scope(generator, &scope, statement->name.value);
+    begin_scope(generator);
+
+    ObjFunction* function = scope.function;
+    function->arity = (i32)statement->function.parameter_count;
+    for (u64 i = 0; i < statement->function.parameter_count; i++) {
+        add_local(generator, statement->function.parameters[i].value);
+    }
+    // The body shares the parameters' scope, and the whole frame is discarded on return
+    Statement* body = statement->function.body;
+    for (u64 i = 0; i < body->block.statement_count; i++) {
+        generate_statement(generator, &body->block.statements[i]);
+    }
+    end_function_scope(generator, body->token.line);
+
+    emit_constant(generator, OBJ_VAL(function), statement->token.line);
+    if (generator->scope->scope_depth > 0) {
+        add_local(generator, statement->name.value);
+        return;
+    }
+    const uint8_t global = resolve_global(generator, statement->name.value);
+    emit_bytes(current_chunk(generator), OP_DEFINE_GLOBAL, global, statement->token.line);
 }
 
-static void generate_assign_statement(ByteCode* byte_code, Statement* statement) {
-    generate_expression(byte_code, statement->value);
-    const uint8_t const_val = create_constant(byte_code->chunk, STRING_VAL(statement->name.value));
-    emit_bytes(byte_code->chunk, OP_SET_GLOBAL, const_val, statement->token.line);
+static void generate_return_statement(Generator* generator, Statement* statement) {
+    if (generator->scope->enclosing == NULL) {
+        error(generator, "[line %lu] Can't return from top-level code.", statement->token.line);
+        return;
+    }
+    Chunk* chunk = current_chunk(generator);
+    if (statement->value == NULL) {
+        emit_return(generator, statement->token.line);
+        return;
+    }
+    if (statement->value->type == EXPR_CALL) {
+        // A call in tail position reuses the caller's frame, so tail recursion runs in constant stack
+        Expression* call = statement->value;
+        generate_call_arguments(generator, call);
+        emit_bytes(chunk, OP_TAIL_CALL, (uint8_t)call->call.argument_count, call->token.line);
+        return;
+    }
+    generate_expression(generator, statement->value);
+    emit_byte(chunk, OP_RETURN, statement->token.line);
 }
 
-static void generate_statement(ByteCode* byte_code, Statement* statement) {
+static void generate_statement(Generator* generator, Statement* statement) {
     switch (statement->type) {
         case STMT_EXPRESSION: {
-            generate_expression(byte_code, statement->value);
+            if (statement->value->type == EXPR_IF) {
+                // In statement position an if has no value to discard
+                generate_if_expression(generator, statement->value);
+                break;
+            }
+            generate_expression(generator, statement->value);
+            emit_byte(current_chunk(generator), OP_POP, statement->token.line);
             break;
         }
         case STMT_PRINT: {
-            generate_expression(byte_code, statement->value);
-            emit_byte(byte_code->chunk, OP_PRINT, statement->token.line);
+            generate_expression(generator, statement->value);
+            emit_byte(current_chunk(generator), OP_PRINT, statement->token.line);
             break;
         }
         case STMT_ASSIGN: {
-            generate_assign_statement(byte_code, statement);
+            generate_assign_statement(generator, statement);
             break;
         }
         case STMT_INSTANTIATE: {
-            generate_instantiate_statement(byte_code, statement);
+            generate_instantiate_statement(generator, statement);
+            break;
+        }
+        case STMT_RETURN: {
+            generate_return_statement(generator, statement);
+            break;
+        }
+        case STMT_BLOCK: {
+            generate_block_statement(generator, statement);
+            break;
+        }
+        case STMT_FUNCTION: {
+            generate_function_statement(generator, statement);
+            break;
+        }
+        case STMT_WHILE: {
+            generate_loop(generator, statement);
+            break;
+        }
+        case STMT_FOR: {
+            generate_for_statement(generator, statement);
             break;
         }
         default: break;
@@ -117,29 +537,63 @@ static void generate_statement(ByteCode* byte_code, Statement* statement) {
 }
 
 static void init_bytecode(ByteCode* byte_code) {
-    Chunk* chunk = (Chunk*)malloc(sizeof(Chunk));
-    init_chunk(chunk);
-    byte_code->chunk = chunk;
-    byte_code->globals = hash_table_init();
-    byte_code->strings = hash_table_init();
+    byte_code->script = NULL;
+    byte_code->objects = NULL;
+    byte_code->function_count = 0;
+    init_table(&byte_code->strings, MEMORY_CONSTANTS);
+    byte_code->names = NULL;
+    byte_code->global_names = NULL;
+    byte_code->global_count = 0;
+    byte_code->global_capacity = 0;
+    byte_code->has_error = false;
+    byte_code->error[0] = '\0';
+}
+
+static void generate_script(ByteCode* byte_code, Program* program) {
+    Generator generator = {.byte_code = byte_code, .scope = NULL};
+    FunctionScope scope;
+    begin_function_scope(&generator, &scope, NULL);
+
+    for (u64 i = 0; i < program->statements.count; i++) {
+        generate_statement(&generator, &program->statements.items[i]);
+    }
+    u64 last_line = program->statements.count > 0 ? program->statements.items[program->statements.count - 1].token.line : 0;
+    byte_code->script = end_function_scope(&generator, last_line);
 }
 
 ByteCode* generate_bytecode(Program* program) {
     ByteCode* byte_code = ALLOCATE(ByteCode, 1);
     init_bytecode(byte_code);
+    generate_script(byte_code, program);
+    return byte_code;
+}
 
-    for (u64 i = 0; i < program->statement_count; i++) {
-        generate_statement(byte_code, &program->statements[i]);
-    }
-    emit_byte(byte_code->chunk, OP_RETURN, program->statements[program->statement_count - 1].token.line);
-    #ifdef DEBUG_MODE_INTERPRETER
-    debug_chunk(byte_code->chunk);
-    #endif
+ByteCode* init_increments(void) {
+    ByteCode* byte_code = ALLOCATE(ByteCode, 1);
+    init_bytecode(byte_code);
+    // A script that does nothing, so a VM can be created before any input
+    Program empty;
+    init_statement_array(&empty.statements);
+    generate_script(byte_code, &empty);
     return byte_code;
 }
 
+void generate_increment(ByteCode* byte_code, Program* program) {
+    // An earlier increment's error doesn't stop this one running
+    byte_code->has_error = false;
+    byte_code->error[0] = '\0';
+    generate_script(byte_code, program);
+}
+
 void free_byte_code(ByteCode* byte_code) {
-    free_chunk(byte_code->chunk);
-    hash_table_destroy(byte_code->globals);
-    hash_table_destroy(byte_code->strings);
-}
\ No newline at end of file
+    free_objects(byte_code->objects, MEMORY_TAG);
+    free_table(&byte_code->strings);
+    NameBlock* block = byte_code->names;
+    while (block != NULL) {
+        NameBlock* next = block->next;
+        reallocate(block, sizeof(NameBlock) + block->size, 0, MEMORY_TAG);
+        block = next;
+    }
+    FREE_ARRAY(const char*, byte_code->global_names, byte_code->global_capacity);
+    FREE(ByteCode, byte_code);
+}
@@ -3,16 +3,61 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "object.h"
+#include "table.h"
 #include "parser.h"
-#include "hashtable.h"
 
+// Names are copied into blocks of at least this many bytes
+#define NAME_BLOCK_SIZE 256
+
+// Holds names end to end. Blocks are never moved or resized, so names can
+// be pointed at directly.
+typedef struct NameBlock {
+    struct NameBlock* next;
+    u64 used;
+    u64 size;
+    char chars[];
+} NameBlock;
+
+// Everything compiled for a program. Nothing writes to it once
+// generate_bytecode returns, so any number of VMs on any number of threads
+// can run the same ByteCode at once; each VM keeps its own globals. The
+// exception is a REPL's, which generate_increment adds to between runs of
+// the one VM running it.
 typedef struct {
-    Chunk* chunk;
-    HashTable* globals;
-    HashTable* strings;
+    // The top level code, compiled as a function taking no arguments
+    ObjFunction* script;
+    // Every function and string literal compiled for this program, freed
+    // with the byte code
+    Obj* objects;
+    // How many functions there are, scripts included, each with its index
+    u32 function_count;
+    // The long string literals, which VMs look in before interning their own
+    Table strings;
+    // The names of globals and functions. The byte code owns everything it
+    // refers to, so the source and AST can be freed before it's run.
+    NameBlock* names;
+    // Indexed by the operand of the global opcodes, pointing into names
+    const char** global_names;
+    u32 global_count;
+    u32 global_capacity;
+    // Set, with the first error's message, when the program can't be run
+    bool has_error;
+    char error[ERROR_MESSAGE_MAX];
 } ByteCode;
 
+// Globals are resolved to indices here, so VMs never look names up. Check
+// has_error before running the result.
 ByteCode* generate_bytecode(Program* program);
+// Byte code for a REPL, which starts out with a script that does nothing
+ByteCode* init_increments(void);
+// Compiles another piece of input into byte code from init_increments. It
+// gets a script of its own, which replaces the last one, so only the new
+// input is compiled and run however long the session has gone on. Globals
+// and literals are shared with everything compiled before. has_error is
+// cleared first, and functions and literals from input that failed to
+// compile stay until the byte code is freed.
+void generate_increment(ByteCode* byte_code, Program* program);
 void free_byte_code(ByteCode* byte_code);
 
 #endif
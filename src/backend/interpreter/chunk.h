@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "value.h"
+#include "vector.h"
 
 typedef enum {
     OP_CONSTANT,
@@ -18,13 +19,28 @@ typedef enum {
     OP_DEFINE_GLOBAL,
     OP_SET_GLOBAL,
     OP_GREATER,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_CALL,
+    OP_TAIL_CALL,
+    OP_LESS,
+    OP_EQUAL,
+    OP_NOT,
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_LOOP,
+    OP_LOOP_IF_TRUE,
+    OP_LOOP_IF_LESS,
 } OpCode;
 
+// Chunks live in their functions, so short functions' code needn't allocate
+DEFINE_VECTOR(ByteArray, byte_array, uint8_t, 16, MEMORY_CHUNK)
+// The line each byte of code came from
+DEFINE_VECTOR(LineArray, line_array, size_t, 16, MEMORY_CHUNK)
+
 typedef struct {
-    u64 count;
-    u64 capacity;
-    uint8_t* code;
-    size_t* lines;
+    ByteArray code;
+    LineArray lines;
     ValueArray constants;
 } Chunk;
 
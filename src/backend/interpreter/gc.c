@@ -0,0 +1,672 @@
+#define _DEFAULT_SOURCE 1
+#define MEMORY_TAG MEMORY_VM_HEAP
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc.h"
+#include "vm.h"
+#include "memory.h"
+#include "phases.h"
+
+// Upper bounds of the pause histogram's buckets, in microseconds
+static const f64 pause_bounds[GC_PAUSE_BUCKETS - 1] = {10, 25, 50, 100, 250, 500, 1000};
+static const char* pause_labels[GC_PAUSE_BUCKETS] = {"<10us", "<25us", "<50us", "<100us",
+                                                     "<250us", "<500us", "<1ms", ">=1ms"};
+
+static bool gc_stress = false;
+
+void gc_set_stress(bool enabled) {
+    gc_stress = enabled;
+}
+
+static bool gc_stress_enabled(void) {
+    const char* setting = getenv("PEPPER_GC_STRESS");
+    if (setting != NULL && strcmp(setting, "1") == 0) return true;
+    return gc_stress;
+}
+
+static u32 gc_marker_threads = 1;
+
+void gc_set_marker_threads(u32 threads) {
+    gc_marker_threads = threads;
+}
+
+static u32 gc_marker_threads_setting(void) {
+    const char* setting = getenv("PEPPER_GC_THREADS");
+    if (setting == NULL) return gc_marker_threads;
+    long threads = strtol(setting, NULL, 10);
+    return threads > 0 && threads <= GC_MAX_MARKER_THREADS ? (u32)threads : gc_marker_threads;
+}
+
+void init_heap(Heap* heap) {
+    heap->nursery = NULL;
+    heap->nursery_top = NULL;
+    heap->nursery_bytes = 0;
+    heap->objects = NULL;
+    heap->size = 0;
+    heap->next_gc = GC_MIN_HEAP;
+    heap->phase = GC_IDLE;
+    heap->debt = 0;
+    heap->gray = NULL;
+    heap->gray_count = 0;
+    heap->gray_capacity = 0;
+    heap->unswept = NULL;
+    heap->remembered = NULL;
+    heap->remembered_count = 0;
+    heap->remembered_capacity = 0;
+    memset(heap->cards, 0, sizeof(heap->cards));
+    heap->stress = gc_stress_enabled();
+    heap->marker_threads = gc_marker_threads_setting();
+    memset(&heap->stats, 0, sizeof(heap->stats));
+}
+
+void free_heap(Heap* heap) {
+    // Nursery objects own nothing outside the nursery
+    FREE_ARRAY(u8, heap->nursery, heap->nursery != NULL ? GC_NURSERY_SIZE : 0);
+    free_objects(heap->objects, MEMORY_TAG);
+    free_objects(heap->unswept, MEMORY_TAG);
+    FREE_ARRAY(Obj*, heap->gray, heap->gray_capacity);
+    FREE_ARRAY(Obj*, heap->remembered, heap->remembered_capacity);
+    heap->nursery = NULL;
+    heap->nursery_top = NULL;
+    heap->nursery_bytes = 0;
+    heap->objects = NULL;
+    heap->unswept = NULL;
+    heap->size = 0;
+}
+
+void reset_heap(Heap* heap) {
+    free_objects(heap->objects, MEMORY_TAG);
+    free_objects(heap->unswept, MEMORY_TAG);
+    heap->nursery_top = heap->nursery;
+    heap->nursery_bytes = 0;
+    heap->objects = NULL;
+    heap->unswept = NULL;
+    heap->size = 0;
+    heap->next_gc = GC_MIN_HEAP;
+    heap->phase = GC_IDLE;
+    heap->debt = 0;
+    heap->gray_count = 0;
+    heap->remembered_count = 0;
+    memset(heap->cards, 0, sizeof(heap->cards));
+}
+
+static void record_pause(Heap* heap, struct timespec* start) {
+    GcStats* stats = &heap->stats;
+    f64 pause = seconds_since(start);
+    stats->pauses++;
+    stats->total_pause += pause;
+    if (pause > stats->max_pause) stats->max_pause = pause;
+    u32 bucket = 0;
+    while (bucket < GC_PAUSE_BUCKETS - 1 && pause * 1e6 >= pause_bounds[bucket]) bucket++;
+    stats->pause_histogram[bucket]++;
+}
+
+static void mark_object(Heap* heap, Obj* object) {
+    // Also true of every byte code object, which keeps them read only.
+    // Nursery objects belong to minor collections.
+    if (object->is_marked || in_nursery(heap, object)) return;
+    object->is_marked = true;
+    // Strings hold no references, so there's nothing to trace later
+    if (object->type == OBJ_STRING) return;
+    if (heap->gray_capacity < heap->gray_count + 1) {
+        u64 old_capacity = heap->gray_capacity;
+        heap->gray_capacity = GROW_CAPACITY(old_capacity);
+        heap->gray = GROW_ARRAY(Obj*, heap->gray, old_capacity, heap->gray_capacity);
+    }
+    heap->gray[heap->gray_count++] = object;
+}
+
+static void mark_value(Heap* heap, Value value) {
+    if (IS_OBJ(value)) mark_object(heap, AS_OBJ(value));
+}
+
+static void mark_roots(VM* vm) {
+    for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
+        mark_value(&vm->heap, *slot);
+    }
+    // Undefined globals hold nil
+    for (u32 i = 0; i < vm->byte_code->global_count; i++) {
+        mark_value(&vm->heap, vm->globals[i]);
+    }
+}
+
+// Marks everything the object refers to
+static void blacken_object(Heap* heap, Obj* object) {
+    switch (object->type) {
+        // Strings hold no references, and functions only live in byte code
+        case OBJ_STRING:
+        case OBJ_FUNCTION:
+            break;
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            mark_value(heap, rope->left);
+            mark_value(heap, rope->right);
+            if (rope->flat != NULL) mark_object(heap, (Obj*)rope->flat);
+            break;
+        }
+    }
+}
+
+// A marker's deque of gray objects, after Chase and Lev. The marker that
+// owns it pushes and takes at the bottom while the others steal from the
+// top, so they only contend over the last object in it.
+typedef struct MarkBuffer {
+    // Always a power of two
+    i64 capacity;
+    Obj** items;
+    // The buffer this one replaced, which a thief may still be reading
+    struct MarkBuffer* outgrown;
+} MarkBuffer;
+
+// A cache line each, so markers don't slow each other down
+typedef struct {
+    i64 top;
+    i64 bottom;
+    MarkBuffer* buffer;
+    u8 padding[40];
+} MarkDeque;
+
+typedef struct {
+    Heap* heap;
+    MarkDeque deques[GC_MAX_MARKER_THREADS];
+    u32 deque_count;
+    // Markers running, and how many of them have run out of work. Marking
+    // is over once every one has, as only a marker with work makes more.
+    u32 markers;
+    u32 idle;
+} ParallelMark;
+
+typedef struct {
+    ParallelMark* mark;
+    u32 index;
+} Marker;
+
+static MarkBuffer* new_mark_buffer(i64 capacity, MarkBuffer* outgrown) {
+    MarkBuffer* buffer = ALLOCATE(MarkBuffer, 1);
+    buffer->capacity = capacity;
+    buffer->items = ALLOCATE(Obj*, (u64)capacity);
+    buffer->outgrown = outgrown;
+    return buffer;
+}
+
+static void free_mark_buffers(MarkBuffer* buffer) {
+    while (buffer != NULL) {
+        MarkBuffer* outgrown = buffer->outgrown;
+        FREE_ARRAY(Obj*, buffer->items, (u64)buffer->capacity);
+        FREE(MarkBuffer, buffer);
+        buffer = outgrown;
+    }
+}
+
+static void push_gray(MarkDeque* deque, Obj* object) {
+    i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    i64 top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    MarkBuffer* buffer = __atomic_load_n(&deque->buffer, __ATOMIC_RELAXED);
+    if (bottom - top > buffer->capacity - 1) {
+        MarkBuffer* grown = new_mark_buffer(buffer->capacity * 2, buffer);
+        for (i64 i = top; i < bottom; i++) {
+            grown->items[i & (grown->capacity - 1)] =
+                __atomic_load_n(&buffer->items[i & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&deque->buffer, grown, __ATOMIC_RELEASE);
+        buffer = grown;
+    }
+    __atomic_store_n(&buffer->items[bottom & (buffer->capacity - 1)], object, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+// The newest object, or NULL when the deque is empty
+static Obj* take_gray(MarkDeque* deque) {
+    i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    MarkBuffer* buffer = __atomic_load_n(&deque->buffer, __ATOMIC_RELAXED);
+    // Paired with the fence in steal_gray, so either the thief sees the
+    // deque shrink or the owner sees the theft
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    i64 top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    Obj* object = NULL;
+    if (top <= bottom) {
+        object = __atomic_load_n(&buffer->items[bottom & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+        if (top != bottom) return object;
+        // The last one, which a thief may be taking too
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            object = NULL;
+        }
+    }
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return object;
+}
+
+// The oldest object, or NULL when the deque is empty or another thief got
+// there first
+static Obj* steal_gray(MarkDeque* deque) {
+    i64 top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    i64 bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return NULL;
+    MarkBuffer* buffer = __atomic_load_n(&deque->buffer, __ATOMIC_ACQUIRE);
+    Obj* object = __atomic_load_n(&buffer->items[top & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return object;
+}
+
+static bool has_gray(MarkDeque* deque) {
+    return __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) < __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+}
+
+// Only the marker that sets the bit traces the object. The first object it
+// needs to trace is kept in hand rather than pushed, as it's traced next.
+static void mark_object_in_parallel(Marker* marker, Obj* object, Obj** hand) {
+    if (in_nursery(marker->mark->heap, object) || __atomic_load_n(&object->is_marked, __ATOMIC_RELAXED)) return;
+    if (__atomic_exchange_n(&object->is_marked, true, __ATOMIC_RELAXED)) return;
+    if (object->type == OBJ_STRING) return;
+    if (*hand == NULL) {
+        *hand = object;
+    } else {
+        push_gray(&marker->mark->deques[marker->index], object);
+    }
+}
+
+static void mark_value_in_parallel(Marker* marker, Value value, Obj** hand) {
+    if (IS_OBJ(value)) mark_object_in_parallel(marker, AS_OBJ(value), hand);
+}
+
+// blacken_object for a marker. Returns one of the objects it marked that
+// needs tracing in turn, if there are any.
+static Obj* blacken_object_in_parallel(Marker* marker, Obj* object) {
+    Obj* hand = NULL;
+    switch (object->type) {
+        case OBJ_STRING:
+        case OBJ_FUNCTION:
+            break;
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            mark_value_in_parallel(marker, rope->left, &hand);
+            mark_value_in_parallel(marker, rope->right, &hand);
+            if (rope->flat != NULL) mark_object_in_parallel(marker, (Obj*)rope->flat, &hand);
+            break;
+        }
+    }
+    return hand;
+}
+
+// Steals from the other markers in turn, starting with the next one along
+static Obj* steal_from_others(Marker* marker) {
+    ParallelMark* mark = marker->mark;
+    for (u32 i = 1; i < mark->deque_count; i++) {
+        Obj* object = steal_gray(&mark->deques[(marker->index + i) % mark->deque_count]);
+        if (object != NULL) return object;
+    }
+    return NULL;
+}
+
+static bool any_gray(ParallelMark* mark) {
+    for (u32 i = 0; i < mark->deque_count; i++) {
+        if (has_gray(&mark->deques[i])) return true;
+    }
+    return false;
+}
+
+static void* run_marker(void* argument) {
+    Marker* marker = (Marker*)argument;
+    ParallelMark* mark = marker->mark;
+    MarkDeque* own = &mark->deques[marker->index];
+    for (;;) {
+        Obj* object = take_gray(own);
+        if (object == NULL) object = steal_from_others(marker);
+        if (object != NULL) {
+            while (object != NULL) object = blacken_object_in_parallel(marker, object);
+            continue;
+        }
+        __atomic_add_fetch(&mark->idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&mark->idle, __ATOMIC_SEQ_CST) == __atomic_load_n(&mark->markers, __ATOMIC_SEQ_CST)) {
+                return NULL;
+            }
+            if (any_gray(mark)) break;
+            sched_yield();
+        }
+        __atomic_sub_fetch(&mark->idle, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Traces everything on the gray stack at once, with the calling thread and
+// marker_threads - 1 more. Marking is only ever done this way straight after
+// the roots are marked, with nothing else running on the heap.
+static void mark_in_parallel(Heap* heap) {
+    ParallelMark* mark = ALLOCATE(ParallelMark, 1);
+    mark->heap = heap;
+    mark->deque_count = heap->marker_threads;
+    mark->markers = heap->marker_threads;
+    mark->idle = 0;
+    Marker markers[GC_MAX_MARKER_THREADS];
+    for (u32 i = 0; i < mark->deque_count; i++) {
+        mark->deques[i].top = 0;
+        mark->deques[i].bottom = 0;
+        mark->deques[i].buffer = new_mark_buffer(GC_SLICE_WORK, NULL);
+        markers[i] = (Marker){mark, i};
+    }
+    // The others steal from the calling thread's deque to begin with
+    for (u64 i = 0; i < heap->gray_count; i++) {
+        push_gray(&mark->deques[0], heap->gray[i]);
+    }
+    heap->gray_count = 0;
+
+    pthread_t threads[GC_MAX_MARKER_THREADS];
+    u32 started = 1;
+    while (started < mark->deque_count &&
+           pthread_create(&threads[started], NULL, run_marker, &markers[started]) == 0) {
+        started++;
+    }
+    // Work left in the deques of markers that never started gets stolen
+    __atomic_store_n(&mark->markers, started, __ATOMIC_SEQ_CST);
+    run_marker(&markers[0]);
+    for (u32 i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (u32 i = 0; i < mark->deque_count; i++) {
+        free_mark_buffers(mark->deques[i].buffer);
+    }
+    FREE(ParallelMark, mark);
+}
+
+void object_write_barrier(Heap* heap, Obj* object, Obj* target) {
+    // A black object mustn't be left pointing at a white one, or the cycle
+    // would sweep it
+    if (heap->phase == GC_MARKING && object->is_marked) mark_object(heap, target);
+    if (in_nursery(heap, object) || !in_nursery(heap, target)) return;
+    if (heap->remembered_capacity < heap->remembered_count + 1) {
+        u64 old_capacity = heap->remembered_capacity;
+        heap->remembered_capacity = GROW_CAPACITY(old_capacity);
+        heap->remembered = GROW_ARRAY(Obj*, heap->remembered, old_capacity, heap->remembered_capacity);
+    }
+    heap->remembered[heap->remembered_count++] = object;
+}
+
+// Links an object into the old generation. Objects that arrive while a
+// cycle is marking are black, so the cycle only ever traces what was there
+// when it began and can't fall behind however fast objects are promoted.
+static void add_old_object(Heap* heap, Obj* object, u64 size) {
+    object->is_marked = heap->phase == GC_MARKING;
+    object->next = heap->objects;
+    heap->objects = object;
+    heap->size += size;
+    heap->debt++;
+}
+
+// Copies a nursery object into the old generation. The original is left
+// marked, with next pointing at the copy, so every other reference to it
+// finds the same one.
+static Obj* promote(Heap* heap, Obj* object) {
+    if (object->is_marked) return object->next;
+    u64 size = object_size(object);
+    Obj* copy = (Obj*)reallocate(NULL, 0, size, MEMORY_TAG);
+    memcpy(copy, object, size);
+    add_old_object(heap, copy, size);
+    if (copy->is_marked) blacken_object(heap, copy);
+    heap->stats.bytes_promoted += size;
+    object->is_marked = true;
+    object->next = copy;
+    return copy;
+}
+
+static void promote_value(Heap* heap, Value* slot) {
+    if (IS_OBJ(*slot) && in_nursery(heap, AS_OBJ(*slot))) *slot = OBJ_VAL(promote(heap, AS_OBJ(*slot)));
+}
+
+// Promotes whatever an old object refers to in the nursery
+static void promote_references(Heap* heap, Obj* object) {
+    if (object->type != OBJ_ROPE) return;
+    ObjRope* rope = (ObjRope*)object;
+    promote_value(heap, &rope->left);
+    promote_value(heap, &rope->right);
+    if (rope->flat != NULL && in_nursery(heap, (Obj*)rope->flat)) {
+        rope->flat = (ObjString*)promote(heap, (Obj*)rope->flat);
+    }
+}
+
+// The interned strings that survive a minor collection, wherever they went
+static ObjString* promoted_string(ObjString* string, void* context) {
+    if (!in_nursery((Heap*)context, (Obj*)string)) return string;
+    return string->obj.is_marked ? (ObjString*)string->obj.next : NULL;
+}
+
+static ObjString* marked_string(ObjString* string, void* context) {
+    (void)context;
+    return string->obj.is_marked ? string : NULL;
+}
+
+// Promotes everything reachable in the nursery and empties it
+static void empty_nursery(VM* vm) {
+    Heap* heap = &vm->heap;
+    u64 used = (u64)(heap->nursery_top - heap->nursery);
+    if (used == 0) return;
+    u64 promoted = heap->stats.bytes_promoted;
+    Obj* scanned = heap->objects;
+
+    for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
+        promote_value(heap, slot);
+    }
+    // Every store to a global goes through mark_card, so globals on clean
+    // cards can't hold nursery objects
+    for (u32 card = 0; card < GC_CARD_COUNT; card++) {
+        if (!heap->cards[card]) continue;
+        heap->cards[card] = false;
+        u32 end = (card + 1) * GC_CARD_GLOBALS;
+        if (end > vm->byte_code->global_count) end = vm->byte_code->global_count;
+        for (u32 i = card * GC_CARD_GLOBALS; i < end; i++) {
+            promote_value(heap, &vm->globals[i]);
+        }
+    }
+    for (u64 i = 0; i < heap->remembered_count; i++) {
+        promote_references(heap, heap->remembered[i]);
+    }
+    heap->remembered_count = 0;
+    // Promoted ropes refer to more of the nursery in turn. Copies go on the
+    // front of the old generation's list, so everything in front of what's
+    // been scanned still needs its references promoting.
+    while (heap->objects != scanned) {
+        Obj* end = scanned;
+        scanned = heap->objects;
+        for (Obj* object = scanned; object != end; object = object->next) {
+            promote_references(heap, object);
+        }
+    }
+
+    table_retain(&vm->strings, promoted_string, heap);
+
+    heap->stats.bytes_freed += heap->nursery_bytes - (heap->stats.bytes_promoted - promoted);
+    // Anything still pointing into the nursery now reads garbage
+    if (heap->stress) memset(heap->nursery, 0xdb, used);
+    heap->nursery_top = heap->nursery;
+    heap->nursery_bytes = 0;
+    heap->stats.minor_collections++;
+}
+
+static void minor_collection(VM* vm) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    empty_nursery(vm);
+    record_pause(&vm->heap, &start);
+}
+
+// The stack and globals changed while marking went on, so they're marked
+// again in one go to finish it. Emptying the nursery first means every root
+// points into the old generation by then.
+static void finish_marking(VM* vm) {
+    Heap* heap = &vm->heap;
+    empty_nursery(vm);
+    mark_roots(vm);
+    while (heap->gray_count > 0) {
+        blacken_object(heap, heap->gray[--heap->gray_count]);
+    }
+    // The marks are final, so interned strings that are about to be swept
+    // can be let go of
+    table_retain(&vm->strings, marked_string, NULL);
+    // Objects promoted or allocated from here on start a new list, unmarked,
+    // and wait for the next cycle
+    heap->phase = GC_SWEEPING;
+    heap->unswept = heap->objects;
+    heap->objects = NULL;
+}
+
+static void finish_sweeping(Heap* heap) {
+    heap->phase = GC_IDLE;
+    // Survivors set the budget for the next cycle, so a heap that stays
+    // small is collected often and a big one rarely
+    heap->next_gc = heap->size * GC_HEAP_GROW_FACTOR;
+    if (heap->next_gc < GC_MIN_HEAP) heap->next_gc = GC_MIN_HEAP;
+    heap->stats.major_collections++;
+}
+
+void gc_step(VM* vm) {
+    Heap* heap = &vm->heap;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    u64 work = GC_SLICE_WORK + 2 * heap->debt;
+    heap->debt = 0;
+    switch (heap->phase) {
+        case GC_IDLE:
+            heap->phase = GC_MARKING;
+            mark_roots(vm);
+            if (heap->marker_threads > 1 && heap->size >= GC_PARALLEL_MARK_HEAP) {
+                mark_in_parallel(heap);
+                finish_marking(vm);
+            }
+            break;
+        case GC_MARKING:
+            while (heap->gray_count > 0 && work > 0) {
+                blacken_object(heap, heap->gray[--heap->gray_count]);
+                work--;
+            }
+            if (heap->gray_count == 0) finish_marking(vm);
+            break;
+        case GC_SWEEPING:
+            while (heap->unswept != NULL && work > 0) {
+                Obj* object = heap->unswept;
+                heap->unswept = object->next;
+                work--;
+                if (object->is_marked) {
+                    object->is_marked = false;
+                    object->next = heap->objects;
+                    heap->objects = object;
+                    continue;
+                }
+                u64 size = object_size(object);
+                heap->size -= size;
+                heap->stats.bytes_freed += size;
+                free_object(object, MEMORY_TAG);
+            }
+            if (heap->unswept == NULL) finish_sweeping(heap);
+            break;
+    }
+    record_pause(heap, &start);
+}
+
+void collect_garbage(VM* vm) {
+    Heap* heap = &vm->heap;
+    minor_collection(vm);
+    // A cycle already under way may keep objects that died since it began,
+    // so a fresh one follows it
+    while (heap->phase != GC_IDLE) gc_step(vm);
+    do {
+        gc_step(vm);
+    } while (heap->phase != GC_IDLE);
+}
+
+static void replace_value(Value* slot, ObjString* from, ObjString* to) {
+    if (IS_OBJ(*slot) && AS_OBJ(*slot) == (Obj*)from) *slot = OBJ_VAL(to);
+}
+
+static ObjString* other_string(ObjString* string, void* context) {
+    return string == (ObjString*)context ? NULL : string;
+}
+
+void replace_string(VM* vm, ObjString* from, ObjString* to) {
+    Heap* heap = &vm->heap;
+    for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
+        replace_value(slot, from, to);
+    }
+    for (u32 i = 0; i < vm->byte_code->global_count; i++) {
+        replace_value(&vm->globals[i], from, to);
+    }
+    // With the nursery empty and no cycle under way, every object is here
+    for (Obj* object = heap->objects; object != NULL; object = object->next) {
+        if (object->type != OBJ_ROPE) continue;
+        ObjRope* rope = (ObjRope*)object;
+        replace_value(&rope->left, from, to);
+        replace_value(&rope->right, from, to);
+        if (rope->flat == from) rope->flat = to;
+    }
+    table_retain(&vm->strings, other_string, from);
+}
+
+static bool major_due(Heap* heap) {
+    return heap->phase != GC_IDLE || heap->size > heap->next_gc;
+}
+
+Obj* allocate_heap_object(VM* vm, u64 size, ObjType type) {
+    Heap* heap = &vm->heap;
+    if (heap->stress) collect_garbage(vm);
+
+    Obj* object;
+    if (size >= GC_LARGE_OBJECT) {
+        if (major_due(heap)) gc_step(vm);
+        object = (Obj*)reallocate(NULL, 0, size, MEMORY_TAG);
+        add_old_object(heap, object, size);
+    } else {
+        if (heap->nursery == NULL) {
+            heap->nursery = ALLOCATE(u8, GC_NURSERY_SIZE);
+            heap->nursery_top = heap->nursery;
+        }
+        // Keeps every nursery object aligned
+        u64 rounded = (size + 7) & ~(u64)7;
+        if ((u64)(heap->nursery + GC_NURSERY_SIZE - heap->nursery_top) < rounded) {
+            minor_collection(vm);
+            // Old generation cycles advance a slice per minor collection
+            if (major_due(heap)) gc_step(vm);
+        }
+        object = (Obj*)heap->nursery_top;
+        heap->nursery_top += rounded;
+        heap->nursery_bytes += size;
+        object->is_marked = false;
+        object->next = NULL;
+    }
+    object->type = type;
+
+    heap->stats.objects_allocated++;
+    heap->stats.bytes_allocated += size;
+    u64 heap_size = heap->size + heap->nursery_bytes;
+    if (heap_size > heap->stats.peak_heap_size) heap->stats.peak_heap_size = heap_size;
+    return object;
+}
+
+ObjString* allocate_string(VM* vm, u64 length) {
+    ObjString* string = (ObjString*)allocate_heap_object(vm, sizeof(ObjString) + length + 1, OBJ_STRING);
+    string->length = length;
+    string->chars[length] = '\0';
+    return string;
+}
+
+void print_gc_stats(Heap* heap, FILE* out) {
+    GcStats* stats = &heap->stats;
+    fprintf(out, "gc: %lu minor, %lu major collections in %lu pauses, %.3fms total pause, %.3fms max pause\n",
+            stats->minor_collections, stats->major_collections, stats->pauses, stats->total_pause * 1e3,
+            stats->max_pause * 1e3);
+    fprintf(out, "gc: %lu objects in %lu bytes allocated, %lu promoted, %lu freed, %lu live, %lu peak\n",
+            stats->objects_allocated, stats->bytes_allocated, stats->bytes_promoted, stats->bytes_freed,
+            heap->size + heap->nursery_bytes, stats->peak_heap_size);
+    fprintf(out, "gc: pauses");
+    for (u32 i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        fprintf(out, " %s %lu", pause_labels[i], stats->pause_histogram[i]);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,157 @@
+#ifndef pepper_gc_h
+#define pepper_gc_h
+
+#include "common.h"
+#include "object.h"
+
+// A generational collector for the objects a VM allocates while it runs.
+// Each VM has its own heap and collects it on its own thread.
+//
+// New objects are bump allocated in a nursery. When it fills, a minor
+// collection copies whatever is still reachable into the old generation and
+// the whole nursery is reused. The old generation is marked and swept
+// incrementally, a slice at a time, so no single pause has to cover the
+// whole heap. Marking advances on the interpreter's back-edges as well, but
+// sweeping is left to allocation: memory only needs freeing when more is
+// being asked for.
+//
+// With more than one marker thread, an old generation of at least
+// GC_PARALLEL_MARK_HEAP is marked in one pause instead, by every marker at
+// once. Each has its own deque of gray objects and steals from the others
+// when it runs out, and mark bits are set atomically, so each object is
+// traced once. That trades the incremental marker's short pauses for
+// marking a big heap sooner.
+//
+// Roots are the value stack and the globals. Byte code objects (functions
+// and literals) are shared between VMs, so the collector never writes to
+// them: they're created marked and are never on a VM's heap. Strings and
+// ropes are the only objects a VM makes, and a rope is only written to
+// once it exists when it's flattened, which goes through
+// object_write_barrier.
+
+#define GC_NURSERY_SIZE (256 * 1024)
+// Bigger objects go straight into the old generation rather than being
+// copied out of the nursery
+#define GC_LARGE_OBJECT (GC_NURSERY_SIZE / 8)
+// The old generation may grow by this factor of what survived the last
+// cycle before the next one starts
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_MIN_HEAP (1024 * 1024)
+// How many objects one slice of an old generation cycle marks or sweeps, at
+// the least
+#define GC_SLICE_WORK 1024
+// Smaller old generations are marked incrementally however many marker
+// threads there are, as starting the threads would cost more than they save
+#define GC_PARALLEL_MARK_HEAP (16 * 1024 * 1024)
+#define GC_MAX_MARKER_THREADS 64
+// How many globals share a card
+#define GC_CARD_GLOBALS 16
+#define GC_CARD_COUNT (UINT8_COUNT / GC_CARD_GLOBALS)
+// Pauses are counted in buckets of under 10us, 25us, 50us, 100us, 250us,
+// 500us, 1ms and anything longer
+#define GC_PAUSE_BUCKETS 8
+
+typedef enum {
+    GC_IDLE,
+    GC_MARKING,
+    GC_SWEEPING,
+} GcPhase;
+
+typedef struct {
+    u64 minor_collections;
+    u64 major_collections;
+    // Every pause: minor collections and each slice of a major one
+    u64 pauses;
+    u64 pause_histogram[GC_PAUSE_BUCKETS];
+    // Totals over the VM's lifetime
+    u64 objects_allocated;
+    u64 bytes_allocated;
+    u64 bytes_promoted;
+    u64 bytes_freed;
+    u64 peak_heap_size;
+    // In seconds
+    f64 total_pause;
+    f64 max_pause;
+} GcStats;
+
+typedef struct {
+    // Allocated on the first allocation, so VMs that never make an object
+    // don't pay for one
+    u8* nursery;
+    u8* nursery_top;
+    // What the nursery's objects were allocated with, leaving out padding
+    u64 nursery_bytes;
+    // The old generation
+    Obj* objects;
+    // Bytes in live and not yet swept old objects
+    u64 size;
+    u64 next_gc;
+    GcPhase phase;
+    // Objects added to the old generation since the last slice. Each slice
+    // does twice that on top of GC_SLICE_WORK, so a cycle always finishes.
+    u64 debt;
+    // Marked objects whose references haven't been traced yet
+    Obj** gray;
+    u64 gray_count;
+    u64 gray_capacity;
+    // Old objects the sweep in progress hasn't reached yet
+    Obj* unswept;
+    // Old objects given a reference into the nursery since the last minor
+    // collection, which treats what they refer to as roots
+    Obj** remembered;
+    u64 remembered_count;
+    u64 remembered_capacity;
+    // Set when a global in the card is given a nursery object, so a minor
+    // collection only has to look at those globals
+    bool cards[GC_CARD_COUNT];
+    // Read from gc_set_stress when the heap is created
+    bool stress;
+    // Read from gc_set_marker_threads when the heap is created
+    u32 marker_threads;
+    GcStats stats;
+} Heap;
+
+struct VM;
+
+void init_heap(Heap* heap);
+void free_heap(Heap* heap);
+// Frees every object but keeps the nursery, for a VM that's starting on
+// another program. The statistics carry on.
+void reset_heap(Heap* heap);
+// May collect first, so anything the caller still needs must be reachable
+// from a root, usually by leaving it on the stack. Collecting moves objects,
+// so pointers into the heap have to be read again afterwards.
+Obj* allocate_heap_object(struct VM* vm, u64 size, ObjType type);
+ObjString* allocate_string(struct VM* vm, u64 length);
+// Empties the nursery and runs a whole old generation cycle
+void collect_garbage(struct VM* vm);
+// Runs one slice of the old generation cycle in progress
+void gc_step(struct VM* vm);
+// Points everything the VM holds that refers to one string at another
+// instead, and stops interning the first, so it's collected. Only straight
+// after collect_garbage, when every object is in the old generation.
+void replace_string(struct VM* vm, ObjString* from, ObjString* to);
+void print_gc_stats(Heap* heap, FILE* out);
+
+// Collects before every allocation, to shake out missing roots. Switched on
+// with --gc-stress or PEPPER_GC_STRESS=1.
+void gc_set_stress(bool enabled);
+// How many threads mark a big old generation, counting the VM's own. 1, the
+// default, keeps marking incremental. Also set with --gc-threads or
+// PEPPER_GC_THREADS.
+void gc_set_marker_threads(u32 threads);
+
+static inline bool in_nursery(Heap* heap, Obj* object) {
+    // One comparison, and false for everything while there's no nursery
+    return (uintptr_t)object - (uintptr_t)heap->nursery < GC_NURSERY_SIZE;
+}
+
+// The write barrier for every store to a global
+static inline void mark_card(Heap* heap, u8 global, Value value) {
+    if (IS_OBJ(value) && in_nursery(heap, AS_OBJ(value))) heap->cards[global / GC_CARD_GLOBALS] = true;
+}
+
+// The write barrier for every store of a reference into an existing object
+void object_write_barrier(Heap* heap, Obj* object, Obj* target);
+
+#endif
@@ -0,0 +1,132 @@
+#define MEMORY_TAG MEMORY_CHUNK
+#include <string.h>
+
+#include "object.h"
+#include "memory.h"
+#include "table.h"
+
+#define ALLOCATE_OBJ(objects, type, object_type) \
+    (type*)allocate_object(objects, sizeof(type), object_type)
+
+static Obj* allocate_object(Obj** objects, u64 size, ObjType type) {
+    Obj* object = (Obj*)reallocate(NULL, 0, size, MEMORY_TAG);
+    object->type = type;
+    object->is_marked = true;
+    // Objects are threaded onto their owner's list so they can all be freed together
+    object->next = *objects;
+    *objects = object;
+    return object;
+}
+
+ObjFunction* new_function(Obj** objects, const char* name) {
+    ObjFunction* function = ALLOCATE_OBJ(objects, ObjFunction, OBJ_FUNCTION);
+    function->arity = 0;
+    function->name = name;
+    function->index = 0;
+    init_chunk(&function->chunk);
+    return function;
+}
+
+ObjString* new_string(Obj** objects, const char* chars, u64 length) {
+    ObjString* string = (ObjString*)allocate_object(objects, sizeof(ObjString) + length + 1, OBJ_STRING);
+    string->length = length;
+    string->hash = hash_chars(HASH_SEED, chars, length);
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    return string;
+}
+
+u64 object_size(Obj* object) {
+    switch (object->type) {
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_STRING: return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+        case OBJ_ROPE: return sizeof(ObjRope);
+    }
+    return 0;
+}
+
+void free_object(Obj* object, MemoryTag tag) {
+    switch (object->type) {
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            free_chunk(&function->chunk);
+            FREE(ObjFunction, object);
+            break;
+        }
+        case OBJ_STRING:
+        case OBJ_ROPE: {
+            reallocate(object, object_size(object), 0, tag);
+            break;
+        }
+    }
+}
+
+void free_objects(Obj* objects, MemoryTag tag) {
+    Obj* object = objects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        free_object(object, tag);
+        object = next;
+    }
+}
+
+void copy_rope_chars(ObjRope* rope, char* chars) {
+    // Pieces are written from the end backwards, each rope's right before
+    // its left, with the lefts still to do kept on a stack. Ropes built by
+    // appending lean left, so for them it never holds more than one.
+    Value* lefts = NULL;
+    u64 left_count = 0;
+    u64 left_capacity = 0;
+    u64 end = rope->length;
+    Value piece = OBJ_VAL(rope);
+    for (;;) {
+        if (IS_ROPE(piece) && AS_ROPE(piece)->flat == NULL) {
+            if (left_capacity < left_count + 1) {
+                u64 old_capacity = left_capacity;
+                left_capacity = GROW_CAPACITY(old_capacity);
+                lefts = (Value*)reallocate(lefts, sizeof(Value) * old_capacity, sizeof(Value) * left_capacity,
+                                           MEMORY_VM_HEAP);
+            }
+            lefts[left_count++] = AS_ROPE(piece)->left;
+            piece = AS_ROPE(piece)->right;
+            continue;
+        }
+        if (IS_ROPE(piece)) piece = OBJ_VAL(AS_ROPE(piece)->flat);
+        u64 length = string_length(&piece);
+        end -= length;
+        memcpy(chars + end, string_chars(&piece), length);
+        if (left_count == 0) break;
+        piece = lefts[--left_count];
+    }
+    reallocate(lefts, sizeof(Value) * left_capacity, 0, MEMORY_VM_HEAP);
+}
+
+void print_object(Value value) {
+    switch (OBJ_TYPE(value)) {
+        case OBJ_FUNCTION: {
+            ObjFunction* function = AS_FUNCTION(value);
+            if (function->name == NULL) {
+                printf("<script>");
+            } else {
+                printf("<fn %s>", function->name);
+            }
+            break;
+        }
+        case OBJ_STRING: {
+            ObjString* string = AS_STRING(value);
+            printf("%.*s", (int)string->length, string->chars);
+            break;
+        }
+        // Printing a rope from a script flattens it first, so this is only
+        // reached from debugging output
+        case OBJ_ROPE: {
+            ObjRope* rope = AS_ROPE(value);
+            if (rope->flat != NULL) {
+                printf("%.*s", (int)rope->flat->length, rope->flat->chars);
+            } else {
+                printf("<rope of %lu characters>", rope->length);
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef pepper_object_h
+#define pepper_object_h
+
+#include "common.h"
+#include "chunk.h"
+#include "memory.h"
+#include "value.h"
+
+#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+
+#define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
+#define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+#define IS_ROPE(value) is_obj_type(value, OBJ_ROPE)
+
+#define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
+#define AS_STRING(value) ((ObjString*)AS_OBJ(value))
+#define AS_ROPE(value) ((ObjRope*)AS_OBJ(value))
+
+typedef enum {
+    OBJ_FUNCTION,
+    OBJ_STRING,
+    OBJ_ROPE,
+} ObjType;
+
+// The header every object starts with
+struct Obj {
+    ObjType type;
+    // Set by the collector on objects it has reached. Objects owned by byte
+    // code start out marked and are never swept. A marked nursery object
+    // has been promoted, and next points at its copy.
+    bool is_marked;
+    struct Obj* next;
+};
+
+typedef struct {
+    Obj obj;
+    i32 arity;
+    Chunk chunk;
+    // NULL for the top level script. Owned by whatever made the function.
+    const char* name;
+    // Numbers the functions of one byte code from 0 in the order they were
+    // generated, so a VM can keep what it knows about each in an array
+    u32 index;
+} ObjFunction;
+
+// Strings longer than SHORT_STRING_MAX. Each one is interned, by its byte
+// code or its VM, so no two have the same contents.
+typedef struct {
+    Obj obj;
+    u64 length;
+    u32 hash;
+    // Always NUL terminated
+    char chars[];
+} ObjString;
+
+// Concatenations this long or longer make a rope
+#define ROPE_MIN_LENGTH 64
+
+// A concatenation that hasn't been carried out yet, so building a string a
+// piece at a time copies each piece once rather than everything before it
+// as well. Ropes are flattened into an interned string the first time
+// they're compared or printed. Only VMs make them.
+typedef struct {
+    Obj obj;
+    u64 length;
+    // Strings or ropes, or nil once the rope has been flattened
+    Value left;
+    Value right;
+    // NULL until the rope has been flattened
+    ObjString* flat;
+} ObjRope;
+
+// Objects made here belong to byte code and live as long as it does. VMs
+// allocate their own objects through the collector in gc.h.
+// The name isn't copied, so it has to last as long as the function
+ObjFunction* new_function(Obj** objects, const char* name);
+ObjString* new_string(Obj** objects, const char* chars, u64 length);
+// How many bytes the object was allocated with
+u64 object_size(Obj* object);
+// Frees under the tag of whichever heap the objects were allocated on
+void free_object(Obj* object, MemoryTag tag);
+void free_objects(Obj* objects, MemoryTag tag);
+// Writes the rope's characters out in order, without a NUL after them
+void copy_rope_chars(ObjRope* rope, char* chars);
+void print_object(Value value);
+
+static inline bool is_obj_type(Value value, ObjType type) {
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+static inline bool is_string(Value value) {
+    return IS_SHORT_STRING(value) || IS_STRING(value) || IS_ROPE(value);
+}
+
+// Not for ropes, which have to be flattened first. Not NUL terminated when
+// the string is short. The characters move with the value, and with the
+// object when the collector moves it.
+static inline const char* string_chars(Value* value) {
+    return IS_SHORT_STRING(*value) ? AS_SHORT_STRING(*value) : AS_STRING(*value)->chars;
+}
+
+static inline u64 string_length(Value* value) {
+    if (IS_SHORT_STRING(*value)) return (u8)SHORT_STRING_LENGTH(*value);
+    return IS_ROPE(*value) ? AS_ROPE(*value)->length : AS_STRING(*value)->length;
+}
+
+#endif
@@ -0,0 +1,251 @@
+#define _DEFAULT_SOURCE 1
+#define MEMORY_TAG MEMORY_VM
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "memory.h"
+#include "object.h"
+
+// The most pieces write_line is given, for "<fn ", the name and ">"
+#define LINE_PIECES_MAX 3
+
+// "00" to "99", so integers are written two digits at a time
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void init_output(Output* output, int fd) {
+    output->fd = fd;
+    output->line_buffered = isatty(fd) == 1;
+    output->buffer = NULL;
+    output->length = 0;
+    output->captured = (CapturedOutput){NULL, 0, 0};
+}
+
+void free_output(Output* output) {
+    flush_output(output);
+    FREE_ARRAY(char, output->buffer, output->buffer != NULL ? OUTPUT_BUFFER_SIZE : 0);
+    output->buffer = NULL;
+    free_captured_output(&output->captured);
+}
+
+void redirect_output(Output* output, int fd) {
+    flush_output(output);
+    output->fd = fd;
+    output->line_buffered = isatty(fd) == 1;
+}
+
+CapturedOutput take_captured_output(Output* output) {
+    flush_output(output);
+    CapturedOutput captured = output->captured;
+    output->captured = (CapturedOutput){NULL, 0, 0};
+    return captured;
+}
+
+void free_captured_output(CapturedOutput* captured) {
+    FREE_ARRAY(char, captured->chars, captured->capacity);
+    *captured = (CapturedOutput){NULL, 0, 0};
+}
+
+static void capture_parts(CapturedOutput* captured, const struct iovec* parts, int count) {
+    u64 length = captured->length;
+    for (int i = 0; i < count; i++) {
+        length += parts[i].iov_len;
+    }
+    if (captured->capacity < length) {
+        u64 old_capacity = captured->capacity;
+        captured->capacity = GROW_CAPACITY(old_capacity);
+        if (captured->capacity < length) captured->capacity = length;
+        captured->chars = GROW_ARRAY(char, captured->chars, old_capacity, captured->capacity);
+    }
+    for (int i = 0; i < count; i++) {
+        // An empty buffer can still be NULL
+        if (parts[i].iov_len == 0) continue;
+        memcpy(captured->chars + captured->length, parts[i].iov_base, parts[i].iov_len);
+        captured->length += parts[i].iov_len;
+    }
+}
+
+// Carries on after partial writes. Errors are ignored, as printf's were.
+static void write_parts(Output* output, struct iovec* parts, int count) {
+    if (output->fd == OUTPUT_CAPTURE) {
+        capture_parts(&output->captured, parts, count);
+        return;
+    }
+    // Pipes only keep small writes whole, so VMs sharing standard output
+    // take turns with stdio's lock. Anything already printed through stdio,
+    // like the REPL's prompt, goes first.
+    bool is_stdout = output->fd == STDOUT_FILENO;
+    if (is_stdout) {
+        flockfile(stdout);
+        fflush(stdout);
+    }
+    while (count > 0) {
+        ssize_t written = writev(output->fd, parts, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        u64 remaining = (u64)written;
+        while (count > 0 && remaining >= parts->iov_len) {
+            remaining -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0) {
+            parts->iov_base = (char*)parts->iov_base + remaining;
+            parts->iov_len -= remaining;
+        }
+    }
+    if (is_stdout) funlockfile(stdout);
+}
+
+void flush_output(Output* output) {
+    if (output->length == 0) return;
+    struct iovec part = {output->buffer, output->length};
+    write_parts(output, &part, 1);
+    output->length = 0;
+}
+
+// Buffers a line made of the pieces, flushing first if it doesn't fit. A
+// line too long to be worth copying goes out with the buffer in one write.
+static void write_line(Output* output, const struct iovec* pieces, int count) {
+    u64 length = 1;
+    for (int i = 0; i < count; i++) {
+        length += pieces[i].iov_len;
+    }
+    if (length >= OUTPUT_DIRECT_WRITE) {
+        struct iovec parts[LINE_PIECES_MAX + 2];
+        parts[0] = (struct iovec){output->buffer, output->length};
+        memcpy(parts + 1, pieces, sizeof(struct iovec) * (u64)count);
+        parts[count + 1] = (struct iovec){"\n", 1};
+        write_parts(output, parts, count + 2);
+        output->length = 0;
+        return;
+    }
+    if (OUTPUT_BUFFER_SIZE - output->length < length) flush_output(output);
+    for (int i = 0; i < count; i++) {
+        memcpy(output->buffer + output->length, pieces[i].iov_base, pieces[i].iov_len);
+        output->length += pieces[i].iov_len;
+    }
+    output->buffer[output->length++] = '\n';
+}
+
+static void write_chars_line(Output* output, const char* chars, u64 length) {
+    struct iovec piece = {(void*)chars, length};
+    write_line(output, &piece, 1);
+}
+
+void write_value_line(Output* output, Value value) {
+    if (output->buffer == NULL) output->buffer = ALLOCATE(char, OUTPUT_BUFFER_SIZE);
+    switch (value.type) {
+        case VAL_INT: {
+            // Integers are by far the most printed, so they're formatted
+            // straight into the buffer
+            if (OUTPUT_BUFFER_SIZE - output->length < INT_CHARS_MAX + 1) flush_output(output);
+            output->length += format_int(AS_INT(value), output->buffer + output->length);
+            output->buffer[output->length++] = '\n';
+            break;
+        }
+        case VAL_FLOATING: {
+            char chars[FLOAT_CHARS_MAX];
+            write_chars_line(output, chars, format_float(AS_FLOATING(value), chars));
+            break;
+        }
+        case VAL_BOOL:
+            if (AS_BOOL(value)) {
+                write_chars_line(output, "true", 4);
+            } else {
+                write_chars_line(output, "false", 5);
+            }
+            break;
+        case VAL_NIL: write_chars_line(output, "nil", 3); break;
+        case VAL_SHORT_STRING:
+            write_chars_line(output, AS_SHORT_STRING(value), (u8)SHORT_STRING_LENGTH(value));
+            break;
+        case VAL_OBJ:
+            switch (OBJ_TYPE(value)) {
+                case OBJ_STRING: write_chars_line(output, AS_STRING(value)->chars, AS_STRING(value)->length); break;
+                case OBJ_FUNCTION: {
+                    ObjFunction* function = AS_FUNCTION(value);
+                    if (function->name == NULL) {
+                        write_chars_line(output, "<script>", 8);
+                        break;
+                    }
+                    struct iovec pieces[LINE_PIECES_MAX] = {
+                        {"<fn ", 4}, {(char*)function->name, strlen(function->name)}, {">", 1}};
+                    write_line(output, pieces, LINE_PIECES_MAX);
+                    break;
+                }
+                case OBJ_ROPE: break; // Unreachable.
+            }
+            break;
+    }
+    if (output->line_buffered) flush_output(output);
+}
+
+u32 format_int(i64 value, char* chars) {
+    // Negating in unsigned arithmetic works for INT64_MIN as well
+    u64 magnitude = value < 0 ? 0 - (u64)value : (u64)value;
+    char digits[INT_CHARS_MAX];
+    u32 start = INT_CHARS_MAX;
+    while (magnitude >= 100) {
+        u64 pair = (magnitude % 100) * 2;
+        magnitude /= 100;
+        start -= 2;
+        digits[start] = digit_pairs[pair];
+        digits[start + 1] = digit_pairs[pair + 1];
+    }
+    if (magnitude >= 10) {
+        start -= 2;
+        digits[start] = digit_pairs[magnitude * 2];
+        digits[start + 1] = digit_pairs[magnitude * 2 + 1];
+    } else {
+        digits[--start] = (char)('0' + magnitude);
+    }
+    u32 length = 0;
+    if (value < 0) chars[length++] = '-';
+    memcpy(chars + length, digits + start, INT_CHARS_MAX - start);
+    return length + INT_CHARS_MAX - start;
+}
+
+u32 format_float(f64 value, char* chars) {
+    // "%f" rounds the exact value to the nearest millionth. Below 2^50
+    // millionths, scaling by a million is out by at most a sixteenth, so
+    // a scaled value within 3/8 of a whole number rounds to it just as the
+    // exact one would. Everything else, including infinities and NaNs,
+    // goes through snprintf.
+    f64 scaled = value * 1e6;
+    f64 magnitude = scaled < 0 ? -scaled : scaled;
+    if (magnitude < 0x1p50) {
+        u64 millionths = (u64)(magnitude + 0.5);
+        f64 error = magnitude - (f64)millionths;
+        if (error < 0.375 && error > -0.375) {
+            u32 length = 0;
+            // Includes -0.0 and negatives that round to zero, as "%f" does
+            if (signbit(value)) chars[length++] = '-';
+            length += format_int((i64)(millionths / 1000000), chars + length);
+            chars[length++] = '.';
+            u64 fraction = millionths % 1000000;
+            for (i32 i = 5; i >= 0; i--) {
+                chars[length + (u32)i] = (char)('0' + fraction % 10);
+                fraction /= 10;
+            }
+            return length + 6;
+        }
+    }
+    return (u32)snprintf(chars, FLOAT_CHARS_MAX, "%f", value);
+}
@@ -0,0 +1,64 @@
+#ifndef pepper_output_h
+#define pepper_output_h
+
+#include "common.h"
+#include "value.h"
+
+// Where a VM's print statements go. Lines collect in a buffer that's
+// written out when it fills, when run returns, and at the end of every line
+// if the output is a terminal. Each write holds whole lines, so VMs printing
+// on different threads never interleave within a line.
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+// Strings at least this long are written straight from the string, along
+// with what's buffered, rather than being copied into the buffer first
+#define OUTPUT_DIRECT_WRITE (OUTPUT_BUFFER_SIZE / 4)
+// The most characters format_int writes
+#define INT_CHARS_MAX 20
+// The most characters format_float writes, for -DBL_MAX, and its NUL
+#define FLOAT_CHARS_MAX 320
+// In place of a file descriptor, keeps everything printed in memory until
+// it's taken with take_captured_output
+#define OUTPUT_CAPTURE (-1)
+
+typedef struct {
+    char* chars;
+    u64 length;
+    u64 capacity;
+} CapturedOutput;
+
+typedef struct {
+    // Or OUTPUT_CAPTURE
+    int fd;
+    // Set for terminals, so each line shows up as soon as it's printed
+    bool line_buffered;
+    // Allocated on the first print
+    char* buffer;
+    u64 length;
+    // Everything flushed so far, when capturing
+    CapturedOutput captured;
+} Output;
+
+void init_output(Output* output, int fd);
+// Flushes anything still buffered first, and frees anything captured that
+// hasn't been taken
+void free_output(Output* output);
+void flush_output(Output* output);
+// Flushes, then sends what's printed from then on to fd instead, keeping the
+// buffer
+void redirect_output(Output* output, int fd);
+// Hands over what's been captured and flushed, which the caller frees with
+// free_captured_output, and starts capturing afresh
+CapturedOutput take_captured_output(Output* output);
+void free_captured_output(CapturedOutput* captured);
+// Prints the value the way print_value does, then a newline. Ropes have to
+// be flattened first.
+void write_value_line(Output* output, Value value);
+
+// Writes value in decimal to chars and returns how many characters that took
+u32 format_int(i64 value, char* chars);
+// Writes value the way printf's "%f" does and returns how many characters
+// that took
+u32 format_float(f64 value, char* chars);
+
+#endif
@@ -0,0 +1,95 @@
+// Each table says what its entries are accounted to
+#define MEMORY_TAG (table->tag)
+#include <string.h>
+
+#include "table.h"
+#include "memory.h"
+
+// Grown once it's three quarters full
+#define TABLE_MAX_LOAD(capacity) ((capacity) / 4 * 3)
+
+// Only its address is used
+static ObjString tombstone;
+#define TOMBSTONE (&tombstone)
+
+void init_table(Table* table, MemoryTag tag) {
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+    table->tag = tag;
+}
+
+void free_table(Table* table) {
+    FREE_ARRAY(ObjString*, table->entries, table->capacity);
+    init_table(table, table->tag);
+}
+
+ObjString* table_find_string(const Table* table, const char* prefix, u64 prefix_length, const char* suffix,
+                             u64 suffix_length, u32 hash) {
+    if (table->count == 0) return NULL;
+    // The capacity is always a power of two
+    u64 index = hash & (table->capacity - 1);
+    for (;;) {
+        ObjString* string = table->entries[index];
+        if (string == NULL) return NULL;
+        if (string != TOMBSTONE && string->hash == hash && string->length == prefix_length + suffix_length &&
+            memcmp(string->chars, prefix, prefix_length) == 0 &&
+            memcmp(string->chars + prefix_length, suffix, suffix_length) == 0) {
+            return string;
+        }
+        index = (index + 1) & (table->capacity - 1);
+    }
+}
+
+// The first empty slot or tombstone the string's probe reaches
+static u64 free_slot(ObjString** entries, u64 capacity, u32 hash) {
+    u64 index = hash & (capacity - 1);
+    while (entries[index] != NULL && entries[index] != TOMBSTONE) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return index;
+}
+
+// Rehashing leaves the tombstones behind
+static void adjust_capacity(Table* table, u64 capacity) {
+    ObjString** entries = ALLOCATE(ObjString*, capacity);
+    for (u64 i = 0; i < capacity; i++) {
+        entries[i] = NULL;
+    }
+    table->count = 0;
+    for (u64 i = 0; i < table->capacity; i++) {
+        ObjString* string = table->entries[i];
+        if (string == NULL || string == TOMBSTONE) continue;
+        entries[free_slot(entries, capacity, string->hash)] = string;
+        table->count++;
+    }
+    FREE_ARRAY(ObjString*, table->entries, table->capacity);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+void table_add(Table* table, ObjString* string) {
+    if (table->count + 1 > TABLE_MAX_LOAD(table->capacity)) {
+        // The collector leaves tombstones behind in bulk, and a table that's
+        // mostly tombstones only needs clearing out, not growing
+        u64 live = 0;
+        for (u64 i = 0; i < table->capacity; i++) {
+            if (table->entries[i] != NULL && table->entries[i] != TOMBSTONE) live++;
+        }
+        u64 capacity = table->capacity < 8 ? 8 : table->capacity;
+        adjust_capacity(table, live + 1 > capacity / 2 ? capacity * 2 : capacity);
+    }
+    u64 index = free_slot(table->entries, table->capacity, string->hash);
+    // Reusing a tombstone doesn't change the count
+    if (table->entries[index] == NULL) table->count++;
+    table->entries[index] = string;
+}
+
+void table_retain(Table* table, ObjString* (*survivor)(ObjString* string, void* context), void* context) {
+    for (u64 i = 0; i < table->capacity; i++) {
+        ObjString* string = table->entries[i];
+        if (string == NULL || string == TOMBSTONE) continue;
+        ObjString* kept = survivor(string, context);
+        table->entries[i] = kept != NULL ? kept : TOMBSTONE;
+    }
+}
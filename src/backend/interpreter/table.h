@@ -0,0 +1,45 @@
+#ifndef pepper_table_h
+#define pepper_table_h
+
+#include "common.h"
+#include "object.h"
+#include "memory.h"
+
+// A set of strings for interning, so there's only ever one string with
+// given contents and equal strings compare by pointer. Open addressing with
+// linear probing; removed entries leave a tombstone so probes carry on
+// past them.
+
+#define HASH_SEED 2166136261u
+
+typedef struct {
+    // Strings and tombstones, which both count towards the load factor
+    u64 count;
+    u64 capacity;
+    ObjString** entries;
+    MemoryTag tag;
+} Table;
+
+// FNV-1a. Strings built in pieces are hashed by feeding each piece the
+// hash of the ones before it, starting from HASH_SEED.
+static inline u32 hash_chars(u32 hash, const char* chars, u64 length) {
+    for (u64 i = 0; i < length; i++) {
+        hash ^= (u8)chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void init_table(Table* table, MemoryTag tag);
+void free_table(Table* table);
+// Finds the string made of prefix followed by suffix, which may be empty,
+// without having to build it first
+ObjString* table_find_string(const Table* table, const char* prefix, u64 prefix_length, const char* suffix,
+                             u64 suffix_length, u32 hash);
+// The string mustn't be in the table already
+void table_add(Table* table, ObjString* string);
+// Replaces every string with what survivor returns for it, removing it if
+// that's NULL. The collector keeps the table weak this way.
+void table_retain(Table* table, ObjString* (*survivor)(ObjString* string, void* context), void* context);
+
+#endif
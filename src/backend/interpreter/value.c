@@ -1,6 +1,13 @@
+#define _DEFAULT_SOURCE 1
+#define MEMORY_TAG MEMORY_CONSTANTS
+#include <stdio.h>
+
 #include "value.h"
 #include "memory.h"
 #include "hashtable.h"
+#include "object.h"
+
+STATIC_ASSERT(sizeof(((Value*)NULL)->as) == sizeof(i64), "Short strings fit in the payload.");
 
 bool values_equal(Value a, Value b) {
     if (a.type != b.type) return false;
@@ -8,31 +15,14 @@ bool values_equal(Value a, Value b) {
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_INT: return AS_INT(a) == AS_INT(b);
         case VAL_FLOATING: return AS_FLOATING(a) == AS_FLOATING(b);
-        case VAL_STRING: return AS_STRING(a) == AS_STRING(b);
+        // Long strings are interned, so objects are only equal to themselves
+        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+        // The characters, padding and length in one comparison
+        case VAL_SHORT_STRING: return AS_INT(a) == AS_INT(b);
         default: return false; // Unreachable.
     }
 }
 
-void init_value_array(ValueArray* array) {
-    array->values = NULL;
-    array->capacity = 0;
-    array->count = 0;
-}
-void write_value_array(ValueArray* array, Value value) {
-    if (array->capacity < array->count + 1) {
-            u64 old_capacity = array->capacity;
-            array->capacity = (u64)GROW_CAPACITY(old_capacity);
-            array->values = GROW_ARRAY(Value, array->values, old_capacity, array->capacity);
-        }
-        array->values[array->count] = value;
-        array->count++;
-}
-
-void free_value_array(ValueArray* array) {
-    FREE_ARRAY(Value, array, array->capacity);
-    init_value_array(array);
-}
-
 void print_value(Value value) {
     switch (value.type) {
             case VAL_BOOL:
@@ -40,7 +30,9 @@ void print_value(Value value) {
                 break;
             case VAL_FLOATING: printf("%f", AS_FLOATING(value)); break;
             case VAL_INT: printf("%ld", AS_INT(value)); break;
-            case VAL_STRING: printf("%s", AS_STRING(value)); break;
+            case VAL_NIL: printf("nil"); break;
+            case VAL_OBJ: print_object(value); break;
+            case VAL_SHORT_STRING: printf("%.*s", (int)(u8)SHORT_STRING_LENGTH(value), AS_SHORT_STRING(value)); break;
             default: break;
         }
 }
@@ -2,51 +2,59 @@
 #define pepper_value_h
 
 #include "common.h"
+#include "vector.h"
+
+typedef struct Obj Obj;
 
 typedef enum {
     VAL_BOOL,
     VAL_INT,
     VAL_FLOATING,
-    VAL_STRING,
     VAL_NIL,
+    VAL_OBJ,
+    // Strings of up to SHORT_STRING_MAX characters, held in the value itself
+    VAL_SHORT_STRING,
 } ValueType;
 
+#define SHORT_STRING_MAX 7
+
 typedef struct {
     ValueType type;
     union {
         bool boolean;
         i64 integer;
         f64 floating;
-        char* string;
+        Obj* obj;
+        // The characters padded with NULs, then the length in the last byte
+        char chars[SHORT_STRING_MAX + 1];
     } as;
 } Value;
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_INT(value) ((value).type == VAL_INT)
-#define IS_STRING(value) ((value).type == VAL_STRING)
+#define IS_FLOATING(value) ((value).type == VAL_FLOATING)
 #define IS_NIL(value) ((value).type == VAL_NIL)
+#define IS_OBJ(value) ((value).type == VAL_OBJ)
+#define IS_SHORT_STRING(value) ((value).type == VAL_SHORT_STRING)
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_INT(value) ((value).as.integer)
-#define AS_STRING(value) ((value).as.string)
 #define AS_FLOATING(value) ((value).as.floating)
+#define AS_OBJ(value) ((value).as.obj)
+#define AS_SHORT_STRING(value) ((value).as.chars)
+#define SHORT_STRING_LENGTH(value) ((value).as.chars[SHORT_STRING_MAX])
 
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define INT_VAL(value) ((Value){VAL_INT, {.integer = value}})
 #define FLOATING_VAL(value) ((Value){VAL_FLOATING, {.floating = value}})
-#define STRING_VAL(value) ((Value){VAL_STRING, {.string = value}})
 #define NIL_VAL ((Value){VAL_NIL, {.boolean = false}})
+#define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+#define EMPTY_SHORT_STRING_VAL ((Value){VAL_SHORT_STRING, {.integer = 0}})
 
-typedef struct {
-    u64 capacity;
-    u64 count;
-    Value* values;
-} ValueArray;
+// Most functions only have a few constants
+DEFINE_VECTOR(ValueArray, value_array, Value, 4, MEMORY_CONSTANTS)
 
 bool values_equal(Value a, Value b);
-void init_value_array(ValueArray* array);
-void write_value_array(ValueArray* array, Value value);
-void free_value_array(ValueArray* array);
 void print_value(Value value);
 
 #endif
@@ -1,57 +1,116 @@
+#define MEMORY_TAG MEMORY_VM
 #include <strings.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "vm.h"
 #include "chunk.h"
 #include "memory.h"
 #include "logger.h"
 #include "debug.h"
-#include "hashtable.h"
 #include "value.h"
+#include "object.h"
 #include "bytecode_generator.h"
+#include "jit.h"
+#include "baseline.h"
+#include "vm_ops.h"
 
 static void reset_stack(VM* vm) {
     vm->stack_top = vm->stack;
+    vm->frame_count = 0;
+    // A recording can't carry on into frames that no longer exist
+    if (vm->jit != NULL) jit_abort_recording(vm->jit);
 }
 
-VM* init_vm(ByteCode* byte_code) {
+VM* init_vm(const ByteCode* byte_code) {
     VM* vm = ALLOCATE(VM, 1);
-    reset_stack(vm);
-    vm->ip = byte_code->chunk->code;
-    vm->chunk = byte_code->chunk;
-    vm->strings = byte_code->strings;
-    vm->globals = byte_code->globals;
+    init_heap(&vm->heap);
+    init_table(&vm->strings, MEMORY_VM_HEAP);
+    init_output(&vm->output, STDOUT_FILENO);
+    vm->byte_code = byte_code;
+    vm->globals = (Value*)reallocate(NULL, 0, sizeof(Value) * byte_code->global_count, MEMORY_GLOBALS);
+    vm->defined_globals = (bool*)reallocate(NULL, 0, sizeof(bool) * byte_code->global_count, MEMORY_GLOBALS);
+    vm->global_capacity = byte_code->global_count;
+    vm->compiled = byte_code->objects;
+    vm->error[0] = '\0';
+    vm->baseline = init_baseline();
+    // Baseline code doesn't count back-edges, so the tracer only runs on top
+    // of the interpreter
+    vm->jit = vm->baseline == NULL ? init_jit() : NULL;
+    reset_vm(vm);
     return vm;
 }
 
-void free_vm(VM* vm) {
+void reset_vm(VM* vm) {
     reset_stack(vm);
-    free(vm);
-}
-
-static Value pop(VM* vm) {
-    vm->stack_top--;
-    return *vm->stack_top;
+    // Traces compiled on an earlier run guard on the types of the globals
+    // they read, and nil fails those guards until the global is defined again
+    for (u32 i = 0; i < vm->byte_code->global_count; i++) {
+        vm->globals[i] = NIL_VAL;
+        vm->defined_globals[i] = false;
+    }
+    ObjFunction* script = vm->byte_code->script;
+    push(vm, OBJ_VAL(script));
+    call(vm, script, 0);
 }
 
-
-static void push(VM* vm, Value value) {
-    *vm->stack_top = value;
-    vm->stack_top++;
+void load_vm(VM* vm, const ByteCode* byte_code) {
+    reset_stack(vm);
+    // Both hold on to the old byte code's functions and code addresses
+    if (vm->jit != NULL) {
+        free_jit(vm->jit);
+        vm->jit = init_jit();
+    }
+    if (vm->baseline != NULL) {
+        free_baseline(vm->baseline);
+        vm->baseline = init_baseline();
+    }
+    // Ropes can refer to the old byte code's literals
+    reset_heap(&vm->heap);
+    free_table(&vm->strings);
+    if (vm->global_capacity < byte_code->global_count) {
+        u32 old_capacity = vm->global_capacity;
+        vm->global_capacity = byte_code->global_count;
+        vm->globals = (Value*)reallocate(vm->globals, sizeof(Value) * old_capacity,
+                                         sizeof(Value) * vm->global_capacity, MEMORY_GLOBALS);
+        vm->defined_globals = (bool*)reallocate(vm->defined_globals, sizeof(bool) * old_capacity,
+                                                sizeof(bool) * vm->global_capacity, MEMORY_GLOBALS);
+    }
+    vm->byte_code = byte_code;
+    vm->compiled = byte_code->objects;
+    vm->error[0] = '\0';
+    reset_vm(vm);
 }
 
-static Value* peek(VM* vm, int distance) {
-    return &vm->stack_top[-1 - distance];
+void free_vm(VM* vm) {
+    reset_stack(vm);
+    if (vm->jit != NULL) free_jit(vm->jit);
+    if (vm->baseline != NULL) free_baseline(vm->baseline);
+    reallocate(vm->globals, sizeof(Value) * vm->global_capacity, 0, MEMORY_GLOBALS);
+    reallocate(vm->defined_globals, sizeof(bool) * vm->global_capacity, 0, MEMORY_GLOBALS);
+    free_heap(&vm->heap);
+    free_table(&vm->strings);
+    free_output(&vm->output);
+    FREE(VM, vm);
 }
 
-Result run(VM* vm) {
-    #define READ_BYTE() (*vm->ip++)
-    #define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
-    #define READ_STRING() AS_STRING(READ_CONSTANT())
-    #define BINARY_OP(op) \
+static Result interpret(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    #define READ_BYTE() (*frame->ip++)
+    #define READ_CONSTANT() (frame->function->chunk.constants.items[READ_BYTE()])
+    #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+    #define HANDLE(handler) \
+    do { \
+      if (!(handler)) return RUNTIME_ERROR; \
+    } while (false)
+    // Counts taken back-edges so hot loops get traced, and gives an old
+    // generation cycle that's marking a slice
+    #define BACK_EDGE() \
     do { \
-      double b = pop(); \
-      double a = pop(); \
-      push(a op b); \
+      if (vm->heap.phase == GC_MARKING) gc_step(vm); \
+      if (vm->jit != NULL && --JIT_HOTCOUNT(vm->jit, frame->ip) == 0) { \
+        jit_back_edge(vm, frame); \
+      } \
     } while (false)
     for (;;) {
     #ifdef DEBUG_MODE_VM
@@ -64,102 +123,164 @@ Result run(VM* vm) {
     printf("\n");
     // This function takes an integer offset, so we need to do some pointer math to convert
     // ip back to its relative offset from the beginning of the bytecode
-    disassemble_instruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
+    disassemble_instruction(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code.items));
 #endif
+    if (vm->jit != NULL && vm->jit->recording) jit_record(vm, frame);
     uint8_t instruction;
     switch (instruction = READ_BYTE()) {
-        case OP_CONSTANT: {
-            Value constant = READ_CONSTANT();
-            push(vm, constant);
-            break;
-        }
-        case OP_ADD: {
-            i64 a = AS_INT(pop(vm));
-            i64 b = AS_INT(pop(vm));
-            push(vm, INT_VAL(a + b));
-            break;
-        }
-        case OP_SUBTRACT: {
-            i64 b = AS_INT(pop(vm));
-            i64 a = AS_INT(pop(vm));
-            push(vm, INT_VAL(a - b));
-            break;
-        }
-        case OP_MULTIPLY: {
-            i64 b = AS_INT(pop(vm));
-            i64 a = AS_INT(pop(vm));
-            push(vm, INT_VAL(a * b));
+        case OP_CONSTANT: push(vm, READ_CONSTANT()); break;
+        case OP_ADD: HANDLE(op_add(vm)); break;
+        case OP_SUBTRACT: HANDLE(op_subtract(vm)); break;
+        case OP_MULTIPLY: HANDLE(op_multiply(vm)); break;
+        case OP_DIVIDE: HANDLE(op_divide(vm)); break;
+        case OP_NEGATE: HANDLE(op_negate(vm)); break;
+        case OP_POP: pop(vm); break;
+        case OP_PRINT: op_print(vm); break;
+        case OP_DEFINE_GLOBAL: op_define_global(vm, READ_BYTE()); break;
+        case OP_GET_GLOBAL: HANDLE(op_get_global(vm, READ_BYTE())); break;
+        case OP_SET_GLOBAL: HANDLE(op_set_global(vm, READ_BYTE())); break;
+        case OP_GREATER: HANDLE(op_greater(vm)); break;
+        case OP_LESS: HANDLE(op_less(vm)); break;
+        case OP_EQUAL: op_equal(vm); break;
+        case OP_NOT: op_not(vm); break;
+        case OP_JUMP: {
+            uint16_t offset = READ_SHORT();
+            frame->ip += offset;
             break;
         }
-        case OP_DIVIDE: {
-            i64 b = AS_INT(pop(vm));
-            i64 a = AS_INT(pop(vm));
-            push(vm, INT_VAL(a / b));
+        case OP_JUMP_IF_FALSE: {
+            uint16_t offset = READ_SHORT();
+            if (is_falsey(pop(vm))) frame->ip += offset;
             break;
         }
-        case OP_NEGATE: {
-            push(vm, pop(vm));
+        case OP_LOOP: {
+            uint16_t offset = READ_SHORT();
+            frame->ip -= offset;
+            BACK_EDGE();
             break;
         }
-        case OP_POP: {
-            pop(vm);
-            break;
-        }
-        case OP_PRINT: {
-            print_value(pop(vm));
+        case OP_LOOP_IF_TRUE: {
+            uint16_t offset = READ_SHORT();
+            if (!is_falsey(pop(vm))) {
+                frame->ip -= offset;
+                BACK_EDGE();
+            }
             break;
         }
-        case OP_DEFINE_GLOBAL: {
-            char* name = READ_STRING();
-            Value* global = (Value*)malloc(sizeof(Value));
-            memcpy(global, peek(vm, 0), sizeof(Value));
-            if (hash_table_add(vm->globals, name, global) == -1) {
-                ERROR("Undefined variable '%s'.", name);
-                return RUNTIME_ERROR;
+        case OP_LOOP_IF_LESS: {
+            uint16_t offset = READ_SHORT();
+            bool less = false;
+            HANDLE(op_loop_if_less(vm, &less));
+            if (less) {
+                frame->ip -= offset;
+                BACK_EDGE();
             }
-            pop(vm);
             break;
         }
-        case OP_SET_GLOBAL: {
-            char* name = READ_STRING();
-            if (hash_table_get(vm->globals, name) == NULL) {
-                ERROR("Undefined variable '%s'.", name);
-                return RUNTIME_ERROR;
-            }
-            pop(vm);
+        case OP_GET_LOCAL: push(vm, frame->slots[READ_BYTE()]); break;
+        case OP_SET_LOCAL: {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = pop(vm);
             break;
         }
-        case OP_GREATER: {
-            i64 b = AS_INT(pop(vm));
-            i64 a = AS_INT(pop(vm));
-            Value val = {.type = VAL_BOOL};
-            if (a > b) {
-                val.as.boolean = true;
-            } else {
-                val.as.boolean = false;
-            }
-            push(vm, val);
+        case OP_CALL: {
+            int arg_count = READ_BYTE();
+            HANDLE(call_value(vm, *peek(vm, arg_count), arg_count));
+            frame = &vm->frames[vm->frame_count - 1];
             break;
         }
-        case OP_GET_GLOBAL: {
-            char* name = READ_STRING();
-            Value* value = (Value*)hash_table_get(vm->globals, name);
-            if (value == NULL) {
-                ERROR("Undefined variable '%s'.", name);
-                return RUNTIME_ERROR;
-            }
-            push(vm, *value);
+        case OP_TAIL_CALL: {
+            int arg_count = READ_BYTE();
+            HANDLE(tail_call(vm, frame, arg_count));
             break;
         }
-        case OP_RETURN:
-            return OK;
+        case OP_RETURN: {
+            if (op_return(vm)) return OK;
+            frame = &vm->frames[vm->frame_count - 1];
             break;
+        }
         default: break;
     }
     }
     #undef READ_BYTE
     #undef READ_CONSTANT
-    #undef READ_STRING
-    #undef BINARY_OP
+    #undef READ_SHORT
+    #undef HANDLE
+    #undef BACK_EDGE
+    return OK;
+}
+
+Result run(VM* vm) {
+    Result result = vm->baseline != NULL ? run_baseline(vm) : interpret(vm);
+    if (result == RUNTIME_ERROR) reset_stack(vm);
+    flush_output(&vm->output);
+    return result;
+}
+
+// Makes room for globals the latest increment added
+static void grow_globals(VM* vm) {
+    u32 old_capacity = vm->global_capacity;
+    if (vm->byte_code->global_count <= old_capacity) return;
+    // Straight to as many as there can be, so it only happens once
+    u32 capacity = UINT8_COUNT;
+    vm->globals = (Value*)reallocate(vm->globals, sizeof(Value) * old_capacity, sizeof(Value) * capacity,
+                                     MEMORY_GLOBALS);
+    vm->defined_globals = (bool*)reallocate(vm->defined_globals, sizeof(bool) * old_capacity,
+                                            sizeof(bool) * capacity, MEMORY_GLOBALS);
+    for (u32 i = old_capacity; i < capacity; i++) {
+        vm->globals[i] = NIL_VAL;
+        vm->defined_globals[i] = false;
+    }
+    vm->global_capacity = capacity;
+    // Traces hold the addresses of the globals they use
+    if (vm->jit != NULL) {
+        free_jit(vm->jit);
+        vm->jit = init_jit();
+    }
+}
+
+// Strings compare by pointer, but a literal in the latest increment can
+// have the same contents as a string this VM interned on an earlier run.
+// Whatever refers to the VM's string is moved over to the literal.
+static void adopt_literals(VM* vm) {
+    bool collected = false;
+    for (const Obj* object = vm->byte_code->objects; object != vm->compiled; object = object->next) {
+        if (object->type != OBJ_STRING) continue;
+        ObjString* literal = (ObjString*)object;
+        ObjString* string = table_find_string(&vm->strings, literal->chars, literal->length, "", 0, literal->hash);
+        if (string == NULL) continue;
+        // Which also finds out whether the string is still alive
+        if (!collected) {
+            collect_garbage(vm);
+            collected = true;
+            string = table_find_string(&vm->strings, literal->chars, literal->length, "", 0, literal->hash);
+            if (string == NULL) continue;
+        }
+        replace_string(vm, string, literal);
+    }
+    vm->compiled = vm->byte_code->objects;
+}
+
+Result run_increment(VM* vm) {
+    reset_stack(vm);
+    grow_globals(vm);
+    adopt_literals(vm);
+    ObjFunction* script = vm->byte_code->script;
+    push(vm, OBJ_VAL(script));
+    call(vm, script, 0);
+    return run(vm);
+}
+
+Result call_function(VM* vm, Value callee, const Value* arguments, int arg_count, Value* result) {
+    push(vm, callee);
+    for (int i = 0; i < arg_count; i++) {
+        push(vm, arguments[i]);
+    }
+    if (!call_value(vm, callee, arg_count)) {
+        reset_stack(vm);
+        return RUNTIME_ERROR;
+    }
+    if (run(vm) != OK) return RUNTIME_ERROR;
+    *result = pop(vm);
     return OK;
 }
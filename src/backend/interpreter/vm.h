@@ -1,32 +1,86 @@
 #ifndef pepper_vm_h
 #define pepper_vm_h
 
-#define STACK_MAX 256
+#define FRAMES_MAX 64
+#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
 
 #include "common.h"
-#include "hashtable.h"
 #include "chunk.h"
+#include "object.h"
 #include "bytecode_generator.h"
+#include "gc.h"
+#include "table.h"
+#include "output.h"
 
 typedef enum {
     OK,
     RUNTIME_ERROR,
 } Result;
 
+// An active function invocation. Locals and arguments are addressed relative
+// to slots, which points at the callee's own stack slot.
 typedef struct {
-    Chunk* chunk;
+    ObjFunction* function;
     uint8_t* ip;
+    Value* slots;
+} CallFrame;
+
+struct Jit;
+struct Baseline;
+
+typedef struct VM {
+    CallFrame frames[FRAMES_MAX];
+    u64 frame_count;
     Value stack[STACK_MAX];
     Value* stack_top;
-    void* objects;
-    HashTable* strings;
-    HashTable* globals;
+    // Objects created while running, such as concatenated strings
+    Heap heap;
+    // Long strings made while running. The collector removes the ones it
+    // frees, so this never keeps a string alive.
+    Table strings;
+    // Buffers what print writes to standard output
+    Output output;
+    // Shared with other VMs and never written to
+    const ByteCode* byte_code;
+    // Indexed like byte_code->global_names. Code can refer to a global
+    // before its definition has run, so each one has a flag as well.
+    Value* globals;
+    bool* defined_globals;
+    // A REPL's byte code can gain globals, so there may be room for more
+    u32 global_capacity;
+    // The newest byte code object as of the last run, so run_increment
+    // knows which literals are new
+    const Obj* compiled;
+    // NULL when the JIT is disabled
+    struct Jit* jit;
+    // Set when functions run as baseline compiled native code instead
+    struct Baseline* baseline;
+    // What went wrong when run last returned RUNTIME_ERROR
+    char error[ERROR_MESSAGE_MAX];
 } VM;
 
-VM* init_vm(ByteCode* byte_code);
+// Sets the VM up to run the script. Creating a VM never touches the byte
+// code, so VMs for the same program can be created and run on any thread.
+VM* init_vm(const ByteCode* byte_code);
+// Readies the VM to run the script again from the start, with every global
+// undefined. The stack and globals are reused, and so is any compiled code.
+void reset_vm(VM* vm);
+// Points the VM at other byte code and readies it to run that script, so a
+// worker can run one program after another without a new VM each time. The
+// stack, nursery and output buffer are kept; compiled code, traces, objects
+// and interned strings all go, so the old byte code can be freed afterwards.
+void load_vm(VM* vm, const ByteCode* byte_code);
 void free_vm(VM* vm);
+// Runs until the outermost frame returns, leaving its result on the stack.
+// A runtime error unwinds every frame but leaves the globals as they were.
+// Everything printed has been written out by the time it returns.
 Result run(VM* vm);
+// Runs the script from the latest generate_increment, keeping the globals
+// and strings left by every run before
+Result run_increment(VM* vm);
+// Calls a function value once the script has finished, storing what it
+// returns in result
+Result call_function(VM* vm, Value callee, const Value* arguments, int arg_count, Value* result);
 void add_chunk(VM* vm, Chunk* chunk);
 
-
 #endif
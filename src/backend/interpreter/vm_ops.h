@@ -0,0 +1,307 @@
+#ifndef pepper_vm_ops_h
+#define pepper_vm_ops_h
+
+// What each opcode does, shared by the switch in vm.c and the baseline
+// compiler's stencils so both tiers run the same semantics. Handlers take
+// their operands already decoded and return false on a runtime error.
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "common.h"
+#include "vm.h"
+#include "value.h"
+#include "object.h"
+#include "gc.h"
+#include "table.h"
+#include "output.h"
+
+static inline void push(VM* vm, Value value) {
+    *vm->stack_top = value;
+    vm->stack_top++;
+}
+
+static inline Value pop(VM* vm) {
+    vm->stack_top--;
+    return *vm->stack_top;
+}
+
+static inline Value* peek(VM* vm, int distance) {
+    return &vm->stack_top[-1 - distance];
+}
+
+static inline bool is_falsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// Keeps the message for whoever called run and returns false, so handlers
+// can return its result directly
+static inline bool runtime_error(VM* vm, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(vm->error, sizeof(vm->error), format, arguments);
+    va_end(arguments);
+    return false;
+}
+
+static inline bool check_callee(VM* vm, Value callee, int arg_count) {
+    if (!IS_FUNCTION(callee)) {
+        return runtime_error(vm, "Can only call functions.");
+    }
+    ObjFunction* function = AS_FUNCTION(callee);
+    if (arg_count != function->arity) {
+        return runtime_error(vm, "Expected %d arguments but got %d.", function->arity, arg_count);
+    }
+    return true;
+}
+
+// The arguments are already on the stack above the callee, so the new frame
+// simply starts at the callee's slot and nothing is copied.
+static inline bool call(VM* vm, ObjFunction* function, int arg_count) {
+    if (vm->frame_count == FRAMES_MAX) {
+        return runtime_error(vm, "Stack overflow.");
+    }
+    CallFrame* frame = &vm->frames[vm->frame_count++];
+    frame->function = function;
+    frame->ip = function->chunk.code.items;
+    frame->slots = vm->stack_top - arg_count - 1;
+    return true;
+}
+
+static inline bool call_value(VM* vm, Value callee, int arg_count) {
+    if (!check_callee(vm, callee, arg_count)) return false;
+    return call(vm, AS_FUNCTION(callee), arg_count);
+}
+
+// Replaces the current frame with a call to the callee, sliding the callee
+// and its arguments down over the frame's slots.
+static inline bool tail_call(VM* vm, CallFrame* frame, int arg_count) {
+    Value callee = *peek(vm, arg_count);
+    if (!check_callee(vm, callee, arg_count)) return false;
+    Value* callee_slot = vm->stack_top - arg_count - 1;
+    memmove(frame->slots, callee_slot, sizeof(Value) * (u64)(arg_count + 1));
+    vm->stack_top = frame->slots + arg_count + 1;
+    frame->function = AS_FUNCTION(callee);
+    frame->ip = frame->function->chunk.code.items;
+    return true;
+}
+
+// Pops the current frame and leaves its result on the caller's stack, in
+// place of the callee. Returns true once the outermost frame has returned.
+static inline bool op_return(VM* vm) {
+    Value result = pop(vm);
+    CallFrame* frame = &vm->frames[--vm->frame_count];
+    vm->stack_top = frame->slots;
+    push(vm, result);
+    return vm->frame_count == 0;
+}
+
+// Int add, subtract and multiply wrap, as they do in native code, rather
+// than overflowing, which C leaves undefined
+#define WRAPPING(a, op, b) ((i64)((u64)(a) op (u64)(b)))
+#define PLAIN(a, op, b) ((a) op (b))
+
+#define BINARY_HANDLER(name, int_type, int_op, float_type, op) \
+    static inline bool name(VM* vm) { \
+        Value b = pop(vm); \
+        Value a = pop(vm); \
+        if (IS_INT(a) && IS_INT(b)) { \
+            push(vm, int_type(int_op(AS_INT(a), op, AS_INT(b)))); \
+        } else if (IS_FLOATING(a) && IS_FLOATING(b)) { \
+            push(vm, float_type(AS_FLOATING(a) op AS_FLOATING(b))); \
+        } else { \
+            return runtime_error(vm, "Operands must be two numbers of the same type."); \
+        } \
+        return true; \
+    }
+
+BINARY_HANDLER(op_add_numbers, INT_VAL, WRAPPING, FLOATING_VAL, +)
+BINARY_HANDLER(op_subtract, INT_VAL, WRAPPING, FLOATING_VAL, -)
+BINARY_HANDLER(op_multiply, INT_VAL, WRAPPING, FLOATING_VAL, *)
+BINARY_HANDLER(op_divide_unchecked, INT_VAL, PLAIN, FLOATING_VAL, /)
+BINARY_HANDLER(op_greater, BOOL_VAL, PLAIN, BOOL_VAL, >)
+BINARY_HANDLER(op_less, BOOL_VAL, PLAIN, BOOL_VAL, <)
+
+#undef BINARY_HANDLER
+#undef WRAPPING
+#undef PLAIN
+
+// The interned string with these characters, if there is one yet
+static inline ObjString* find_string(VM* vm, const char* prefix, u64 prefix_length, const char* suffix,
+                                     u64 suffix_length, u32 hash) {
+    ObjString* string =
+        table_find_string(&vm->byte_code->strings, prefix, prefix_length, suffix, suffix_length, hash);
+    if (string != NULL) return string;
+    return table_find_string(&vm->strings, prefix, prefix_length, suffix, suffix_length, hash);
+}
+
+// Both strings stay on the stack until the result exists, in case
+// allocating it collects.
+// Equal flat strings are always stored the same way, so they compare as
+// equal values: short ones by their characters and long ones by pointer,
+// since each is interned. Nothing is allocated for a short result, or for
+// a long one that already exists. Results of ROPE_MIN_LENGTH or more are
+// ropes, which are flattened before they're compared.
+static inline void concatenate(VM* vm) {
+    Value* a = peek(vm, 1);
+    Value* b = peek(vm, 0);
+    u64 a_length = string_length(a);
+    u64 b_length = string_length(b);
+    Value result = EMPTY_SHORT_STRING_VAL;
+    if (a_length + b_length <= SHORT_STRING_MAX) {
+        // Both are short, so they're copied whole. b's padding lands after
+        // its characters and pads the result.
+        char chars[2 * (SHORT_STRING_MAX + 1)];
+        memcpy(chars, AS_SHORT_STRING(*a), SHORT_STRING_MAX);
+        memcpy(chars + a_length, AS_SHORT_STRING(*b), SHORT_STRING_MAX);
+        memcpy(AS_SHORT_STRING(result), chars, SHORT_STRING_MAX);
+        SHORT_STRING_LENGTH(result) = (char)(a_length + b_length);
+    } else if (a_length + b_length < ROPE_MIN_LENGTH) {
+        // Neither can be a rope, being shorter than the result.
+        // FNV-1a carries on from the hash of what came before, so only b's
+        // characters need hashing when a is long.
+        u32 a_hash = IS_SHORT_STRING(*a) ? hash_chars(HASH_SEED, string_chars(a), a_length) : AS_STRING(*a)->hash;
+        u32 hash = hash_chars(a_hash, string_chars(b), b_length);
+        ObjString* string = find_string(vm, string_chars(a), a_length, string_chars(b), b_length, hash);
+        if (string == NULL) {
+            string = allocate_string(vm, a_length + b_length);
+            // Allocating may have moved both operands
+            memcpy(string->chars, string_chars(a), a_length);
+            memcpy(string->chars + a_length, string_chars(b), b_length);
+            string->hash = hash;
+            table_add(&vm->strings, string);
+        }
+        result = OBJ_VAL(string);
+    } else {
+        ObjRope* rope = (ObjRope*)allocate_heap_object(vm, sizeof(ObjRope), OBJ_ROPE);
+        rope->length = a_length + b_length;
+        // Flattened ropes are replaced by their strings, so what they were
+        // made of can be collected
+        rope->left = IS_ROPE(*a) && AS_ROPE(*a)->flat != NULL ? OBJ_VAL(AS_ROPE(*a)->flat) : *a;
+        rope->right = IS_ROPE(*b) && AS_ROPE(*b)->flat != NULL ? OBJ_VAL(AS_ROPE(*b)->flat) : *b;
+        rope->flat = NULL;
+        result = OBJ_VAL(rope);
+    }
+    vm->stack_top -= 2;
+    push(vm, result);
+}
+
+// Replaces the rope in the slot with the interned string it flattens into,
+// which the rope keeps from then on in place of its pieces
+static inline void flatten(VM* vm, Value* slot) {
+    ObjRope* rope = AS_ROPE(*slot);
+    if (rope->flat == NULL) {
+        ObjString* string = allocate_string(vm, rope->length);
+        rope = AS_ROPE(*slot);
+        copy_rope_chars(rope, string->chars);
+        u32 hash = hash_chars(HASH_SEED, string->chars, string->length);
+        ObjString* existing = find_string(vm, string->chars, string->length, "", 0, hash);
+        if (existing != NULL) {
+            string = existing;
+        } else {
+            string->hash = hash;
+            table_add(&vm->strings, string);
+        }
+        rope->left = NIL_VAL;
+        rope->right = NIL_VAL;
+        rope->flat = string;
+        object_write_barrier(&vm->heap, (Obj*)rope, (Obj*)string);
+    }
+    *slot = OBJ_VAL(rope->flat);
+}
+
+static inline bool op_add(VM* vm) {
+    if (is_string(*peek(vm, 0)) && is_string(*peek(vm, 1))) {
+        concatenate(vm);
+        return true;
+    }
+    return op_add_numbers(vm);
+}
+
+// Negates with wrapping, so negating INT64_MIN gives INT64_MIN back, as the
+// native targets do
+static inline i64 negate_int(i64 value) {
+    return (i64)(0 - (u64)value);
+}
+
+static inline bool op_divide(VM* vm) {
+    if (IS_INT(*peek(vm, 0)) && AS_INT(*peek(vm, 0)) == 0) {
+        return runtime_error(vm, "Division by zero.");
+    }
+    // INT64_MIN / -1 overflows, which traps in the hardware, so dividing by
+    // -1 negates instead
+    if (IS_INT(*peek(vm, 0)) && IS_INT(*peek(vm, 1)) && AS_INT(*peek(vm, 0)) == -1) {
+        pop(vm);
+        push(vm, INT_VAL(negate_int(AS_INT(pop(vm)))));
+        return true;
+    }
+    return op_divide_unchecked(vm);
+}
+
+static inline bool op_negate(VM* vm) {
+    Value value = pop(vm);
+    if (IS_INT(value)) {
+        push(vm, INT_VAL(negate_int(AS_INT(value))));
+    } else if (IS_FLOATING(value)) {
+        push(vm, FLOATING_VAL(-AS_FLOATING(value)));
+    } else {
+        return runtime_error(vm, "Operand must be a number.");
+    }
+    return true;
+}
+
+static inline void op_equal(VM* vm) {
+    if (IS_ROPE(*peek(vm, 0))) flatten(vm, peek(vm, 0));
+    if (IS_ROPE(*peek(vm, 1))) flatten(vm, peek(vm, 1));
+    Value b = pop(vm);
+    Value a = pop(vm);
+    push(vm, BOOL_VAL(values_equal(a, b)));
+}
+
+static inline void op_not(VM* vm) {
+    push(vm, BOOL_VAL(is_falsey(pop(vm))));
+}
+
+static inline void op_print(VM* vm) {
+    if (IS_ROPE(*peek(vm, 0))) flatten(vm, peek(vm, 0));
+    write_value_line(&vm->output, pop(vm));
+}
+
+static inline void op_define_global(VM* vm, u8 global) {
+    vm->globals[global] = pop(vm);
+    mark_card(&vm->heap, global, vm->globals[global]);
+    vm->defined_globals[global] = true;
+}
+
+static inline bool op_get_global(VM* vm, u8 global) {
+    if (!vm->defined_globals[global]) {
+        return runtime_error(vm, "Undefined variable '%s'.", vm->byte_code->global_names[global]);
+    }
+    push(vm, vm->globals[global]);
+    return true;
+}
+
+static inline bool op_set_global(VM* vm, u8 global) {
+    if (!vm->defined_globals[global]) {
+        return runtime_error(vm, "Undefined variable '%s'.", vm->byte_code->global_names[global]);
+    }
+    vm->globals[global] = pop(vm);
+    mark_card(&vm->heap, global, vm->globals[global]);
+    return true;
+}
+
+// Stores true in less when the loop should go round again
+static inline bool op_loop_if_less(VM* vm, bool* less) {
+    Value b = pop(vm);
+    Value a = pop(vm);
+    if (IS_INT(a) && IS_INT(b)) {
+        *less = AS_INT(a) < AS_INT(b);
+    } else if (IS_FLOATING(a) && IS_FLOATING(b)) {
+        *less = AS_FLOATING(a) < AS_FLOATING(b);
+    } else {
+        return runtime_error(vm, "Operands must be two numbers of the same type.");
+    }
+    return true;
+}
+
+#endif
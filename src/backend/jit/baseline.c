@@ -0,0 +1,453 @@
+#define MEMORY_TAG MEMORY_JIT
+#include "baseline.h"
+
+static bool baseline_enabled = false;
+
+void baseline_set_enabled(bool enabled) {
+    baseline_enabled = enabled;
+}
+
+#ifdef JIT_SUPPORTED
+
+#include <stddef.h>
+
+#include "x64.h"
+#include "memory.h"
+#include "object.h"
+#include "vm_ops.h"
+
+// Stencils are the per-opcode templates the compiled code is stitched
+// together from. Each one is an ordinary C function built from the same
+// handlers as the switch in vm.c; the compiler emits a call to it with the
+// decoded operand baked in as an immediate.
+typedef u32 (*Stencil)(VM* vm, Value* slots, u64 operand);
+
+#define STENCIL(name) static u32 stencil_##name(VM* vm, Value* slots, u64 operand)
+#define UNUSED_OPERANDS() (void)slots; (void)operand
+
+STENCIL(add) { UNUSED_OPERANDS(); return op_add(vm); }
+STENCIL(subtract) { UNUSED_OPERANDS(); return op_subtract(vm); }
+STENCIL(multiply) { UNUSED_OPERANDS(); return op_multiply(vm); }
+STENCIL(divide) { UNUSED_OPERANDS(); return op_divide(vm); }
+STENCIL(negate) { UNUSED_OPERANDS(); return op_negate(vm); }
+STENCIL(greater) { UNUSED_OPERANDS(); return op_greater(vm); }
+STENCIL(less) { UNUSED_OPERANDS(); return op_less(vm); }
+STENCIL(equal) { UNUSED_OPERANDS(); op_equal(vm); return true; }
+STENCIL(not) { UNUSED_OPERANDS(); op_not(vm); return true; }
+STENCIL(print) { UNUSED_OPERANDS(); op_print(vm); return true; }
+
+STENCIL(define_global) {
+    (void)slots;
+    op_define_global(vm, (u8)operand);
+    return true;
+}
+
+STENCIL(get_global) {
+    (void)slots;
+    return op_get_global(vm, (u8)operand);
+}
+
+STENCIL(set_global) {
+    (void)slots;
+    return op_set_global(vm, (u8)operand);
+}
+
+// Branch stencils return 1 to take the jump, 0 to fall through and 2 on error
+STENCIL(jump_if_false) {
+    UNUSED_OPERANDS();
+    return is_falsey(pop(vm));
+}
+
+STENCIL(loop_if_true) {
+    UNUSED_OPERANDS();
+    return !is_falsey(pop(vm));
+}
+
+STENCIL(loop_if_less) {
+    UNUSED_OPERANDS();
+    bool less = false;
+    if (!op_loop_if_less(vm, &less)) return 2;
+    return less;
+}
+
+static Result run_frame(VM* vm);
+
+// Calls nest on the native stack; FRAMES_MAX bounds how deep that goes
+STENCIL(call) {
+    (void)slots;
+    int arg_count = (int)operand;
+    if (!call_value(vm, *peek(vm, arg_count), arg_count)) return BASELINE_ERROR;
+    return run_frame(vm) == OK;
+}
+
+STENCIL(tail_call) {
+    (void)slots;
+    if (!tail_call(vm, &vm->frames[vm->frame_count - 1], (int)operand)) return BASELINE_ERROR;
+    return BASELINE_TAIL_CALL;
+}
+
+STENCIL(return) {
+    UNUSED_OPERANDS();
+    op_return(vm);
+    return BASELINE_RETURN;
+}
+
+#undef STENCIL
+#undef UNUSED_OPERANDS
+
+// The VM pointer, the frame's slots and the stack top live in callee-saved
+// registers for the whole function. The stack top is written back to the VM
+// around every stencil call.
+#define VM_REGISTER RBX
+#define SLOTS_REGISTER R12
+#define STACK_REGISTER R13
+
+#define STACK_TOP_OFFSET ((i32)offsetof(VM, stack_top))
+#define TYPE_OFFSET ((i32)offsetof(Value, type))
+#define PAYLOAD_OFFSET ((i32)offsetof(Value, as))
+#define VALUE_SIZE ((i32)sizeof(Value))
+// Displacement of a field of the value distance slots below the stack top
+#define STACK_FIELD(distance, field) (-(distance + 1) * VALUE_SIZE + (field))
+
+STATIC_ASSERT(sizeof(ValueType) == 4, "Baseline code compares value tags as 32 bit immediates.");
+STATIC_ASSERT(sizeof(Value) == 16, "Baseline code copies values as two 8 byte words.");
+
+typedef struct {
+    u64 displacement;
+    u64 target;
+} JumpFixup;
+
+typedef struct {
+    Assembler as;
+    JumpFixup* fixups;
+    u64 fixup_count;
+    u64 fixup_capacity;
+    // Jumps to the shared error stub and epilogue
+    u64* error_jumps;
+    u64 error_count;
+    u64 error_capacity;
+    u64* exit_jumps;
+    u64 exit_count;
+    u64 exit_capacity;
+} BaselineCompiler;
+
+static void add_label_use(u64** uses, u64* count, u64* capacity, u64 displacement) {
+    if (*capacity < *count + 1) {
+        u64 old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *uses = GROW_ARRAY(u64, *uses, old_capacity, *capacity);
+    }
+    (*uses)[(*count)++] = displacement;
+}
+
+static void add_fixup(BaselineCompiler* compiler, u64 displacement, u64 target) {
+    if (compiler->fixup_capacity < compiler->fixup_count + 1) {
+        u64 old_capacity = compiler->fixup_capacity;
+        compiler->fixup_capacity = GROW_CAPACITY(old_capacity);
+        compiler->fixups = GROW_ARRAY(JumpFixup, compiler->fixups, old_capacity, compiler->fixup_capacity);
+    }
+    compiler->fixups[compiler->fixup_count++] = (JumpFixup){displacement, target};
+}
+
+static void emit_stencil(BaselineCompiler* compiler, Stencil stencil, u64 operand) {
+    Assembler* as = &compiler->as;
+    asm_store(as, VM_REGISTER, STACK_TOP_OFFSET, STACK_REGISTER);
+    asm_mov_reg_reg(as, RDI, VM_REGISTER);
+    asm_mov_reg_reg(as, RSI, SLOTS_REGISTER);
+    asm_mov_reg_imm(as, RDX, (i64)operand);
+    asm_mov_reg_imm(as, RAX, (i64)(uintptr_t)stencil);
+    asm_call(as, RAX);
+    asm_load(as, STACK_REGISTER, VM_REGISTER, STACK_TOP_OFFSET);
+}
+
+// For stencils that return false on a runtime error
+static void emit_checked(BaselineCompiler* compiler, Stencil stencil, u64 operand) {
+    emit_stencil(compiler, stencil, operand);
+    asm_test32(&compiler->as, RAX, RAX);
+    add_label_use(&compiler->error_jumps, &compiler->error_count, &compiler->error_capacity,
+                  asm_jcc(&compiler->as, CC_E));
+}
+
+static void emit_branch(BaselineCompiler* compiler, Stencil stencil, u64 target) {
+    emit_stencil(compiler, stencil, 0);
+    asm_cmp32_imm(&compiler->as, RAX, 1);
+    add_fixup(compiler, asm_jcc(&compiler->as, CC_E), target);
+    add_label_use(&compiler->error_jumps, &compiler->error_count, &compiler->error_capacity,
+                  asm_jcc(&compiler->as, CC_A));
+}
+
+// Leaves the function with the stencil's status in eax
+static void emit_exit(BaselineCompiler* compiler, Stencil stencil, u64 operand) {
+    emit_stencil(compiler, stencil, operand);
+    add_label_use(&compiler->exit_jumps, &compiler->exit_count, &compiler->exit_capacity,
+                  asm_jmp(&compiler->as));
+}
+
+// The simplest opcodes are emitted inline rather than as stencil calls
+
+static void emit_copy_value(Assembler* as, Register dst_base, i32 dst, Register src_base, i32 src) {
+    asm_load(as, RAX, src_base, src);
+    asm_store(as, dst_base, dst, RAX);
+    asm_load(as, RAX, src_base, src + PAYLOAD_OFFSET);
+    asm_store(as, dst_base, dst + PAYLOAD_OFFSET, RAX);
+}
+
+static void emit_constant(BaselineCompiler* compiler, Value* constant) {
+    Assembler* as = &compiler->as;
+    asm_store_imm32(as, STACK_REGISTER, TYPE_OFFSET, (i32)constant->type);
+    asm_mov_reg_imm(as, RAX, (i64)constant->as.integer);
+    asm_store(as, STACK_REGISTER, PAYLOAD_OFFSET, RAX);
+    asm_add_imm(as, STACK_REGISTER, VALUE_SIZE);
+}
+
+static void emit_get_local(BaselineCompiler* compiler, u64 slot) {
+    emit_copy_value(&compiler->as, STACK_REGISTER, 0, SLOTS_REGISTER, (i32)slot * VALUE_SIZE);
+    asm_add_imm(&compiler->as, STACK_REGISTER, VALUE_SIZE);
+}
+
+static void emit_set_local(BaselineCompiler* compiler, u64 slot) {
+    asm_sub_imm(&compiler->as, STACK_REGISTER, VALUE_SIZE);
+    emit_copy_value(&compiler->as, SLOTS_REGISTER, (i32)slot * VALUE_SIZE, STACK_REGISTER, 0);
+}
+
+// Checks the top count values are ints, jumping to the returned slow path
+// displacements otherwise
+static void emit_int_checks(Assembler* as, int count, u64* slow_paths) {
+    for (int i = 0; i < count; i++) {
+        asm_cmp_mem_imm32(as, STACK_REGISTER, STACK_FIELD(i, TYPE_OFFSET), VAL_INT);
+        slow_paths[i] = asm_jcc(as, CC_NE);
+    }
+}
+
+static void load_int_operands(Assembler* as) {
+    asm_load(as, RAX, STACK_REGISTER, STACK_FIELD(1, PAYLOAD_OFFSET));
+    asm_load(as, RDX, STACK_REGISTER, STACK_FIELD(0, PAYLOAD_OFFSET));
+}
+
+// Int operands take the inline path; anything else goes through the stencil
+static void emit_binary(BaselineCompiler* compiler, OpCode op, Stencil stencil) {
+    Assembler* as = &compiler->as;
+    u64 slow_paths[2];
+    emit_int_checks(as, 2, slow_paths);
+    load_int_operands(as);
+    if (op == OP_ADD) asm_add(as, RAX, RDX);
+    else if (op == OP_SUBTRACT) asm_sub(as, RAX, RDX);
+    else if (op == OP_MULTIPLY) asm_imul(as, RAX, RDX);
+    else {
+        asm_cmp(as, RAX, RDX);
+        asm_setcc(as, op == OP_LESS ? CC_L : CC_G, RAX);
+        asm_store_imm32(as, STACK_REGISTER, STACK_FIELD(1, TYPE_OFFSET), VAL_BOOL);
+    }
+    asm_store(as, STACK_REGISTER, STACK_FIELD(1, PAYLOAD_OFFSET), RAX);
+    asm_sub_imm(as, STACK_REGISTER, VALUE_SIZE);
+    u64 done = asm_jmp(as);
+    asm_patch(as, slow_paths[0], as->count);
+    asm_patch(as, slow_paths[1], as->count);
+    emit_checked(compiler, stencil, 0);
+    asm_patch(as, done, as->count);
+}
+
+static void emit_loop_if_less(BaselineCompiler* compiler, u64 target) {
+    Assembler* as = &compiler->as;
+    u64 slow_paths[2];
+    emit_int_checks(as, 2, slow_paths);
+    load_int_operands(as);
+    asm_sub_imm(as, STACK_REGISTER, 2 * VALUE_SIZE);
+    asm_cmp(as, RAX, RDX);
+    add_fixup(compiler, asm_jcc(as, CC_L), target);
+    u64 done = asm_jmp(as);
+    asm_patch(as, slow_paths[0], as->count);
+    asm_patch(as, slow_paths[1], as->count);
+    emit_branch(compiler, stencil_loop_if_less, target);
+    asm_patch(as, done, as->count);
+}
+
+// Bools branch inline; other values are left to the stencil's truthiness rules
+static void emit_bool_branch(BaselineCompiler* compiler, Stencil stencil, Condition jump_when, u64 target) {
+    Assembler* as = &compiler->as;
+    asm_cmp_mem_imm32(as, STACK_REGISTER, STACK_FIELD(0, TYPE_OFFSET), VAL_BOOL);
+    u64 slow_path = asm_jcc(as, CC_NE);
+    asm_load_u8(as, RAX, STACK_REGISTER, STACK_FIELD(0, PAYLOAD_OFFSET));
+    asm_sub_imm(as, STACK_REGISTER, VALUE_SIZE);
+    asm_test32(as, RAX, RAX);
+    add_fixup(compiler, asm_jcc(as, jump_when), target);
+    u64 done = asm_jmp(as);
+    asm_patch(as, slow_path, as->count);
+    emit_branch(compiler, stencil, target);
+    asm_patch(as, done, as->count);
+}
+
+static u64 jump_operand(Chunk* chunk, u64 offset) {
+    return (u64)((chunk->code.items[offset + 1] << 8) | chunk->code.items[offset + 2]);
+}
+
+static Value* constant_operand(Chunk* chunk, u64 offset) {
+    return &chunk->constants.items[chunk->code.items[offset + 1]];
+}
+
+// Returns the length of the instruction it compiled
+static u64 compile_instruction(BaselineCompiler* compiler, Chunk* chunk, u64 offset) {
+    u64 byte = chunk->code.items[offset + 1 < chunk->code.count ? offset + 1 : offset];
+    switch (chunk->code.items[offset]) {
+        case OP_CONSTANT: emit_constant(compiler, constant_operand(chunk, offset)); return 2;
+        case OP_ADD: emit_binary(compiler, OP_ADD, stencil_add); return 1;
+        case OP_SUBTRACT: emit_binary(compiler, OP_SUBTRACT, stencil_subtract); return 1;
+        case OP_MULTIPLY: emit_binary(compiler, OP_MULTIPLY, stencil_multiply); return 1;
+        case OP_DIVIDE: emit_checked(compiler, stencil_divide, 0); return 1;
+        case OP_NEGATE: emit_checked(compiler, stencil_negate, 0); return 1;
+        case OP_GREATER: emit_binary(compiler, OP_GREATER, stencil_greater); return 1;
+        case OP_LESS: emit_binary(compiler, OP_LESS, stencil_less); return 1;
+        case OP_EQUAL: emit_stencil(compiler, stencil_equal, 0); return 1;
+        case OP_NOT: emit_stencil(compiler, stencil_not, 0); return 1;
+        case OP_POP: asm_sub_imm(&compiler->as, STACK_REGISTER, VALUE_SIZE); return 1;
+        case OP_PRINT: emit_stencil(compiler, stencil_print, 0); return 1;
+        case OP_DEFINE_GLOBAL: emit_stencil(compiler, stencil_define_global, byte); return 2;
+        case OP_GET_GLOBAL: emit_checked(compiler, stencil_get_global, byte); return 2;
+        case OP_SET_GLOBAL: emit_checked(compiler, stencil_set_global, byte); return 2;
+        case OP_GET_LOCAL: emit_get_local(compiler, byte); return 2;
+        case OP_SET_LOCAL: emit_set_local(compiler, byte); return 2;
+        case OP_CALL: emit_checked(compiler, stencil_call, byte); return 2;
+        case OP_TAIL_CALL: emit_exit(compiler, stencil_tail_call, byte); return 2;
+        case OP_RETURN: emit_exit(compiler, stencil_return, 0); return 1;
+        case OP_JUMP:
+            add_fixup(compiler, asm_jmp(&compiler->as), offset + 3 + jump_operand(chunk, offset));
+            return 3;
+        case OP_JUMP_IF_FALSE:
+            emit_bool_branch(compiler, stencil_jump_if_false, CC_E, offset + 3 + jump_operand(chunk, offset));
+            return 3;
+        case OP_LOOP:
+            add_fixup(compiler, asm_jmp(&compiler->as), offset + 3 - jump_operand(chunk, offset));
+            return 3;
+        case OP_LOOP_IF_TRUE:
+            emit_bool_branch(compiler, stencil_loop_if_true, CC_NE, offset + 3 - jump_operand(chunk, offset));
+            return 3;
+        case OP_LOOP_IF_LESS:
+            emit_loop_if_less(compiler, offset + 3 - jump_operand(chunk, offset));
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+static void free_compiler(BaselineCompiler* compiler) {
+    free_assembler(&compiler->as);
+    FREE_ARRAY(JumpFixup, compiler->fixups, compiler->fixup_capacity);
+    FREE_ARRAY(u64, compiler->error_jumps, compiler->error_capacity);
+    FREE_ARRAY(u64, compiler->exit_jumps, compiler->exit_capacity);
+}
+
+static NativeFunction compile_function(Baseline* baseline, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    BaselineCompiler compiler = {0};
+    init_assembler(&compiler.as);
+    Assembler* as = &compiler.as;
+
+    // Three pushes keep the stack 16 byte aligned for the stencil calls
+    asm_push(as, RBX);
+    asm_push(as, R12);
+    asm_push(as, R13);
+    asm_mov_reg_reg(as, VM_REGISTER, RDI);
+    asm_mov_reg_reg(as, SLOTS_REGISTER, RSI);
+    asm_load(as, STACK_REGISTER, VM_REGISTER, STACK_TOP_OFFSET);
+
+    // Native offset of every bytecode instruction, for patching jumps
+    u64* offsets = ALLOCATE(u64, chunk->code.count + 1);
+    u64 offset = 0;
+    while (offset < chunk->code.count) {
+        offsets[offset] = as->count;
+        offset += compile_instruction(&compiler, chunk, offset);
+    }
+    for (u64 i = 0; i < compiler.fixup_count; i++) {
+        asm_patch(as, compiler.fixups[i].displacement, offsets[compiler.fixups[i].target]);
+    }
+    FREE_ARRAY(u64, offsets, chunk->code.count + 1);
+
+    for (u64 i = 0; i < compiler.error_count; i++) asm_patch(as, compiler.error_jumps[i], as->count);
+    asm_mov_eax_imm(as, BASELINE_ERROR);
+    for (u64 i = 0; i < compiler.exit_count; i++) asm_patch(as, compiler.exit_jumps[i], as->count);
+    asm_pop(as, R13);
+    asm_pop(as, R12);
+    asm_pop(as, RBX);
+    asm_ret(as);
+
+    u64 mapped_size;
+    void* code = map_executable(as->code, as->count, &mapped_size);
+    u64 code_size = as->count;
+    free_compiler(&compiler);
+    if (code == NULL) return NULL;
+    perf_map_add(code, code_size, "baseline", function->name == NULL ? "script" : function->name,
+                 chunk->code.count > 0 ? (u64)chunk->lines.items[0] : 0);
+
+    if (baseline->capacity <= function->index) {
+        u32 old_capacity = baseline->capacity;
+        baseline->capacity = GROW_CAPACITY(old_capacity);
+        if (baseline->capacity <= function->index) baseline->capacity = function->index + 1;
+        baseline->entries = GROW_ARRAY(NativeEntry, baseline->entries, old_capacity, baseline->capacity);
+        memset(baseline->entries + old_capacity, 0, sizeof(NativeEntry) * (baseline->capacity - old_capacity));
+    }
+    NativeEntry* entry = &baseline->entries[function->index];
+    entry->code = (NativeFunction)(uintptr_t)code;
+    entry->mapped_size = mapped_size;
+    return entry->code;
+}
+
+static NativeFunction native_code(Baseline* baseline, ObjFunction* function) {
+    if (function->index < baseline->capacity && baseline->entries[function->index].code != NULL) {
+        return baseline->entries[function->index].code;
+    }
+    return compile_function(baseline, function);
+}
+
+// Runs the frame on top of the call stack until it returns. Tail calls come
+// back here so the replacement function starts without growing the C stack.
+static Result run_frame(VM* vm) {
+    for (;;) {
+        CallFrame* frame = &vm->frames[vm->frame_count - 1];
+        NativeFunction code = native_code(vm->baseline, frame->function);
+        if (code == NULL) {
+            runtime_error(vm, "Out of executable memory.");
+            return RUNTIME_ERROR;
+        }
+        u32 status = code(vm, frame->slots);
+        if (status == BASELINE_ERROR) return RUNTIME_ERROR;
+        if (status == BASELINE_RETURN) return OK;
+    }
+}
+
+Baseline* init_baseline(void) {
+    if (!baseline_enabled) return NULL;
+    Baseline* baseline = ALLOCATE(Baseline, 1);
+    baseline->entries = NULL;
+    baseline->capacity = 0;
+    return baseline;
+}
+
+void free_baseline(Baseline* baseline) {
+    for (u32 i = 0; i < baseline->capacity; i++) {
+        if (baseline->entries[i].code == NULL) continue;
+        unmap_executable((void*)(uintptr_t)baseline->entries[i].code, baseline->entries[i].mapped_size);
+    }
+    FREE_ARRAY(NativeEntry, baseline->entries, baseline->capacity);
+    FREE(Baseline, baseline);
+}
+
+Result run_baseline(VM* vm) {
+    return run_frame(vm);
+}
+
+#else
+
+Baseline* init_baseline(void) {
+    return NULL;
+}
+
+void free_baseline(Baseline* baseline) {
+    (void)baseline;
+}
+
+Result run_baseline(VM* vm) {
+    (void)vm;
+    return RUNTIME_ERROR;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef pepper_baseline_h
+#define pepper_baseline_h
+
+#include "common.h"
+#include "vm.h"
+
+// Compiled code runs one function's frame until it returns (BASELINE_RETURN)
+// or replaces itself with a tail call (BASELINE_TAIL_CALL).
+typedef enum {
+    BASELINE_ERROR = 0,
+    BASELINE_RETURN = 1,
+    BASELINE_TAIL_CALL = 2,
+} BaselineStatus;
+
+typedef u32 (*NativeFunction)(VM* vm, Value* slots);
+
+typedef struct {
+    // NULL until the function is first called
+    NativeFunction code;
+    u64 mapped_size;
+} NativeEntry;
+
+typedef struct Baseline {
+    // Indexed by ObjFunction.index, so finding a function's code on every
+    // call doesn't depend on how many functions there are. Grown as
+    // functions with higher indices are called.
+    NativeEntry* entries;
+    u32 capacity;
+} Baseline;
+
+// Returns NULL unless the baseline tier was asked for with --baseline and is
+// supported on this platform
+Baseline* init_baseline(void);
+void free_baseline(Baseline* baseline);
+
+void baseline_set_enabled(bool enabled);
+
+// Runs the VM's current frame to completion, compiling each function to
+// native code the first time it's called
+Result run_baseline(VM* vm);
+
+#endif
@@ -0,0 +1,293 @@
+#define _DEFAULT_SOURCE 1
+#define MEMORY_TAG MEMORY_JIT
+#include <string.h>
+
+#include "jit.h"
+
+static bool jit_enabled = true;
+
+void jit_set_enabled(bool enabled) {
+    jit_enabled = enabled;
+}
+
+#ifdef JIT_SUPPORTED
+
+#include "memory.h"
+#include "object.h"
+#include "x64.h"
+
+bool jit_is_enabled(void) {
+    const char* setting = getenv("PEPPER_JIT");
+    if (setting != NULL && strcmp(setting, "0") == 0) return false;
+    return jit_enabled;
+}
+
+Jit* init_jit(void) {
+    if (!jit_is_enabled()) return NULL;
+    Jit* jit = ALLOCATE(Jit, 1);
+    for (int i = 0; i < JIT_HOTCOUNT_SLOTS; i++) {
+        jit->hotcounts[i] = JIT_HOT_THRESHOLD;
+    }
+    jit->loops = NULL;
+    jit->loop_count = 0;
+    jit->loop_capacity = 0;
+    jit->recording = false;
+    jit->recording_loop = 0;
+    jit->recording_frame = NULL;
+    jit->recording_depth = 0;
+    jit->ops = ALLOCATE(TraceOp, TRACE_MAX_LENGTH);
+    jit->op_count = 0;
+    return jit;
+}
+
+void free_jit(Jit* jit) {
+    for (u64 i = 0; i < jit->loop_count; i++) {
+        if (jit->loops[i].trace != NULL) free_trace(jit->loops[i].trace);
+    }
+    FREE_ARRAY(LoopInfo, jit->loops, jit->loop_capacity);
+    FREE_ARRAY(TraceOp, jit->ops, TRACE_MAX_LENGTH);
+    FREE(Jit, jit);
+}
+
+static u64 find_loop(Jit* jit, uint8_t* ip) {
+    for (u64 i = 0; i < jit->loop_count; i++) {
+        if (jit->loops[i].ip == ip) return i;
+    }
+    if (jit->loop_capacity < jit->loop_count + 1) {
+        u64 old_capacity = jit->loop_capacity;
+        jit->loop_capacity = GROW_CAPACITY(old_capacity);
+        jit->loops = GROW_ARRAY(LoopInfo, jit->loops, old_capacity, jit->loop_capacity);
+    }
+    jit->loops[jit->loop_count] = (LoopInfo){ip, NULL, 0, false};
+    return jit->loop_count++;
+}
+
+static const char* function_name(ObjFunction* function) {
+    return function->name == NULL ? "script" : function->name;
+}
+
+static u64 line_of(ObjFunction* function, uint8_t* ip) {
+    return (u64)function->chunk.lines.items[ip - function->chunk.code.items];
+}
+
+static void stop_recording(Jit* jit) {
+    jit->recording = false;
+    jit->recording_frame = NULL;
+    jit->op_count = 0;
+}
+
+static void abort_recording(Jit* jit) {
+    LoopInfo* loop = &jit->loops[jit->recording_loop];
+#ifdef DEBUG_MODE_JIT
+    printf("== jit: aborted trace at op %u ==\n", jit->op_count);
+#endif
+    if (++loop->aborts >= JIT_MAX_ABORTS) loop->blacklisted = true;
+    stop_recording(jit);
+}
+
+void jit_abort_recording(Jit* jit) {
+    if (jit->recording) abort_recording(jit);
+}
+
+static void finish_recording(Jit* jit, CallFrame* frame) {
+    Trace* trace = compile_trace(jit->ops, jit->op_count, jit->recording_depth);
+    if (trace == NULL) {
+        abort_recording(jit);
+        return;
+    }
+    LoopInfo* loop = &jit->loops[jit->recording_loop];
+    loop->trace = trace;
+    // Enter the trace as soon as the back-edge being recorded is taken
+    JIT_HOTCOUNT(jit, loop->ip) = 1;
+    perf_map_add((void*)(uintptr_t)trace->code, trace->code_size, "trace", function_name(frame->function),
+                 line_of(frame->function, trace->start_ip));
+#ifdef DEBUG_MODE_JIT
+    printf("== jit: compiled %s:%lu, %u ops to %lu bytes ==\n", function_name(frame->function),
+           line_of(frame->function, trace->start_ip), jit->op_count, trace->code_size);
+#endif
+    stop_recording(jit);
+}
+
+static bool is_traceable(Value value) {
+    return IS_INT(value) || IS_BOOL(value);
+}
+
+static bool is_falsey(Value value) {
+    return IS_BOOL(value) && !AS_BOOL(value);
+}
+
+// Records the instruction at frame->ip before the interpreter executes it.
+// Anything outside the int and bool subset the trace compiler understands
+// aborts the recording.
+void jit_record(VM* vm, CallFrame* frame) {
+    Jit* jit = vm->jit;
+    if (frame != jit->recording_frame || jit->op_count == TRACE_MAX_LENGTH) {
+        abort_recording(jit);
+        return;
+    }
+    uint8_t* ip = frame->ip;
+    Chunk* chunk = &frame->function->chunk;
+    Value* top = vm->stack_top - 1;
+    TraceOp* op = &jit->ops[jit->op_count];
+    op->ip = ip;
+    op->op = (OpCode)*ip;
+    op->slot = 0;
+    op->exit_ip = NULL;
+    op->taken = false;
+    op->type = VAL_NIL;
+    op->global = NULL;
+    op->constant = NIL_VAL;
+
+    bool traceable = true;
+    bool finished = false;
+    switch (op->op) {
+        case OP_CONSTANT:
+            op->constant = chunk->constants.items[ip[1]];
+            traceable = is_traceable(op->constant);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_GREATER:
+        case OP_LESS:
+            traceable = IS_INT(top[0]) && IS_INT(top[-1]);
+            break;
+        case OP_DIVIDE:
+            traceable = IS_INT(top[0]) && IS_INT(top[-1]) && AS_INT(top[0]) != 0;
+            break;
+        case OP_EQUAL:
+            traceable = is_traceable(top[0]) && is_traceable(top[-1]);
+            break;
+        case OP_NOT:
+            traceable = is_traceable(top[0]);
+            break;
+        case OP_NEGATE:
+            traceable = IS_INT(top[0]);
+            break;
+        case OP_POP:
+        case OP_JUMP:
+            break;
+        case OP_GET_LOCAL:
+            op->slot = ip[1];
+            op->type = frame->slots[op->slot].type;
+            traceable = is_traceable(frame->slots[op->slot]);
+            break;
+        case OP_SET_LOCAL:
+            op->slot = ip[1];
+            traceable = is_traceable(top[0]);
+            break;
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL: {
+            // The trace uses the global's address, which never changes for a VM
+            if (!vm->defined_globals[ip[1]]) {
+                traceable = false;
+                break;
+            }
+            op->global = &vm->globals[ip[1]];
+            op->type = op->global->type;
+            traceable = op->op == OP_GET_GLOBAL ? is_traceable(*op->global) : is_traceable(top[0]);
+            break;
+        }
+        case OP_JUMP_IF_FALSE: {
+            uint8_t* next = ip + 3;
+            traceable = is_traceable(top[0]);
+            op->taken = is_falsey(top[0]);
+            op->exit_ip = op->taken ? next : next + ((ip[1] << 8) | ip[2]);
+            break;
+        }
+        case OP_LOOP:
+        case OP_LOOP_IF_TRUE:
+        case OP_LOOP_IF_LESS: {
+            uint8_t* target = ip + 3 - ((ip[1] << 8) | ip[2]);
+            bool taken = true;
+            if (op->op == OP_LOOP_IF_TRUE) {
+                traceable = is_traceable(top[0]);
+                taken = !is_falsey(top[0]);
+            } else if (op->op == OP_LOOP_IF_LESS) {
+                traceable = IS_INT(top[0]) && IS_INT(top[-1]);
+                taken = traceable && AS_INT(top[-1]) < AS_INT(top[0]);
+            }
+            op->exit_ip = ip + 3;
+            // Inner loops and early exits end the recording
+            finished = traceable && taken && target == jit->loops[jit->recording_loop].ip;
+            traceable = finished;
+            break;
+        }
+        default:
+            traceable = false;
+            break;
+    }
+    if (!traceable) {
+        abort_recording(jit);
+        return;
+    }
+    jit->op_count++;
+    if (finished) finish_recording(jit, frame);
+}
+
+static void run_trace(VM* vm, CallFrame* frame, LoopInfo* loop) {
+    Trace* trace = loop->trace;
+    if ((u64)(vm->stack_top - frame->slots) != trace->entry_depth) return;
+    u32 exit = trace->code(frame->slots);
+    frame->ip = trace->exits[exit].ip;
+    vm->stack_top = frame->slots + trace->exits[exit].stack_depth;
+    // A loop whose types keep changing isn't worth tracing
+    if (exit == 0 && ++trace->entry_failures >= JIT_MAX_ENTRY_FAILURES) {
+        free_trace(trace);
+        loop->trace = NULL;
+        loop->blacklisted = true;
+        JIT_HOTCOUNT(vm->jit, loop->ip) = UINT16_MAX;
+    }
+}
+
+void jit_back_edge(VM* vm, CallFrame* frame) {
+    Jit* jit = vm->jit;
+    u64 index = find_loop(jit, frame->ip);
+    LoopInfo* loop = &jit->loops[index];
+    if (loop->trace != NULL) {
+        JIT_HOTCOUNT(jit, loop->ip) = 1;
+        run_trace(vm, frame, loop);
+        return;
+    }
+    if (loop->blacklisted) {
+        JIT_HOTCOUNT(jit, loop->ip) = UINT16_MAX;
+        return;
+    }
+    JIT_HOTCOUNT(jit, loop->ip) = JIT_HOT_THRESHOLD;
+    if (jit->recording) return;
+    jit->recording = true;
+    jit->recording_loop = index;
+    jit->recording_frame = frame;
+    jit->recording_depth = (u64)(vm->stack_top - frame->slots);
+    jit->op_count = 0;
+}
+
+#else
+
+bool jit_is_enabled(void) {
+    return false;
+}
+
+Jit* init_jit(void) {
+    return NULL;
+}
+
+void free_jit(Jit* jit) {
+    (void)jit;
+}
+
+void jit_back_edge(VM* vm, CallFrame* frame) {
+    (void)vm;
+    (void)frame;
+}
+
+void jit_record(VM* vm, CallFrame* frame) {
+    (void)vm;
+    (void)frame;
+}
+
+void jit_abort_recording(Jit* jit) {
+    (void)jit;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef pepper_jit_h
+#define pepper_jit_h
+
+#include "common.h"
+#include "vm.h"
+#include "trace.h"
+
+// Back-edges per loop before it gets recorded
+#define JIT_HOT_THRESHOLD 56
+#define JIT_MAX_ABORTS 3
+#define JIT_MAX_ENTRY_FAILURES 16
+#define JIT_HOTCOUNT_SLOTS 64
+
+// Loops share a small direct-mapped table of counters keyed by the address of
+// the loop head. Collisions only cost an extra lookup in jit_back_edge.
+#define JIT_HOTCOUNT(jit, ip) ((jit)->hotcounts[(uintptr_t)(ip) & (JIT_HOTCOUNT_SLOTS - 1)])
+
+typedef struct {
+    uint8_t* ip;
+    Trace* trace;
+    u32 aborts;
+    bool blacklisted;
+} LoopInfo;
+
+typedef struct Jit {
+    u16 hotcounts[JIT_HOTCOUNT_SLOTS];
+    LoopInfo* loops;
+    u64 loop_count;
+    u64 loop_capacity;
+
+    // Recorder state, only meaningful while recording is set
+    bool recording;
+    u64 recording_loop;
+    CallFrame* recording_frame;
+    u64 recording_depth;
+    TraceOp* ops;
+    u32 op_count;
+} Jit;
+
+// Returns NULL when the JIT is disabled or unsupported on this platform
+Jit* init_jit(void);
+void free_jit(Jit* jit);
+
+// Switched off with --no-jit or PEPPER_JIT=0
+void jit_set_enabled(bool enabled);
+bool jit_is_enabled(void);
+
+// Called by the interpreter when a loop's counter runs out, after the
+// back-edge has been taken. Runs the loop's trace if it has one, which may
+// move frame->ip and the stack top.
+void jit_back_edge(VM* vm, CallFrame* frame);
+// Called before each instruction while a trace is being recorded
+void jit_record(VM* vm, CallFrame* frame);
+// Drops any recording in progress, for when the VM's frames are discarded
+void jit_abort_recording(Jit* jit);
+
+#endif
@@ -0,0 +1,722 @@
+#define MEMORY_TAG MEMORY_JIT
+#include "trace.h"
+
+#ifdef JIT_SUPPORTED
+
+#include <stddef.h>
+#include <string.h>
+
+#include "x64.h"
+#include "memory.h"
+
+#define TRACE_STACK_MAX 64
+#define TRACE_GLOBALS_MAX 64
+#define UNTYPED -1
+
+#define TYPE_OFFSET ((i32)offsetof(Value, type))
+#define PAYLOAD_OFFSET ((i32)offsetof(Value, as))
+#define SLOT_OFFSET(slot) ((i32)((slot) * sizeof(Value)))
+
+STATIC_ASSERT(sizeof(ValueType) == 4, "Trace code stores value tags as 32 bit immediates.");
+
+// Slots are passed in rdi and stay there. rax and rdx are reserved for idiv
+// and r11 for addresses and wide immediates; everything else in the pool holds
+// values on the virtual stack.
+#define SLOTS RDI
+#define SCRATCH R11
+static const Register temp_registers[] = {RCX, RSI, R8, R9, R10, RBX, R12};
+
+typedef enum {
+    ENTRY_CONST,
+    ENTRY_REG,
+    // The result of a comparison still sitting in the flags
+    ENTRY_COND,
+} EntryKind;
+
+typedef struct {
+    EntryKind kind;
+    ValueType type;
+    Register reg;
+    Condition cc;
+    i64 constant;
+} StackEntry;
+
+// A guard whose stub hasn't been emitted yet. The snapshot is the virtual
+// stack at the guard, which the stub writes back before leaving.
+typedef struct {
+    u64 displacement;
+    uint8_t* ip;
+    StackEntry* snapshot;
+    u32 snapshot_count;
+} SideExit;
+
+typedef struct {
+    Value* address;
+    int type;
+    int entry_type;
+} GlobalType;
+
+typedef struct {
+    Assembler as;
+    u64 entry_depth;
+    StackEntry stack[TRACE_STACK_MAX];
+    u32 stack_count;
+    u32 free_registers;
+    int local_types[UINT8_COUNT];
+    int entry_local_types[UINT8_COUNT];
+    GlobalType globals[TRACE_GLOBALS_MAX];
+    u32 global_count;
+    SideExit* exits;
+    u32 exit_count;
+    u32 exit_capacity;
+    bool failed;
+} TraceCompiler;
+
+static void fail(TraceCompiler* compiler) {
+    compiler->failed = true;
+}
+
+static Register allocate_register(TraceCompiler* compiler) {
+    for (u32 i = 0; i < sizeof(temp_registers) / sizeof(temp_registers[0]); i++) {
+        Register reg = temp_registers[i];
+        if (compiler->free_registers & (1u << reg)) {
+            compiler->free_registers &= ~(1u << reg);
+            return reg;
+        }
+    }
+    fail(compiler);
+    return temp_registers[0];
+}
+
+static void release(TraceCompiler* compiler, StackEntry* entry) {
+    if (entry->kind == ENTRY_REG) compiler->free_registers |= 1u << entry->reg;
+}
+
+static void push_entry(TraceCompiler* compiler, StackEntry entry) {
+    if (compiler->stack_count == TRACE_STACK_MAX) {
+        fail(compiler);
+        return;
+    }
+    compiler->stack[compiler->stack_count++] = entry;
+}
+
+static StackEntry pop_entry(TraceCompiler* compiler) {
+    if (compiler->stack_count == 0) {
+        fail(compiler);
+        return (StackEntry){ENTRY_CONST, VAL_INT, RAX, CC_E, 0};
+    }
+    return compiler->stack[--compiler->stack_count];
+}
+
+static void push_constant(TraceCompiler* compiler, ValueType type, i64 constant) {
+    push_entry(compiler, (StackEntry){ENTRY_CONST, type, RAX, CC_E, constant});
+}
+
+static void push_register(TraceCompiler* compiler, ValueType type, Register reg) {
+    push_entry(compiler, (StackEntry){ENTRY_REG, type, reg, CC_E, 0});
+}
+
+static void push_condition(TraceCompiler* compiler, Condition cc) {
+    push_entry(compiler, (StackEntry){ENTRY_COND, VAL_BOOL, RAX, cc, 0});
+}
+
+static Register to_register(TraceCompiler* compiler, StackEntry* entry) {
+    if (entry->kind == ENTRY_REG) return entry->reg;
+    Register reg = allocate_register(compiler);
+    if (entry->kind == ENTRY_CONST) {
+        asm_mov_reg_imm(&compiler->as, reg, entry->constant);
+    } else {
+        asm_setcc(&compiler->as, entry->cc, reg);
+    }
+    entry->kind = ENTRY_REG;
+    entry->reg = reg;
+    return reg;
+}
+
+static void load_value(TraceCompiler* compiler, Register reg, Register base, i32 disp, int type) {
+    if (type == VAL_BOOL) {
+        asm_load_u8(&compiler->as, reg, base, disp + PAYLOAD_OFFSET);
+    } else {
+        asm_load(&compiler->as, reg, base, disp + PAYLOAD_OFFSET);
+    }
+}
+
+// Writes an entry into a Value in memory. The tag is only written when the
+// slot isn't already known to hold the same type.
+static void store_value(TraceCompiler* compiler, Register base, i32 disp, StackEntry* entry, int* known_type) {
+    if (entry->kind == ENTRY_CONST) {
+        if (fits_i32(entry->constant)) {
+            asm_store_imm(&compiler->as, base, disp + PAYLOAD_OFFSET, (i32)entry->constant);
+        } else {
+            asm_mov_reg_imm(&compiler->as, RAX, entry->constant);
+            asm_store(&compiler->as, base, disp + PAYLOAD_OFFSET, RAX);
+        }
+    } else {
+        asm_store(&compiler->as, base, disp + PAYLOAD_OFFSET, to_register(compiler, entry));
+    }
+    if (known_type == NULL || *known_type != (int)entry->type) {
+        asm_store_imm32(&compiler->as, base, disp + TYPE_OFFSET, (i32)entry->type);
+        if (known_type != NULL) *known_type = (int)entry->type;
+    }
+}
+
+static GlobalType* find_global(TraceCompiler* compiler, Value* address) {
+    for (u32 i = 0; i < compiler->global_count; i++) {
+        if (compiler->globals[i].address == address) return &compiler->globals[i];
+    }
+    if (compiler->global_count == TRACE_GLOBALS_MAX) {
+        fail(compiler);
+        return NULL;
+    }
+    GlobalType* global = &compiler->globals[compiler->global_count++];
+    global->address = address;
+    global->type = UNTYPED;
+    global->entry_type = UNTYPED;
+    return global;
+}
+
+static void load_address(TraceCompiler* compiler, Value* address) {
+    asm_mov_reg_imm(&compiler->as, SCRATCH, (i64)(uintptr_t)address);
+}
+
+// Emits a conditional jump to a stub that writes back the virtual stack and
+// resumes the interpreter at ip.
+static void emit_side_exit(TraceCompiler* compiler, Condition cc, uint8_t* ip) {
+    if (compiler->exit_capacity < compiler->exit_count + 1) {
+        u32 old_capacity = compiler->exit_capacity;
+        compiler->exit_capacity = (u32)GROW_CAPACITY(old_capacity);
+        compiler->exits = GROW_ARRAY(SideExit, compiler->exits, old_capacity, compiler->exit_capacity);
+    }
+    SideExit* exit = &compiler->exits[compiler->exit_count++];
+    exit->displacement = asm_jcc(&compiler->as, cc);
+    exit->ip = ip;
+    exit->snapshot_count = compiler->stack_count;
+    exit->snapshot = ALLOCATE(StackEntry, compiler->stack_count + 1);
+    memcpy(exit->snapshot, compiler->stack, sizeof(StackEntry) * compiler->stack_count);
+}
+
+// Entry guards check that every slot the trace reads before writing still
+// holds the type seen while recording. Types inside the trace then follow
+// statically, so the body needs no further type checks.
+static void find_entry_types(TraceCompiler* compiler, TraceOp* ops, u32 count) {
+    bool seen[UINT8_COUNT] = {false};
+    for (u32 i = 0; i < count && !compiler->failed; i++) {
+        TraceOp* op = &ops[i];
+        switch (op->op) {
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                if (op->slot >= compiler->entry_depth || seen[op->slot]) break;
+                seen[op->slot] = true;
+                if (op->op == OP_GET_LOCAL) compiler->entry_local_types[op->slot] = (int)op->type;
+                break;
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL: {
+                bool known = false;
+                for (u32 j = 0; j < compiler->global_count; j++) {
+                    if (compiler->globals[j].address == op->global) known = true;
+                }
+                GlobalType* global = find_global(compiler, op->global);
+                if (known || global == NULL) break;
+                if (op->op == OP_GET_GLOBAL) global->entry_type = (int)op->type;
+                break;
+            }
+            default: break;
+        }
+    }
+}
+
+static void emit_entry_guards(TraceCompiler* compiler, u64* entry_exits, u32* entry_exit_count) {
+    for (u64 slot = 0; slot < compiler->entry_depth; slot++) {
+        int type = compiler->entry_local_types[slot];
+        compiler->local_types[slot] = type;
+        if (type == UNTYPED) continue;
+        asm_cmp_mem_imm32(&compiler->as, SLOTS, SLOT_OFFSET(slot) + TYPE_OFFSET, type);
+        entry_exits[(*entry_exit_count)++] = asm_jcc(&compiler->as, CC_NE);
+    }
+    for (u32 i = 0; i < compiler->global_count; i++) {
+        GlobalType* global = &compiler->globals[i];
+        global->type = global->entry_type;
+        if (global->entry_type == UNTYPED) continue;
+        load_address(compiler, global->address);
+        asm_cmp_mem_imm32(&compiler->as, SCRATCH, TYPE_OFFSET, global->entry_type);
+        entry_exits[(*entry_exit_count)++] = asm_jcc(&compiler->as, CC_NE);
+    }
+}
+
+static Condition swap_condition(Condition cc) {
+    switch (cc) {
+        case CC_L: return CC_G;
+        case CC_G: return CC_L;
+        case CC_LE: return CC_GE;
+        case CC_GE: return CC_LE;
+        default: return cc;
+    }
+}
+
+static bool compare_constants(Condition cc, i64 a, i64 b) {
+    switch (cc) {
+        case CC_L: return a < b;
+        case CC_G: return a > b;
+        case CC_E: return a == b;
+        default: return false;
+    }
+}
+
+// Compares a with b, consuming both, and returns the condition that holds
+// when the comparison is true.
+static Condition emit_compare(TraceCompiler* compiler, StackEntry* a, StackEntry* b, Condition cc) {
+    if (b->kind == ENTRY_CONST && fits_i32(b->constant)) {
+        asm_cmp_imm(&compiler->as, to_register(compiler, a), (i32)b->constant);
+    } else if (a->kind == ENTRY_CONST && fits_i32(a->constant)) {
+        asm_cmp_imm(&compiler->as, to_register(compiler, b), (i32)a->constant);
+        cc = swap_condition(cc);
+    } else {
+        Register left = to_register(compiler, a);
+        asm_cmp(&compiler->as, left, to_register(compiler, b));
+    }
+    release(compiler, a);
+    release(compiler, b);
+    return cc;
+}
+
+static void compile_comparison(TraceCompiler* compiler, Condition cc) {
+    StackEntry b = pop_entry(compiler);
+    StackEntry a = pop_entry(compiler);
+    if (cc == CC_E && a.type != b.type) {
+        release(compiler, &a);
+        release(compiler, &b);
+        push_constant(compiler, VAL_BOOL, false);
+        return;
+    }
+    if (cc != CC_E && (a.type != VAL_INT || b.type != VAL_INT)) {
+        fail(compiler);
+        return;
+    }
+    if (a.kind == ENTRY_CONST && b.kind == ENTRY_CONST) {
+        push_constant(compiler, VAL_BOOL, compare_constants(cc, a.constant, b.constant));
+        return;
+    }
+    push_condition(compiler, emit_compare(compiler, &a, &b, cc));
+}
+
+static void compile_arithmetic(TraceCompiler* compiler, OpCode op) {
+    StackEntry b = pop_entry(compiler);
+    StackEntry a = pop_entry(compiler);
+    if (a.type != VAL_INT || b.type != VAL_INT) {
+        fail(compiler);
+        return;
+    }
+    if (a.kind == ENTRY_CONST && b.kind == ENTRY_CONST) {
+        // Wrap the same way the generated code does
+        u64 x = (u64)a.constant;
+        u64 y = (u64)b.constant;
+        u64 result = op == OP_ADD ? x + y : op == OP_SUBTRACT ? x - y : x * y;
+        push_constant(compiler, VAL_INT, (i64)result);
+        return;
+    }
+    bool commutes = op != OP_SUBTRACT;
+    if (commutes && a.kind == ENTRY_CONST) {
+        StackEntry swap = a;
+        a = b;
+        b = swap;
+    }
+    Register dst = to_register(compiler, &a);
+    if (b.kind == ENTRY_CONST && fits_i32(b.constant)) {
+        i32 imm = (i32)b.constant;
+        if (op == OP_ADD) asm_add_imm(&compiler->as, dst, imm);
+        else if (op == OP_SUBTRACT) asm_sub_imm(&compiler->as, dst, imm);
+        else asm_imul_imm(&compiler->as, dst, dst, imm);
+    } else {
+        Register src = to_register(compiler, &b);
+        if (op == OP_ADD) asm_add(&compiler->as, dst, src);
+        else if (op == OP_SUBTRACT) asm_sub(&compiler->as, dst, src);
+        else asm_imul(&compiler->as, dst, src);
+        release(compiler, &b);
+    }
+    push_register(compiler, VAL_INT, dst);
+}
+
+static void compile_divide(TraceCompiler* compiler, TraceOp* op) {
+    if (compiler->stack_count < 2) {
+        fail(compiler);
+        return;
+    }
+    StackEntry* dividend = &compiler->stack[compiler->stack_count - 2];
+    StackEntry* divisor = &compiler->stack[compiler->stack_count - 1];
+    if (dividend->type != VAL_INT || divisor->type != VAL_INT) {
+        fail(compiler);
+        return;
+    }
+    if (divisor->kind == ENTRY_CONST) {
+        if (divisor->constant == 0) {
+            fail(compiler);
+            return;
+        }
+        // INT64_MIN / -1 traps in idiv, so dividing by -1 negates, with
+        // wrapping, as the interpreter does
+        if (divisor->constant == -1) {
+            pop_entry(compiler);
+            StackEntry a = pop_entry(compiler);
+            if (a.kind == ENTRY_CONST) {
+                push_constant(compiler, VAL_INT, (i64)(0 - (u64)a.constant));
+                return;
+            }
+            Register dst = to_register(compiler, &a);
+            asm_neg(&compiler->as, dst);
+            push_register(compiler, VAL_INT, dst);
+            return;
+        }
+        if (dividend->kind == ENTRY_CONST) {
+            StackEntry b = pop_entry(compiler);
+            StackEntry a = pop_entry(compiler);
+            push_constant(compiler, VAL_INT, a.constant / b.constant);
+            return;
+        }
+        asm_mov_reg_imm(&compiler->as, SCRATCH, divisor->constant);
+    } else {
+        // Leave both operands on the stack so the interpreter can report
+        // the division by zero itself, and divide by -1 without trapping
+        Register reg = to_register(compiler, divisor);
+        asm_test(&compiler->as, reg, reg);
+        emit_side_exit(compiler, CC_E, op->ip);
+        asm_cmp_imm(&compiler->as, reg, -1);
+        emit_side_exit(compiler, CC_E, op->ip);
+        asm_mov_reg_reg(&compiler->as, SCRATCH, reg);
+    }
+    StackEntry b = pop_entry(compiler);
+    StackEntry a = pop_entry(compiler);
+    release(compiler, &b);
+    Register dst = to_register(compiler, &a);
+    asm_mov_reg_reg(&compiler->as, RAX, dst);
+    asm_cqo(&compiler->as);
+    asm_idiv(&compiler->as, SCRATCH);
+    asm_mov_reg_reg(&compiler->as, dst, RAX);
+    push_register(compiler, VAL_INT, dst);
+}
+
+static bool constant_truthy(StackEntry* entry) {
+    return entry->type != VAL_BOOL || entry->constant != 0;
+}
+
+// Turns a popped condition into the flag that holds when it's truthy.
+// Returns false if the value's truthiness is fixed, in which case it's
+// stored in truthy instead.
+static bool condition_flags(TraceCompiler* compiler, StackEntry* entry, Condition* cc, bool* truthy) {
+    if (entry->type != VAL_BOOL) {
+        // Anything that isn't a bool or nil is truthy
+        release(compiler, entry);
+        *truthy = true;
+        return false;
+    }
+    if (entry->kind == ENTRY_CONST) {
+        *truthy = constant_truthy(entry);
+        return false;
+    }
+    if (entry->kind == ENTRY_REG) {
+        asm_test(&compiler->as, entry->reg, entry->reg);
+        release(compiler, entry);
+        *cc = CC_NE;
+        return true;
+    }
+    *cc = entry->cc;
+    return true;
+}
+
+static void compile_guard(TraceCompiler* compiler, TraceOp* op) {
+    StackEntry condition = pop_entry(compiler);
+    Condition cc;
+    bool truthy;
+    if (!condition_flags(compiler, &condition, &cc, &truthy)) {
+        // The recorded direction is the only possible one
+        if (truthy == op->taken) fail(compiler);
+        return;
+    }
+    // Leave when the branch would go the other way
+    emit_side_exit(compiler, op->taken ? cc : NEGATE_CONDITION(cc), op->exit_ip);
+}
+
+static void compile_not(TraceCompiler* compiler) {
+    StackEntry value = pop_entry(compiler);
+    if (value.type != VAL_BOOL) {
+        release(compiler, &value);
+        push_constant(compiler, VAL_BOOL, false);
+    } else if (value.kind == ENTRY_CONST) {
+        push_constant(compiler, VAL_BOOL, !value.constant);
+    } else if (value.kind == ENTRY_COND) {
+        push_condition(compiler, NEGATE_CONDITION(value.cc));
+    } else {
+        asm_xor_imm8(&compiler->as, value.reg, 1);
+        push_register(compiler, VAL_BOOL, value.reg);
+    }
+}
+
+static void compile_get_local(TraceCompiler* compiler, u8 slot) {
+    if (slot < compiler->entry_depth) {
+        int type = compiler->local_types[slot];
+        if (type == UNTYPED) {
+            fail(compiler);
+            return;
+        }
+        Register reg = allocate_register(compiler);
+        load_value(compiler, reg, SLOTS, SLOT_OFFSET(slot), type);
+        push_register(compiler, (ValueType)type, reg);
+        return;
+    }
+    u64 index = slot - compiler->entry_depth;
+    if (index >= compiler->stack_count) {
+        fail(compiler);
+        return;
+    }
+    StackEntry local = compiler->stack[index];
+    if (local.kind == ENTRY_REG) {
+        Register reg = allocate_register(compiler);
+        asm_mov_reg_reg(&compiler->as, reg, local.reg);
+        local.reg = reg;
+    }
+    push_entry(compiler, local);
+}
+
+static void compile_set_local(TraceCompiler* compiler, u8 slot) {
+    StackEntry value = pop_entry(compiler);
+    if (slot < compiler->entry_depth) {
+        store_value(compiler, SLOTS, SLOT_OFFSET(slot), &value, &compiler->local_types[slot]);
+        release(compiler, &value);
+        return;
+    }
+    u64 index = slot - compiler->entry_depth;
+    if (index >= compiler->stack_count) {
+        fail(compiler);
+        return;
+    }
+    if (value.kind == ENTRY_COND) to_register(compiler, &value);
+    release(compiler, &compiler->stack[index]);
+    compiler->stack[index] = value;
+}
+
+static void compile_get_global(TraceCompiler* compiler, Value* address) {
+    GlobalType* global = find_global(compiler, address);
+    if (global == NULL || global->type == UNTYPED) {
+        fail(compiler);
+        return;
+    }
+    Register reg = allocate_register(compiler);
+    load_address(compiler, address);
+    load_value(compiler, reg, SCRATCH, 0, global->type);
+    push_register(compiler, (ValueType)global->type, reg);
+}
+
+static void compile_set_global(TraceCompiler* compiler, Value* address) {
+    GlobalType* global = find_global(compiler, address);
+    StackEntry value = pop_entry(compiler);
+    if (global == NULL) return;
+    if (value.kind == ENTRY_COND) to_register(compiler, &value);
+    load_address(compiler, address);
+    store_value(compiler, SCRATCH, 0, &value, &global->type);
+    release(compiler, &value);
+}
+
+// The closing back-edge of the loop. Anything else falls through to exit 1.
+static void compile_back_edge(TraceCompiler* compiler, TraceOp* op, u64 loop_start) {
+    Condition cc = CC_E;
+    bool always = false;
+    if (op->op == OP_LOOP) {
+        always = true;
+    } else if (op->op == OP_LOOP_IF_TRUE) {
+        StackEntry condition = pop_entry(compiler);
+        bool truthy;
+        if (!condition_flags(compiler, &condition, &cc, &truthy)) {
+            if (!truthy) fail(compiler);
+            always = true;
+        }
+    } else {
+        StackEntry b = pop_entry(compiler);
+        StackEntry a = pop_entry(compiler);
+        if (a.type != VAL_INT || b.type != VAL_INT) {
+            fail(compiler);
+            return;
+        }
+        if (a.kind == ENTRY_CONST && b.kind == ENTRY_CONST) {
+            if (a.constant >= b.constant) fail(compiler);
+            always = true;
+        } else {
+            cc = emit_compare(compiler, &a, &b, CC_L);
+        }
+    }
+    if (compiler->stack_count != 0) fail(compiler);
+    u64 jump = always ? asm_jmp(&compiler->as) : asm_jcc(&compiler->as, cc);
+    asm_patch(&compiler->as, jump, loop_start);
+}
+
+static void compile_op(TraceCompiler* compiler, TraceOp* op) {
+    // Flags only survive until the next instruction, so a pending comparison
+    // is materialised unless the op consumes it straight away.
+    if (compiler->stack_count > 0 && compiler->stack[compiler->stack_count - 1].kind == ENTRY_COND &&
+        op->op != OP_JUMP_IF_FALSE && op->op != OP_LOOP_IF_TRUE && op->op != OP_NOT) {
+        to_register(compiler, &compiler->stack[compiler->stack_count - 1]);
+    }
+    switch (op->op) {
+        case OP_CONSTANT: {
+            if (IS_INT(op->constant)) push_constant(compiler, VAL_INT, AS_INT(op->constant));
+            else if (IS_BOOL(op->constant)) push_constant(compiler, VAL_BOOL, AS_BOOL(op->constant));
+            else fail(compiler);
+            break;
+        }
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY: compile_arithmetic(compiler, op->op); break;
+        case OP_DIVIDE: compile_divide(compiler, op); break;
+        case OP_NEGATE: {
+            StackEntry value = pop_entry(compiler);
+            if (value.type != VAL_INT) {
+                fail(compiler);
+            } else if (value.kind == ENTRY_CONST) {
+                push_constant(compiler, VAL_INT, (i64)(0 - (u64)value.constant));
+            } else {
+                asm_neg(&compiler->as, value.reg);
+                push_register(compiler, VAL_INT, value.reg);
+            }
+            break;
+        }
+        case OP_GREATER: compile_comparison(compiler, CC_G); break;
+        case OP_LESS: compile_comparison(compiler, CC_L); break;
+        case OP_EQUAL: compile_comparison(compiler, CC_E); break;
+        case OP_NOT: compile_not(compiler); break;
+        case OP_POP: {
+            StackEntry value = pop_entry(compiler);
+            release(compiler, &value);
+            break;
+        }
+        case OP_GET_LOCAL: compile_get_local(compiler, op->slot); break;
+        case OP_SET_LOCAL: compile_set_local(compiler, op->slot); break;
+        case OP_GET_GLOBAL: compile_get_global(compiler, op->global); break;
+        case OP_SET_GLOBAL: compile_set_global(compiler, op->global); break;
+        case OP_JUMP: break;
+        case OP_JUMP_IF_FALSE: compile_guard(compiler, op); break;
+        default: fail(compiler); break;
+    }
+}
+
+static void free_side_exits(TraceCompiler* compiler) {
+    for (u32 i = 0; i < compiler->exit_count; i++) {
+        FREE_ARRAY(StackEntry, compiler->exits[i].snapshot, compiler->exits[i].snapshot_count + 1);
+    }
+    FREE_ARRAY(SideExit, compiler->exits, compiler->exit_capacity);
+}
+
+// Layout: prologue, entry guards, loop body ending in the back-edge, the
+// normal loop exit, then one stub per side exit and the shared epilogue.
+Trace* compile_trace(TraceOp* ops, u32 count, u64 entry_depth) {
+    if (count == 0 || entry_depth > UINT8_COUNT) return NULL;
+    TraceCompiler compiler;
+    init_assembler(&compiler.as);
+    compiler.entry_depth = entry_depth;
+    compiler.stack_count = 0;
+    compiler.free_registers = 0;
+    for (u32 i = 0; i < sizeof(temp_registers) / sizeof(temp_registers[0]); i++) {
+        compiler.free_registers |= 1u << temp_registers[i];
+    }
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        compiler.local_types[i] = UNTYPED;
+        compiler.entry_local_types[i] = UNTYPED;
+    }
+    compiler.global_count = 0;
+    compiler.exits = NULL;
+    compiler.exit_count = 0;
+    compiler.exit_capacity = 0;
+    compiler.failed = false;
+
+    Assembler* as = &compiler.as;
+    asm_push(as, RBX);
+    asm_push(as, R12);
+
+    find_entry_types(&compiler, ops, count - 1);
+    u64 entry_exits[UINT8_COUNT + TRACE_GLOBALS_MAX];
+    u32 entry_exit_count = 0;
+    emit_entry_guards(&compiler, entry_exits, &entry_exit_count);
+
+    u64 loop_start = as->count;
+    for (u32 i = 0; i < count - 1 && !compiler.failed; i++) {
+        compile_op(&compiler, &ops[i]);
+    }
+    TraceOp* back_edge = &ops[count - 1];
+    if (!compiler.failed) compile_back_edge(&compiler, back_edge, loop_start);
+
+    // Types have to line up with the entry guards for the back-edge to be valid
+    for (u64 slot = 0; slot < entry_depth; slot++) {
+        int type = compiler.entry_local_types[slot];
+        if (type != UNTYPED && compiler.local_types[slot] != type) fail(&compiler);
+    }
+    for (u32 i = 0; i < compiler.global_count; i++) {
+        GlobalType* global = &compiler.globals[i];
+        if (global->entry_type != UNTYPED && global->type != global->entry_type) fail(&compiler);
+    }
+    if (compiler.failed) {
+        free_side_exits(&compiler);
+        free_assembler(as);
+        return NULL;
+    }
+
+    Trace* trace = ALLOCATE(Trace, 1);
+    trace->start_ip = ops[0].ip;
+    trace->entry_depth = entry_depth;
+    trace->entry_failures = 0;
+    trace->exit_count = compiler.exit_count + 2;
+    trace->exits = ALLOCATE(TraceExit, trace->exit_count);
+    trace->exits[0] = (TraceExit){ops[0].ip, entry_depth};
+    trace->exits[1] = (TraceExit){back_edge->exit_ip, entry_depth};
+
+    u64 epilogue_jumps[2];
+    u32 epilogue_jump_count = 0;
+    asm_mov_eax_imm(as, 1);
+    epilogue_jumps[epilogue_jump_count++] = asm_jmp(as);
+
+    u64 entry_exit = as->count;
+    for (u32 i = 0; i < entry_exit_count; i++) asm_patch(as, entry_exits[i], entry_exit);
+    asm_mov_eax_imm(as, 0);
+    epilogue_jumps[epilogue_jump_count++] = asm_jmp(as);
+
+    // Side exit stubs fall through into the epilogue one after another
+    u64* stub_jumps = ALLOCATE(u64, compiler.exit_count + 1);
+    for (u32 i = 0; i < compiler.exit_count; i++) {
+        SideExit* exit = &compiler.exits[i];
+        asm_patch(as, exit->displacement, as->count);
+        for (u32 j = 0; j < exit->snapshot_count; j++) {
+            StackEntry entry = exit->snapshot[j];
+            store_value(&compiler, SLOTS, SLOT_OFFSET(entry_depth + j), &entry, NULL);
+        }
+        asm_mov_eax_imm(as, i + 2);
+        stub_jumps[i] = asm_jmp(as);
+        trace->exits[i + 2] = (TraceExit){exit->ip, entry_depth + exit->snapshot_count};
+    }
+
+    u64 epilogue = as->count;
+    for (u32 i = 0; i < epilogue_jump_count; i++) asm_patch(as, epilogue_jumps[i], epilogue);
+    for (u32 i = 0; i < compiler.exit_count; i++) asm_patch(as, stub_jumps[i], epilogue);
+    asm_pop(as, R12);
+    asm_pop(as, RBX);
+    asm_ret(as);
+
+    FREE_ARRAY(u64, stub_jumps, compiler.exit_count + 1);
+    free_side_exits(&compiler);
+
+    trace->code_size = as->count;
+    void* code = map_executable(as->code, as->count, &trace->mapped_size);
+    free_assembler(as);
+    if (code == NULL) {
+        FREE_ARRAY(TraceExit, trace->exits, trace->exit_count);
+        FREE(Trace, trace);
+        return NULL;
+    }
+    // Object to function pointer conversion goes through uintptr_t, which
+    // POSIX guarantees round trips for mmap'd code.
+    trace->code = (TraceFunction)(uintptr_t)code;
+    return trace;
+}
+
+void free_trace(Trace* trace) {
+    unmap_executable((void*)(uintptr_t)trace->code, trace->mapped_size);
+    FREE_ARRAY(TraceExit, trace->exits, trace->exit_count);
+    FREE(Trace, trace);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef pepper_trace_h
+#define pepper_trace_h
+
+#include "common.h"
+#include "chunk.h"
+#include "value.h"
+
+#define TRACE_MAX_LENGTH 1000
+
+// One bytecode instruction as the interpreter executed it while recording
+typedef struct {
+    uint8_t* ip;
+    OpCode op;
+    u8 slot;
+    // Where the interpreter resumes if the recorded direction of a branch
+    // stops holding
+    uint8_t* exit_ip;
+    // The branch direction seen for OP_JUMP_IF_FALSE
+    bool taken;
+    // Type of the value read by OP_GET_LOCAL and OP_GET_GLOBAL
+    ValueType type;
+    Value* global;
+    Value constant;
+} TraceOp;
+
+// Where to resume the interpreter after leaving a trace. Exit 0 is taken when
+// the entry guards fail and exit 1 when the loop finishes normally.
+typedef struct {
+    uint8_t* ip;
+    u64 stack_depth;
+} TraceExit;
+
+typedef u32 (*TraceFunction)(Value* slots);
+
+typedef struct {
+    TraceFunction code;
+    u64 code_size;
+    u64 mapped_size;
+    uint8_t* start_ip;
+    u64 entry_depth;
+    TraceExit* exits;
+    u32 exit_count;
+    u32 entry_failures;
+} Trace;
+
+// Compiles a recorded loop body to machine code. Returns NULL if the trace
+// uses something the compiler can't handle.
+Trace* compile_trace(TraceOp* ops, u32 count, u64 entry_depth);
+void free_trace(Trace* trace);
+
+#endif
@@ -0,0 +1,354 @@
+#define _DEFAULT_SOURCE 1
+#define MEMORY_TAG MEMORY_JIT
+#include "x64.h"
+
+#ifdef JIT_SUPPORTED
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "logger.h"
+
+// Code is placed a little way into its mapping so that anything peeking at the
+// bytes before a function pointer (clang's -fsanitize=function does) stays in
+// mapped memory.
+#define CODE_PADDING 16
+
+void init_assembler(Assembler* as) {
+    as->code = NULL;
+    as->count = 0;
+    as->capacity = 0;
+}
+
+void free_assembler(Assembler* as) {
+    FREE_ARRAY(u8, as->code, as->capacity);
+    init_assembler(as);
+}
+
+static void emit(Assembler* as, u8 byte) {
+    if (as->capacity < as->count + 1) {
+        u64 old_capacity = as->capacity;
+        as->capacity = GROW_CAPACITY(old_capacity);
+        as->code = GROW_ARRAY(u8, as->code, old_capacity, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emit_u32(Assembler* as, u32 value) {
+    for (int i = 0; i < 4; i++) {
+        emit(as, (u8)(value >> (i * 8)));
+    }
+}
+
+static void emit_u64(Assembler* as, u64 value) {
+    for (int i = 0; i < 8; i++) {
+        emit(as, (u8)(value >> (i * 8)));
+    }
+}
+
+bool fits_i32(i64 value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// REX prefix: W selects 64 bit operands, R extends ModRM.reg and B extends ModRM.rm
+static void emit_rex(Assembler* as, bool wide, int reg, int rm, bool force) {
+    u8 rex = (u8)(0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0));
+    if (rex != 0x40 || force) emit(as, rex);
+}
+
+static void emit_modrm_reg(Assembler* as, int reg, int rm) {
+    emit(as, (u8)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+// [base + disp32]; rsp and r12 as a base need a SIB byte
+static void emit_modrm_mem(Assembler* as, int reg, Register base, i32 disp) {
+    int rm = (int)base & 7;
+    emit(as, (u8)(0x80 | ((reg & 7) << 3) | rm));
+    if (rm == RSP) emit(as, 0x24);
+    emit_u32(as, (u32)disp);
+}
+
+static void emit_op_reg_reg(Assembler* as, u8 opcode, Register reg, Register rm) {
+    emit_rex(as, true, reg, rm, false);
+    emit(as, opcode);
+    emit_modrm_reg(as, reg, rm);
+}
+
+void asm_mov_reg_reg(Assembler* as, Register dst, Register src) {
+    if (dst == src) return;
+    emit_op_reg_reg(as, 0x89, src, dst);
+}
+
+void asm_mov_reg_imm(Assembler* as, Register dst, i64 imm) {
+    if (imm >= 0 && imm <= UINT32_MAX) {
+        // mov r32, imm32 zero extends into the full register
+        emit_rex(as, false, 0, dst, false);
+        emit(as, (u8)(0xB8 + (dst & 7)));
+        emit_u32(as, (u32)imm);
+    } else if (fits_i32(imm)) {
+        emit_rex(as, true, 0, dst, false);
+        emit(as, 0xC7);
+        emit_modrm_reg(as, 0, dst);
+        emit_u32(as, (u32)imm);
+    } else {
+        emit_rex(as, true, 0, dst, false);
+        emit(as, (u8)(0xB8 + (dst & 7)));
+        emit_u64(as, (u64)imm);
+    }
+}
+
+void asm_load(Assembler* as, Register dst, Register base, i32 disp) {
+    emit_rex(as, true, dst, base, false);
+    emit(as, 0x8B);
+    emit_modrm_mem(as, dst, base, disp);
+}
+
+void asm_load_u8(Assembler* as, Register dst, Register base, i32 disp) {
+    // movzx r32, byte [base + disp]
+    emit_rex(as, false, dst, base, false);
+    emit(as, 0x0F);
+    emit(as, 0xB6);
+    emit_modrm_mem(as, dst, base, disp);
+}
+
+void asm_store(Assembler* as, Register base, i32 disp, Register src) {
+    emit_rex(as, true, src, base, false);
+    emit(as, 0x89);
+    emit_modrm_mem(as, src, base, disp);
+}
+
+void asm_store_imm(Assembler* as, Register base, i32 disp, i32 imm) {
+    emit_rex(as, true, 0, base, false);
+    emit(as, 0xC7);
+    emit_modrm_mem(as, 0, base, disp);
+    emit_u32(as, (u32)imm);
+}
+
+void asm_store_imm32(Assembler* as, Register base, i32 disp, i32 imm) {
+    emit_rex(as, false, 0, base, false);
+    emit(as, 0xC7);
+    emit_modrm_mem(as, 0, base, disp);
+    emit_u32(as, (u32)imm);
+}
+
+void asm_cmp_mem_imm32(Assembler* as, Register base, i32 disp, i32 imm) {
+    emit_rex(as, false, 0, base, false);
+    emit(as, 0x81);
+    emit_modrm_mem(as, 7, base, disp);
+    emit_u32(as, (u32)imm);
+}
+
+void asm_add(Assembler* as, Register dst, Register src) {
+    emit_op_reg_reg(as, 0x01, src, dst);
+}
+
+void asm_sub(Assembler* as, Register dst, Register src) {
+    emit_op_reg_reg(as, 0x29, src, dst);
+}
+
+void asm_imul(Assembler* as, Register dst, Register src) {
+    emit_rex(as, true, dst, src, false);
+    emit(as, 0x0F);
+    emit(as, 0xAF);
+    emit_modrm_reg(as, dst, src);
+}
+
+static void emit_group1_imm(Assembler* as, int extension, Register dst, i32 imm) {
+    emit_rex(as, true, 0, dst, false);
+    emit(as, 0x81);
+    emit_modrm_reg(as, extension, dst);
+    emit_u32(as, (u32)imm);
+}
+
+void asm_add_imm(Assembler* as, Register dst, i32 imm) {
+    emit_group1_imm(as, 0, dst, imm);
+}
+
+void asm_sub_imm(Assembler* as, Register dst, i32 imm) {
+    emit_group1_imm(as, 5, dst, imm);
+}
+
+void asm_imul_imm(Assembler* as, Register dst, Register src, i32 imm) {
+    emit_rex(as, true, dst, src, false);
+    emit(as, 0x69);
+    emit_modrm_reg(as, dst, src);
+    emit_u32(as, (u32)imm);
+}
+
+void asm_cmp(Assembler* as, Register a, Register b) {
+    emit_op_reg_reg(as, 0x39, b, a);
+}
+
+void asm_cmp_imm(Assembler* as, Register a, i32 imm) {
+    emit_group1_imm(as, 7, a, imm);
+}
+
+void asm_test(Assembler* as, Register a, Register b) {
+    emit_op_reg_reg(as, 0x85, b, a);
+}
+
+void asm_cmp32_imm(Assembler* as, Register a, i32 imm) {
+    emit_rex(as, false, 0, a, false);
+    emit(as, 0x81);
+    emit_modrm_reg(as, 7, a);
+    emit_u32(as, (u32)imm);
+}
+
+void asm_test32(Assembler* as, Register a, Register b) {
+    emit_rex(as, false, b, a, false);
+    emit(as, 0x85);
+    emit_modrm_reg(as, b, a);
+}
+
+void asm_xor_imm8(Assembler* as, Register dst, i8 imm) {
+    emit_rex(as, true, 0, dst, false);
+    emit(as, 0x83);
+    emit_modrm_reg(as, 6, dst);
+    emit(as, (u8)imm);
+}
+
+void asm_neg(Assembler* as, Register dst) {
+    emit_rex(as, true, 0, dst, false);
+    emit(as, 0xF7);
+    emit_modrm_reg(as, 3, dst);
+}
+
+void asm_cqo(Assembler* as) {
+    emit(as, 0x48);
+    emit(as, 0x99);
+}
+
+void asm_idiv(Assembler* as, Register divisor) {
+    emit_rex(as, true, 0, divisor, false);
+    emit(as, 0xF7);
+    emit_modrm_reg(as, 7, divisor);
+}
+
+void asm_setcc(Assembler* as, Condition cc, Register dst) {
+    // setcc r8 followed by movzx r32, r8. The REX prefix is forced so that
+    // registers 4-7 name spl/bpl/sil/dil rather than ah/ch/dh/bh.
+    emit_rex(as, false, 0, dst, true);
+    emit(as, 0x0F);
+    emit(as, (u8)(0x90 + cc));
+    emit_modrm_reg(as, 0, dst);
+    emit_rex(as, false, dst, dst, true);
+    emit(as, 0x0F);
+    emit(as, 0xB6);
+    emit_modrm_reg(as, dst, dst);
+}
+
+void asm_push(Assembler* as, Register reg) {
+    emit_rex(as, false, 0, reg, false);
+    emit(as, (u8)(0x50 + (reg & 7)));
+}
+
+void asm_pop(Assembler* as, Register reg) {
+    emit_rex(as, false, 0, reg, false);
+    emit(as, (u8)(0x58 + (reg & 7)));
+}
+
+void asm_call(Assembler* as, Register target) {
+    emit_rex(as, false, 0, target, false);
+    emit(as, 0xFF);
+    emit_modrm_reg(as, 2, target);
+}
+
+void asm_ret(Assembler* as) {
+    emit(as, 0xC3);
+}
+
+void asm_mov_eax_imm(Assembler* as, u32 imm) {
+    emit(as, 0xB8);
+    emit_u32(as, imm);
+}
+
+u64 asm_jmp(Assembler* as) {
+    emit(as, 0xE9);
+    u64 offset = as->count;
+    emit_u32(as, 0);
+    return offset;
+}
+
+u64 asm_jcc(Assembler* as, Condition cc) {
+    emit(as, 0x0F);
+    emit(as, (u8)(0x80 + cc));
+    u64 offset = as->count;
+    emit_u32(as, 0);
+    return offset;
+}
+
+void asm_patch(Assembler* as, u64 displacement_offset, u64 target) {
+    // Displacements are relative to the end of the 4 byte operand
+    i64 relative = (i64)target - (i64)(displacement_offset + 4);
+    u32 value = (u32)(i32)relative;
+    for (int i = 0; i < 4; i++) {
+        as->code[displacement_offset + (u64)i] = (u8)(value >> (i * 8));
+    }
+}
+
+void* map_executable(const u8* code, u64 size, u64* mapped_size) {
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 length = (size + CODE_PADDING + page_size - 1) / page_size * page_size;
+    void* memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (memory == MAP_FAILED) {
+        WARN("Unable to map memory for JIT code.");
+        return NULL;
+    }
+    memset(memory, 0xCC, CODE_PADDING);
+    memcpy((u8*)memory + CODE_PADDING, code, size);
+    // Never writable and executable at the same time
+    if (mprotect(memory, length, PROT_READ | PROT_EXEC) != 0) {
+        WARN("Unable to make JIT code executable.");
+        munmap(memory, length);
+        return NULL;
+    }
+    *mapped_size = length;
+    return (u8*)memory + CODE_PADDING;
+}
+
+void unmap_executable(void* code, u64 mapped_size) {
+    munmap((u8*)code - CODE_PADDING, mapped_size);
+}
+
+// Shared by every VM in the process, which may be on different threads
+static FILE* perf_map = NULL;
+static bool perf_map_opened = false;
+static pthread_mutex_t perf_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void close_perf_map(void) {
+    fclose(perf_map);
+    perf_map = NULL;
+}
+
+// Opened the first time it's needed, if PEPPER_PERF_MAP=1, and truncated so
+// a reused pid doesn't inherit another process's symbols
+static FILE* open_perf_map(void) {
+    if (perf_map_opened) return perf_map;
+    perf_map_opened = true;
+    const char* setting = getenv("PEPPER_PERF_MAP");
+    if (setting == NULL || strcmp(setting, "1") != 0) return NULL;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    perf_map = fopen(path, "w");
+    if (perf_map == NULL) {
+        WARN("Unable to open %s.", path);
+    } else {
+        atexit(close_perf_map);
+    }
+    return perf_map;
+}
+
+void perf_map_add(const void* code, u64 size, const char* kind, const char* name, u64 line) {
+    pthread_mutex_lock(&perf_map_lock);
+    FILE* map = open_perf_map();
+    if (map != NULL) {
+        fprintf(map, "%lx %lx pepper-%s-%s:%lu\n", (u64)(uintptr_t)code, size, kind, name, line);
+        fflush(map);
+    }
+    pthread_mutex_unlock(&perf_map_lock);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef pepper_x64_h
+#define pepper_x64_h
+
+#include "common.h"
+
+typedef enum {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} Register;
+
+// Condition codes, in the encoding used by jcc and setcc. Flipping the low
+// bit negates the condition.
+typedef enum {
+    CC_O = 0x0, CC_NO = 0x1, CC_B = 0x2, CC_AE = 0x3,
+    CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF,
+} Condition;
+
+#define NEGATE_CONDITION(cc) ((Condition)((cc) ^ 1))
+
+typedef struct {
+    u8* code;
+    u64 count;
+    u64 capacity;
+} Assembler;
+
+void init_assembler(Assembler* as);
+void free_assembler(Assembler* as);
+
+void asm_mov_reg_reg(Assembler* as, Register dst, Register src);
+void asm_mov_reg_imm(Assembler* as, Register dst, i64 imm);
+void asm_load(Assembler* as, Register dst, Register base, i32 disp);
+void asm_load_u8(Assembler* as, Register dst, Register base, i32 disp);
+void asm_store(Assembler* as, Register base, i32 disp, Register src);
+void asm_store_imm(Assembler* as, Register base, i32 disp, i32 imm);
+void asm_store_imm32(Assembler* as, Register base, i32 disp, i32 imm);
+void asm_cmp_mem_imm32(Assembler* as, Register base, i32 disp, i32 imm);
+void asm_add(Assembler* as, Register dst, Register src);
+void asm_sub(Assembler* as, Register dst, Register src);
+void asm_imul(Assembler* as, Register dst, Register src);
+void asm_add_imm(Assembler* as, Register dst, i32 imm);
+void asm_sub_imm(Assembler* as, Register dst, i32 imm);
+void asm_imul_imm(Assembler* as, Register dst, Register src, i32 imm);
+void asm_cmp(Assembler* as, Register a, Register b);
+void asm_cmp_imm(Assembler* as, Register a, i32 imm);
+void asm_test(Assembler* as, Register a, Register b);
+void asm_cmp32_imm(Assembler* as, Register a, i32 imm);
+void asm_test32(Assembler* as, Register a, Register b);
+void asm_xor_imm8(Assembler* as, Register dst, i8 imm);
+void asm_neg(Assembler* as, Register dst);
+void asm_cqo(Assembler* as);
+void asm_idiv(Assembler* as, Register divisor);
+void asm_setcc(Assembler* as, Condition cc, Register dst);
+void asm_push(Assembler* as, Register reg);
+void asm_pop(Assembler* as, Register reg);
+void asm_call(Assembler* as, Register target);
+void asm_ret(Assembler* as);
+void asm_mov_eax_imm(Assembler* as, u32 imm);
+
+// Jumps are emitted with a 32 bit displacement. Both return the offset of the
+// displacement so it can be patched once the target is known.
+u64 asm_jmp(Assembler* as);
+u64 asm_jcc(Assembler* as, Condition cc);
+void asm_patch(Assembler* as, u64 displacement_offset, u64 target);
+
+bool fits_i32(i64 value);
+
+// Copies finished machine code into freshly mapped executable memory
+void* map_executable(const u8* code, u64 size, u64* mapped_size);
+void unmap_executable(void* code, u64 mapped_size);
+
+// Adds a symbol for generated code to /tmp/perf-<pid>.map so perf can
+// attribute samples in it. Only done when PEPPER_PERF_MAP=1.
+void perf_map_add(const void* code, u64 size, const char* kind, const char* name, u64 line);
+
+#endif
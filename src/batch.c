@@ -0,0 +1,253 @@
+#define _DEFAULT_SOURCE 1
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "batch.h"
+#include "lexer.h"
+#include "parser.h"
+#include "bytecode_generator.h"
+#include "vm.h"
+#include "output.h"
+#include "files.h"
+#include "memory.h"
+#include "phases.h"
+#include "vector.h"
+
+#define SCRIPT_EXTENSION ".pepr"
+
+DEFINE_VECTOR(PathArray, path_array, char*, 0, MEMORY_OTHER)
+
+typedef struct {
+    char* path;
+    CapturedOutput output;
+    bool failed;
+    char error[ERROR_MESSAGE_MAX];
+    // Set, under the batch's lock, once the script has finished
+    bool done;
+} Script;
+
+typedef struct {
+    Script* scripts;
+    u64 count;
+    // The next script for a worker to take
+    u64 next;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} Batch;
+
+static char* copy_path(const char* path, u64 length) {
+    char* copy = ALLOCATE(char, length + 1);
+    memcpy(copy, path, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static bool is_script(const char* directory, const char* name) {
+    u64 length = strlen(name);
+    u64 extension = strlen(SCRIPT_EXTENSION);
+    if (length <= extension || strcmp(name + length - extension, SCRIPT_EXTENSION) != 0) return false;
+    char path[PATH_MAX];
+    struct stat info;
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    return stat(path, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void list_directory(const char* directory, DIR* dir, PathArray* paths) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_script(directory, entry->d_name)) continue;
+        char path[PATH_MAX];
+        int length = snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        write_path_array(paths, copy_path(path, (u64)length));
+    }
+    // readdir's order depends on the file system
+    qsort(paths->items, paths->count, sizeof(char*), compare_paths);
+}
+
+// One path a line. Blank lines and lines starting with # are skipped.
+static void list_file(FILE* file, PathArray* paths) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t read;
+    while ((read = getline(&line, &capacity, file)) != -1) {
+        u64 length = (u64)read;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' || line[length - 1] == ' ')) {
+            length--;
+        }
+        if (length == 0 || line[0] == '#') continue;
+        write_path_array(paths, copy_path(line, length));
+    }
+    free(line);
+}
+
+static void list_scripts(const char* path, PathArray* paths) {
+    if (strcmp(path, "-") == 0) {
+        list_file(stdin, paths);
+        return;
+    }
+    DIR* dir = opendir(path);
+    if (dir != NULL) {
+        list_directory(path, dir, paths);
+        closedir(dir);
+        return;
+    }
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open \"%s\".\n", path);
+        exit(74);
+    }
+    list_file(file, paths);
+    fclose(file);
+}
+
+static void fail(Script* script, const char* message) {
+    script->failed = true;
+    snprintf(script->error, sizeof(script->error), "%s", message);
+}
+
+
+// NULL, with the script failed, if it doesn't compile
+static ByteCode* compile_script(Script* script) {
+    const char* error;
+    char* source = read_source_file(script->path, &error);
+    if (source == NULL) {
+        // Printed after the path already
+        char message[ERROR_MESSAGE_MAX];
+        snprintf(message, sizeof(message), "%s.", error);
+        fail(script, message);
+        return NULL;
+    }
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    Parser* parser = init_parser(lexer);
+    // Reported along with the script's output instead
+    parser->error_output = NULL;
+    Program* program = parse_program(parser);
+    ByteCode* byte_code = NULL;
+    if (parser->has_error || parser->panic_mode) {
+        fail(script, parser->error);
+    } else {
+        byte_code = generate_bytecode(program);
+        if (byte_code->has_error) {
+            fail(script, byte_code->error);
+            free_byte_code(byte_code);
+            byte_code = NULL;
+        }
+    }
+    de_init_program(program);
+    de_init_parser(parser);
+    free(source);
+    return byte_code;
+}
+
+// Takes scripts until there are none left. The VM is made for the first
+// script that compiles and loaded with each one after it, and the byte code
+// it last ran is only freed once it's been loaded with the next.
+static void* run_worker(void* argument) {
+    Batch* batch = (Batch*)argument;
+    VM* vm = NULL;
+    ByteCode* loaded = NULL;
+    for (;;) {
+        u64 index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (index >= batch->count) break;
+        Script* script = &batch->scripts[index];
+        ByteCode* byte_code = compile_script(script);
+        if (byte_code != NULL) {
+            if (vm == NULL) {
+                vm = init_vm(byte_code);
+                init_output(&vm->output, OUTPUT_CAPTURE);
+            } else {
+                load_vm(vm, byte_code);
+            }
+            if (loaded != NULL) free_byte_code(loaded);
+            loaded = byte_code;
+            if (run(vm) != OK) fail(script, vm->error);
+            script->output = take_captured_output(&vm->output);
+        }
+        pthread_mutex_lock(&batch->lock);
+        script->done = true;
+        pthread_cond_broadcast(&batch->finished);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    if (vm != NULL) free_vm(vm);
+    if (loaded != NULL) free_byte_code(loaded);
+    return NULL;
+}
+
+static void write_script(Script* script) {
+    if (script->output.length > 0) fwrite(script->output.chars, sizeof(char), script->output.length, stdout);
+    if (script->failed) {
+        // After whatever it printed before failing
+        fflush(stdout);
+        fprintf(stderr, "%s: %s\n", script->path, script->error);
+    }
+    free_captured_output(&script->output);
+}
+
+u64 run_batch(const char* path, u32 threads) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    PathArray paths;
+    init_path_array(&paths);
+    list_scripts(path, &paths);
+
+    Batch batch;
+    batch.count = paths.count;
+    batch.next = 0;
+    batch.scripts = ALLOCATE(Script, batch.count > 0 ? batch.count : 1);
+    for (u64 i = 0; i < batch.count; i++) {
+        Script* script = &batch.scripts[i];
+        script->path = paths.items[i];
+        script->output = (CapturedOutput){NULL, 0, 0};
+        script->failed = false;
+        script->error[0] = '\0';
+        script->done = false;
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.finished, NULL);
+
+    if (threads > batch.count) threads = batch.count > 0 ? (u32)batch.count : 1;
+    pthread_t* handles = ALLOCATE(pthread_t, threads);
+    for (u32 i = 0; i < threads; i++) {
+        if (pthread_create(&handles[i], NULL, run_worker, &batch) != 0) {
+            fprintf(stderr, "Could not start a worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Each script is written out as soon as it and every one before it
+    // have finished, so output streams while later scripts still run
+    u64 failed = 0;
+    for (u64 i = 0; i < batch.count; i++) {
+        Script* script = &batch.scripts[i];
+        pthread_mutex_lock(&batch.lock);
+        while (!script->done) pthread_cond_wait(&batch.finished, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+        write_script(script);
+        if (script->failed) failed++;
+    }
+    fflush(stdout);
+    for (u32 i = 0; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    f64 elapsed = seconds_since(&start);
+    fprintf(stderr, "%lu scripts, %lu failed, on %u threads in %.3fs, %.1f scripts/s\n", batch.count, failed,
+            threads, elapsed, (f64)batch.count / elapsed);
+
+    pthread_cond_destroy(&batch.finished);
+    pthread_mutex_destroy(&batch.lock);
+    FREE_ARRAY(pthread_t, handles, threads);
+    for (u64 i = 0; i < paths.count; i++) {
+        FREE_ARRAY(char, paths.items[i], strlen(paths.items[i]) + 1);
+    }
+    FREE_ARRAY(Script, batch.scripts, batch.count > 0 ? batch.count : 1);
+    free_path_array(&paths);
+    return failed;
+}
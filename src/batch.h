@@ -0,0 +1,17 @@
+#ifndef pepper_batch_h
+#define pepper_batch_h
+
+#include "common.h"
+
+// Runs many scripts in one process, for pipelines that would otherwise
+// start pepper once for each. path is a directory, whose .pepr files are
+// run in name order, a file listing one script per line, or - for a list
+// on standard input. Worker threads each compile and run one script after
+// another on a VM of their own that they reuse. What each script prints is
+// captured and written to standard output in the order of the list, with
+// its error, if any, on standard error, so the output is the same whatever
+// the number of threads. A script that fails doesn't stop the others.
+// Returns how many failed.
+u64 run_batch(const char* path, u32 threads);
+
+#endif
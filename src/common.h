@@ -4,11 +4,26 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "defines.h"
 
 //#define DEBUG_MODE_TOKEN
-#define DEBUG_MODE_PARSER
+//#define DEBUG_MODE_PARSER
 //#define DEBUG_MODE_INTERPRETER
-#define DEBUG_MODE_VM
+//#define DEBUG_MODE_VM
+//#define DEBUG_MODE_JIT
+//#define DEBUG_MODE_COMPILER
+
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+// Room for one error message kept for the caller instead of printed
+#define ERROR_MESSAGE_MAX 256
+
+// The tracing JIT emits x86-64 machine code into mmap'd memory, and the
+// ahead-of-time compiler x86-64 assembly for the system toolchain
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED
+#define NATIVE_SUPPORTED
+#endif
 
 #endif
@@ -0,0 +1,462 @@
+#define MEMORY_TAG MEMORY_AST
+#include <stdarg.h>
+#include <string.h>
+
+#include "checker.h"
+#include "memory.h"
+#include "logger.h"
+
+typedef struct {
+    const char* name;
+    u32 local;
+    i32 depth;
+} ScopedLocal;
+
+typedef struct {
+    CheckedProgram* program;
+    CheckedFunction* function;
+    // Locals currently in scope, innermost last
+    ScopedLocal scoped[UINT8_COUNT];
+    i32 scoped_count;
+    i32 depth;
+    // Whether the script has called a function yet
+    bool called;
+} Checker;
+
+static void check_statement(Checker* checker, Statement* statement);
+static StaticType check_expression(Checker* checker, Expression* expression);
+
+const char* static_type_name(StaticType type) {
+    switch (type) {
+        case TYPE_NIL: return "Nil";
+        case TYPE_INT: return "Int";
+        case TYPE_FLOAT: return "Float";
+        case TYPE_BOOL: return "Bool";
+        case TYPE_FUNCTION: return "Function";
+        default: return "Unknown";
+    }
+}
+
+static void error_at(Checker* checker, Token* token, const char* format, ...) {
+    fprintf(stderr, "[line %lu] Error at '%.*s': ", token->line, (int)token->length, token->start);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    checker->program->has_error = true;
+}
+
+static u32 add_variable(Variable** variables, u32* count, u32* capacity, const char* name, StaticType type) {
+    if (*capacity < *count + 1) {
+        u32 old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        *variables = GROW_ARRAY(Variable, *variables, old_capacity, *capacity);
+    }
+    (*variables)[*count] = (Variable){name, type, false};
+    return (*count)++;
+}
+
+static i32 find_global(CheckedProgram* program, const char* name) {
+    for (u32 i = 0; i < program->global_count; i++) {
+        if (strcmp(program->globals[i].name, name) == 0) return (i32)i;
+    }
+    return -1;
+}
+
+// Function zero is the script, which is never called by name
+static i32 find_function(CheckedProgram* program, const char* name) {
+    for (u32 i = 1; i < program->function_count; i++) {
+        if (strcmp(program->functions[i].name, name) == 0) return (i32)i;
+    }
+    return -1;
+}
+
+static i32 find_local(Checker* checker, const char* name) {
+    for (i32 i = checker->scoped_count - 1; i >= 0; i--) {
+        if (strcmp(checker->scoped[i].name, name) == 0) return (i32)checker->scoped[i].local;
+    }
+    return -1;
+}
+
+static void declare_local(Checker* checker, Token* token, const char* name, StaticType type, i32* variable) {
+    if (checker->scoped_count == UINT8_COUNT) {
+        error_at(checker, token, "Too many local variables in function.");
+        return;
+    }
+    CheckedFunction* function = checker->function;
+    u32 local = add_variable(&function->locals, &function->local_count, &function->local_capacity, name, type);
+    checker->scoped[checker->scoped_count++] = (ScopedLocal){name, local, checker->depth};
+    *variable = (i32)local;
+}
+
+static void begin_scope(Checker* checker) {
+    checker->depth++;
+}
+
+static void end_scope(Checker* checker) {
+    checker->depth--;
+    while (checker->scoped_count > 0 && checker->scoped[checker->scoped_count - 1].depth > checker->depth) {
+        checker->scoped_count--;
+    }
+}
+
+static StaticType parse_type(Checker* checker, Identifier* type, bool is_return_type) {
+    if (type->value[0] == '\0' || strcmp(type->value, "void") == 0) {
+        if (!is_return_type) return TYPE_UNKNOWN;
+        return TYPE_NIL;
+    }
+    if (strcmp(type->value, "Int") == 0) return TYPE_INT;
+    if (strcmp(type->value, "Float") == 0) return TYPE_FLOAT;
+    if (strcmp(type->value, "Bool") == 0) return TYPE_BOOL;
+    error_at(checker, &type->token, "Unknown type '%s'.", type->value);
+    return TYPE_UNKNOWN;
+}
+
+static bool is_number(StaticType type) {
+    return type == TYPE_INT || type == TYPE_FLOAT;
+}
+
+// Reports a value of the wrong type, unless the value already failed to check
+static bool expect_type(Checker* checker, Token* token, StaticType actual, StaticType expected, const char* what) {
+    if (actual == expected) return true;
+    if (actual != TYPE_UNKNOWN) {
+        error_at(checker, token, "%s must be %s but is %s.", what, static_type_name(expected), static_type_name(actual));
+    }
+    return false;
+}
+
+static StaticType check_identifier(Checker* checker, Expression* expression) {
+    const char* name = expression->ident.value;
+    i32 local = find_local(checker, name);
+    if (local != -1) {
+        expression->variable = local;
+        return checker->function->locals[local].type;
+    }
+    i32 global = find_global(checker->program, name);
+    if (global != -1) {
+        expression->variable = -(global + 1);
+        return checker->program->globals[global].type;
+    }
+    i32 function = find_function(checker->program, name);
+    if (function != -1) {
+        expression->variable = function;
+        return TYPE_FUNCTION;
+    }
+    error_at(checker, &expression->token, "Undefined variable '%s'.", name);
+    return TYPE_UNKNOWN;
+}
+
+static StaticType check_infix(Checker* checker, Expression* expression) {
+    StaticType left = check_expression(checker, (Expression*)expression->infix.left);
+    StaticType right = check_expression(checker, (Expression*)expression->infix.right);
+    if (left == TYPE_UNKNOWN || right == TYPE_UNKNOWN) return TYPE_UNKNOWN;
+    switch (expression->infix.operator) {
+        case PARSE_OP_ADD:
+        case PARSE_OP_MINUS:
+        case PARSE_OP_MULTIPLY:
+        case PARSE_OP_DIVIDE:
+            if (!is_number(left) || left != right) break;
+            return left;
+        case PARSE_OP_GREATER:
+        case PARSE_OP_EQUAL_GREATER:
+        case PARSE_OP_LESS:
+        case PARSE_OP_EQUAL_LESS:
+            if (!is_number(left) || left != right) break;
+            return TYPE_BOOL;
+        case PARSE_OP_EQUALITY:
+        case PARSE_OP_NOT_EQUAL:
+            // Values of different types are never equal, which is known statically
+            if (left == TYPE_FUNCTION || right == TYPE_FUNCTION) break;
+            return TYPE_BOOL;
+        case PARSE_OP_AND:
+        case PARSE_OP_OR:
+            if (left != TYPE_BOOL || right != TYPE_BOOL) break;
+            return TYPE_BOOL;
+        default:
+            break;
+    }
+    error_at(checker, &expression->token, "Operands can't be %s and %s.", static_type_name(left),
+             static_type_name(right));
+    return TYPE_UNKNOWN;
+}
+
+static StaticType check_prefix(Checker* checker, Expression* expression) {
+    StaticType right = check_expression(checker, (Expression*)expression->prefix.right);
+    if (right == TYPE_UNKNOWN) return TYPE_UNKNOWN;
+    if (expression->prefix.operator == PARSE_OP_MINUS && is_number(right)) return right;
+    if (expression->prefix.operator == PARSE_OP_NOT && right != TYPE_FUNCTION) return TYPE_BOOL;
+    error_at(checker, &expression->token, "Operand can't be %s.", static_type_name(right));
+    return TYPE_UNKNOWN;
+}
+
+static StaticType check_call(Checker* checker, Expression* expression) {
+    Expression* callee = (Expression*)expression->call.callee;
+    if (checker->function->name == NULL) checker->called = true;
+    for (u64 i = 0; i < expression->call.argument_count; i++) {
+        check_expression(checker, (Expression*)expression->call.arguments[i]);
+    }
+    if (callee->type != EXPR_IDENT || check_expression(checker, callee) != TYPE_FUNCTION) {
+        error_at(checker, &callee->token, "Can only call functions declared at the top level.");
+        return TYPE_UNKNOWN;
+    }
+    CheckedFunction* function = &checker->program->functions[callee->variable];
+    if (expression->call.argument_count != function->parameter_count) {
+        error_at(checker, &expression->token, "Expected %u arguments but got %lu.", function->parameter_count,
+                 expression->call.argument_count);
+        return function->return_type;
+    }
+    for (u64 i = 0; i < expression->call.argument_count; i++) {
+        Expression* argument = (Expression*)expression->call.arguments[i];
+        expect_type(checker, &argument->token, argument->static_type, function->locals[i].type, "Argument");
+    }
+    return function->return_type;
+}
+
+static void check_if(Checker* checker, Expression* expression) {
+    StaticType condition = check_expression(checker, (Expression*)expression->if_expr.condition);
+    if (condition == TYPE_FUNCTION) {
+        error_at(checker, &expression->token, "Condition can't be a function.");
+    }
+    check_statement(checker, (Statement*)expression->if_expr.consequence);
+    if (expression->if_expr.alternative != NULL) {
+        check_statement(checker, (Statement*)expression->if_expr.alternative);
+    }
+}
+
+static StaticType check_expression(Checker* checker, Expression* expression) {
+    StaticType type = TYPE_UNKNOWN;
+    switch (expression->type) {
+        case EXPR_INT: type = TYPE_INT; break;
+        case EXPR_FLOAT: type = TYPE_FLOAT; break;
+        case EXPR_BOOL: type = TYPE_BOOL; break;
+        case EXPR_IDENT: type = check_identifier(checker, expression); break;
+        case EXPR_INFIX: type = check_infix(checker, expression); break;
+        case EXPR_PREFIX: type = check_prefix(checker, expression); break;
+        case EXPR_CALL: type = check_call(checker, expression); break;
+        case EXPR_IF:
+            error_at(checker, &expression->token, "'if' can only be used as a statement.");
+            break;
+        case EXPR_STRING:
+            error_at(checker, &expression->token, "Strings can't be compiled to native code yet.");
+            break;
+        default: break;
+    }
+    expression->static_type = type;
+    return type;
+}
+
+static void check_instantiate(Checker* checker, Statement* statement) {
+    StaticType type = check_expression(checker, statement->value);
+    if (type == TYPE_FUNCTION) {
+        error_at(checker, &statement->token, "Functions can't be stored in variables.");
+        return;
+    }
+    const char* name = statement->name.value;
+    if (checker->depth > 0 || checker->function->name != NULL) {
+        declare_local(checker, &statement->token, name, type, &statement->variable);
+        return;
+    }
+    if (find_global(checker->program, name) != -1 || find_function(checker->program, name) != -1) {
+        error_at(checker, &statement->token, "'%s' is already declared.", name);
+        return;
+    }
+    CheckedProgram* program = checker->program;
+    u32 global = add_variable(&program->globals, &program->global_count, &program->global_capacity, name, type);
+    program->globals[global].maybe_undefined = checker->called;
+    statement->variable = -((i32)global + 1);
+}
+
+static void check_assign(Checker* checker, Statement* statement) {
+    StaticType type = check_expression(checker, statement->value);
+    const char* name = statement->name.value;
+    StaticType target = TYPE_UNKNOWN;
+    i32 local = find_local(checker, name);
+    i32 global = find_global(checker->program, name);
+    if (local != -1) {
+        statement->variable = local;
+        target = checker->function->locals[local].type;
+    } else if (global != -1) {
+        statement->variable = -(global + 1);
+        target = checker->program->globals[global].type;
+    } else {
+        error_at(checker, &statement->token, "Undefined variable '%s'.", name);
+        return;
+    }
+    expect_type(checker, &statement->token, type, target, "Assigned value");
+}
+
+static void check_return(Checker* checker, Statement* statement) {
+    CheckedFunction* function = checker->function;
+    if (function->name == NULL) {
+        error_at(checker, &statement->token, "Can't return from top-level code.");
+        return;
+    }
+    StaticType type = TYPE_NIL;
+    if (statement->value != NULL) type = check_expression(checker, statement->value);
+    expect_type(checker, &statement->token, type, function->return_type, "Returned value");
+}
+
+static void check_block(Checker* checker, Statement* statement) {
+    begin_scope(checker);
+    for (u64 i = 0; i < statement->block.statement_count; i++) {
+        check_statement(checker, &statement->block.statements[i]);
+    }
+    end_scope(checker);
+}
+
+static void check_loop(Checker* checker, Statement* statement) {
+    begin_scope(checker);
+    if (statement->loop.initializer != NULL) check_statement(checker, statement->loop.initializer);
+    Expression* condition = (Expression*)statement->loop.condition;
+    if (condition != NULL && check_expression(checker, condition) == TYPE_FUNCTION) {
+        error_at(checker, &statement->token, "Condition can't be a function.");
+    }
+    check_statement(checker, statement->loop.body);
+    if (statement->loop.increment != NULL) check_statement(checker, statement->loop.increment);
+    end_scope(checker);
+}
+
+static void check_statement(Checker* checker, Statement* statement) {
+    switch (statement->type) {
+        case STMT_EXPRESSION:
+            if (statement->value->type == EXPR_IF) {
+                check_if(checker, statement->value);
+                break;
+            }
+            check_expression(checker, statement->value);
+            break;
+        case STMT_PRINT:
+            if (check_expression(checker, statement->value) == TYPE_FUNCTION) {
+                error_at(checker, &statement->token, "Can't print a function.");
+            }
+            break;
+        case STMT_INSTANTIATE: check_instantiate(checker, statement); break;
+        case STMT_ASSIGN: check_assign(checker, statement); break;
+        case STMT_RETURN: check_return(checker, statement); break;
+        case STMT_BLOCK: check_block(checker, statement); break;
+        case STMT_WHILE:
+        case STMT_FOR: check_loop(checker, statement); break;
+        case STMT_FUNCTION:
+            if (checker->depth > 0 || checker->function->name != NULL) {
+                error_at(checker, &statement->token, "Functions can only be declared at the top level.");
+                break;
+            }
+            statement->variable = find_function(checker->program, statement->name.value);
+            break;
+        default: break;
+    }
+}
+
+// Whether control can never reach the end of the statement
+static bool always_returns(Statement* statement) {
+    switch (statement->type) {
+        case STMT_RETURN: return true;
+        case STMT_BLOCK:
+            for (u64 i = 0; i < statement->block.statement_count; i++) {
+                if (always_returns(&statement->block.statements[i])) return true;
+            }
+            return false;
+        case STMT_EXPRESSION: {
+            Expression* expression = statement->value;
+            if (expression->type != EXPR_IF || expression->if_expr.alternative == NULL) return false;
+            return always_returns((Statement*)expression->if_expr.consequence) &&
+                   always_returns((Statement*)expression->if_expr.alternative);
+        }
+        default: return false;
+    }
+}
+
+static CheckedFunction* add_function(CheckedProgram* program, const char* name, Statement* declaration) {
+    if (program->function_capacity < program->function_count + 1) {
+        u32 old_capacity = program->function_capacity;
+        program->function_capacity = GROW_CAPACITY(old_capacity);
+        program->functions = GROW_ARRAY(CheckedFunction, program->functions, old_capacity,
+                                        program->function_capacity);
+    }
+    CheckedFunction* function = &program->functions[program->function_count++];
+    function->name = name;
+    function->declaration = declaration;
+    function->return_type = TYPE_NIL;
+    function->parameter_count = 0;
+    function->locals = NULL;
+    function->local_count = 0;
+    function->local_capacity = 0;
+    return function;
+}
+
+// Signatures are collected up front so calls can be checked in any order
+static void declare_function(Checker* checker, Statement* statement) {
+    const char* name = statement->name.value;
+    if (find_function(checker->program, name) != -1) {
+        error_at(checker, &statement->token, "'%s' is already declared.", name);
+        return;
+    }
+    CheckedFunction* function = add_function(checker->program, name, statement);
+    function->return_type = parse_type(checker, &statement->function.return_type, true);
+    function->parameter_count = (u32)statement->function.parameter_count;
+    for (u64 i = 0; i < statement->function.parameter_count; i++) {
+        Identifier* parameter = &statement->function.parameters[i];
+        StaticType type = parse_type(checker, &statement->function.parameter_types[i], false);
+        if (type == TYPE_UNKNOWN && statement->function.parameter_types[i].value[0] == '\0') {
+            error_at(checker, &parameter->token, "Parameter '%s' needs a type.", parameter->value);
+        }
+        add_variable(&function->locals, &function->local_count, &function->local_capacity, parameter->value, type);
+    }
+}
+
+static void check_function_body(Checker* checker, CheckedFunction* function) {
+    Statement* declaration = function->declaration;
+    checker->function = function;
+    checker->scoped_count = 0;
+    checker->depth = 1;
+    for (u32 i = 0; i < function->parameter_count; i++) {
+        checker->scoped[checker->scoped_count++] = (ScopedLocal){function->locals[i].name, i, 1};
+    }
+    // The body shares the parameters' scope, as in the bytecode generator
+    Statement* body = declaration->function.body;
+    for (u64 i = 0; i < body->block.statement_count; i++) {
+        check_statement(checker, &body->block.statements[i]);
+    }
+    if (function->return_type != TYPE_NIL && !always_returns(body)) {
+        error_at(checker, &declaration->token, "Function '%s' can end without returning a value.", function->name);
+    }
+}
+
+CheckedProgram* check_program(Program* program) {
+    CheckedProgram* checked = ALLOCATE(CheckedProgram, 1);
+    checked->program = program;
+    checked->functions = NULL;
+    checked->function_count = 0;
+    checked->function_capacity = 0;
+    checked->globals = NULL;
+    checked->global_count = 0;
+    checked->global_capacity = 0;
+    checked->has_error = false;
+
+    Checker checker = {.program = checked, .scoped_count = 0, .depth = 0, .called = false};
+    add_function(checked, NULL, NULL);
+    for (u64 i = 0; i < program->statements.count; i++) {
+        if (program->statements.items[i].type == STMT_FUNCTION) declare_function(&checker, &program->statements.items[i]);
+    }
+
+    // The script runs first so every global is known by the time any
+    // function body is checked
+    checker.function = &checked->functions[0];
+    for (u64 i = 0; i < program->statements.count; i++) {
+        check_statement(&checker, &program->statements.items[i]);
+    }
+    for (u32 i = 1; i < checked->function_count; i++) {
+        check_function_body(&checker, &checked->functions[i]);
+    }
+    return checked;
+}
+
+void free_checked_program(CheckedProgram* checked) {
+    for (u32 i = 0; i < checked->function_count; i++) {
+        FREE_ARRAY(Variable, checked->functions[i].locals, checked->functions[i].local_capacity);
+    }
+    FREE_ARRAY(CheckedFunction, checked->functions, checked->function_capacity);
+    FREE_ARRAY(Variable, checked->globals, checked->global_capacity);
+    FREE(CheckedProgram, checked);
+}
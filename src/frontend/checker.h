@@ -0,0 +1,53 @@
+#ifndef pepper_checker_h
+#define pepper_checker_h
+
+#include "common.h"
+#include "parser.h"
+
+// Static checking for the native backends. The VM works everything out at
+// runtime, but compiled code needs every variable's type and home up front, so
+// the checker gives each expression a StaticType and resolves every name to a
+// local or global index.
+
+typedef struct {
+    // Points into the AST
+    const char* name;
+    StaticType type;
+    // Globals only. Set when the script has called a function before the
+    // global's definition runs, so a function might use it while it's still
+    // undefined and native code has to check, as the VM always does.
+    bool maybe_undefined;
+} Variable;
+
+typedef struct {
+    // NULL for the top-level script
+    const char* name;
+    Statement* declaration;
+    StaticType return_type;
+    u32 parameter_count;
+    // Parameters come first. Every declaration gets its own local, so a
+    // shadowing declaration or one in a sibling block never shares a slot.
+    Variable* locals;
+    u32 local_count;
+    u32 local_capacity;
+} CheckedFunction;
+
+typedef struct {
+    Program* program;
+    // Function zero is the script
+    CheckedFunction* functions;
+    u32 function_count;
+    u32 function_capacity;
+    Variable* globals;
+    u32 global_count;
+    u32 global_capacity;
+    bool has_error;
+} CheckedProgram;
+
+// Reports every error it finds to stderr and sets has_error
+CheckedProgram* check_program(Program* program);
+void free_checked_program(CheckedProgram* checked);
+
+const char* static_type_name(StaticType type);
+
+#endif
@@ -1,14 +1,16 @@
+#define MEMORY_TAG MEMORY_LEXER
 #include <stdlib.h>
 #include <string.h>
 
 #include "lexer.h"
+#include "memory.h"
 #include "logger.h"
 #include "debug.h"
 
 
 // initialize the scanner with sensible defaults
 Lexer* init_lexer(const char* source) {
-    Lexer* lexer = (Lexer*)malloc(sizeof(Lexer));
+    Lexer* lexer = ALLOCATE(Lexer, 1);
     if (!lexer) {
         ERROR("Run out of memory when initializing lexer");
         exit(EXIT_FAILURE);
@@ -16,28 +18,12 @@ Lexer* init_lexer(const char* source) {
     lexer->start = source;
     lexer->current = source;
     lexer->line = 1;
-    lexer->tokens = (Token*)calloc(1, sizeof(Token));
-    lexer->token_capacity = 0;
-    lexer->token_count = 0;
+    init_token_array(&lexer->tokens);
     return lexer;
 }
 void de_init_lexer(Lexer* lexer) {
-    lexer->tokens = NULL;
-    lexer->token_count = 0;
-    lexer->token_capacity = 0;
-}
-
-static void add_token(Lexer* lexer, Token token) {
-    if (lexer->token_count == lexer->token_capacity) {
-        lexer->token_capacity = lexer->token_capacity == 0 ? 8 : lexer->token_capacity * 2;
-        lexer->tokens = realloc(lexer->tokens, lexer->token_capacity * sizeof(Token));
-        if (lexer->tokens == NULL) {
-            ERROR("Failed to allocate memory for tokens.");
-            exit(EXIT_FAILURE);
-        }
-    }
-    lexer->tokens[lexer->token_count] = token;
-    lexer->token_count++;
+    free_token_array(&lexer->tokens);
+    FREE(Lexer, lexer);
 }
 
 static bool is_at_end(Lexer* lexer) {
@@ -50,7 +36,7 @@ static Token create_token(Lexer* lexer, TokenType type) {
     token.length = (u64)(lexer->current - lexer->start);
     token.line = lexer->line;
     token.start = lexer->start;
-    add_token(lexer, token);
+    write_token_array(&lexer->tokens, token);
     return token;
 }
 
@@ -60,7 +46,7 @@ static Token error_token(Lexer* lexer, const char* message) {
     token.length = (u64)strlen(message);
     token.line = lexer->line;
     token.start = message;
-    add_token(lexer, token);
+    write_token_array(&lexer->tokens, token);
     return token;
 }
 
@@ -141,24 +127,27 @@ static TokenType identifier_type(Lexer* lexer) {
                     case 'l': return check_for_keyword(lexer, 2, 2, "se", TOKEN_ELSE);
                 }
             }
+            break;
         }
         case 'f': {
             if (lexer->current - lexer->start > 1) {
                 switch (lexer->start[1]) {
                     case 'a': return check_for_keyword(lexer, 2, 3, "lse", TOKEN_FALSE);
                     case 'o': return check_for_keyword(lexer, 2, 1, "r", TOKEN_FOR);
-                    case 'n': return TOKEN_FN;
+                    case 'n': return check_for_keyword(lexer, 2, 0, "", TOKEN_FN);
                 }
             }
+            break;
         }
         case 'i': return check_for_keyword(lexer, 1, 1, "f", TOKEN_IF);
         case 'm': {
             if (lexer->current - lexer->start > 1) {
                 switch (lexer->start[1]) {
-                    case 'u': check_for_keyword(lexer, 2, 1, "t", TOKEN_MUT);
-                    case 'e': check_for_keyword(lexer, 2, 4, "thod", TOKEN_METHOD);
+                    case 'u': return check_for_keyword(lexer, 2, 1, "t", TOKEN_MUT);
+                    case 'e': return check_for_keyword(lexer, 2, 4, "thod", TOKEN_METHOD);
                 }
             }
+            break;
         }
         case 'n': return check_for_keyword(lexer, 1, 2, "il", TOKEN_NIL);
         case 'o': return check_for_keyword(lexer, 1, 1, "r", TOKEN_OR);
@@ -170,6 +159,7 @@ static TokenType identifier_type(Lexer* lexer) {
         case 'w': return check_for_keyword(lexer, 1, 4, "hile", TOKEN_WHILE);
         default: return TOKEN_IDENTIFIER;
     }
+    return TOKEN_IDENTIFIER;
 }
 
 static Token identifier(Lexer* lexer) {
@@ -178,11 +168,21 @@ static Token identifier(Lexer* lexer) {
 }
 
 static Token number(Lexer* lexer) {
-    while (is_numeric(peek(lexer))) advance(lexer);
+    // Hexadecimal and binary. Every letter and digit after the prefix is
+    // part of the token, so the parser can report a bad digit.
+    char prefix = peek(lexer);
+    if (lexer->start[0] == '0' && (prefix == 'x' || prefix == 'X' || prefix == 'b' || prefix == 'B')) {
+        advance(lexer);
+        while (is_alpha(peek(lexer)) || is_numeric(peek(lexer))) advance(lexer);
+        return create_token(lexer, TOKEN_NUMBER);
+    }
+
+    // Underscores separate digits, which the parser checks
+    while (is_numeric(peek(lexer)) || peek(lexer) == '_') advance(lexer);
 
     if (peek(lexer) == '.' && is_numeric(peekNext(lexer))) {
         advance(lexer);
-        while (is_numeric(peek(lexer))) advance(lexer);
+        while (is_numeric(peek(lexer)) || peek(lexer) == '_') advance(lexer);
     }
 
     return create_token(lexer, TOKEN_NUMBER);
@@ -224,6 +224,7 @@ Token scan_token(Lexer* lexer) {
         case '?': return create_token(lexer, TOKEN_QUESTION_MARK);
         case '@': return create_token(lexer, TOKEN_AT);
         case '%': return create_token(lexer, TOKEN_PERCENT);
+        case '|': return create_token(lexer, TOKEN_PIPE);
         case '<': {
             if (match(lexer, '=')) {
                 return create_token(lexer, TOKEN_LESS_EQUAL);
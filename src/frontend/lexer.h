@@ -2,6 +2,8 @@
 #define pepper_lexer_h
 
 #include "common.h"
+#include "memory.h"
+#include "vector.h"
 
 #define MAX_TOKEN_LENGTH 256
 
@@ -11,7 +13,7 @@ typedef enum {
   TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
   TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
   TOKEN_SEMICOLON, TOKEN_COLON, TOKEN_SLASH, TOKEN_STAR,
-  TOKEN_QUESTION_MARK, TOKEN_AT, TOKEN_PERCENT,
+  TOKEN_QUESTION_MARK, TOKEN_AT, TOKEN_PERCENT, TOKEN_PIPE,
   // One or two character tokens.
   TOKEN_BANG, TOKEN_BANG_EQUAL,
   TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
@@ -39,6 +41,8 @@ typedef struct {
     u64 line;
 } Token;
 
+DEFINE_VECTOR(TokenArray, token_array, Token, 0, MEMORY_LEXER)
+
 typedef struct {
     // marks the beginning of the current lexeme (word) being scanned
     const char* start;
@@ -46,9 +50,7 @@ typedef struct {
     const char* current;
     // the current line number we are scanning
     u64 line;
-    Token* tokens;
-    u64 token_count;
-    u64 token_capacity;
+    TokenArray tokens;
 } Lexer;
 
 Lexer* init_lexer(const char* source);
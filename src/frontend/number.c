@@ -0,0 +1,132 @@
+#define MEMORY_TAG MEMORY_AST
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+#include "memory.h"
+
+// A u64 holds any number with this many digits
+#define SIGNIFICAND_DIGITS_MAX 19
+// Doubles hold every integer up to this exactly
+#define EXACT_INTEGER_MAX ((u64)1 << 53)
+// And every power of ten up to this one
+#define EXACT_POWER_MAX 22
+// Literals going through strtod that are shorter than this are copied onto
+// the stack
+#define STRTOD_BUFFER_SIZE 64
+
+static const f64 powers_of_ten[EXACT_POWER_MAX + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// 16 or more for anything that isn't a digit in any base
+static u32 digit_value(char c) {
+    if (c >= '0' && c <= '9') return (u32)(c - '0');
+    if (c >= 'a' && c <= 'f') return (u32)(c - 'a' + 10);
+    if (c >= 'A' && c <= 'F') return (u32)(c - 'A' + 10);
+    return 16;
+}
+
+// Whether the underscore at i has a digit on either side. The lexer only
+// puts digits, letters, underscores and a decimal point in a number.
+static bool separates_digits(const char* chars, u64 i, u64 length) {
+    if (i == 0 || i + 1 == length) return false;
+    char before = chars[i - 1];
+    char after = chars[i + 1];
+    return before != '_' && before != '.' && after != '_' && after != '.';
+}
+
+// The magnitude an integer literal may have
+static u64 integer_limit(bool negated) {
+    return negated ? (u64)INT64_MAX + 1 : (u64)INT64_MAX;
+}
+
+static i64 integer_value(u64 magnitude) {
+    return magnitude > (u64)INT64_MAX ? INT64_MIN : (i64)magnitude;
+}
+
+// Hexadecimal and binary literals, with the prefix already skipped
+static NumberResult parse_prefixed(const char* chars, u64 length, u32 base, bool negated, i64* integer) {
+    if (length == 0) return NUMBER_BAD_DIGIT;
+    u64 limit = integer_limit(negated);
+    u64 value = 0;
+    for (u64 i = 0; i < length; i++) {
+        if (chars[i] == '_') {
+            if (!separates_digits(chars, i, length)) return NUMBER_BAD_SEPARATOR;
+            continue;
+        }
+        u32 digit = digit_value(chars[i]);
+        if (digit >= base) return NUMBER_BAD_DIGIT;
+        if (value > (limit - digit) / base) return NUMBER_TOO_LARGE;
+        value = value * base + digit;
+    }
+    *integer = integer_value(value);
+    return NUMBER_INT;
+}
+
+// For floats with more digits than the fast path takes. strtod rounds
+// correctly, but wants the literal without its underscores and terminated.
+static f64 parse_float_slowly(const char* chars, u64 length) {
+    char stack_buffer[STRTOD_BUFFER_SIZE];
+    char* buffer = length < STRTOD_BUFFER_SIZE ? stack_buffer : ALLOCATE(char, length + 1);
+    u64 count = 0;
+    for (u64 i = 0; i < length; i++) {
+        if (chars[i] != '_') buffer[count++] = chars[i];
+    }
+    buffer[count] = '\0';
+    f64 value = strtod(buffer, NULL);
+    if (buffer != stack_buffer) FREE_ARRAY(char, buffer, length + 1);
+    return value;
+}
+
+NumberResult parse_number(const char* chars, u64 length, bool negated, i64* integer, f64* floating_point) {
+    if (length > 2 && chars[0] == '0') {
+        if (chars[1] == 'x' || chars[1] == 'X') return parse_prefixed(chars + 2, length - 2, 16, negated, integer);
+        if (chars[1] == 'b' || chars[1] == 'B') return parse_prefixed(chars + 2, length - 2, 2, negated, integer);
+    }
+
+    // One pass collects up to the first 19 significant digits, whether
+    // they're before or after the decimal point, and how many of the digits
+    // are after it
+    u64 significand = 0;
+    u32 significant_digits = 0;
+    bool truncated = false;
+    bool is_float = false;
+    u64 fraction_digits = 0;
+    for (u64 i = 0; i < length; i++) {
+        char c = chars[i];
+        if (c == '_') {
+            if (!separates_digits(chars, i, length)) return NUMBER_BAD_SEPARATOR;
+            continue;
+        }
+        if (c == '.') {
+            is_float = true;
+            continue;
+        }
+        if (c < '0' || c > '9') return NUMBER_BAD_DIGIT;
+        fraction_digits += is_float;
+        if (significant_digits < SIGNIFICAND_DIGITS_MAX) {
+            significand = significand * 10 + (u64)(c - '0');
+            significant_digits += significand != 0;
+        } else {
+            truncated = true;
+        }
+    }
+
+    if (!is_float) {
+        // Twenty digits is more than 2^63 already
+        if (truncated || significand > integer_limit(negated)) return NUMBER_TOO_LARGE;
+        *integer = integer_value(significand);
+        return NUMBER_INT;
+    }
+    // When the digits and the power of ten are both exact as doubles, one
+    // division rounds the quotient correctly, which covers nearly every
+    // float anyone writes
+    if (!truncated && significand <= EXACT_INTEGER_MAX && fraction_digits <= EXACT_POWER_MAX) {
+        *floating_point = (f64)significand / powers_of_ten[fraction_digits];
+    } else {
+        *floating_point = parse_float_slowly(chars, length);
+    }
+    return NUMBER_FLOAT;
+}
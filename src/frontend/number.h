@@ -0,0 +1,24 @@
+#ifndef pepper_number_h
+#define pepper_number_h
+
+#include "common.h"
+
+// Turns number literals into values, straight from the source. Integers are
+// decimal, hexadecimal with 0x or binary with 0b, and floats are decimal
+// with a fractional part. An underscore may go between any two digits.
+
+typedef enum {
+    NUMBER_INT,
+    NUMBER_FLOAT,
+    // The errors
+    NUMBER_TOO_LARGE,
+    NUMBER_BAD_DIGIT,
+    NUMBER_BAD_SEPARATOR,
+} NumberResult;
+
+// Parses the literal into integer or floating_point, whichever the result
+// says. An integer literal has to fit in an i64, except that a negated one
+// may be 9223372036854775808, which is parsed as INT64_MIN.
+NumberResult parse_number(const char* chars, u64 length, bool negated, i64* integer, f64* floating_point);
+
+#endif
@@ -1,8 +1,10 @@
+#define MEMORY_TAG MEMORY_AST
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include "parser.h"
+#include "number.h"
 #include "memory.h"
 #include "logger.h"
 #include "debug.h"
@@ -11,6 +13,7 @@ static Expression* parse_expression(Parser* parser, Precedence precedence);
 static void parse_statement(Parser* parser, Statement* stmt);
 static void free_expression(Expression* expr);
 static void error(Parser* parser, const char* message);
+static void error_at(Parser* parser, Token* token, const char* message);
 
 static void free_statement(Statement* stmt) {
     if (stmt == NULL) return;
@@ -26,6 +29,28 @@ static void free_statement(Statement* stmt) {
             free_expression(stmt->value);
             // Assuming name is not dynamically allocated
             break;
+        case STMT_BLOCK:
+            for (u64 i = 0; i < stmt->block.statement_count; i++) {
+                free_statement(&stmt->block.statements[i]);
+            }
+            FREE_ARRAY(Statement, stmt->block.statements, stmt->block.statement_capacity);
+            break;
+        case STMT_FUNCTION:
+            FREE_ARRAY(Identifier, stmt->function.parameters, stmt->function.parameter_count);
+            FREE_ARRAY(Identifier, stmt->function.parameter_types, stmt->function.parameter_count);
+            free_statement(stmt->function.body);
+            FREE(Statement, stmt->function.body);
+            break;
+        case STMT_WHILE:
+        case STMT_FOR:
+            free_statement(stmt->loop.initializer);
+            FREE(Statement, stmt->loop.initializer);
+            free_expression((Expression*)stmt->loop.condition);
+            free_statement(stmt->loop.increment);
+            FREE(Statement, stmt->loop.increment);
+            free_statement(stmt->loop.body);
+            FREE(Statement, stmt->loop.body);
+            break;
         // Add cases for other statement types as needed
         default:
             fprintf(stderr, "Unknown statement type in free_statement\n");
@@ -50,15 +75,25 @@ static void free_expression(Expression* expr) {
         case EXPR_IF:
             free_expression((Expression*)expr->if_expr.condition);
             free_statement((Statement*)expr->if_expr.consequence);
+            FREE(Statement, expr->if_expr.consequence);
             if (expr->if_expr.alternative) {
                 free_statement((Statement*)expr->if_expr.alternative);
+                FREE(Statement, expr->if_expr.alternative);
             }
             break;
+        case EXPR_CALL:
+            free_expression((Expression*)expr->call.callee);
+            for (u64 i = 0; i < expr->call.argument_count; i++) {
+                free_expression((Expression*)expr->call.arguments[i]);
+            }
+            FREE_ARRAY(struct Expression*, expr->call.arguments, expr->call.argument_count);
+            break;
         // Add cases for other expression types as needed
         case EXPR_IDENT:
         case EXPR_INT:
         case EXPR_FLOAT:
         case EXPR_BOOL:
+        case EXPR_STRING:
             // These types don't have nested allocations
             break;
         default:
@@ -67,27 +102,23 @@ static void free_expression(Expression* expr) {
             break;
     }
 
-    free(expr);
+    FREE(Expression, expr);
 }
 
 void de_init_program(Program* program) {
     if (program == NULL) return;
 
-    for (u64 i = 0; i < program->statement_count; i++) {
-        free_statement(&program->statements[i]);
+    for (u64 i = 0; i < program->statements.count; i++) {
+        free_statement(&program->statements.items[i]);
     }
 
-    free(program->statements);
-    free(program);
+    free_statement_array(&program->statements);
+    FREE(Program, program);
 }
 
 void de_init_parser(Parser* parser) {
-    free(parser->lexer->tokens);
-    free(parser->lexer);
-    parser->current = 0;
-    parser->has_error = false;
-    parser->panic_mode = false;
-    free(parser);
+    de_init_lexer(parser->lexer);
+    FREE(Parser, parser);
 }
 
 static OperatorType get_operator(TokenType type) {
@@ -102,6 +133,9 @@ static OperatorType get_operator(TokenType type) {
         case TOKEN_BANG_EQUAL: return PARSE_OP_NOT_EQUAL;
         case TOKEN_LESS: return PARSE_OP_LESS;
         case TOKEN_LESS_EQUAL: return PARSE_OP_EQUAL_LESS;
+        case TOKEN_BANG: return PARSE_OP_NOT;
+        case TOKEN_AND: return PARSE_OP_AND;
+        case TOKEN_OR: return PARSE_OP_OR;
         default: return OP_UNKNOWN;
     }
 }
@@ -169,6 +203,14 @@ bool get_literal(Token* token, char* buffer, size_t buffer_size) {
     return true;
 }
 
+// Like get_literal, but a token too long for the buffer is a parse error
+// rather than fatal, and leaves the buffer empty
+static void read_literal(Parser* parser, Token* token, char* buffer, size_t buffer_size) {
+    if (get_literal(token, buffer, buffer_size)) return;
+    buffer[0] = '\0';
+    error_at(parser, token, "Token is too long.");
+}
+
 static Expression* create_expression(ExpressionType type, Token token) {
     Expression* expr = ALLOCATE(Expression, 1);
     if (expr == NULL) {
@@ -177,13 +219,15 @@ static Expression* create_expression(ExpressionType type, Token token) {
     }
     expr->type = type;
     expr->token = token;
+    expr->static_type = TYPE_UNKNOWN;
+    expr->variable = 0;
     return expr;
 }
 
 static void next_token(Parser* parser) {
     parser->current_token = parser->peek_token;
     if (parser->peek_token.type != TOKEN_EOF) {
-        parser->peek_token = parser->lexer->tokens[parser->current];
+        parser->peek_token = parser->lexer->tokens.items[parser->current];
     }
     parser->current++;
 }
@@ -204,41 +248,56 @@ Parser* init_parser(Lexer* lexer) {
     }
     parser->has_error = false;
     parser->panic_mode = false;
+    parser->negated_literal = false;
+    parser->error_output = stderr;
+    parser->error[0] = '\0';
     parser->current = 0;
     parser->lexer = lexer;
+    // next_token stops advancing at EOF, so this mustn't look like it before
+    // the first two tokens are loaded
+    parser->peek_token = (Token){.type = TOKEN_ERROR, .start = NULL, .length = 0, .line = 0};
     next_token(parser);
     next_token(parser);
     return parser;
 }
 
-static void error(Parser* parser, const char* message) {
+static void error_at(Parser* parser, Token* token, const char* message) {
     if (parser->panic_mode) return;
     parser->panic_mode = true;
-    Token* token = &parser->current_token;
-    fprintf(stderr, "[line %lu] Error", token->line);
-    if (token->type == TOKEN_EOF) fprintf(stderr, " at end.");
-    if (token->type == TOKEN_ERROR) {
-
-    } else {
-        fprintf(stderr, " at '%.*s'", (int)token->length, token->start);
+    char formatted[ERROR_MESSAGE_MAX];
+    int length = snprintf(formatted, sizeof(formatted), "[line %lu] Error", token->line);
+    if (token->type == TOKEN_EOF) {
+        length += snprintf(formatted + length, sizeof(formatted) - (u64)length, " at end.");
     }
-    fprintf(stderr, ": %s\n", message);
+    if (token->type != TOKEN_ERROR && (u64)length < sizeof(formatted)) {
+        length += snprintf(formatted + length, sizeof(formatted) - (u64)length, " at '%.*s'", (int)token->length, token->start);
+    }
+    if ((u64)length < sizeof(formatted)) {
+        snprintf(formatted + length, sizeof(formatted) - (u64)length, ": %s", message);
+    }
+    if (parser->error_output != NULL) fprintf(parser->error_output, "%s\n", formatted);
+    if (!parser->has_error) memcpy(parser->error, formatted, sizeof(formatted));
     parser->has_error = true;
 }
 
-static void add_statement(Program* program, Statement* statement) {
-    if (program->statement_count == program->statement_capacity) {
-        u64 old_capacity = program->statement_capacity;
-        program->statement_capacity = GROW_CAPACITY(program->statement_capacity);
-        program->statements = GROW_ARRAY(Statement, program->statements, old_capacity, program->statement_capacity);
-        if (program->statements == NULL) {
-            ERROR("Failed to allocate memory for statements in program.");
+static void error(Parser* parser, const char* message) {
+    error_at(parser, &parser->current_token, message);
+}
+
+
+static void add_block_statement(BlockStatement* block, Statement* statement) {
+    if (block->statement_count == block->statement_capacity) {
+        u64 old_capacity = block->statement_capacity;
+        block->statement_capacity = GROW_CAPACITY(block->statement_capacity);
+        block->statements = GROW_ARRAY(Statement, block->statements, old_capacity, block->statement_capacity);
+        if (block->statements == NULL) {
+            ERROR("Failed to allocate memory for statements in block.");
             exit(EXIT_FAILURE);
         }
     }
 
-    program->statements[program->statement_count] = *statement;
-    program->statement_count++;
+    block->statements[block->statement_count] = *statement;
+    block->statement_count++;
 }
 
 static bool current_token_is(Parser* parser, TokenType type) {
@@ -259,23 +318,26 @@ static bool expect_peek(Parser* parser, TokenType type) {
     }
 }
 
-static void parse_instantiate_statement(Parser* parser, Statement* statement) {
-    statement->type = STMT_INSTANTIATE;
+// Parses 'name := value' or 'name = value', leaving the parser on the last token of the value
+static void parse_binding(Parser* parser, Statement* statement, StatementType type, TokenType operator) {
+    statement->type = type;
     statement->token = parser->current_token;
+    statement->value = NULL;
 
-    if (!expect_peek(parser, TOKEN_ASSIGN)) {
+    if (!expect_peek(parser, operator)) {
         return;
     }
     Identifier ident = {.token = parser->current_token};
-    if (!get_literal(&statement->token, ident.value, sizeof(ident.value))) {
-        ERROR("Unable to get ident value from string literal");
-        exit(EXIT_FAILURE);
-    }
+    read_literal(parser, &statement->token, ident.value, sizeof(ident.value));
     statement->name = ident;
     next_token(parser);
     statement->value = parse_expression(parser, LOWEST);
+}
 
-    while (!current_token_is(parser, TOKEN_DOT)) {
+static void parse_instantiate_statement(Parser* parser, Statement* statement) {
+    parse_binding(parser, statement, STMT_INSTANTIATE, TOKEN_ASSIGN);
+
+    while (!current_token_is(parser, TOKEN_DOT) && !current_token_is(parser, TOKEN_EOF)) {
         next_token(parser);
     }
 }
@@ -283,36 +345,53 @@ static void parse_instantiate_statement(Parser* parser, Statement* statement) {
 static void parse_return_statement(Parser* parser, Statement* statement) {
     statement->type = STMT_RETURN;
     statement->token = parser->current_token;
-    next_token(parser);
-    while (!current_token_is(parser, TOKEN_DOT)) {
+    statement->value = NULL;
+    if (peek_token_is(parser, TOKEN_DOT)) {
         next_token(parser);
+        return;
     }
+    next_token(parser);
+    statement->value = parse_expression(parser, LOWEST);
+    consume(parser, TOKEN_DOT, "Expected '.' after return value");
 }
 
 static Expression* parse_number_expression(Parser* parser) {
-    char literal[MAX_TOKEN_LENGTH];
-    if (!get_literal(&parser->current_token, literal, sizeof(literal))) {
-        ERROR("Unable to get string literal for use in parsing number");
-        exit(EXIT_FAILURE);
-    }
-    for (u64 i = 0; i < parser->current_token.length; i++) {
-        if (literal[i] == '.') {
-            char* eptr;
-            Expression* expr = create_expression(EXPR_FLOAT, parser->current_token);
-            expr->floating_point = (f64)strtod(literal, &eptr);
+    Token* token = &parser->current_token;
+    bool negated = parser->negated_literal;
+    parser->negated_literal = false;
+    i64 integer = 0;
+    f64 floating_point = 0;
+    switch (parse_number(token->start, token->length, negated, &integer, &floating_point)) {
+        case NUMBER_INT: {
+            Expression* expr = create_expression(EXPR_INT, *token);
+            expr->integer = integer;
+            return expr;
+        }
+        case NUMBER_FLOAT: {
+            Expression* expr = create_expression(EXPR_FLOAT, *token);
+            expr->floating_point = floating_point;
             return expr;
         }
+        case NUMBER_TOO_LARGE: error(parser, "Integer literal is too large."); break;
+        case NUMBER_BAD_DIGIT: error(parser, "Invalid digit in number literal."); break;
+        case NUMBER_BAD_SEPARATOR: error(parser, "Underscores in a number literal must go between digits."); break;
     }
-    Expression* expr = create_expression(EXPR_INT, parser->current_token);
-    expr->integer = (i64)atoi(literal);
-    return expr;
+    return NULL;
 }
 
 static Expression* parse_prefix_expression(Parser* parser) {
     Expression* expr = create_expression(EXPR_PREFIX, parser->current_token);
     expr->prefix.operator = get_operator(parser->current_token.type);
     next_token(parser);
-    expr->prefix.right = (struct Expression*)parse_expression(parser, PREFIX);
+    parser->negated_literal = expr->prefix.operator == PARSE_OP_MINUS && parser->current_token.type == TOKEN_NUMBER;
+    Expression* right = parse_expression(parser, PREFIX);
+    // Literals are never negative, so this one was -9223372036854775808,
+    // which is already its own negation
+    if (right != NULL && right->type == EXPR_INT && right->integer == INT64_MIN) {
+        FREE(Expression, expr);
+        return right;
+    }
+    expr->prefix.right = (struct Expression*)right;
     return expr;
 }
 
@@ -324,7 +403,10 @@ static Expression* parse_infix_expression(Parser* parser, Expression* left) {
     next_token(parser);
     Expression* right_expr = parse_expression(parser, precedence);
     expr->infix.right = (struct Expression*)right_expr;
-    if (expr->infix.operator == PARSE_OP_DIVIDE && right_expr->integer == 0) {
+    // Only literals have a value to look at yet. A float literal is zero
+    // exactly when its bits are.
+    bool literal = right_expr != NULL && (right_expr->type == EXPR_INT || right_expr->type == EXPR_FLOAT);
+    if (expr->infix.operator == PARSE_OP_DIVIDE && literal && right_expr->integer == 0) {
         error(parser, "Divide by zero error!");
     }
     return expr;
@@ -336,29 +418,38 @@ static Expression* parse_boolean_expression(Parser* parser) {
     return expr;
 }
 
+// For parse functions giving up on an expression after an error
+static Expression* abandon_expression(Expression* expr) {
+    free_expression(expr);
+    return NULL;
+}
+
 static Expression* parse_grouped_expression(Parser* parser) {
     next_token(parser);
     Expression* expr = parse_expression(parser, LOWEST);
-    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) {
-        return NULL;
-    }
+    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) return abandon_expression(expr);
     return expr;
 }
 
+// Expects the current token to be the opening '{', and leaves the parser on the closing '}'
 static Statement* parse_block_statement(Parser* parser) {
-    u64 statement_count = 1;
-    Statement* block_stmt = ALLOCATE(Statement, statement_count);
+    Statement* block_stmt = ALLOCATE(Statement, 1);
+    if (block_stmt == NULL) {
+        ERROR("Out of memory when allocating block statement");
+        exit(EXIT_FAILURE);
+    }
+    block_stmt->type = STMT_BLOCK;
+    block_stmt->token = parser->current_token;
+    block_stmt->value = NULL;
+    block_stmt->block.statements = NULL;
+    block_stmt->block.statement_count = 0;
+    block_stmt->block.statement_capacity = 0;
     next_token(parser);
-    if (current_token_is(parser, TOKEN_LEFT_BRACE)) next_token(parser);
 
     while (!current_token_is(parser, TOKEN_RIGHT_BRACE) && !current_token_is(parser, TOKEN_EOF)) {
-        Statement* stmt = ALLOCATE(Statement, 1);
-        parse_statement(parser, stmt);
-        if (stmt != NULL) {
-            block_stmt = GROW_ARRAY(Statement, block_stmt, statement_count, statement_count + 1);
-            block_stmt[statement_count - 1] = *stmt;
-            statement_count++;
-        }
+        Statement stmt;
+        parse_statement(parser, &stmt);
+        add_block_statement(&block_stmt->block, &stmt);
         if (peek_token_is(parser, TOKEN_DOT)) next_token(parser);
         next_token(parser);
     }
@@ -367,20 +458,24 @@ static Statement* parse_block_statement(Parser* parser) {
 
 static Expression* parse_if_expression(Parser* parser) {
     Expression* expr = create_expression(EXPR_IF, parser->current_token);
+    expr->if_expr.condition = NULL;
+    expr->if_expr.consequence = NULL;
+    expr->if_expr.alternative = NULL;
 
-    if (!expect_peek(parser, TOKEN_LEFT_PAREN)) return NULL;
+    if (!expect_peek(parser, TOKEN_LEFT_PAREN)) return abandon_expression(expr);
 
     next_token(parser);
     expr->if_expr.condition = (struct Expression*)parse_expression(parser, LOWEST);
 
-    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) return NULL;
+    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) return abandon_expression(expr);
+    if (!expect_peek(parser, TOKEN_LEFT_BRACE)) return abandon_expression(expr);
 
     expr->if_expr.consequence = (struct Statement*)parse_block_statement(parser);
 
     if (peek_token_is(parser, TOKEN_ELSE)) {
         next_token(parser);
         if (!expect_peek(parser, TOKEN_LEFT_BRACE)) {
-            return NULL;
+            return abandon_expression(expr);
         }
         struct Statement* alt = (struct Statement*)parse_block_statement(parser);
         expr->if_expr.alternative = alt;
@@ -388,13 +483,48 @@ static Expression* parse_if_expression(Parser* parser) {
     return expr;
 }
 
+static void add_argument(Parser* parser, Expression* call, Expression* argument) {
+    if (call->call.argument_count == UINT8_MAX) {
+        error(parser, "Can't have more than 255 arguments.");
+        free_expression(argument);
+        return;
+    }
+    u64 count = call->call.argument_count;
+    call->call.arguments = GROW_ARRAY(struct Expression*, call->call.arguments, count, count + 1);
+    if (call->call.arguments == NULL) {
+        ERROR("Out of memory when allocating call arguments");
+        exit(EXIT_FAILURE);
+    }
+    call->call.arguments[count] = (struct Expression*)argument;
+    call->call.argument_count++;
+}
+
+// Expects the current token to be the opening '(' of the argument list
+static Expression* parse_call_expression(Parser* parser, Expression* callee) {
+    Expression* expr = create_expression(EXPR_CALL, parser->current_token);
+    expr->call.callee = (struct Expression*)callee;
+    expr->call.arguments = NULL;
+    expr->call.argument_count = 0;
+
+    if (peek_token_is(parser, TOKEN_RIGHT_PAREN)) {
+        next_token(parser);
+        return expr;
+    }
+    next_token(parser);
+    add_argument(parser, expr, parse_expression(parser, LOWEST));
+    while (peek_token_is(parser, TOKEN_COMMA)) {
+        next_token(parser);
+        next_token(parser);
+        add_argument(parser, expr, parse_expression(parser, LOWEST));
+    }
+    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) return abandon_expression(expr);
+    return expr;
+}
+
 static Expression* parse_identifier(Parser* parser) {
     Expression* expr = create_expression(EXPR_IDENT, parser->current_token);
     Identifier ident = {.token = expr->token};
-    if (!get_literal(&expr->token, ident.value, sizeof(ident.value))) {
-        ERROR("Unable to get ident value from string literal");
-        exit(EXIT_FAILURE);
-    }
+    read_literal(parser, &expr->token, ident.value, sizeof(ident.value));
     expr->ident = ident;
     return expr;
 }
@@ -419,6 +549,10 @@ static Expression* parse_expression(Parser* parser, Precedence precedence) {
             left = parse_number_expression(parser);
             break;
         }
+        case TOKEN_STRING: {
+            left = create_expression(EXPR_STRING, parser->current_token);
+            break;
+        }
         case TOKEN_MINUS:
         case TOKEN_BANG: {
             left = parse_prefix_expression(parser);
@@ -429,7 +563,7 @@ static Expression* parse_expression(Parser* parser, Precedence precedence) {
             break;
         }
         default: {
-            printf("CANT PARSE EXPR\n");
+            error(parser, "Expected an expression.");
             break;
         }
     }
@@ -445,12 +579,19 @@ static Expression* parse_expression(Parser* parser, Precedence precedence) {
             case TOKEN_BANG_EQUAL:
             case TOKEN_LESS:
             case TOKEN_LESS_EQUAL:
+            case TOKEN_AND:
+            case TOKEN_OR:
             case TOKEN_MINUS: {
                 next_token(parser);
                 left = parse_infix_expression(parser, left);
                 break;
             }
-            default: break;
+            case TOKEN_LEFT_PAREN: {
+                next_token(parser);
+                left = parse_call_expression(parser, left);
+                break;
+            }
+            default: return left;
         }
     }
     return left;
@@ -460,9 +601,6 @@ static void parse_expression_statement(Parser* parser, Statement* statement) {
     statement->type = STMT_EXPRESSION;
     statement->token = parser->current_token;
     statement->value = parse_expression(parser, LOWEST);
-    if (!peek_token_is(parser, TOKEN_DOT)) {
-        next_token(parser);
-    }
 }
 
 static void synchronize(Parser* parser) {
@@ -492,24 +630,160 @@ static void parse_print_statement(Parser* parser, Statement* statement) {
 }
 
 static void parse_assignment_statement(Parser* parser, Statement* statement) {
+    parse_binding(parser, statement, STMT_ASSIGN, TOKEN_EQUAL);
+
+    while (!current_token_is(parser, TOKEN_DOT) && !current_token_is(parser, TOKEN_EOF)) {
+        next_token(parser);
+    }
+}
+
+// Desugars 'name++' and 'name--' into 'name = name + 1' and 'name = name - 1'
+static void parse_increment_statement(Parser* parser, Statement* statement) {
     statement->type = STMT_ASSIGN;
     statement->token = parser->current_token;
+    Identifier ident = {.token = parser->current_token};
+    read_literal(parser, &statement->token, ident.value, sizeof(ident.value));
+    statement->name = ident;
+    next_token(parser);
+
+    Expression* target = create_expression(EXPR_IDENT, statement->token);
+    target->ident = ident;
+    Expression* one = create_expression(EXPR_INT, parser->current_token);
+    one->integer = 1;
+    Expression* value = create_expression(EXPR_INFIX, parser->current_token);
+    value->infix.left = (struct Expression*)target;
+    value->infix.right = (struct Expression*)one;
+    value->infix.operator = current_token_is(parser, TOKEN_INCREMENT) ? PARSE_OP_ADD : PARSE_OP_MINUS;
+    statement->value = value;
+}
+
+static Statement* create_statement(void) {
+    Statement* statement = ALLOCATE(Statement, 1);
+    if (statement == NULL) {
+        ERROR("Out of memory when allocating statements");
+        exit(EXIT_FAILURE);
+    }
+    return statement;
+}
+
+static void init_loop_statement(Parser* parser, Statement* statement, StatementType type) {
+    statement->type = type;
+    statement->token = parser->current_token;
+    statement->value = NULL;
+    statement->loop.initializer = NULL;
+    statement->loop.condition = NULL;
+    statement->loop.increment = NULL;
+    statement->loop.body = NULL;
+}
+
+static void parse_while_statement(Parser* parser, Statement* statement) {
+    init_loop_statement(parser, statement, STMT_WHILE);
+
+    if (!expect_peek(parser, TOKEN_LEFT_PAREN)) return;
+    next_token(parser);
+    statement->loop.condition = (struct Expression*)parse_expression(parser, LOWEST);
+    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) return;
+    if (!expect_peek(parser, TOKEN_LEFT_BRACE)) return;
+    statement->loop.body = parse_block_statement(parser);
+}
 
-    if (!expect_peek(parser, TOKEN_EQUAL)) {
+// for (i := 0; i < 10) |i++| { ... }
+// The initializer, condition and increment are all optional.
+static void parse_for_statement(Parser* parser, Statement* statement) {
+    init_loop_statement(parser, statement, STMT_FOR);
+
+    if (!expect_peek(parser, TOKEN_LEFT_PAREN)) return;
+    next_token(parser);
+    if (!current_token_is(parser, TOKEN_SEMICOLON)) {
+        Statement* initializer = create_statement();
+        parse_binding(parser, initializer, STMT_INSTANTIATE, TOKEN_ASSIGN);
+        statement->loop.initializer = initializer;
+        if (!expect_peek(parser, TOKEN_SEMICOLON)) return;
+    }
+    if (!peek_token_is(parser, TOKEN_RIGHT_PAREN)) {
+        next_token(parser);
+        statement->loop.condition = (struct Expression*)parse_expression(parser, LOWEST);
+    }
+    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) return;
+
+    if (peek_token_is(parser, TOKEN_PIPE)) {
+        next_token(parser);
+        if (!expect_peek(parser, TOKEN_IDENTIFIER)) return;
+        Statement* increment = create_statement();
+        if (peek_token_is(parser, TOKEN_INCREMENT) || peek_token_is(parser, TOKEN_DECREMENT)) {
+            parse_increment_statement(parser, increment);
+        } else {
+            parse_binding(parser, increment, STMT_ASSIGN, TOKEN_EQUAL);
+        }
+        statement->loop.increment = increment;
+        if (!expect_peek(parser, TOKEN_PIPE)) return;
+    }
+    if (!expect_peek(parser, TOKEN_LEFT_BRACE)) return;
+    statement->loop.body = parse_block_statement(parser);
+}
+
+static void add_parameter(Parser* parser, Statement* statement, Identifier* parameter, Identifier* type) {
+    if (statement->function.parameter_count == UINT8_MAX) {
+        error(parser, "Can't have more than 255 parameters.");
         return;
     }
-    Identifier ident = {.token = parser->current_token};
-    if (!get_literal(&statement->token, ident.value, sizeof(ident.value))) {
-        ERROR("Unable to get ident value from string literal");
+    u64 count = statement->function.parameter_count;
+    statement->function.parameters = GROW_ARRAY(Identifier, statement->function.parameters, count, count + 1);
+    statement->function.parameter_types = GROW_ARRAY(Identifier, statement->function.parameter_types, count, count + 1);
+    if (statement->function.parameters == NULL || statement->function.parameter_types == NULL) {
+        ERROR("Out of memory when allocating function parameters");
         exit(EXIT_FAILURE);
     }
-    statement->name = ident;
-    next_token(parser);
-    statement->value = parse_expression(parser, LOWEST);
+    statement->function.parameters[count] = *parameter;
+    statement->function.parameter_types[count] = *type;
+    statement->function.parameter_count++;
+}
+
+static void parse_type_name(Parser* parser, Identifier* type) {
+    type->token = parser->current_token;
+    read_literal(parser, &parser->current_token, type->value, sizeof(type->value));
+}
+
+static void parse_function_statement(Parser* parser, Statement* statement) {
+    statement->type = STMT_FUNCTION;
+    statement->token = parser->current_token;
+    statement->value = NULL;
+    statement->function.parameters = NULL;
+    statement->function.parameter_types = NULL;
+    statement->function.parameter_count = 0;
+    statement->function.return_type = (Identifier){.value = ""};
+    statement->function.body = NULL;
+
+    if (!expect_peek(parser, TOKEN_IDENTIFIER)) return;
+    Identifier name = {.token = parser->current_token};
+    read_literal(parser, &parser->current_token, name.value, sizeof(name.value));
+    statement->name = name;
+
+    if (!expect_peek(parser, TOKEN_LEFT_PAREN)) return;
+    while (!peek_token_is(parser, TOKEN_RIGHT_PAREN)) {
+        if (!expect_peek(parser, TOKEN_IDENTIFIER)) return;
+        Identifier parameter = {.token = parser->current_token};
+        read_literal(parser, &parser->current_token, parameter.value, sizeof(parameter.value));
+        // Types are kept for the native backends; the VM doesn't check them
+        Identifier type = {.value = ""};
+        if (peek_token_is(parser, TOKEN_COLON)) {
+            next_token(parser);
+            if (!expect_peek(parser, TOKEN_IDENTIFIER)) return;
+            parse_type_name(parser, &type);
+        }
+        add_parameter(parser, statement, &parameter, &type);
+        if (!peek_token_is(parser, TOKEN_COMMA)) break;
+        next_token(parser);
+    }
+    if (!expect_peek(parser, TOKEN_RIGHT_PAREN)) return;
 
-    while (!current_token_is(parser, TOKEN_DOT)) {
+    // Optional return type
+    if (peek_token_is(parser, TOKEN_IDENTIFIER) || peek_token_is(parser, TOKEN_VOID)) {
         next_token(parser);
+        parse_type_name(parser, &statement->function.return_type);
     }
+    if (!expect_peek(parser, TOKEN_LEFT_BRACE)) return;
+    statement->function.body = parse_block_statement(parser);
 }
 
 static void parse_statement(Parser* parser, Statement* stmt) {
@@ -519,9 +793,25 @@ static void parse_statement(Parser* parser, Statement* stmt) {
                 parse_instantiate_statement(parser, stmt);
             } else if (parser->peek_token.type == TOKEN_EQUAL) {
                 parse_assignment_statement(parser, stmt);
+            } else if (parser->peek_token.type == TOKEN_INCREMENT || parser->peek_token.type == TOKEN_DECREMENT) {
+                parse_increment_statement(parser, stmt);
+            } else {
+                parse_expression_statement(parser, stmt);
             }
             break;
         }
+        case TOKEN_FN: {
+            parse_function_statement(parser, stmt);
+            break;
+        }
+        case TOKEN_WHILE: {
+            parse_while_statement(parser, stmt);
+            break;
+        }
+        case TOKEN_FOR: {
+            parse_for_statement(parser, stmt);
+            break;
+        }
         case TOKEN_RETURN: {
             parse_return_statement(parser, stmt);
             break;
@@ -544,9 +834,7 @@ static Program* init_program() {
         ERROR("Out of memory, unable to parse program.");
         exit(EXIT_FAILURE);
     }
-    program->statement_count = 0;
-    program->statement_capacity = 1;
-    program->statements = ALLOCATE(Statement, 1);
+    init_statement_array(&program->statements);
     return program;
 }
 
@@ -555,11 +843,9 @@ Program* parse_program(Parser* parser) {
 
      while (parser->current_token.type != TOKEN_EOF) {
 
-         Statement* stmt = ALLOCATE(Statement, 1);
-         parse_statement(parser, stmt);
-         if (stmt != NULL) {
-            add_statement(program, stmt);
-         }
+         Statement stmt;
+         parse_statement(parser, &stmt);
+         write_statement_array(&program->statements, stmt);
 
          if (peek_token_is(parser, TOKEN_DOT)) next_token(parser);
 
@@ -2,6 +2,7 @@
 #define pepper_parser_h
 
 #include "lexer.h"
+#include "vector.h"
 
 typedef enum {
     LOWEST = 0,
@@ -25,6 +26,9 @@ typedef enum {
     EXPR_BOOL,
     EXPR_IF,
     EXPR_IDENT,
+    EXPR_CALL,
+    // The token still has its quotes
+    EXPR_STRING,
 } ExpressionType;
 
 typedef enum {
@@ -33,6 +37,10 @@ typedef enum {
     STMT_RETURN,
     STMT_EXPRESSION,
     STMT_PRINT,
+    STMT_BLOCK,
+    STMT_FUNCTION,
+    STMT_WHILE,
+    STMT_FOR,
 } StatementType;
 
 typedef enum {
@@ -46,9 +54,22 @@ typedef enum {
     PARSE_OP_LESS,
     PARSE_OP_EQUAL_LESS,
     PARSE_OP_NOT_EQUAL,
+    PARSE_OP_NOT,
+    PARSE_OP_AND,
+    PARSE_OP_OR,
     OP_UNKNOWN,
 } OperatorType;
 
+// Static types worked out by the checker for the native backends
+typedef enum {
+    TYPE_UNKNOWN = 0,
+    TYPE_NIL,
+    TYPE_INT,
+    TYPE_FLOAT,
+    TYPE_BOOL,
+    TYPE_FUNCTION,
+} StaticType;
+
 typedef struct {
     Lexer* lexer;
     Token current_token;
@@ -56,6 +77,12 @@ typedef struct {
     u64 current;
     bool has_error;
     bool panic_mode;
+    // Set when the number literal about to be parsed has a minus in front
+    bool negated_literal;
+    // Errors are printed here as they're found; NULL keeps the parser quiet
+    FILE* error_output;
+    // The first error, kept for embedders
+    char error[ERROR_MESSAGE_MAX];
 } Parser;
 
 struct Expression;
@@ -78,14 +105,51 @@ typedef struct {
     struct Statement* alternative;
 } IfExpression;
 
+typedef struct {
+    struct Expression* callee;
+    struct Expression** arguments;
+    u64 argument_count;
+} CallExpression;
+
 typedef struct {
     char value[MAX_TOKEN_LENGTH];
     Token token;
 } Identifier;
 
 typedef struct {
+    struct Statement* statements;
+    u64 statement_count;
+    u64 statement_capacity;
+} BlockStatement;
+
+typedef struct {
+    Identifier* parameters;
+    // Type annotations as written, parallel to parameters. An empty value
+    // means the annotation was left out.
+    Identifier* parameter_types;
+    u64 parameter_count;
+    Identifier return_type;
+    // Always a STMT_BLOCK
+    struct Statement* body;
+} FunctionStatement;
+
+// Shared by while and for loops; a while loop only has a condition and a body
+typedef struct {
+    struct Statement* initializer;
+    // NULL loops forever
+    struct Expression* condition;
+    struct Statement* increment;
+    // Always a STMT_BLOCK
+    struct Statement* body;
+} LoopStatement;
+
+typedef struct Expression {
     ExpressionType type;
     Token token;
+    // Set by the checker. For identifiers, variable is a local index, or
+    // -(global index + 1); for a function name it's the function index.
+    StaticType static_type;
+    i32 variable;
     union {
         i64 integer;
         f64 floating_point;
@@ -94,14 +158,22 @@ typedef struct {
         InfixExpression infix;
         PrefixExpression prefix;
         IfExpression if_expr;
+        CallExpression call;
     };
 } Expression;
 
-typedef struct {
+typedef struct Statement {
     StatementType type;
     Token token;
     Identifier name;
+    // The variable name resolves to, set by the checker like Expression.variable
+    i32 variable;
     Expression *value;
+    union {
+        BlockStatement block;
+        FunctionStatement function;
+        LoopStatement loop;
+    };
 } Statement;
 
 typedef struct {
@@ -122,10 +194,10 @@ typedef struct {
     Expression expression;
 } ExpressionStatement;
 
+DEFINE_VECTOR(StatementArray, statement_array, Statement, 0, MEMORY_AST)
+
 typedef struct {
-    Statement* statements;
-    u64 statement_count;
-    u64 statement_capacity;
+    StatementArray statements;
 } Program;
 
 Parser* init_parser(Lexer* lexer);
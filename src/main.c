@@ -1,92 +1,437 @@
+#define _DEFAULT_SOURCE 1
+#include <ctype.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "serve.h"
 #include "lexer.h"
 #include "parser.h"
 #include "bytecode_generator.h"
 #include "vm.h"
-
-static void repl() {
-    char line[1024];
-    for (;;) {
-        printf(">> ");
-        if (!fgets(line, sizeof(line), stdin)) {
-            printf("\n");
-            break;
-        }
-        Lexer* lexer = init_lexer(line);
-        tokenize(lexer);
-        Parser* parser = init_parser(lexer);
-        parse_program(parser);
-        de_init_lexer(lexer);
-    }
-}
+#include "jit.h"
+#include "baseline.h"
+#include "compiler.h"
+#include "files.h"
+#include "logger.h"
+#include "memory.h"
+#include "phases.h"
 
 static char* read_file(const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
+    const char* error;
+    char* source = read_source_file(path, &error);
+    if (source == NULL) {
+        fprintf(stderr, "%s \"%s\".\n", error, path);
         exit(74);
     }
+    return source;
+}
 
-    fseek(file, 0L, SEEK_END);
-    u64 file_size = (u64)ftell(file);
-    rewind(file);
-
-    char* buffer = (char*)malloc(file_size + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
-    }
-    u64 bytes_read = fread(buffer, sizeof(char), file_size, file);
-    if (bytes_read < file_size) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(74);
-    }
-    buffer[bytes_read] = '\0';
 
-    fclose(file);
-    return buffer;
+// Errors come back from the byte code generator and the VM rather than
+// ending the process, so the command line logs them, which exits
+static void exit_with_error(const char* message) {
+    ERROR("%s", message);
+    exit(EXIT_FAILURE);
 }
 
+// The bytes of code compiled for every function, the script's included
+static u64 code_size(const ByteCode* byte_code) {
+    u64 size = 0;
+    for (const Obj* object = byte_code->objects; object != NULL; object = object->next) {
+        if (object->type == OBJ_FUNCTION) size += ((const ObjFunction*)object)->chunk.code.count;
+    }
+    return size;
+}
 
-static void run_file(const char* path) {
+static void run_file(const char* path, bool gc_stats) {
+    // Counting what each phase got through costs time of its own, so it's
+    // only done when it's reported
+    bool timed = phases_enabled();
+    phases_start();
     // Read in the file
     char* source = read_file(path);
+    phases_end("read_file", timed ? strlen(source) : 0, "bytes");
     // Initialise the lexer
     Lexer* lexer = init_lexer(source);
     // Tokenise the source code
     tokenize(lexer);
+    memory_end_phase("lex");
+    phases_end("tokenize", lexer->tokens.count, "tokens");
     // Initialize the parser
     Parser* parser = init_parser(lexer);
     // Parse the program
     Program* program = parse_program(parser);
+    memory_end_phase("parse");
+    phases_end("parse_program", program->statements.count, "statements");
 
     if (parser->has_error || parser->panic_mode) {
         exit(EXIT_FAILURE);
     }
     // Interpret the program
     ByteCode* byte_code = generate_bytecode(program);
+    if (byte_code->has_error) exit_with_error(byte_code->error);
+    memory_end_phase("generate");
+    phases_end("generate_bytecode", timed ? code_size(byte_code) : 0, "code bytes");
+    // The byte code owns everything it needs, so the source, tokens and AST
+    // don't have to stay around while it runs
+    u64 tokens = lexer->tokens.count;
+    de_init_program(program);
+    de_init_parser(parser);
+    free(source);
+    phases_end("free_frontend", tokens, "tokens");
     // Initialize the VM
     VM* vm = init_vm(byte_code);
+    phases_end("init_vm", byte_code->global_count, "globals");
     // Run the bytecode on the vm
-    run(vm);
+    if (run(vm) != OK) exit_with_error(vm->error);
+    memory_end_phase("run");
+    phases_end("run", vm->heap.stats.objects_allocated, "objects");
+    if (gc_stats) print_gc_stats(&vm->heap, stderr);
 
-    de_init_program(program);
-    de_init_parser(parser);
-    free_byte_code(byte_code);
+    // The VM still points at the byte code
     free_vm(vm);
-    free(source);
+    free_byte_code(byte_code);
     // exit codes differ for each error
     //if (result == INTERPRET_COMPILE_ERROR) exit(65);
     //if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+typedef struct {
+    const ByteCode* byte_code;
+    u64 runs;
+} Worker;
+
+// Each worker has its own VM and resets it between runs
+static void* run_worker(void* argument) {
+    Worker* worker = (Worker*)argument;
+    VM* vm = init_vm(worker->byte_code);
+    for (u64 i = 0; i < worker->runs; i++) {
+        if (i > 0) reset_vm(vm);
+        if (run(vm) != OK) exit_with_error(vm->error);
+    }
+    free_vm(vm);
+    return NULL;
+}
+
+#define REPL_LINE_MAX 1024
+
+// Whether the input stops inside brackets or a string, in which case the
+// REPL reads more before running it
+static bool is_unfinished(const char* source) {
+    i64 depth = 0;
+    for (const char* c = source; *c != '\0'; c++) {
+        if (*c == '/' && c[1] == '/') {
+            while (*c != '\n' && *c != '\0') c++;
+            if (*c == '\0') break;
+        } else if (*c == '"') {
+            c = strchr(c + 1, '"');
+            if (c == NULL) return true;
+        } else if (*c == '{' || *c == '(') {
+            depth++;
+        } else if (*c == '}' || *c == ')') {
+            depth--;
+        }
+    }
+    return depth > 0;
+}
+
+// Whether the line is the command, give or take whitespace
+static bool is_command(const char* line, const char* command) {
+    while (isspace((unsigned char)*line)) line++;
+    u64 length = strlen(command);
+    if (strncmp(line, command, length) != 0) return false;
+    for (line += length; *line != '\0'; line++) {
+        if (!isspace((unsigned char)*line)) return false;
+    }
+    return true;
+}
+
+static bool is_blank(const char* source) {
+    while (isspace((unsigned char)*source)) source++;
+    return *source == '\0';
+}
+
+// Compiles and runs one input. Errors are reported without ending the
+// session, and the frontend's structures are freed as soon as the byte code
+// is generated, since it copies everything it keeps.
+static void run_input(VM* vm, ByteCode* byte_code, const char* source, bool show_time) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    f64 lexed = seconds_since(&start);
+    Parser* parser = init_parser(lexer);
+    Program* program = parse_program(parser);
+    // The parser has printed its errors already
+    bool parsed = !parser->has_error && !parser->panic_mode;
+    if (parsed) generate_increment(byte_code, program);
+    de_init_program(program);
+    de_init_parser(parser);
+    f64 compiled = seconds_since(&start);
+    if (!parsed) return;
+    if (byte_code->has_error) {
+        fprintf(stderr, "%s\n", byte_code->error);
+        return;
+    }
+    if (run_increment(vm) != OK) fprintf(stderr, "%s\n", vm->error);
+    f64 ran = seconds_since(&start);
+    if (show_time) {
+        printf("lex %.3fms, compile %.3fms, run %.3fms\n", lexed * 1e3, (compiled - lexed) * 1e3,
+               (ran - compiled) * 1e3);
+    }
+}
+
+// One VM runs the whole session, so globals and strings carry over from one
+// input to the next. Each input is compiled into a script of its own, so
+// it takes as long as it would at the start of the session. Input that
+// leaves a bracket open carries on over the following lines, and :time
+// switches timing each input on and off.
+static void repl() {
+    ByteCode* byte_code = init_increments();
+    VM* vm = init_vm(byte_code);
+    bool show_time = false;
+    char line[REPL_LINE_MAX];
+    char* source = NULL;
+    u64 length = 0;
+    u64 capacity = 0;
+    for (;;) {
+        fputs(length == 0 ? ">> " : ".. ", stdout);
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin)) {
+            printf("\n");
+            // Whatever's left over from input that didn't end in a newline
+            if (length > 0 && !is_blank(source)) run_input(vm, byte_code, source, show_time);
+            break;
+        }
+        if (length == 0 && is_command(line, ":time")) {
+            show_time = !show_time;
+            printf("Timing is %s.\n", show_time ? "on" : "off");
+            continue;
+        }
+        u64 line_length = strlen(line);
+        if (capacity < length + line_length + 1) {
+            capacity = (length + line_length + 1) * 2;
+            source = (char*)realloc(source, capacity);
+            if (source == NULL) exit_with_error("Not enough memory for the REPL's input.");
+        }
+        memcpy(source + length, line, line_length + 1);
+        length += line_length;
+        // A line longer than the buffer comes in pieces
+        if (line[line_length - 1] != '\n' || is_unfinished(source)) continue;
+        if (!is_blank(source)) run_input(vm, byte_code, source, show_time);
+        length = 0;
+    }
+    free(source);
+    // The VM still points at the byte code
+    free_vm(vm);
+    free_byte_code(byte_code);
+}
+
+// Compiles the file once and runs it the given number of times spread over
+// worker threads, which all share the byte code. Reports the throughput to
+// stderr.
+static void run_file_repeated(const char* path, u64 runs, u32 threads) {
+    char* source = read_file(path);
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    Parser* parser = init_parser(lexer);
+    Program* program = parse_program(parser);
+
+    if (parser->has_error || parser->panic_mode) {
+        exit(EXIT_FAILURE);
+    }
+    ByteCode* byte_code = generate_bytecode(program);
+    if (byte_code->has_error) exit_with_error(byte_code->error);
+    de_init_program(program);
+    de_init_parser(parser);
+    free(source);
+
+    pthread_t* handles = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    Worker* workers = (Worker*)malloc(sizeof(Worker) * threads);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (u32 i = 0; i < threads; i++) {
+        workers[i].byte_code = byte_code;
+        workers[i].runs = runs / threads + (i < runs % threads ? 1 : 0);
+        if (pthread_create(&handles[i], NULL, run_worker, &workers[i]) != 0) {
+            fprintf(stderr, "Could not start a worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (u32 i = 0; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    f64 elapsed = seconds_since(&start);
+    fprintf(stderr, "%lu runs on %u threads in %.3fs, %.1f runs/s\n", runs, threads, elapsed, (f64)runs / elapsed);
+
+    free(workers);
+    free(handles);
+    free_byte_code(byte_code);
+}
+
+static void build_file(const char* path, const char* output_path, CompileTarget target) {
+    char* source = read_file(path);
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    memory_end_phase("lex");
+    Parser* parser = init_parser(lexer);
+    Program* program = parse_program(parser);
+    memory_end_phase("parse");
+
+    if (parser->has_error || parser->panic_mode) {
+        exit(EXIT_FAILURE);
+    }
+    Compiler* compiler = init_compiler(output_path, target);
+    bool compiled = compile(compiler, program);
+    memory_end_phase("compile");
+
+    free_compiler(compiler);
+    de_init_program(program);
+    de_init_parser(parser);
+    free(source);
+    if (!compiled) exit(65);
+}
+
+// pepper build <path> [-o <output>] [--target asm|c] [--mem-stats]
+static void build(int argc, const char* argv[]) {
+    const char* path = NULL;
+    const char* output_path = "a.out";
+    CompileTarget target = TARGET_ASSEMBLY;
+    bool mem_stats = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--mem-stats") == 0) {
+            memory_set_tracking(true);
+            mem_stats = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc && strcmp(argv[i + 1], "asm") == 0) {
+            target = TARGET_ASSEMBLY;
+            i++;
+        } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc && strcmp(argv[i + 1], "c") == 0) {
+            target = TARGET_C;
+            i++;
+        } else if (path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "Usage: pepper build <path> [-o <output>] [--target asm|c] [--mem-stats]\n");
+        exit(64);
+    }
+    build_file(path, output_path, target);
+    if (mem_stats) print_memory_stats(stderr);
+}
+
 int main(int argc, const char* argv[]) {
-    if (argc == 1) {
+    if (!initialize_logging()) exit(64);
+    if (argc > 1 && strcmp(argv[1], "build") == 0) {
+        build(argc, argv);
+        return 0;
+    }
+    const char* path = NULL;
+    long runs = 0;
+    // One for --runs and a thread a core for --batch, unless given
+    long threads = 0;
+    const char* batch_path = NULL;
+    const char* serve_path = NULL;
+    const char* connect_path = NULL;
+    // Marker threads, for --gc-threads
+    long gc_threads = 0;
+    bool gc_stats = false;
+    bool mem_stats = false;
+    // Whether the phase times are printed as JSON rather than a table
+    bool phases_json = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-jit") == 0) {
+            jit_set_enabled(false);
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            baseline_set_enabled(true);
+        } else if (strcmp(argv[i], "--gc-stress") == 0) {
+            gc_set_stress(true);
+        } else if (strcmp(argv[i], "--gc-threads") == 0 && i + 1 < argc &&
+                   (gc_threads = strtol(argv[i + 1], NULL, 10)) > 0 && gc_threads <= GC_MAX_MARKER_THREADS) {
+            gc_set_marker_threads((u32)gc_threads);
+            i++;
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gc_stats = true;
+        } else if (strcmp(argv[i], "--mem-stats") == 0) {
+            memory_set_tracking(true);
+            mem_stats = true;
+        } else if (strcmp(argv[i], "--time-phases") == 0) {
+            phases_set_enabled(true);
+        } else if (strcmp(argv[i], "--time-phases-json") == 0) {
+            phases_set_enabled(true);
+            phases_json = true;
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc && parse_log_level(argv[i + 1], &log_level)) {
+            i++;
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc && (runs = strtol(argv[i + 1], NULL, 10)) > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc &&
+                   (threads = strtol(argv[i + 1], NULL, 10)) > 0 && threads <= 1024) {
+            i++;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_path = argv[++i];
+        } else if (path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: pepper [--no-jit] [--baseline] [--gc-stress] [--gc-threads <n>] [--gc-stats] [--mem-stats] [--time-phases | --time-phases-json] [--log-level <level>] [--runs <n> [--threads <n>]] [path]\n"
+                            "       pepper [options] --batch <directory|list|-> [--threads <n>]\n"
+                            "       pepper [options] --serve <socket>\n"
+                            "       pepper --connect <socket> <path>\n"
+                            "       pepper build <path> [-o <output>] [--target asm|c] [--mem-stats]\n");
+            exit(64);
+        }
+    }
+    if (phases_enabled() && (path == NULL || runs > 0 || batch_path != NULL || serve_path != NULL ||
+                             connect_path != NULL)) {
+        fprintf(stderr, "--time-phases needs the path of a script, without --runs, --batch, --serve or --connect.\n");
+        exit(64);
+    }
+    if (serve_path != NULL) {
+        serve(serve_path);
+        return 0;
+    }
+    if (connect_path != NULL) {
+        if (path == NULL) {
+            fprintf(stderr, "--connect needs the path of a script.\n");
+            exit(64);
+        }
+        return run_on_server(connect_path, path);
+    }
+    if (batch_path != NULL) {
+        if (path != NULL || runs > 0) {
+            fprintf(stderr, "--batch can't be given with a path or --runs.\n");
+            exit(64);
+        }
+        if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1) threads = 1;
+        u64 failed = run_batch(batch_path, (u32)threads);
+        if (mem_stats) print_memory_stats(stderr);
+        return failed > 0 ? EXIT_FAILURE : 0;
+    }
+    if (path == NULL) {
         repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
+    } else if (runs > 0) {
+        run_file_repeated(path, (u64)runs, threads > 0 ? (u32)threads : 1);
     } else {
-        fprintf(stderr, "Usage: pepper [path]\n");
-        exit(64);
+        run_file(path, gc_stats);
+        if (phases_json) {
+            print_phases_json(stderr, path);
+        } else {
+            print_phases(stderr);
+        }
     }
+    // After everything's freed, so anything still live was leaked
+    if (mem_stats) print_memory_stats(stderr);
     return 0;
 }
@@ -0,0 +1,216 @@
+#define _DEFAULT_SOURCE 1
+#define MEMORY_TAG MEMORY_VM
+#include <pthread.h>
+#include <string.h>
+
+#include "pepper.h"
+#include "lexer.h"
+#include "parser.h"
+#include "bytecode_generator.h"
+#include "vm.h"
+#include "vm_ops.h"
+#include "memory.h"
+
+// The public handles are the internal structures under another name
+#define AS_BYTE_CODE(script) ((const ByteCode*)(script))
+#define AS_VM(vm) ((VM*)(vm))
+
+static PepperReallocate host_reallocate = NULL;
+
+static void* forward_reallocate(void* pointer, u64 old_size, u64 new_size, void* user_data) {
+    return host_reallocate(pointer, (size_t)old_size, (size_t)new_size, user_data);
+}
+
+void pepper_set_allocator(PepperReallocate reallocate, void* user_data) {
+    host_reallocate = reallocate;
+    set_reallocator(reallocate != NULL ? forward_reallocate : NULL, user_data);
+}
+
+void pepper_track_memory(bool enabled) {
+    memory_set_tracking(enabled);
+}
+
+size_t pepper_memory_usage(PepperMemoryUsage* usage, size_t capacity) {
+    for (u32 i = 0; i < MEMORY_TAG_COUNT && i < capacity; i++) {
+        MemoryStats stats;
+        get_memory_stats((MemoryTag)i, &stats);
+        usage[i].subsystem = memory_tag_name((MemoryTag)i);
+        usage[i].live_bytes = stats.live_bytes;
+        usage[i].peak_bytes = stats.peak_bytes;
+        usage[i].allocations = stats.allocations;
+        usage[i].frees = stats.frees;
+    }
+    return MEMORY_TAG_COUNT;
+}
+
+static void copy_error(char* error, size_t error_size, const char* message) {
+    if (error != NULL && error_size > 0) snprintf(error, error_size, "%s", message);
+}
+
+PepperStatus pepper_compile(const char* source, PepperScript** script, char* error, size_t error_size) {
+    *script = NULL;
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    Parser* parser = init_parser(lexer);
+    parser->error_output = NULL;
+    Program* program = parse_program(parser);
+
+    PepperStatus status = PEPPER_OK;
+    if (parser->has_error) {
+        copy_error(error, error_size, parser->error);
+        status = PEPPER_COMPILE_ERROR;
+    } else {
+        ByteCode* byte_code = generate_bytecode(program);
+        if (byte_code->has_error) {
+            copy_error(error, error_size, byte_code->error);
+            free_byte_code(byte_code);
+            status = PEPPER_COMPILE_ERROR;
+        } else {
+            *script = (PepperScript*)byte_code;
+        }
+    }
+    de_init_program(program);
+    de_init_parser(parser);
+    return status;
+}
+
+void pepper_free_script(PepperScript* script) {
+    free_byte_code((ByteCode*)script);
+}
+
+PepperVM* pepper_instantiate(const PepperScript* script) {
+    return (PepperVM*)init_vm(AS_BYTE_CODE(script));
+}
+
+void pepper_free_vm(PepperVM* vm) {
+    free_vm(AS_VM(vm));
+}
+
+PepperStatus pepper_run(PepperVM* vm) {
+    if (AS_VM(vm)->frame_count == 0) {
+        runtime_error(AS_VM(vm), "The script has already run.");
+        return PEPPER_RUNTIME_ERROR;
+    }
+    if (run(AS_VM(vm)) != OK) return PEPPER_RUNTIME_ERROR;
+    // The script's own return value
+    pop(AS_VM(vm));
+    return PEPPER_OK;
+}
+
+static Value to_value(const PepperValue* value) {
+    switch (value->type) {
+        case PEPPER_BOOL: return BOOL_VAL(value->as.boolean);
+        case PEPPER_INT: return INT_VAL(value->as.integer);
+        case PEPPER_FLOAT: return FLOATING_VAL(value->as.floating);
+        default: return NIL_VAL;
+    }
+}
+
+static PepperValue from_value(Value value) {
+    PepperValue result = {.type = PEPPER_OTHER, .as.integer = 0};
+    switch (value.type) {
+        case VAL_NIL: result.type = PEPPER_NIL; break;
+        case VAL_BOOL: result.type = PEPPER_BOOL; result.as.boolean = AS_BOOL(value); break;
+        case VAL_INT: result.type = PEPPER_INT; result.as.integer = AS_INT(value); break;
+        case VAL_FLOATING: result.type = PEPPER_FLOAT; result.as.floating = AS_FLOATING(value); break;
+        default: break;
+    }
+    return result;
+}
+
+static bool find_global(VM* vm, const char* name, Value* value) {
+    const ByteCode* byte_code = vm->byte_code;
+    for (u32 i = 0; i < byte_code->global_count; i++) {
+        if (strcmp(byte_code->global_names[i], name) == 0) {
+            if (!vm->defined_globals[i]) return false;
+            *value = vm->globals[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+PepperStatus pepper_call(PepperVM* vm, const char* function, const PepperValue* arguments, uint8_t argument_count,
+                         PepperValue* result) {
+    // Only a finished script has its functions defined, so this also keeps
+    // the call from running on top of the script's own frames
+    Value callee;
+    if (!find_global(AS_VM(vm), function, &callee) || AS_VM(vm)->frame_count != 0) {
+        runtime_error(AS_VM(vm), "Undefined function '%s'.", function);
+        return PEPPER_RUNTIME_ERROR;
+    }
+    Value values[UINT8_MAX];
+    for (u32 i = 0; i < argument_count; i++) {
+        values[i] = to_value(&arguments[i]);
+    }
+    Value returned;
+    if (call_function(AS_VM(vm), callee, values, argument_count, &returned) != OK) return PEPPER_RUNTIME_ERROR;
+    if (result != NULL) *result = from_value(returned);
+    return PEPPER_OK;
+}
+
+void pepper_reset(PepperVM* vm) {
+    reset_vm(AS_VM(vm));
+}
+
+const char* pepper_error(const PepperVM* vm) {
+    return ((const VM*)vm)->error;
+}
+
+struct PepperPool {
+    const ByteCode* byte_code;
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    // A stack of the VMs nobody holds
+    VM** idle;
+    u32 idle_count;
+    u32 created;
+    u32 size;
+};
+
+PepperPool* pepper_create_pool(const PepperScript* script, uint32_t size) {
+    PepperPool* pool = ALLOCATE(PepperPool, 1);
+    pool->byte_code = AS_BYTE_CODE(script);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->released, NULL);
+    pool->idle = ALLOCATE(VM*, size);
+    pool->idle_count = 0;
+    pool->created = 0;
+    pool->size = size;
+    return pool;
+}
+
+void pepper_free_pool(PepperPool* pool) {
+    for (u32 i = 0; i < pool->idle_count; i++) {
+        free_vm(pool->idle[i]);
+    }
+    FREE_ARRAY(VM*, pool->idle, pool->size);
+    pthread_cond_destroy(&pool->released);
+    pthread_mutex_destroy(&pool->lock);
+    FREE(PepperPool, pool);
+}
+
+PepperVM* pepper_acquire(PepperPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->idle_count == 0 && pool->created == pool->size) {
+        pthread_cond_wait(&pool->released, &pool->lock);
+    }
+    if (pool->idle_count > 0) {
+        VM* vm = pool->idle[--pool->idle_count];
+        pthread_mutex_unlock(&pool->lock);
+        return (PepperVM*)vm;
+    }
+    // Creating a VM takes a while, so it's done outside the lock
+    pool->created++;
+    pthread_mutex_unlock(&pool->lock);
+    return (PepperVM*)init_vm(pool->byte_code);
+}
+
+void pepper_release(PepperPool* pool, PepperVM* vm) {
+    // Reset by the thread giving it back, so acquiring stays cheap
+    reset_vm(AS_VM(vm));
+    pthread_mutex_lock(&pool->lock);
+    pool->idle[pool->idle_count++] = AS_VM(vm);
+    pthread_cond_signal(&pool->released);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,101 @@
+#ifndef pepper_h
+#define pepper_h
+
+// The embedding API. Compile a script once, then run it on as many VMs as
+// needed. Nothing here exits the process or prints an error; every failure
+// comes back as a PepperStatus with a message to go with it.
+//
+// Only standard types appear here, so hosts don't pick up Pepper's own
+// headers by including this one.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    PEPPER_OK,
+    PEPPER_COMPILE_ERROR,
+    PEPPER_RUNTIME_ERROR,
+} PepperStatus;
+
+typedef enum {
+    PEPPER_NIL,
+    PEPPER_BOOL,
+    PEPPER_INT,
+    PEPPER_FLOAT,
+    // Functions, which the host can only call by name, and strings. Passed
+    // back in, it arrives as nil.
+    PEPPER_OTHER,
+} PepperType;
+
+typedef struct {
+    PepperType type;
+    union {
+        bool boolean;
+        int64_t integer;
+        double floating;
+    } as;
+} PepperValue;
+
+// Compiled byte code. Never changes once compiled, so any number of VMs on
+// any number of threads can share one.
+typedef struct PepperScript PepperScript;
+// Runs one script on one thread at a time, with its own stack and globals
+typedef struct PepperVM PepperVM;
+// A fixed number of VMs for one script, handed out to threads as they ask
+typedef struct PepperPool PepperPool;
+
+// Every allocation Pepper makes goes through this once it's installed. A
+// new_size of 0 is a free. old_size is always accurate, so arenas and
+// accounting allocators don't need a header. Install it before compiling
+// anything and leave it in place until everything is freed.
+typedef void* (*PepperReallocate)(void* pointer, size_t old_size, size_t new_size, void* user_data);
+void pepper_set_allocator(PepperReallocate reallocate, void* user_data);
+
+// What Pepper has allocated for one part of itself (the lexer, the AST, byte
+// code, constants, VMs, their heaps and globals, the JIT) since counting
+// started
+typedef struct {
+    const char* subsystem;
+    int64_t live_bytes;
+    int64_t peak_bytes;
+    uint64_t allocations;
+    uint64_t frees;
+} PepperMemoryUsage;
+
+// Counts allocations by subsystem. Switch it on before compiling anything.
+void pepper_track_memory(bool enabled);
+// Fills in usage for up to capacity subsystems and returns how many there are
+size_t pepper_memory_usage(PepperMemoryUsage* usage, size_t capacity);
+
+// On success *script is set. On failure it's NULL and the first error is
+// copied into error, which may be NULL.
+PepperStatus pepper_compile(const char* source, PepperScript** script, char* error, size_t error_size);
+// Every VM made from the script has to be freed first
+void pepper_free_script(PepperScript* script);
+
+// The VM is ready to run the script's top level code
+PepperVM* pepper_instantiate(const PepperScript* script);
+void pepper_free_vm(PepperVM* vm);
+// Runs the top level code, defining the script's globals. On a runtime error
+// the globals defined so far stay defined.
+PepperStatus pepper_run(PepperVM* vm);
+// Calls a global function once pepper_run has defined it. result may be NULL.
+PepperStatus pepper_call(PepperVM* vm, const char* function, const PepperValue* arguments, uint8_t argument_count,
+                         PepperValue* result);
+// Readies the VM to run the script again from the start, with every global
+// undefined, keeping its stack, globals and any compiled code
+void pepper_reset(PepperVM* vm);
+// The message for the last runtime error
+const char* pepper_error(const PepperVM* vm);
+
+// VMs are created as they're first needed, up to size of them
+PepperPool* pepper_create_pool(const PepperScript* script, uint32_t size);
+// Every VM has to be released first
+void pepper_free_pool(PepperPool* pool);
+// Blocks until a VM is free. It comes back ready to run, as from
+// pepper_instantiate, whatever the last thread did with it.
+PepperVM* pepper_acquire(PepperPool* pool);
+void pepper_release(PepperPool* pool, PepperVM* vm);
+
+#endif
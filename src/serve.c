@@ -0,0 +1,412 @@
+#define _DEFAULT_SOURCE 1
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "serve.h"
+#include "lexer.h"
+#include "parser.h"
+#include "bytecode_generator.h"
+#include "vm.h"
+#include "output.h"
+#include "files.h"
+#include "memory.h"
+#include "vector.h"
+
+#define SERVE_BACKLOG 64
+// Finished VMs kept for later requests. More than this are freed.
+#define SERVE_IDLE_VMS_MAX 8
+
+// A script's byte code, shared by every run of it
+typedef struct {
+    char* path;
+    struct timespec modified;
+    off_t size;
+    ByteCode* byte_code;
+    // Requests running it and idle VMs last loaded with it. Once the file
+    // has changed it's stale, and it's freed when the last of them is done.
+    u32 users;
+    bool stale;
+} Compiled;
+
+// A VM waiting for a request, with what it last ran
+typedef struct {
+    VM* vm;
+    Compiled* compiled;
+} IdleVM;
+
+DEFINE_VECTOR(CompiledArray, compiled_array, Compiled*, 0, MEMORY_OTHER)
+DEFINE_VECTOR(IdleVMArray, idle_vm_array, IdleVM, 0, MEMORY_OTHER)
+
+// Guards everything below
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static CompiledArray cache;
+static IdleVMArray idle_vms;
+
+static bool write_all(int fd, const void* data, u64 length) {
+    const char* chars = (const char*)data;
+    while (length > 0) {
+        ssize_t written = write(fd, chars, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        chars += written;
+        length -= (u64)written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* data, u64 length) {
+    char* chars = (char*)data;
+    while (length > 0) {
+        ssize_t received = read(fd, chars, length);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        chars += received;
+        length -= (u64)received;
+    }
+    return true;
+}
+
+static bool socket_address(const char* socket_path, struct sockaddr_un* address) {
+    if (strlen(socket_path) >= sizeof(address->sun_path)) return false;
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+// A connected socket, or -1
+static int connect_to(const char* socket_path) {
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void free_compiled(Compiled* compiled) {
+    free_byte_code(compiled->byte_code);
+    FREE_ARRAY(char, compiled->path, strlen(compiled->path) + 1);
+    FREE(Compiled, compiled);
+}
+
+// Holding the lock
+static void release_compiled(Compiled* compiled) {
+    compiled->users--;
+    if (compiled->stale && compiled->users == 0) free_compiled(compiled);
+}
+
+static bool is_current(Compiled* compiled, struct stat* info) {
+    return compiled->modified.tv_sec == info->st_mtim.tv_sec &&
+           compiled->modified.tv_nsec == info->st_mtim.tv_nsec && compiled->size == info->st_size;
+}
+
+// Holding the lock. Finds the path's byte code if it's still current, and
+// drops it from the cache if it isn't.
+static Compiled* find_compiled(const char* path, struct stat* info) {
+    for (u64 i = 0; i < cache.count; i++) {
+        Compiled* compiled = cache.items[i];
+        if (strcmp(compiled->path, path) != 0) continue;
+        if (is_current(compiled, info)) return compiled;
+        compiled->stale = true;
+        cache.items[i] = cache.items[--cache.count];
+        if (compiled->users == 0) free_compiled(compiled);
+        return NULL;
+    }
+    return NULL;
+}
+
+// Errors go to errors, as they would running the file directly
+static ByteCode* compile_file(const char* path, FILE* errors, i32* status) {
+    const char* error;
+    char* source = read_source_file(path, &error);
+    if (source == NULL) {
+        fprintf(errors, "%s \"%s\".\n", error, path);
+        *status = 74;
+        return NULL;
+    }
+    Lexer* lexer = init_lexer(source);
+    tokenize(lexer);
+    Parser* parser = init_parser(lexer);
+    parser->error_output = errors;
+    Program* program = parse_program(parser);
+    ByteCode* byte_code = NULL;
+    if (!parser->has_error && !parser->panic_mode) {
+        byte_code = generate_bytecode(program);
+        if (byte_code->has_error) {
+            fprintf(errors, "[ERROR]: %s\n", byte_code->error);
+            free_byte_code(byte_code);
+            byte_code = NULL;
+        }
+    }
+    de_init_program(program);
+    de_init_parser(parser);
+    free(source);
+    if (byte_code == NULL) *status = EXIT_FAILURE;
+    return byte_code;
+}
+
+// The path's byte code, compiled if there's none current, with a user
+// added for the caller. Compiling happens without the lock, so a slow
+// compile doesn't hold up requests for other scripts.
+static Compiled* acquire_compiled(const char* path, FILE* errors, i32* status) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        fprintf(errors, "Could not open file \"%s\".\n", path);
+        *status = 74;
+        return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    Compiled* compiled = find_compiled(path, &info);
+    if (compiled != NULL) compiled->users++;
+    pthread_mutex_unlock(&lock);
+    if (compiled != NULL) return compiled;
+
+    ByteCode* byte_code = compile_file(path, errors, status);
+    if (byte_code == NULL) return NULL;
+    pthread_mutex_lock(&lock);
+    // Another request may have compiled it in the meantime
+    compiled = find_compiled(path, &info);
+    if (compiled == NULL) {
+        compiled = ALLOCATE(Compiled, 1);
+        u64 length = strlen(path);
+        compiled->path = ALLOCATE(char, length + 1);
+        memcpy(compiled->path, path, length + 1);
+        compiled->modified = info.st_mtim;
+        compiled->size = info.st_size;
+        compiled->byte_code = byte_code;
+        compiled->users = 0;
+        compiled->stale = false;
+        write_compiled_array(&cache, compiled);
+        byte_code = NULL;
+    }
+    compiled->users++;
+    pthread_mutex_unlock(&lock);
+    if (byte_code != NULL) free_byte_code(byte_code);
+    return compiled;
+}
+
+// An idle VM ready to run the script from the start, preferring one that
+// last ran it, or a new one
+static VM* take_vm(Compiled* compiled) {
+    pthread_mutex_lock(&lock);
+    if (idle_vms.count == 0) {
+        pthread_mutex_unlock(&lock);
+        return init_vm(compiled->byte_code);
+    }
+    u64 chosen = idle_vms.count - 1;
+    for (u64 i = 0; i < idle_vms.count; i++) {
+        if (idle_vms.items[i].compiled == compiled) chosen = i;
+    }
+    IdleVM idle = idle_vms.items[chosen];
+    idle_vms.items[chosen] = idle_vms.items[--idle_vms.count];
+    pthread_mutex_unlock(&lock);
+
+    if (idle.compiled == compiled) {
+        reset_vm(idle.vm);
+    } else {
+        load_vm(idle.vm, compiled->byte_code);
+    }
+    // The idle VM's hold on what it last ran, which the caller has one of
+    // already if it's the same
+    pthread_mutex_lock(&lock);
+    release_compiled(idle.compiled);
+    pthread_mutex_unlock(&lock);
+    return idle.vm;
+}
+
+// The VM keeps the caller's hold on the byte code while it's idle
+static void give_back_vm(VM* vm, Compiled* compiled) {
+    pthread_mutex_lock(&lock);
+    if (idle_vms.count < SERVE_IDLE_VMS_MAX) {
+        write_idle_vm_array(&idle_vms, (IdleVM){vm, compiled});
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    pthread_mutex_unlock(&lock);
+    free_vm(vm);
+    pthread_mutex_lock(&lock);
+    release_compiled(compiled);
+    pthread_mutex_unlock(&lock);
+}
+
+static i32 run_request(const char* path, int out, FILE* errors) {
+    i32 status = 0;
+    Compiled* compiled = acquire_compiled(path, errors, &status);
+    if (compiled == NULL) return status;
+    VM* vm = take_vm(compiled);
+    // run flushes before it returns, so nothing's written to the client's
+    // output once it's been answered
+    redirect_output(&vm->output, out);
+    if (run(vm) != OK) {
+        fprintf(errors, "[ERROR]: %s\n", vm->error);
+        status = EXIT_FAILURE;
+    }
+    give_back_vm(vm, compiled);
+    return status;
+}
+
+// A request is the path's length as a u32 and then the path, with the
+// client's standard output and standard error attached
+// Closes every descriptor the message carried, for a request that's refused
+// before they're handed over
+static void close_received_fds(struct msghdr* message) {
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(message); header != NULL; header = CMSG_NXTHDR(message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+        u64 count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (u64 i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            close(fd);
+        }
+    }
+}
+
+// Once it has the descriptors, they're the caller's to close whatever
+// happens
+static bool receive_request(int client, char* path, int* fds) {
+    u32 length;
+    struct iovec part = {&length, sizeof(length)};
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received = recvmsg(client, &message, MSG_WAITALL);
+    if (received < 0) return false;
+    // Anything but the length and exactly one pair of descriptors is refused,
+    // closing whatever descriptors did arrive
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (received != (ssize_t)sizeof(length) || (message.msg_flags & MSG_CTRUNC) != 0 || header == NULL ||
+        header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(sizeof(int) * 2) || CMSG_NXTHDR(&message, header) != NULL) {
+        close_received_fds(&message);
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(header), sizeof(int) * 2);
+    if (length == 0 || length >= PATH_MAX) return false;
+    if (!read_all(client, path, length)) return false;
+    path[length] = '\0';
+    return true;
+}
+
+static void* serve_client(void* argument) {
+    int client = (int)(intptr_t)argument;
+    char path[PATH_MAX];
+    int fds[2] = {-1, -1};
+    i32 status = SERVE_STATUS_BAD_REQUEST;
+    if (receive_request(client, path, fds)) {
+        FILE* errors = fdopen(fds[1], "w");
+        if (errors != NULL) {
+            status = run_request(path, fds[0], errors);
+            fclose(errors);
+            fds[1] = -1;
+        }
+    }
+    write_all(client, &status, sizeof(status));
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    close(client);
+    return NULL;
+}
+
+void serve(const char* socket_path) {
+    // A client going away mustn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    init_compiled_array(&cache);
+    init_idle_vm_array(&idle_vms);
+
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) {
+        fprintf(stderr, "The socket path \"%s\" is too long.\n", socket_path);
+        exit(64);
+    }
+    // A socket left behind by a server that's gone is replaced, but not
+    // one that's still being served
+    int existing = connect_to(socket_path);
+    if (existing >= 0) {
+        close(existing);
+        fprintf(stderr, "A server is already listening on \"%s\".\n", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    unlink(socket_path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, SERVE_BACKLOG) != 0) {
+        fprintf(stderr, "Could not listen on \"%s\": %s.\n", socket_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Each request gets a thread, so a long running script doesn't hold up
+    // the rest
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) continue;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_client, (void*)(intptr_t)client) != 0) {
+            close(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+int run_on_server(const char* socket_path, const char* path) {
+    // The server has its own working directory
+    char absolute[PATH_MAX];
+    if (realpath(path, absolute) == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return 74;
+    }
+    int server = connect_to(socket_path);
+    if (server < 0) {
+        fprintf(stderr, "Could not connect to a server on \"%s\".\n", socket_path);
+        return SERVE_STATUS_UNAVAILABLE;
+    }
+
+    u32 length = (u32)strlen(absolute);
+    struct iovec parts[2] = {{&length, sizeof(length)}, {absolute, length}};
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    // Small enough that it's sent whole
+    if (sendmsg(server, &message, 0) != (ssize_t)(sizeof(length) + length)) {
+        fprintf(stderr, "Could not send the request to the server.\n");
+        close(server);
+        return SERVE_STATUS_UNAVAILABLE;
+    }
+
+    i32 status;
+    bool answered = read_all(server, &status, sizeof(status));
+    close(server);
+    if (!answered) {
+        fprintf(stderr, "The server went away before the script finished.\n");
+        return SERVE_STATUS_UNAVAILABLE;
+    }
+    return status;
+}
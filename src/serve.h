@@ -0,0 +1,27 @@
+#ifndef pepper_serve_h
+#define pepper_serve_h
+
+#include "common.h"
+
+// A daemon that runs scripts for clients on the same machine, so they don't
+// pay for starting a process and compiling every time. It listens on a
+// Unix domain socket and keeps the byte code it compiles, keyed by path,
+// until the file's modification time or size changes. VMs are kept between
+// runs as well, and one that last ran the same script is reused as it is,
+// with whatever its tiers compiled.
+//
+// A client sends the absolute path of the script, with its standard output
+// and standard error attached as file descriptors, so the script prints
+// straight to them. The server answers with the exit status the script
+// would have had if it had been run directly.
+
+// Exit statuses of their own, for the client
+#define SERVE_STATUS_UNAVAILABLE 69
+#define SERVE_STATUS_BAD_REQUEST 76
+
+// Serves until the process is killed
+void serve(const char* socket_path);
+// Runs the script on the server and returns its exit status
+int run_on_server(const char* socket_path, const char* path);
+
+#endif
@@ -1,10 +1,11 @@
 #include "hashtable.h"
+#include "memory.h"
 #include <stdio.h>
 #include <stdlib.h>
 
 HashTable *hash_table_init(void)
 {
-    HashTable *p_dic = malloc(sizeof(HashTable));
+    HashTable *p_dic = ALLOCATE(HashTable, 1);
     if (p_dic)
     {
         p_dic->number_of_elements = 0;
@@ -100,5 +101,5 @@ void *hash_table_get_index(HashTable *dict, int index)
 }
 
 void hash_table_destroy(HashTable *dict) { 
-    free(dict); 
+    FREE(HashTable, dict);
 }
@@ -0,0 +1,86 @@
+#ifndef pepper_vector_h
+#define pepper_vector_h
+
+#include <string.h>
+
+#include "common.h"
+#include "logger.h"
+#include "memory.h"
+
+// DEFINE_VECTOR(Name, name, type, inline_capacity, tag) defines Name, a
+// growable array of type with the elements stored in place, and these
+// functions for it:
+//
+//   init_name(Name*)              empty, with room for inline_capacity
+//   write_name(Name*, type)       appends, growing geometrically
+//   reserve_name(Name*, u64)      makes room for at least that many
+//   shrink_name(Name*)            gives back whatever isn't in use
+//   free_name(Name*)              frees it and leaves it empty
+//
+// The first inline_capacity elements are kept in the struct itself, so
+// short arrays never allocate. items then points into the struct, so a
+// vector mustn't be copied or moved once it's initialized. Everything it
+// allocates is accounted to tag. Running out of memory is fatal, as it is
+// everywhere else.
+#define DEFINE_VECTOR(Name, name, type, inline_capacity, tag) \
+    typedef struct { \
+        u64 count; \
+        u64 capacity; \
+        type* items; \
+        type inline_items[(inline_capacity) > 0 ? (inline_capacity) : 1]; \
+    } Name; \
+    \
+    static inline void init_##name(Name* vector) { \
+        vector->count = 0; \
+        vector->capacity = (inline_capacity); \
+        vector->items = vector->inline_items; \
+    } \
+    \
+    static inline void reserve_##name(Name* vector, u64 capacity) { \
+        if (capacity <= vector->capacity) return; \
+        u64 new_capacity = GROW_CAPACITY(vector->capacity); \
+        if (new_capacity < capacity) new_capacity = capacity; \
+        type* items; \
+        if (vector->items == vector->inline_items) { \
+            items = (type*)reallocate(NULL, 0, sizeof(type) * new_capacity, tag); \
+            if (items != NULL) memcpy(items, vector->inline_items, sizeof(type) * vector->count); \
+        } else { \
+            items = (type*)reallocate(vector->items, sizeof(type) * vector->capacity, \
+                                      sizeof(type) * new_capacity, tag); \
+        } \
+        if (items == NULL) ERROR("Failed to allocate memory for " #Name "."); \
+        vector->items = items; \
+        vector->capacity = new_capacity; \
+    } \
+    \
+    static inline void write_##name(Name* vector, type value) { \
+        u64 count = vector->count; \
+        if (count == vector->capacity) reserve_##name(vector, count + 1); \
+        vector->items[count] = value; \
+        vector->count = count + 1; \
+    } \
+    \
+    static inline void shrink_##name(Name* vector) { \
+        if (vector->items == vector->inline_items || vector->count == vector->capacity) return; \
+        if (vector->count <= (inline_capacity)) { \
+            memcpy(vector->inline_items, vector->items, sizeof(type) * vector->count); \
+            reallocate(vector->items, sizeof(type) * vector->capacity, 0, tag); \
+            vector->items = vector->inline_items; \
+            vector->capacity = (inline_capacity); \
+            return; \
+        } \
+        type* items = (type*)reallocate(vector->items, sizeof(type) * vector->capacity, \
+                                        sizeof(type) * vector->count, tag); \
+        if (items == NULL) return; \
+        vector->items = items; \
+        vector->capacity = vector->count; \
+    } \
+    \
+    static inline void free_##name(Name* vector) { \
+        if (vector->items != vector->inline_items) { \
+            reallocate(vector->items, sizeof(type) * vector->capacity, 0, tag); \
+        } \
+        init_##name(vector); \
+    }
+
+#endif
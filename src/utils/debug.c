@@ -19,6 +19,7 @@ const char* print_token_type(TokenType type) {
         case TOKEN_QUESTION_MARK: return "TOKEN_QUESTION_MARK";
         case TOKEN_AT: return "TOKEN_AT";
         case TOKEN_PERCENT: return "TOKEN_PERCENT";
+        case TOKEN_PIPE: return "TOKEN_PIPE";
         // One or two character tokens
         case TOKEN_BANG: return "TOKEN_BANG";
         case TOKEN_BANG_EQUAL: return "TOKEN_BANG_EQUAL";
@@ -71,6 +72,10 @@ static const char* print_statement_type(StatementType type) {
         case STMT_RETURN: return "STMT_RETURN";
         case STMT_EXPRESSION: return "STMT_EXPRESSION";
         case STMT_PRINT: return "STMT_PRINT";
+        case STMT_BLOCK: return "STMT_BLOCK";
+        case STMT_FUNCTION: return "STMT_FUNCTION";
+        case STMT_WHILE: return "STMT_WHILE";
+        case STMT_FOR: return "STMT_FOR";
     }
     return "UNKNOWN_STATEMENT";
 }
@@ -140,6 +145,24 @@ void debug_expression(Expression* expression) {
             printf("Expression: if");
             break;
         }
+        case EXPR_STRING: {
+            printf("%.*s", (int)expression->token.length, expression->token.start);
+            break;
+        }
+        case EXPR_IDENT: {
+            printf("%s", expression->ident.value);
+            break;
+        }
+        case EXPR_CALL: {
+            debug_expression((Expression*)expression->call.callee);
+            printf("(");
+            for (u64 i = 0; i < expression->call.argument_count; i++) {
+                if (i > 0) printf(", ");
+                debug_expression((Expression*)expression->call.arguments[i]);
+            }
+            printf(")");
+            break;
+        }
         default: {
             printf("YEEET");
             break;
@@ -165,8 +188,26 @@ void debug_statement(Statement* statement) {
             break;
         }
         case STMT_RETURN: {
-            printf("RETURN\n");
-            printf("return statement.\n");
+            printf("Return: ");
+            if (statement->value != NULL) debug_expression(statement->value);
+            printf("\n");
+            break;
+        }
+        case STMT_BLOCK: {
+            printf("Statements: %lu\n", statement->block.statement_count);
+            break;
+        }
+        case STMT_FUNCTION: {
+            printf("Function: %s(", statement->name.value);
+            for (u64 i = 0; i < statement->function.parameter_count; i++) {
+                if (i > 0) printf(", ");
+                printf("%s", statement->function.parameters[i].value);
+            }
+            printf(")\n");
+            for (u64 i = 0; i < statement->function.body->block.statement_count; i++) {
+                printf("\t");
+                debug_statement(&statement->function.body->block.statements[i]);
+            }
             break;
         }
         case STMT_EXPRESSION: {
@@ -187,9 +228,9 @@ void debug_statement(Statement* statement) {
 
 void debug_program(Program* program) {
     printf("Program: {\n");
-    for (u64 i = 0; i < program->statement_count; i++) {
+    for (u64 i = 0; i < program->statements.count; i++) {
         printf("\t");
-        debug_statement(&program->statements[i]);
+        debug_statement(&program->statements.items[i]);
     }
     printf("}\n");
 }
@@ -200,31 +241,44 @@ static int simple_instruction(const char* name, int offset) {
 }
 static int constant_instruction(const char* name, Chunk* chunk, int offset) {
     // this gets the constant index from the subsequent byte in the chunk
-    uint8_t constant = chunk->code[offset + 1];
+    uint8_t constant = chunk->code.items[offset + 1];
     // we then print it out
     printf("%-16s %4d '", name, constant);
     // we then print the actual value stored at that constant index
-    print_value(chunk->constants.values[constant]);
+    print_value(chunk->constants.items[constant]);
     printf("'\n");
     // disassembleInstruction returns offset + 1 (the beginning of the next instruction)
     // constant returns offset + 2 (1 for opcode, 1 for constant) so we can do the same
     return (offset + 2);
 }
 
+static int jump_instruction(const char* name, int sign, Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)(chunk->code.items[offset + 1] << 8);
+    jump |= chunk->code.items[offset + 2];
+    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    return (offset + 3);
+}
+
+static int byte_instruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code.items[offset + 1];
+    printf("%-16s %4d\n", name, slot);
+    return (offset + 2);
+}
+
 
 int disassemble_instruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
     // this basically checks if the source code line is the same as the previous one
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    if (offset > 0 && chunk->lines.items[offset] == chunk->lines.items[offset - 1]) {
         printf("   | ");
     } else {
-        printf("%4lu ", chunk->lines[offset]);
+        printf("%4lu ", chunk->lines.items[offset]);
     }
 
     // This gets a single byte from the bytecode at the given offset, which we
     // then switch on.
-    uint8_t instruction = chunk->code[offset];
+    uint8_t instruction = chunk->code.items[offset];
     switch (instruction)
     {
     case OP_ADD:
@@ -246,13 +300,37 @@ int disassemble_instruction(Chunk* chunk, int offset) {
     case OP_PRINT:
         return simple_instruction("OP_PRINT", offset);
     case OP_DEFINE_GLOBAL:
-        return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+        return byte_instruction("OP_DEFINE_GLOBAL", chunk, offset);
     case OP_SET_GLOBAL:
-        return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+        return byte_instruction("OP_SET_GLOBAL", chunk, offset);
     case OP_GET_GLOBAL:
-        return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+        return byte_instruction("OP_GET_GLOBAL", chunk, offset);
     case OP_GREATER:
         return simple_instruction("OP_GREATER", offset);
+    case OP_GET_LOCAL:
+        return byte_instruction("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL:
+        return byte_instruction("OP_SET_LOCAL", chunk, offset);
+    case OP_CALL:
+        return byte_instruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+        return byte_instruction("OP_TAIL_CALL", chunk, offset);
+    case OP_LESS:
+        return simple_instruction("OP_LESS", offset);
+    case OP_EQUAL:
+        return simple_instruction("OP_EQUAL", offset);
+    case OP_NOT:
+        return simple_instruction("OP_NOT", offset);
+    case OP_JUMP:
+        return jump_instruction("OP_JUMP", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE:
+        return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_LOOP:
+        return jump_instruction("OP_LOOP", -1, chunk, offset);
+    case OP_LOOP_IF_TRUE:
+        return jump_instruction("OP_LOOP_IF_TRUE", -1, chunk, offset);
+    case OP_LOOP_IF_LESS:
+        return jump_instruction("OP_LOOP_IF_LESS", -1, chunk, offset);
     default:
         // On the off chance theres a compiler bug, we print that too
         printf("Unknown opcode %d\n", instruction);
@@ -261,7 +339,7 @@ int disassemble_instruction(Chunk* chunk, int offset) {
 }
 
 void debug_chunk(Chunk* chunk) {
-    for (int offset = 0; offset < (int)chunk->count;) {
+    for (int offset = 0; offset < (int)chunk->code.count;) {
         offset = disassemble_instruction(chunk, offset);
     }
 }
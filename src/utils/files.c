@@ -0,0 +1,29 @@
+#include "files.h"
+
+char* read_source_file(const char* path, const char** error) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        *error = "Could not open file";
+        return NULL;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    u64 file_size = (u64)ftell(file);
+    rewind(file);
+
+    char* buffer = (char*)malloc(file_size + 1);
+    if (buffer == NULL) {
+        *error = "Not enough memory to read";
+        fclose(file);
+        return NULL;
+    }
+    u64 bytes_read = fread(buffer, sizeof(char), file_size, file);
+    fclose(file);
+    if (bytes_read < file_size) {
+        *error = "Could not read file";
+        free(buffer);
+        return NULL;
+    }
+    buffer[bytes_read] = '\0';
+    return buffer;
+}
@@ -0,0 +1,11 @@
+#ifndef pepper_files_h
+#define pepper_files_h
+
+#include "common.h"
+
+// Reads the whole file into memory from malloc, with a NUL after it, for
+// the caller to free. Returns NULL if it can't, with error set to why, in a
+// form that reads "<error> \"<path>\"."
+char* read_source_file(const char* path, const char** error);
+
+#endif
@@ -1,34 +1,615 @@
+#define _DEFAULT_SOURCE 1
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
 #include "logger.h"
 
-bool initialize_logging() {
+// Each thread's ring, in bytes. A power of two.
+#define LOG_RING_SIZE (64 * 1024)
+// The most one record takes. String arguments are cut short to fit.
+#define LOG_RECORD_MAX 1024
+// The most one formatted message takes
+#define LOG_LINE_MAX 4096
+// How long the logging thread sleeps while there's nothing to write
+#define LOG_IDLE_NANOSECONDS (10 * 1000 * 1000)
+#define LOG_CACHE_LINE 64
+// Longer conversions are written as they are rather than formatted
+#define LOG_CONVERSION_MAX 32
+// The level of the record filling the rest of a ring when the next record
+// won't fit before its end
+#define LOG_PADDING UINT32_MAX
+
+LogLevel log_level = (LogLevel)LOG_COMPILED_LEVEL;
+
+static const char* level_strings[6] = {"[FATAL]: ", "[ERROR]: ", "[WARN]:  ", "[INFO]:  ", "[DEBUG]: ", "[TRACE]: "};
+static const char* level_names[6] = {"fatal", "error", "warn", "info", "debug", "trace"};
+
+typedef struct {
+    // Rounded up to a multiple of 8, like everything in a ring
+    u32 size;
+    u32 level;
+    u64 timestamp;
+    const char* format;
+} RecordHeader;
+
+// One thread writes records to its ring and the logging thread reads them.
+// Each only moves its own end, so neither waits for the other.
+typedef struct Ring {
+    // Bytes ever written and read. Only the ring's thread writes head and
+    // only the logging thread writes tail, and they're kept on different
+    // cache lines so the two threads don't keep taking the line from each
+    // other.
+    u64 head;
+    // The tail as the ring's thread last saw it, read again only when the
+    // ring looks full
+    u64 cached_tail;
+    u8* buffer;
+    struct Ring* next;
+    // Set when the thread exits, so the ring can go once it's empty
+    bool retired;
+    u8 padding[LOG_CACHE_LINE - 3 * sizeof(u64) - sizeof(u8*) - sizeof(bool)];
+    u64 tail;
+} Ring;
+
+typedef enum {
+    ARG_NONE,
+    ARG_INT,
+    ARG_WIDE,
+    ARG_DOUBLE,
+    ARG_LONG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+    ARG_IGNORED,
+} ArgType;
+
+typedef enum {
+    LENGTH_DEFAULT,
+    LENGTH_LONG,
+    LENGTH_LONG_LONG,
+    LENGTH_SIZE,
+    LENGTH_MAX,
+    LENGTH_PTRDIFF,
+} ArgLength;
+
+// One conversion in a format string, from its '%' to its conversion
+// character
+typedef struct {
+    const char* start;
+    const char* end;
+    // Where the length modifier is, so it can be swapped for "ll"
+    const char* length_start;
+    const char* length_end;
+    ArgLength length;
+    u32 stars;
+    ArgType type;
+} Conversion;
+
+static pthread_once_t logging_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+// Guards the list of rings, which threads join the first time they log
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static Ring* rings = NULL;
+// Held by whoever is reading the rings: the logging thread, or a thread
+// logging an error
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t logging_thread;
+static bool running = false;
+static bool stopping = false;
+static bool idle = false;
+static FILE* binary_output = NULL;
+// Where the logging thread formats messages, under drain_lock
+static char line[LOG_LINE_MAX];
+
+static u64 load_acquire(u64* position) {
+    return __atomic_load_n(position, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(u64* position, u64 value) {
+    __atomic_store_n(position, value, __ATOMIC_RELEASE);
+}
+
+static u64 align_record(u64 size) {
+    return (size + 7) & ~(u64)7;
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Finds the next conversion at or after format, returning false if there
+// isn't one
+static bool next_conversion(const char* format, Conversion* conversion) {
+    const char* c = strchr(format, '%');
+    if (c == NULL) return false;
+    conversion->start = c++;
+    conversion->stars = 0;
+    conversion->length = LENGTH_DEFAULT;
+    if (*c == '%') {
+        conversion->type = ARG_NONE;
+        conversion->end = c + 1;
+        conversion->length_start = conversion->length_end = c;
+        return true;
+    }
+    while (*c != '\0' && strchr("-+ #0'", *c) != NULL) c++;
+    if (*c == '*') {
+        conversion->stars++;
+        c++;
+    }
+    while (is_digit(*c)) c++;
+    if (*c == '.') {
+        c++;
+        if (*c == '*') {
+            conversion->stars++;
+            c++;
+        }
+        while (is_digit(*c)) c++;
+    }
+    conversion->length_start = c;
+    bool long_double = false;
+    switch (*c) {
+        case 'h':
+            c++;
+            if (*c == 'h') c++;
+            break;
+        case 'l':
+            c++;
+            conversion->length = LENGTH_LONG;
+            if (*c == 'l') {
+                c++;
+                conversion->length = LENGTH_LONG_LONG;
+            }
+            break;
+        case 'z': c++; conversion->length = LENGTH_SIZE; break;
+        case 'j': c++; conversion->length = LENGTH_MAX; break;
+        case 't': c++; conversion->length = LENGTH_PTRDIFF; break;
+        case 'L': c++; long_double = true; break;
+        default: break;
+    }
+    conversion->length_end = c;
+    switch (*c) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            conversion->type = conversion->length == LENGTH_DEFAULT ? ARG_INT : ARG_WIDE;
+            break;
+        case 'c': conversion->type = ARG_INT; break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            conversion->type = long_double ? ARG_LONG_DOUBLE : ARG_DOUBLE;
+            break;
+        case 's': conversion->type = ARG_STRING; break;
+        case 'p': conversion->type = ARG_POINTER; break;
+        case 'n': conversion->type = ARG_IGNORED; break;
+        default:
+            // Malformed, so it's written as it is
+            conversion->type = ARG_NONE;
+            conversion->end = c;
+            return true;
+    }
+    conversion->end = c + 1;
     return true;
 }
 
-void shutdown_logging() {
-    //TODO
+static i64 read_wide(va_list* args, ArgLength length) {
+    switch (length) {
+        case LENGTH_LONG: return (i64)va_arg(*args, long);
+        case LENGTH_LONG_LONG: return (i64)va_arg(*args, long long);
+        case LENGTH_SIZE: return (i64)va_arg(*args, size_t);
+        case LENGTH_MAX: return (i64)va_arg(*args, intmax_t);
+        case LENGTH_PTRDIFF: return (i64)va_arg(*args, ptrdiff_t);
+        case LENGTH_DEFAULT: break;
+    }
+    return (i64)va_arg(*args, int);
+}
+
+// Copies the format's address and the arguments it uses into record,
+// returning the record's size. Nothing is formatted yet.
+static u32 encode_record(u8* record, LogLevel level, const char* format, va_list* args) {
+    RecordHeader header = {0, (u32)level, 0, format};
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.timestamp = (u64)now.tv_sec * 1000000000 + (u64)now.tv_nsec;
+
+    u64 size = sizeof(RecordHeader);
+    Conversion conversion;
+    const char* next = format;
+    while (next_conversion(next, &conversion)) {
+        next = conversion.end;
+        if (conversion.type == ARG_NONE) continue;
+        // Arguments that don't fit are dropped, which the formatting side
+        // sees from the record's size
+        if (size + 8 * (conversion.stars + 1) > LOG_RECORD_MAX) break;
+        for (u32 i = 0; i < conversion.stars; i++) {
+            i64 star = (i64)va_arg(*args, int);
+            memcpy(record + size, &star, 8);
+            size += 8;
+        }
+        switch (conversion.type) {
+            case ARG_INT: {
+                i64 value = (i64)va_arg(*args, int);
+                memcpy(record + size, &value, 8);
+                break;
+            }
+            case ARG_WIDE: {
+                i64 value = read_wide(args, conversion.length);
+                memcpy(record + size, &value, 8);
+                break;
+            }
+            case ARG_DOUBLE: {
+                f64 value = va_arg(*args, f64);
+                memcpy(record + size, &value, 8);
+                break;
+            }
+            case ARG_LONG_DOUBLE: {
+                f64 value = (f64)va_arg(*args, long double);
+                memcpy(record + size, &value, 8);
+                break;
+            }
+            case ARG_POINTER:
+            case ARG_IGNORED: {
+                u64 value = (u64)(uintptr_t)va_arg(*args, void*);
+                memcpy(record + size, &value, 8);
+                break;
+            }
+            case ARG_STRING: {
+                const char* string = va_arg(*args, const char*);
+                if (string == NULL) string = "(null)";
+                u64 length = strlen(string);
+                u64 room = LOG_RECORD_MAX - size - 4;
+                u32 copied = (u32)(length < room ? length : room);
+                memcpy(record + size, &copied, 4);
+                memcpy(record + size + 4, string, copied);
+                u64 end = size + 4 + copied;
+                memset(record + end, 0, align_record(end) - end);
+                size = align_record(end);
+                continue;
+            }
+            case ARG_NONE: break;
+        }
+        size += 8;
+    }
+    header.size = (u32)align_record(size);
+    memcpy(record, &header, sizeof(RecordHeader));
+    return header.size;
+}
+
+static void append(char* out, u64* length, const char* chars, u64 count) {
+    if (count > LOG_LINE_MAX - *length) count = LOG_LINE_MAX - *length;
+    memcpy(out + *length, chars, count);
+    *length += count;
+}
+
+// snprintf with the conversion's * arguments in front of its value
+#define FORMAT_CONVERSION(value) \
+    (conversion.stars == 0 ? snprintf(out + *length, room, spec, value) \
+     : conversion.stars == 1 ? snprintf(out + *length, room, spec, stars[0], value) \
+                              : snprintf(out + *length, room, spec, stars[0], stars[1], value))
+
+// Formats a record's message into out, one conversion at a time
+static void format_record(const u8* record, char* out, u64* length) {
+    RecordHeader header;
+    memcpy(&header, record, sizeof(RecordHeader));
+    u64 offset = sizeof(RecordHeader);
+    Conversion conversion;
+    const char* next = header.format;
+    while (next_conversion(next, &conversion)) {
+        append(out, length, next, (u64)(conversion.start - next));
+        next = conversion.end;
+        u64 spec_length = (u64)(conversion.end - conversion.start);
+        if (conversion.type == ARG_NONE) {
+            if (spec_length == 2 && conversion.start[1] == '%') {
+                append(out, length, "%", 1);
+            } else {
+                append(out, length, conversion.start, spec_length);
+            }
+            continue;
+        }
+        if (offset + 8 * (conversion.stars + 1) > header.size) return;
+        int stars[2] = {0, 0};
+        for (u32 i = 0; i < conversion.stars; i++) {
+            i64 star;
+            memcpy(&star, record + offset, 8);
+            stars[i] = (int)star;
+            offset += 8;
+        }
+        u64 slot;
+        memcpy(&slot, record + offset, 8);
+        offset += 8;
+        if (conversion.type == ARG_IGNORED) continue;
+        if (spec_length + 2 >= LOG_CONVERSION_MAX) {
+            append(out, length, conversion.start, spec_length);
+            continue;
+        }
+        // The conversion again, with any length modifier made "ll" for wide
+        // integers and dropped for long doubles, which were stored as f64
+        char spec[LOG_CONVERSION_MAX];
+        u64 prefix = (u64)(conversion.length_start - conversion.start);
+        memcpy(spec, conversion.start, prefix);
+        u64 spec_end = prefix;
+        if (conversion.type == ARG_WIDE) {
+            memcpy(spec + spec_end, "ll", 2);
+            spec_end += 2;
+        }
+        u64 suffix = (u64)(conversion.end - conversion.length_end);
+        memcpy(spec + spec_end, conversion.length_end, suffix);
+        spec[spec_end + suffix] = '\0';
+
+        u64 room = LOG_LINE_MAX - *length;
+        int written = 0;
+        switch (conversion.type) {
+            case ARG_INT: written = FORMAT_CONVERSION((int)(i64)slot); break;
+            case ARG_WIDE: written = FORMAT_CONVERSION((long long)(i64)slot); break;
+            case ARG_DOUBLE:
+            case ARG_LONG_DOUBLE: {
+                f64 value;
+                memcpy(&value, &slot, 8);
+                written = FORMAT_CONVERSION(value);
+                break;
+            }
+            case ARG_POINTER: written = FORMAT_CONVERSION((void*)(uintptr_t)slot); break;
+            case ARG_STRING: {
+                // The slot was the string's length and its first characters
+                u32 copied;
+                memcpy(&copied, record + offset - 8, 4);
+                const char* chars = (const char*)record + offset - 4;
+                offset = align_record(offset - 4 + copied);
+                // The copied characters have no terminator, so a plain %s
+                // is limited to them with a precision
+                if (conversion.stars == 0 && prefix == 1) {
+                    written = snprintf(out + *length, room, "%.*s", (int)copied, chars);
+                } else {
+                    // Widths and flags are rare enough to go through a
+                    // terminated copy
+                    char* terminated = (char*)malloc(copied + 1);
+                    if (terminated == NULL) return;
+                    memcpy(terminated, chars, copied);
+                    terminated[copied] = '\0';
+                    written = FORMAT_CONVERSION(terminated);
+                    free(terminated);
+                }
+                break;
+            }
+            case ARG_NONE:
+            case ARG_IGNORED: break;
+        }
+        if (written > 0) *length += (u64)written < room ? (u64)written : room - (room > 0);
+    }
+    append(out, length, next, strlen(next));
+}
+
+#undef FORMAT_CONVERSION
+
+static void write_binary_record(const u8* record) {
+    RecordHeader header;
+    memcpy(&header, record, sizeof(RecordHeader));
+    u32 format_length = (u32)strlen(header.format);
+    u32 arguments_length = header.size - (u32)sizeof(RecordHeader);
+    u32 size = 20 + format_length + arguments_length;
+    fwrite(&size, 4, 1, binary_output);
+    fwrite(&header.level, 4, 1, binary_output);
+    fwrite(&header.timestamp, 8, 1, binary_output);
+    fwrite(&format_length, 4, 1, binary_output);
+    fwrite(header.format, 1, format_length, binary_output);
+    fwrite(record + sizeof(RecordHeader), 1, arguments_length, binary_output);
+}
+
+// Writes out one record. Errors always go to stderr as text as well, so
+// they're seen.
+static void write_record(const u8* record) {
+    RecordHeader header;
+    memcpy(&header, record, sizeof(RecordHeader));
+    bool is_error = header.level < LOG_LEVEL_WARN;
+    if (binary_output != NULL) {
+        write_binary_record(record);
+        if (!is_error) return;
+    }
+    u64 length = 0;
+    append(line, &length, level_strings[header.level], strlen(level_strings[header.level]));
+    format_record(record, line, &length);
+    fprintf(is_error ? stderr : stdout, "%.*s\n\n", (int)length, line);
+}
+
+// Writes out everything queued. The caller holds drain_lock.
+static bool drain_rings() {
+    bool wrote = false;
+    pthread_mutex_lock(&rings_lock);
+    Ring** link = &rings;
+    while (*link != NULL) {
+        Ring* ring = *link;
+        u64 head = load_acquire(&ring->head);
+        while (ring->tail != head) {
+            u64 offset = ring->tail & (LOG_RING_SIZE - 1);
+            if (LOG_RING_SIZE - offset < sizeof(RecordHeader)) {
+                store_release(&ring->tail, ring->tail + LOG_RING_SIZE - offset);
+                continue;
+            }
+            const u8* record = ring->buffer + offset;
+            RecordHeader header;
+            memcpy(&header, record, sizeof(RecordHeader));
+            if (header.level != LOG_PADDING) write_record(record);
+            store_release(&ring->tail, ring->tail + header.size);
+            wrote = true;
+        }
+        if (__atomic_load_n(&ring->retired, __ATOMIC_ACQUIRE) && load_acquire(&ring->head) == ring->tail) {
+            *link = ring->next;
+            free(ring->buffer);
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+    if (wrote) {
+        fflush(stdout);
+        if (binary_output != NULL) fflush(binary_output);
+    }
+    return wrote;
+}
+
+static void* run_logging_thread(void* unused) {
+    (void)unused;
+    pthread_mutex_lock(&drain_lock);
+    while (!stopping) {
+        if (drain_rings()) continue;
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += LOG_IDLE_NANOSECONDS;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        __atomic_store_n(&idle, true, __ATOMIC_RELEASE);
+        pthread_cond_timedwait(&wake, &drain_lock, &until);
+        __atomic_store_n(&idle, false, __ATOMIC_RELEASE);
+    }
+    drain_rings();
+    pthread_mutex_unlock(&drain_lock);
+    return NULL;
+}
+
+static void retire_ring(void* ring) {
+    __atomic_store_n(&((Ring*)ring)->retired, true, __ATOMIC_RELEASE);
+}
+
+static void start_logging() {
+    pthread_key_create(&ring_key, retire_ring);
+    if (pthread_create(&logging_thread, NULL, run_logging_thread, NULL) == 0) {
+        running = true;
+        atexit(shutdown_logging);
+    }
+}
+
+// The calling thread's ring, made the first time it logs
+static Ring* thread_ring() {
+    pthread_once(&logging_once, start_logging);
+    Ring* ring = (Ring*)pthread_getspecific(ring_key);
+    if (ring != NULL) return ring;
+    ring = (Ring*)calloc(1, sizeof(Ring));
+    if (ring == NULL) return NULL;
+    ring->buffer = (u8*)malloc(LOG_RING_SIZE);
+    if (ring->buffer == NULL) {
+        free(ring);
+        return NULL;
+    }
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+// Waits for the logging thread to make room, which it only has to do when
+// messages come faster than they can be written
+static void wait_for_space(Ring* ring, u64 size) {
+    if (LOG_RING_SIZE - (ring->head - ring->cached_tail) >= size) return;
+    for (;;) {
+        ring->cached_tail = load_acquire(&ring->tail);
+        if (LOG_RING_SIZE - (ring->head - ring->cached_tail) >= size) return;
+        pthread_cond_signal(&wake);
+        sched_yield();
+    }
+}
+
+static void push_record(Ring* ring, const u8* record, u32 size) {
+    // Records never wrap, so the rest of the ring is padded out when this
+    // one won't fit before its end
+    u64 offset = ring->head & (LOG_RING_SIZE - 1);
+    if (LOG_RING_SIZE - offset < size) {
+        u64 padding = LOG_RING_SIZE - offset;
+        wait_for_space(ring, padding);
+        // Too little for a header is skipped without one
+        if (padding >= sizeof(RecordHeader)) {
+            RecordHeader header = {(u32)padding, LOG_PADDING, 0, NULL};
+            memcpy(ring->buffer + offset, &header, sizeof(RecordHeader));
+        }
+        store_release(&ring->head, ring->head + padding);
+        offset = 0;
+    }
+    wait_for_space(ring, size);
+    memcpy(ring->buffer + offset, record, size);
+    store_release(&ring->head, ring->head + size);
+    if (__atomic_load_n(&idle, __ATOMIC_ACQUIRE)) pthread_cond_signal(&wake);
 }
 
 void log_output(LogLevel level, const char* message, ...) {
-    const char* level_strings[6] =  {"[FATAL]: ", "[ERROR]: ", "[WARN]:  ", "[INFO]:  ", "[DEBUG]: ", "[TRACE]: "};
-    bool is_error = level < LOG_LEVEL_WARN;
-
-    const i32 message_length = 32000;
-    char out_message[message_length];
-    memset(out_message, 0, sizeof(out_message));
-
-    __builtin_va_list arg_ptr;
-    va_start(arg_ptr, message);
-    vsnprintf(out_message, message_length, message, arg_ptr);
-    va_end(arg_ptr);
-
-    char out_message_2[message_length];
-    snprintf(out_message_2, message_length, "%s%s\n", level_strings[level], out_message);
-    if (is_error) {
-        fprintf(stderr, "%s\n", out_message_2);
+    u8 record[LOG_RECORD_MAX];
+    va_list args;
+    va_start(args, message);
+    u32 size = encode_record(record, level, message, &args);
+    va_end(args);
+
+    if (level < LOG_LEVEL_WARN) {
+        // Everything logged so far goes first, then the error, before exiting
+        pthread_mutex_lock(&drain_lock);
+        drain_rings();
+        write_record(record);
+        fflush(stdout);
+        if (binary_output != NULL) fflush(binary_output);
+        pthread_mutex_unlock(&drain_lock);
         exit(1);
-    } else {
-        fprintf(stdout, "%s\n", out_message_2);
     }
+
+    Ring* ring = thread_ring();
+    if (ring == NULL || !running || __atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        // With nowhere to queue it, or no thread left to write it, the
+        // message is written here and now
+        pthread_mutex_lock(&drain_lock);
+        write_record(record);
+        fflush(stdout);
+        pthread_mutex_unlock(&drain_lock);
+        return;
+    }
+    push_record(ring, record, size);
+}
+
+bool parse_log_level(const char* name, LogLevel* level) {
+    for (u32 i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            *level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool initialize_logging() {
+    bool ok = true;
+    const char* level = getenv("PEPPER_LOG_LEVEL");
+    if (level != NULL && !parse_log_level(level, &log_level)) {
+        fprintf(stderr, "Unknown log level \"%s\".\n", level);
+        ok = false;
+    }
+    const char* binary_path = getenv("PEPPER_LOG_BINARY");
+    if (binary_path != NULL && binary_output == NULL) {
+        binary_output = fopen(binary_path, "wb");
+        if (binary_output == NULL) {
+            fprintf(stderr, "Could not open log file \"%s\".\n", binary_path);
+            ok = false;
+        } else {
+            fwrite("PEPLOG01", 1, 8, binary_output);
+        }
+    }
+    return ok;
+}
+
+void shutdown_logging() {
+    pthread_mutex_lock(&drain_lock);
+    bool was_running = running && !stopping;
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&drain_lock);
+    if (was_running) pthread_join(logging_thread, NULL);
+    pthread_mutex_lock(&drain_lock);
+    drain_rings();
+    if (binary_output != NULL) {
+        fclose(binary_output);
+        binary_output = NULL;
+    }
+    pthread_mutex_unlock(&drain_lock);
 }
@@ -3,10 +3,24 @@
 
 #include "common.h"
 
-#define LOG_WARN_ENABLED 1
-#define LOG_INFO_ENABLED 1
-#define LOG_DEBUG_ENABLED 1
-#define LOG_TRACE_ENABLED 1
+// Logging is asynchronous. A log call copies its format string's address and
+// its arguments into a ring belonging to the calling thread, without taking
+// a lock, and a background thread formats and writes them. ERROR and FATAL
+// are the exceptions: they write everything logged before them, then
+// themselves, and exit.
+//
+// Levels above LOG_COMPILED_LEVEL aren't compiled in at all, and levels
+// above log_level are skipped before their arguments are evaluated.
+
+// Build with -DLOG_COMPILED_LEVEL=2, say, to keep only warnings and errors
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 5
+#endif
+
+#define LOG_WARN_ENABLED (LOG_COMPILED_LEVEL >= 2)
+#define LOG_INFO_ENABLED (LOG_COMPILED_LEVEL >= 3)
+#define LOG_DEBUG_ENABLED (LOG_COMPILED_LEVEL >= 4)
+#define LOG_TRACE_ENABLED (LOG_COMPILED_LEVEL >= 5)
 
 typedef enum LogLevel {
     LOG_LEVEL_FATAL = 0,
@@ -17,46 +31,75 @@ typedef enum LogLevel {
     LOG_LEVEL_TRACE = 5,
 } LogLevel;
 
+// Messages above this level are skipped
+extern LogLevel log_level;
+
+// Reads PEPPER_LOG_LEVEL (fatal, error, warn, info, debug or trace) and
+// PEPPER_LOG_BINARY, a file to write binary records to instead of text.
+// Logging works without it, with the defaults. The logging thread starts the
+// first time a message is queued. Returns false if either variable couldn't
+// be used.
 bool initialize_logging();
+// Writes whatever is still queued and stops the logging thread. Also run at
+// exit once anything has been logged.
 void shutdown_logging();
+bool parse_log_level(const char* name, LogLevel* level);
 
+// Arguments are captured as the format says: %s copies the string, up to a
+// limit, and %n is ignored
 void log_output(LogLevel level, const char* message, ...);
 
-#define FATAL(message, ...) log_output(LOG_LEVEL_FATAL, message, ##__VA_ARGS__);
+// Binary logs start with the 8 bytes "PEPLOG01". Each record then has, in
+// the machine's byte order:
+//   u32 size of the whole record
+//   u32 level
+//   u64 nanoseconds since the epoch
+//   u32 length of the format string, then the format string
+//   the arguments, in order, in 8 byte slots: integers as i64, floats as
+//   f64 and pointers as u64. A string is a u32 length and its characters,
+//   padded to a multiple of 8. A * width or precision takes a slot of its
+//   own before the argument.
+
+#define FATAL(message, ...) log_output(LOG_LEVEL_FATAL, message, ##__VA_ARGS__)
 
 #ifndef ERROR
 // Logs an error-level message.
-#define ERROR(message, ...) log_output(LOG_LEVEL_ERROR, message, ##__VA_ARGS__);
+#define ERROR(message, ...) log_output(LOG_LEVEL_ERROR, message, ##__VA_ARGS__)
 #endif
 
-#if LOG_WARN_ENABLED == 1
+#define LOG_AT(level, message, ...) \
+    do { \
+        if ((level) <= log_level) log_output(level, message, ##__VA_ARGS__); \
+    } while (0)
+
+#if LOG_WARN_ENABLED
 // Logs a warning-level message.
-#define WARN(message, ...) log_output(LOG_LEVEL_WARN, message, ##__VA_ARGS__);
+#define WARN(message, ...) LOG_AT(LOG_LEVEL_WARN, message, ##__VA_ARGS__)
 #else
-// Does nothing when LOG_WARN_ENABLED != 1
-#define WARN(message, ...)
+// Does nothing when warnings aren't compiled in
+#define WARN(message, ...) do { } while (0)
 #endif
 
-#if LOG_INFO_ENABLED == 1
+#if LOG_INFO_ENABLED
 // Logs a info-level message.
-#define INFO(message, ...) log_output(LOG_LEVEL_INFO, message, ##__VA_ARGS__);
+#define INFO(message, ...) LOG_AT(LOG_LEVEL_INFO, message, ##__VA_ARGS__)
 #else
-// Does nothing when LOG_INFO_ENABLED != 1
-#define INFO(message, ...)
+// Does nothing when info messages aren't compiled in
+#define INFO(message, ...) do { } while (0)
 #endif
 
-#if LOG_DEBUG_ENABLED == 1
+#if LOG_DEBUG_ENABLED
 // Logs a debug-level message.
-#define DEBUG(message, ...) log_output(LOG_LEVEL_DEBUG, message, ##__VA_ARGS__);
+#define DEBUG(message, ...) LOG_AT(LOG_LEVEL_DEBUG, message, ##__VA_ARGS__)
 #else
-// Does nothing when LOG_DEBUG_ENABLED != 1
-#define DEBUG(message, ...)
+// Does nothing when debug messages aren't compiled in
+#define DEBUG(message, ...) do { } while (0)
 #endif
 
-#if LOG_TRACE_ENABLED == 1
+#if LOG_TRACE_ENABLED
 // Logs a trace-level message.
-#define TRACE(message, ...) log_output(LOG_LEVEL_TRACE, message, ##__VA_ARGS__);
+#define TRACE(message, ...) LOG_AT(LOG_LEVEL_TRACE, message, ##__VA_ARGS__)
 #else
-#define TRACE(message, ...)
+#define TRACE(message, ...) do { } while (0)
 #endif
 #endif
@@ -1,12 +1,364 @@
+#define _DEFAULT_SOURCE 1
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
 #include "memory.h"
 
-void* reallocate(void* pointer, u64 oldSize, u64 newSize) {
-    if (newSize == 0 && oldSize <= 0) {
+// Build with -DMEMORY_SLABS=0 to send every allocation straight to malloc.
+// Off by default under AddressSanitizer, which can only see malloc's blocks.
+#ifndef MEMORY_SLABS
+#ifdef __SANITIZE_ADDRESS__
+#define MEMORY_SLABS 0
+#else
+#define MEMORY_SLABS 1
+#endif
+#endif
+
+// Blocks of up to SLAB_BLOCK_MAX bytes are carved out of slabs, in classes
+// SLAB_GRANULE bytes apart. Slabs are handed out from one reserved range of
+// addresses, so a block's class can be found from its address alone.
+#define SLAB_GRANULE 16
+#define SLAB_BLOCK_MAX 256
+#define SLAB_CLASSES (SLAB_BLOCK_MAX / SLAB_GRANULE)
+#define SLAB_SIZE ((u64)64 * 1024)
+#define SLAB_REGION_SIZE ((u64)1024 * 1024 * 1024)
+#define SLAB_COUNT (SLAB_REGION_SIZE / SLAB_SIZE)
+
+typedef struct {
+    const char* name;
+    // In kilobytes
+    i64 peak_rss;
+    i64 live_bytes;
+} MemoryPhase;
+
+// NULL until an embedder installs its own
+static Reallocator host_reallocate = NULL;
+static void* host_user_data = NULL;
+
+static bool tracking = false;
+// One for each tag, then the total. VMs allocate on their own threads, so
+// these are only updated atomically.
+static MemoryStats stats[MEMORY_TAG_COUNT + 1];
+static MemoryPhase phases[MEMORY_PHASES_MAX];
+static u32 phase_count = 0;
+
+static const char* tag_names[MEMORY_TAG_COUNT] = {
+    "other", "lexer", "ast", "chunk", "constants", "vm", "vm heap", "globals", "jit", "compiler",
+};
+
+static const char* size_names[MEMORY_SIZE_BUCKETS] = {
+    "<=16", "<=64", "<=256", "<=1K", "<=4K", "<=16K", "<=64K", ">64K",
+};
+
+#if MEMORY_SLABS
+typedef struct Block {
+    struct Block* next;
+} Block;
+
+// Each thread allocates from and frees to its own lists, without locking.
+// When one grows past two slabs' worth, half of it goes back to the shared
+// lists, and a thread's lists are given back whole when it exits.
+typedef struct {
+    Block* free[SLAB_CLASSES];
+    u64 counts[SLAB_CLASSES];
+} SlabCache;
+
+static pthread_once_t slabs_once = PTHREAD_ONCE_INIT;
+// The key only gets each thread's cache freed when the thread exits. Looking
+// it up on every allocation would cost more than the allocation.
+static pthread_key_t cache_key;
+static __thread SlabCache* thread_slabs = NULL;
+// NULL if the range couldn't be reserved, leaving everything to malloc
+static u8* region = NULL;
+static u64 region_used = 0;
+// The class of each slab handed out so far
+static u8 slab_classes[SLAB_COUNT];
+// Blocks given back by threads, one list and lock for each class
+static pthread_mutex_t shared_locks[SLAB_CLASSES];
+static Block* shared_free[SLAB_CLASSES];
+
+static u64 block_size(u32 class) {
+    return (u64)(class + 1) * SLAB_GRANULE;
+}
+
+static u32 size_class(u64 size) {
+    return (u32)((size + SLAB_GRANULE - 1) / SLAB_GRANULE) - 1;
+}
+
+static bool in_slabs(void* pointer) {
+    // Threads that haven't allocated yet can free, so they may read this
+    // while the first allocation sets it
+    uintptr_t start = (uintptr_t)__atomic_load_n(&region, __ATOMIC_RELAXED);
+    uintptr_t address = (uintptr_t)pointer;
+    return start != 0 && address >= start && address < start + SLAB_REGION_SIZE;
+}
+
+static u32 class_of(void* pointer) {
+    return slab_classes[((uintptr_t)pointer - (uintptr_t)region) / SLAB_SIZE];
+}
+
+// Puts the blocks from first to last on the shared list for class
+static void share_blocks(u32 class, Block* first, Block* last) {
+    pthread_mutex_lock(&shared_locks[class]);
+    last->next = shared_free[class];
+    shared_free[class] = first;
+    pthread_mutex_unlock(&shared_locks[class]);
+}
+
+static void release_cache(void* data) {
+    SlabCache* cache = (SlabCache*)data;
+    for (u32 class = 0; class < SLAB_CLASSES; class++) {
+        Block* first = cache->free[class];
+        if (first == NULL) continue;
+        Block* last = first;
+        while (last->next != NULL) last = last->next;
+        share_blocks(class, first, last);
+    }
+    free(cache);
+    // In case another key's destructor allocates after this
+    thread_slabs = NULL;
+}
+
+static void initialize_slabs() {
+    // Only address space until slabs are handed out
+    void* memory = mmap(NULL, SLAB_REGION_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (memory == MAP_FAILED) return;
+    for (u32 class = 0; class < SLAB_CLASSES; class++) pthread_mutex_init(&shared_locks[class], NULL);
+    if (pthread_key_create(&cache_key, release_cache) != 0) {
+        munmap(memory, SLAB_REGION_SIZE);
+        return;
+    }
+    __atomic_store_n(&region, (u8*)memory, __ATOMIC_RELAXED);
+}
+
+static SlabCache* thread_cache() {
+    if (thread_slabs != NULL) return thread_slabs;
+    pthread_once(&slabs_once, initialize_slabs);
+    if (region == NULL) return NULL;
+    SlabCache* cache = (SlabCache*)calloc(1, sizeof(SlabCache));
+    if (cache != NULL && pthread_setspecific(cache_key, cache) != 0) {
+        free(cache);
+        return NULL;
+    }
+    thread_slabs = cache;
+    return cache;
+}
+
+// Refills an empty list, from the shared lists if they have any blocks and
+// otherwise from a new slab
+static void refill_cache(SlabCache* cache, u32 class) {
+    pthread_mutex_lock(&shared_locks[class]);
+    Block* first = shared_free[class];
+    if (first != NULL) {
+        // Up to a slab's worth, as much as a new slab would give
+        u64 batch = SLAB_SIZE / block_size(class);
+        Block* last = first;
+        u64 count = 1;
+        while (count < batch && last->next != NULL) {
+            last = last->next;
+            count++;
+        }
+        shared_free[class] = last->next;
+        pthread_mutex_unlock(&shared_locks[class]);
+        last->next = NULL;
+        cache->free[class] = first;
+        cache->counts[class] = count;
+        return;
+    }
+    pthread_mutex_unlock(&shared_locks[class]);
+
+    u64 offset = __atomic_fetch_add(&region_used, SLAB_SIZE, __ATOMIC_RELAXED);
+    if (offset >= SLAB_REGION_SIZE) return;
+    u8* slab = region + offset;
+    if (mprotect(slab, SLAB_SIZE, PROT_READ | PROT_WRITE) != 0) return;
+    slab_classes[offset / SLAB_SIZE] = (u8)class;
+
+    u64 size = block_size(class);
+    u64 count = SLAB_SIZE / size;
+    for (u64 i = 0; i < count; i++) {
+        Block* block = (Block*)(slab + (count - 1 - i) * size);
+        block->next = cache->free[class];
+        cache->free[class] = block;
+    }
+    cache->counts[class] = count;
+}
+
+// NULL if there's no slab memory left
+static void* slab_allocate(u64 size) {
+    SlabCache* cache = thread_cache();
+    if (cache == NULL) return NULL;
+    u32 class = size_class(size);
+    if (cache->free[class] == NULL) {
+        refill_cache(cache, class);
+        if (cache->free[class] == NULL) return NULL;
+    }
+    Block* block = cache->free[class];
+    cache->free[class] = block->next;
+    cache->counts[class]--;
+    return block;
+}
+
+static void slab_free(void* pointer) {
+    u32 class = class_of(pointer);
+    Block* block = (Block*)pointer;
+    SlabCache* cache = thread_cache();
+    if (cache == NULL) {
+        share_blocks(class, block, block);
+        return;
+    }
+    block->next = cache->free[class];
+    cache->free[class] = block;
+    // Compared in bytes, as dividing here costs more than the rest of a free
+    if (++cache->counts[class] * block_size(class) <= 2 * SLAB_SIZE) return;
+
+    // Keep the most recently freed half
+    u64 keep = SLAB_SIZE / block_size(class);
+    Block* last_kept = block;
+    for (u64 i = 1; i < keep; i++) last_kept = last_kept->next;
+    Block* first = last_kept->next;
+    Block* last = first;
+    while (last->next != NULL) last = last->next;
+    last_kept->next = NULL;
+    share_blocks(class, first, last);
+    cache->counts[class] = keep;
+}
+#endif
+
+// Small blocks come from slabs, anything else from malloc. A block outgrowing
+// its slab class moves, while malloc's blocks stay with malloc.
+static void* system_reallocate(void* pointer, u64 newSize) {
+#if MEMORY_SLABS
+    if (in_slabs(pointer)) {
+        if (newSize == 0) {
+            slab_free(pointer);
+            return NULL;
+        }
+        u64 size = block_size(class_of(pointer));
+        if (newSize <= size) return pointer;
+        void* result = newSize <= SLAB_BLOCK_MAX ? slab_allocate(newSize) : NULL;
+        if (result == NULL) result = malloc(newSize);
+        if (result == NULL) return NULL;
+        memcpy(result, pointer, size);
+        slab_free(pointer);
+        return result;
+    }
+    if (pointer == NULL && newSize != 0 && newSize <= SLAB_BLOCK_MAX) {
+        void* result = slab_allocate(newSize);
+        if (result != NULL) return result;
+    }
+#endif
+    if (newSize == 0) {
         free(pointer);
         return NULL;
     }
+    return realloc(pointer, newSize);
+}
+
+void set_reallocator(Reallocator reallocator, void* user_data) {
+    host_reallocate = reallocator;
+    host_user_data = user_data;
+}
+
+static u32 size_bucket(u64 size) {
+    u32 bucket = 0;
+    for (u64 limit = 16; bucket < MEMORY_SIZE_BUCKETS - 1 && size > limit; limit *= 4) bucket++;
+    return bucket;
+}
+
+static void add_live(MemoryStats* counts, i64 delta) {
+    i64 live = __atomic_add_fetch(&counts->live_bytes, delta, __ATOMIC_RELAXED);
+    i64 peak = __atomic_load_n(&counts->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&counts->peak_bytes, &peak, live, true, __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+static void count(MemoryStats* counts, void* pointer, u64 oldSize, u64 newSize) {
+    // Freeing NULL is allowed, whatever size it's given
+    if (pointer == NULL) oldSize = 0;
+    if (newSize == 0) {
+        if (pointer != NULL) __atomic_add_fetch(&counts->frees, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(pointer == NULL ? &counts->allocations : &counts->reallocations, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&counts->sizes[size_bucket(newSize)], 1, __ATOMIC_RELAXED);
+    }
+    if (newSize > oldSize) __atomic_add_fetch(&counts->allocated_bytes, newSize - oldSize, __ATOMIC_RELAXED);
+    if (newSize != oldSize) add_live(counts, (i64)newSize - (i64)oldSize);
+}
 
-    void* result = realloc(pointer, newSize);
-    if (result == NULL) return NULL;
+void* reallocate(void* pointer, u64 oldSize, u64 newSize, MemoryTag tag) {
+    void* result;
+    if (host_reallocate != NULL) {
+        result = host_reallocate(pointer, oldSize, newSize, host_user_data);
+    } else {
+        result = system_reallocate(pointer, newSize);
+    }
+    if (tracking && (result != NULL || newSize == 0)) {
+        count(&stats[tag], pointer, oldSize, newSize);
+        count(&stats[MEMORY_TAG_COUNT], pointer, oldSize, newSize);
+    }
     return result;
 }
+
+void memory_set_tracking(bool enabled) {
+    tracking = enabled;
+}
+
+void get_memory_stats(MemoryTag tag, MemoryStats* out) {
+    MemoryStats* counts = &stats[tag];
+    out->live_bytes = __atomic_load_n(&counts->live_bytes, __ATOMIC_RELAXED);
+    out->peak_bytes = __atomic_load_n(&counts->peak_bytes, __ATOMIC_RELAXED);
+    out->allocations = __atomic_load_n(&counts->allocations, __ATOMIC_RELAXED);
+    out->reallocations = __atomic_load_n(&counts->reallocations, __ATOMIC_RELAXED);
+    out->frees = __atomic_load_n(&counts->frees, __ATOMIC_RELAXED);
+    out->allocated_bytes = __atomic_load_n(&counts->allocated_bytes, __ATOMIC_RELAXED);
+    for (u32 i = 0; i < MEMORY_SIZE_BUCKETS; i++) {
+        out->sizes[i] = __atomic_load_n(&counts->sizes[i], __ATOMIC_RELAXED);
+    }
+}
+
+const char* memory_tag_name(MemoryTag tag) {
+    return tag == MEMORY_TAG_COUNT ? "total" : tag_names[tag];
+}
+
+void memory_end_phase(const char* name) {
+    if (!tracking || phase_count == MEMORY_PHASES_MAX) return;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    MemoryPhase* phase = &phases[phase_count++];
+    phase->name = name;
+    phase->peak_rss = (i64)usage.ru_maxrss;
+    phase->live_bytes = __atomic_load_n(&stats[MEMORY_TAG_COUNT].live_bytes, __ATOMIC_RELAXED);
+}
+
+void print_memory_stats(FILE* out) {
+    fprintf(out, "%-10s %12s %12s %10s %10s %10s\n", "memory", "live", "peak", "allocs", "reallocs", "frees");
+    for (u32 i = 0; i <= MEMORY_TAG_COUNT; i++) {
+        MemoryStats counts;
+        get_memory_stats((MemoryTag)i, &counts);
+        if (counts.allocations == 0 && counts.frees == 0 && i != MEMORY_TAG_COUNT) continue;
+        fprintf(out, "%-10s %12ld %12ld %10lu %10lu %10lu\n", memory_tag_name((MemoryTag)i), counts.live_bytes,
+                counts.peak_bytes, counts.allocations, counts.reallocations, counts.frees);
+    }
+
+    fprintf(out, "\n%-10s", "sizes");
+    for (u32 bucket = 0; bucket < MEMORY_SIZE_BUCKETS; bucket++) fprintf(out, " %8s", size_names[bucket]);
+    fprintf(out, "\n");
+    for (u32 i = 0; i <= MEMORY_TAG_COUNT; i++) {
+        MemoryStats counts;
+        get_memory_stats((MemoryTag)i, &counts);
+        if (counts.allocations == 0 && counts.reallocations == 0 && i != MEMORY_TAG_COUNT) continue;
+        fprintf(out, "%-10s", memory_tag_name((MemoryTag)i));
+        for (u32 bucket = 0; bucket < MEMORY_SIZE_BUCKETS; bucket++) fprintf(out, " %8lu", counts.sizes[bucket]);
+        fprintf(out, "\n");
+    }
+
+    if (phase_count == 0) return;
+    fprintf(out, "\n%-10s %12s %12s\n", "phase", "peak rss", "live");
+    for (u32 i = 0; i < phase_count; i++) {
+        fprintf(out, "%-10s %10ldKB %12ld\n", phases[i].name, phases[i].peak_rss, phases[i].live_bytes);
+    }
+}
@@ -1,22 +1,84 @@
 #ifndef pepper_memory_h
 #define pepper_memory_h
 
+#include <stdio.h>
+
 #include "common.h"
 
+// What an allocation is for, so memory can be accounted to each subsystem
+typedef enum {
+    MEMORY_OTHER,
+    MEMORY_LEXER,
+    MEMORY_AST,
+    MEMORY_CHUNK,
+    MEMORY_CONSTANTS,
+    MEMORY_VM,
+    MEMORY_VM_HEAP,
+    MEMORY_GLOBALS,
+    MEMORY_JIT,
+    MEMORY_COMPILER,
+    MEMORY_TAG_COUNT,
+} MemoryTag;
+
+// A file's allocations are tagged with MEMORY_TAG, which it defines before
+// its first include. Allocations for anything else call reallocate with
+// their own tag.
+#ifndef MEMORY_TAG
+#define MEMORY_TAG MEMORY_OTHER
+#endif
+
 #define ALLOCATE(type, count) \
-    (type*)reallocate(NULL, 0, sizeof(type) * (count))
+    (type*)reallocate(NULL, 0, sizeof(type) * (count), MEMORY_TAG)
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0, MEMORY_TAG)
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
 
 #define GROW_ARRAY(type, pointer, oldCount, count) \
-    (type*)reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * (count))
+    (type*)reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * (count), MEMORY_TAG)
 
 #define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * (oldCount), 0)
+    reallocate(pointer, sizeof(type) * (oldCount), 0, MEMORY_TAG)
+
+// Requests of up to 16 bytes, 64, 256, 1KB, 4KB, 16KB, 64KB, and bigger
+#define MEMORY_SIZE_BUCKETS 8
+#define MEMORY_PHASES_MAX 8
+
+typedef struct {
+    // Signed, as a tag's frees can come before its allocations are counted
+    // if tracking starts late
+    i64 live_bytes;
+    i64 peak_bytes;
+    u64 allocations;
+    u64 reallocations;
+    u64 frees;
+    // Everything allocated, growing blocks included, with nothing taken off
+    // for frees
+    u64 allocated_bytes;
+    u64 sizes[MEMORY_SIZE_BUCKETS];
+} MemoryStats;
+
+// Every allocation goes through reallocate. Blocks of up to 256 bytes come
+// from slabs cached per thread, unless built with -DMEMORY_SLABS=0, and
+// bigger ones from malloc. A host embedding Pepper can route them to its own
+// allocator instead, which gets the old size back on every resize and free.
+// Install it before anything is allocated; it must be thread safe if VMs run
+// on several threads.
+typedef void* (*Reallocator)(void* pointer, u64 old_size, u64 new_size, void* user_data);
+
+void set_reallocator(Reallocator reallocator, void* user_data);
+void* reallocate(void* pointer, u64 oldSize, u64 newSize, MemoryTag tag);
 
-void* reallocate(void* pointer, u64 oldSize, u64 newSize);
+// Counts every allocation by tag while it's on. Switched on with --mem-stats
+// before anything is allocated.
+void memory_set_tracking(bool enabled);
+// A tag's counts, or every tag's together for MEMORY_TAG_COUNT
+void get_memory_stats(MemoryTag tag, MemoryStats* stats);
+const char* memory_tag_name(MemoryTag tag);
+// Notes the process's peak resident size so far at the end of a phase of
+// compiling or running, so each phase's high water mark can be reported
+void memory_end_phase(const char* name);
+void print_memory_stats(FILE* out);
 
 #endif
@@ -0,0 +1,128 @@
+#define _DEFAULT_SOURCE 1
+#include <time.h>
+
+#include "phases.h"
+#include "memory.h"
+
+typedef struct {
+    u64 wall_ns;
+    u64 cpu_ns;
+    u64 allocations;
+    u64 allocated_bytes;
+} Mark;
+
+static bool enabled = false;
+static Phase phases[PHASES_MAX];
+static u32 phase_count = 0;
+// Where the current phase started
+static Mark start;
+
+static u64 read_clock(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (u64)now.tv_sec * 1000000000 + (u64)now.tv_nsec;
+}
+
+static void take_mark(Mark* mark) {
+    MemoryStats stats;
+    get_memory_stats(MEMORY_TAG_COUNT, &stats);
+    // Reallocations count, as growing a vector costs as much as making one
+    mark->allocations = stats.allocations + stats.reallocations;
+    mark->allocated_bytes = stats.allocated_bytes;
+    mark->cpu_ns = read_clock(CLOCK_PROCESS_CPUTIME_ID);
+    mark->wall_ns = read_clock(CLOCK_MONOTONIC);
+}
+
+void phases_set_enabled(bool on) {
+    enabled = on;
+    if (on) memory_set_tracking(true);
+}
+
+bool phases_enabled(void) {
+    return enabled;
+}
+
+void phases_start(void) {
+    if (!enabled) return;
+    phase_count = 0;
+    take_mark(&start);
+}
+
+void phases_end(const char* name, u64 items, const char* unit) {
+    if (!enabled || phase_count == PHASES_MAX) return;
+    Mark end;
+    take_mark(&end);
+    Phase* phase = &phases[phase_count++];
+    phase->name = name;
+    phase->items = items;
+    phase->unit = unit;
+    phase->wall_ns = end.wall_ns - start.wall_ns;
+    phase->cpu_ns = end.cpu_ns - start.cpu_ns;
+    phase->allocations = end.allocations - start.allocations;
+    phase->allocated_bytes = end.allocated_bytes - start.allocated_bytes;
+    start = end;
+}
+
+f64 seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (f64)(now.tv_sec - start->tv_sec) + (f64)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Items a second of wall time, or 0 if the phase was too quick to measure
+static f64 throughput(const Phase* phase) {
+    return phase->wall_ns > 0 ? (f64)phase->items * 1e9 / (f64)phase->wall_ns : 0.0;
+}
+
+void print_phases(FILE* out) {
+    if (!enabled) return;
+    fprintf(out, "%-18s %10s %10s %14s %-12s %14s %10s %14s\n", "phase", "wall ms", "cpu ms", "items", "", "per second",
+            "allocs", "alloc bytes");
+    Phase total = {"total", 0, "", 0, 0, 0, 0};
+    for (u32 i = 0; i < phase_count; i++) {
+        const Phase* phase = &phases[i];
+        fprintf(out, "%-18s %10.3f %10.3f %14lu %-12s %14.0f %10lu %14lu\n", phase->name, (f64)phase->wall_ns / 1e6,
+                (f64)phase->cpu_ns / 1e6, phase->items, phase->unit, throughput(phase), phase->allocations,
+                phase->allocated_bytes);
+        total.wall_ns += phase->wall_ns;
+        total.cpu_ns += phase->cpu_ns;
+        total.allocations += phase->allocations;
+        total.allocated_bytes += phase->allocated_bytes;
+    }
+    fprintf(out, "%-18s %10.3f %10.3f %14s %-12s %14s %10lu %14lu\n", total.name, (f64)total.wall_ns / 1e6,
+            (f64)total.cpu_ns / 1e6, "", "", "", total.allocations, total.allocated_bytes);
+}
+
+static void print_json_string(FILE* out, const char* string) {
+    fputc('"', out);
+    for (const unsigned char* c = (const unsigned char*)string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void print_phases_json(FILE* out, const char* script) {
+    if (!enabled) return;
+    fprintf(out, "{\"script\": ");
+    print_json_string(out, script);
+    fprintf(out, ", \"phases\": [");
+    u64 wall_ns = 0;
+    u64 cpu_ns = 0;
+    for (u32 i = 0; i < phase_count; i++) {
+        const Phase* phase = &phases[i];
+        fprintf(out,
+                "%s\n  {\"name\": \"%s\", \"wall_ns\": %lu, \"cpu_ns\": %lu, \"items\": %lu, \"unit\": \"%s\", "
+                "\"per_second\": %.1f, \"allocations\": %lu, \"allocated_bytes\": %lu}",
+                i > 0 ? "," : "", phase->name, phase->wall_ns, phase->cpu_ns, phase->items, phase->unit,
+                throughput(phase), phase->allocations, phase->allocated_bytes);
+        wall_ns += phase->wall_ns;
+        cpu_ns += phase->cpu_ns;
+    }
+    fprintf(out, "\n], \"wall_ns\": %lu, \"cpu_ns\": %lu}\n", wall_ns, cpu_ns);
+}
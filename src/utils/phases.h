@@ -0,0 +1,43 @@
+#ifndef pepper_phases_h
+#define pepper_phases_h
+
+#include <stdio.h>
+#include <time.h>
+
+#include "common.h"
+
+// Wall and CPU time, throughput and allocations for each phase of getting a
+// script from its file to the end of its run, switched on with
+// --time-phases. Each phase runs from the end of the one before it, so
+// together they cover everything from phases_start on.
+
+#define PHASES_MAX 16
+
+typedef struct {
+    const char* name;
+    // How much the phase got through, counted in unit, as in 1200 tokens
+    u64 items;
+    const char* unit;
+    u64 wall_ns;
+    u64 cpu_ns;
+    u64 allocations;
+    u64 allocated_bytes;
+} Phase;
+
+// Switching it on switches memory tracking on too, for the allocation
+// counts, so it has to be done before anything is allocated
+void phases_set_enabled(bool enabled);
+bool phases_enabled(void);
+// Starts the first phase
+void phases_start(void);
+// Ends the current phase and starts the next
+void phases_end(const char* name, u64 items, const char* unit);
+// A table for people, and JSON with times in nanoseconds for tools
+void print_phases(FILE* out);
+void print_phases_json(FILE* out, const char* script);
+
+// Seconds on the monotonic clock since start, which came from
+// clock_gettime(CLOCK_MONOTONIC)
+f64 seconds_since(const struct timespec* start);
+
+#endif
@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+# Runs every script each way Pepper can run it and checks that stdout,
+# stderr and the exit status all match the interpreter's on its own:
+#   jit       the default, with the tracing JIT
+#   baseline  whole functions compiled to native code on first call
+#   asm       an executable from 'pepper build'
+#   c         the same through 'pepper build --target c'
+# A script the native targets can't compile is skipped for them if it uses
+# strings, which they don't support yet, or if the interpreter fails on it
+# too, as a global used before its definition at the top level is a
+# compile error there. Any other build failure is a mismatch, and so is
+# any difference on stderr or a report from -fsanitize=undefined, even when
+# every run printed it.
+# Usage: tests/differential.sh [path/to/pepper] [scripts...]
+PEPPER=${1:-./bin/pepper}
+shift
+DIR=$(dirname "$0")
+if [ $# -eq 0 ]; then
+    set -- "$DIR"/differential/*.pepr "$DIR"/../pepr/*.pepr "$DIR"/../bench/*.pepr
+fi
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Everything a run printed, with its exit status, in one file
+capture() {
+    local out=$1
+    shift
+    "$@" > "$out.stdout" 2> "$out.stderr"
+    local status=$?
+    { cat "$out.stdout"; echo "--- stderr"; cat "$out.stderr"; echo "--- exit $status"; } > "$out"
+    return $status
+}
+
+failed=0
+skipped=0
+compared=0
+# Whether -fsanitize=undefined reported anything during the run, which
+# counts as a failure by itself
+undefined_behaviour() {
+    local file=$1 tier=$2 stderr=$3
+    grep -Eq ":[0-9]+:[0-9]+: runtime error: " "$stderr" || return 1
+    echo "FAIL $tier $file: undefined behaviour"
+    grep -E ": runtime error: " "$stderr" | head -5
+    failed=$((failed + 1))
+}
+
+check() {
+    local file=$1 tier=$2
+    if undefined_behaviour "$file" "$tier" "$WORK/$tier.stderr"; then
+        return
+    elif cmp -s "$WORK/expected" "$WORK/$tier"; then
+        compared=$((compared + 1))
+    else
+        echo "FAIL $tier $file"
+        diff "$WORK/expected" "$WORK/$tier" | head -20
+        failed=$((failed + 1))
+    fi
+}
+
+for file in "$@"; do
+    capture "$WORK/expected" "$PEPPER" --no-jit "$file"
+    expected_status=$?
+    undefined_behaviour "$file" no-jit "$WORK/expected.stderr"
+    capture "$WORK/jit" "$PEPPER" "$file"
+    check "$file" jit
+    capture "$WORK/baseline" "$PEPPER" --baseline "$file"
+    check "$file" baseline
+    for target in asm c; do
+        if "$PEPPER" build "$file" -o "$WORK/program" --target "$target" 2> "$WORK/build"; then
+            capture "$WORK/$target" "$WORK/program"
+            check "$file" "$target"
+        elif grep -q "native code yet" "$WORK/build" || [ "$expected_status" -ne 0 ]; then
+            skipped=$((skipped + 1))
+        else
+            echo "FAIL $target $file: $(head -1 "$WORK/build")"
+            failed=$((failed + 1))
+        fi
+    done
+done
+
+echo "$# scripts: $compared runs matched, $skipped native builds skipped, $failed failed"
+[ "$failed" -eq 0 ]